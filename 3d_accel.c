@@ -31,6 +31,7 @@
 #include "vmdahal32.h"
 
 #include "vmhal9x.h"
+#include "nuke.h"
 
 #include "nocrt.h"
 
@@ -57,7 +58,7 @@ static FBHDA_t *hda = NULL;
  *
  **/
 
-static fbhda_lib_t fbhda_lib = {NULL, 0};
+static fbhda_lib_t fbhda_lib = {NULL, 0, 1};
 
 #ifdef DD_LOCKING
 
@@ -87,10 +88,107 @@ static void FBHDA_call_unlock()
 
 #define LoadAddress(_n) fbhda_lib.p ## _n = (_n ## _t)GetProcAddress(fbhda_lib.lib, #_n)
 
-static BOOL FBHDA_handle()
+/* fast path is allowed when every attached process resolved current table */
+static void FBHDA_lib_cache_update()
+{
+	DWORD i;
+
+	fbhda_lib.cached = FALSE;
+	if(fbhda_lib.untracked > 0)
+	{
+		return;
+	}
+
+	for(i = 0; i < FBHDA_LIB_PROCS; i++)
+	{
+		if(fbhda_lib.procs[i].pid != 0 && fbhda_lib.procs[i].generation != fbhda_lib.generation)
+		{
+			return;
+		}
+	}
+
+	fbhda_lib.cached = TRUE;
+}
+
+static void FBHDA_lib_proc_set(DWORD pid, DWORD generation, BOOL attach)
+{
+	DWORD i;
+	fbhda_lib_proc_t *slot = NULL;
+	BOOL found = FALSE;
+
+	for(i = 0; i < FBHDA_LIB_PROCS; i++)
+	{
+		if(fbhda_lib.procs[i].pid == pid)
+		{
+			slot = &fbhda_lib.procs[i];
+			found = TRUE;
+			break;
+		}
+		else if(slot == NULL && fbhda_lib.procs[i].pid == 0)
+		{
+			slot = &fbhda_lib.procs[i];
+		}
+	}
+
+	/* attached process without slot was replaced before, it is tracked again */
+	if(!found && !attach && fbhda_lib.untracked > 0)
+	{
+		fbhda_lib.untracked--;
+	}
+
+	if(slot == NULL)
+	{
+		/* full, replace oldest, it only goes through slow path next time */
+		slot = &fbhda_lib.procs[fbhda_lib.proc_next];
+		fbhda_lib.proc_next = (fbhda_lib.proc_next + 1) % FBHDA_LIB_PROCS;
+		/* replaced process isn't tracked anymore, until it detaches */
+		fbhda_lib.untracked++;
+	}
+
+	slot->pid = pid;
+	slot->generation = generation;
+
+	FBHDA_lib_cache_update();
+}
+
+/* called from DllMain, process (vmhal9x) attach and detach
+ * invalidate resolved state for current PID, PIDs can be reused */
+void FBHDA_lib_notify(DWORD dwReason)
+{
+	DWORD pid = GetCurrentProcessId();
+	DWORD i;
+	BOOL found = FALSE;
+
+	FBHDA_call_lock();
+	for(i = 0; i < FBHDA_LIB_PROCS; i++)
+	{
+		if(fbhda_lib.procs[i].pid == pid)
+		{
+			fbhda_lib.procs[i].pid = 0;
+			found = TRUE;
+		}
+	}
+
+	if(dwReason == DLL_PROCESS_ATTACH)
+	{
+		/* new process has to resolve library itself (generation 0 is never
+		   valid), so block fast path until it does */
+		FBHDA_lib_proc_set(pid, 0, TRUE);
+	}
+	else
+	{
+		/* every attached process has slot, so this one was replaced */
+		if(!found && fbhda_lib.untracked > 0)
+		{
+			fbhda_lib.untracked--;
+		}
+		FBHDA_lib_cache_update();
+	}
+	FBHDA_call_unlock();
+}
+
+static BOOL FBHDA_handle_load(DWORD pid)
 {
-	//TRACE_ENTRY
-	
 	HMODULE mod = GetModuleHandle(VMDISP9X_LIB);
 	BOOL need_load = TRUE;
 	if(mod)
@@ -124,7 +222,11 @@ static BOOL FBHDA_handle()
 			LoadAddress(FBHDA_swap);
 			LoadAddress(FBHDA_page_modify);
 			LoadAddress(FBHDA_mode_query);
+
+			/* pointers changed, all processes need to verify library address again */
+			fbhda_lib.generation++;
 		}
+		FBHDA_lib_proc_set(pid, fbhda_lib.generation, FALSE);
 		//TRACE("FBHDA_handle() = TRUE");
 
 		return TRUE;
@@ -133,6 +235,35 @@ static BOOL FBHDA_handle()
 	return FALSE;
 }
 
+NUKED_INLINE BOOL FBHDA_handle()
+{
+	//TRACE_ENTRY
+	DWORD pid;
+	DWORD i;
+
+	/* fast path: library was resolved in every process and table wasn't reloaded since */
+	if(fbhda_lib.cached)
+	{
+		return TRUE;
+	}
+
+	/* library was resolved in this process */
+	pid = GetCurrentProcessId();
+	for(i = 0; i < FBHDA_LIB_PROCS; i++)
+	{
+		if(fbhda_lib.procs[i].pid == pid)
+		{
+			if(fbhda_lib.procs[i].generation == fbhda_lib.generation)
+			{
+				return TRUE;
+			}
+			break;
+		}
+	}
+
+	return FBHDA_handle_load(pid);
+}
+
 BOOL FBHDA_load_ex(VMDAHAL_t *pHal)
 {
 	TRACE_ENTRY
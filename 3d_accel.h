@@ -465,6 +465,8 @@ BOOL VESA_setmode(DWORD w, DWORD h, DWORD bpp, DWORD rr_min, DWORD rr_max);
 /* DLL handlers */
 #define VMDISP9X_LIB "vmdisp9x.dll"
 
+void FBHDA_lib_notify(DWORD dwReason);
+
 typedef FBHDA_t *(__cdecl *FBHDA_setup_t)();
 typedef void (__cdecl *FBHDA_access_begin_t)(DWORD flags);
 typedef void (__cdecl *FBHDA_access_end_t)(DWORD flags);
@@ -474,10 +476,23 @@ typedef BOOL (__cdecl *FBHDA_page_modify_t)(DWORD flat_address, DWORD size, cons
 typedef void (__cdecl *FBHDA_clean_t)(void);
 typedef BOOL (__cdecl *FBHDA_mode_query_t)(DWORD index, FBHDA_mode_t *mode);
 
+/* processes with resolved library, vmhal9x is shared but the library is
+   loaded to each process separately */
+#define FBHDA_LIB_PROCS 16
+
+typedef struct _fbhda_lib_proc_t
+{
+	DWORD pid;
+	DWORD generation;
+} fbhda_lib_proc_t;
+
 typedef struct _fbhda_lib_t
 {
 	HMODULE lib;
 	LONG lock;
+	DWORD generation; /* incremented when function table is reloaded */
+	DWORD proc_next;
+	fbhda_lib_proc_t procs[FBHDA_LIB_PROCS];
 	FBHDA_setup_t pFBHDA_setup;
 	FBHDA_access_begin_t pFBHDA_access_begin;
 	FBHDA_access_end_t pFBHDA_access_end;
@@ -486,6 +501,8 @@ typedef struct _fbhda_lib_t
 	FBHDA_page_modify_t pFBHDA_page_modify;
 	FBHDA_clean_t pFBHDA_clean;
 	FBHDA_mode_query_t pFBHDA_mode_query;
+	volatile BOOL cached; /* all attached processes resolved current table */
+	DWORD untracked;      /* attached processes replaced in procs[], no fast path until they detach */
 } fbhda_lib_t;
 
 #endif /* __3D_ACCEL_H__ */
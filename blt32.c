@@ -50,6 +50,11 @@ DDENTRY_FPUSAVE(Blt32, LPDDHAL_BLTDATA, pbd)
 	
 	VMDAHAL_t *ddhal = GetHAL(pbd->lpDD);	
 	
+#ifdef D3DHAL
+	/* source or destination can be render target of queued DP2 */
+	SurfaceCtxSync();
+#endif
+
 	DWORD	   dwFlags;	// For specifying the type of blit
 
 	DWORD dwFillColor;	  // Used to specify the RGB color to fill with
@@ -85,6 +90,12 @@ DDENTRY_FPUSAVE(Blt32, LPDDHAL_BLTDATA, pbd)
 		return DDHAL_DRIVER_NOTHANDLED;
 	}
 
+	PERF_ADD(blts, 1);
+	PERF_ADD(blt_pixels, (pbd->rDest.right - pbd->rDest.left) * (pbd->rDest.bottom - pbd->rDest.top));
+
+	/* don't overwrite surface which is copied to screen */
+	FlipWaitSurface((void*)dst->fpVidMem);
+
 	isInFront = IsInFront(ddhal, (void*)dst->fpVidMem);
 
 	/* remove cursor before blit */
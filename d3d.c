@@ -342,18 +342,49 @@ DWORD __stdcall DrawPrimitives2_32(LPD3DHAL_DRAWPRIMITIVES2DATA pd)
 	LPBYTE cmdBufferEnd      = cmdBufferStart + pd->dwCommandLength;
 	DWORD rc = DD_OK;
 
-	GL_BLOCK_BEGIN(pd->dwhContext)
-		LPBYTE UMVertices = pd->lpVertices;
-		if(UMVertices != NULL)
+	LPBYTE UMVertices = pd->lpVertices;
+	if(UMVertices != NULL)
+	{
+		UMVertices += pd->dwVertexOffset;
+	}
+
+	/* worker thread, dwVertexSize shares memory with ddrval and it is valid only on DX8 */
+	mesa3d_ctx_t *qctx = MESA_HANDLE_TO_CTX(pd->dwhContext);
+	if(RStates == NULL && !MESA_TRACE_ON(qctx->entry))
+	{
+		if(MesaDP2Push(qctx, cmdBufferStart, pd->dwCommandLength, vertices, UMVertices,
+			pd->dwVertexType, pd->dwVertexLength, qctx->dxif >= MESA_CTX_IF_DX8 ? pd->dwVertexSize : 0,
+			(pd->dwFlags & D3DHALDP2_USERMEMVERTICES) ? TRUE : FALSE))
 		{
-			UMVertices += pd->dwVertexOffset;
+			/* failure of previously queued call */
+			pd->dwErrorOffset = 0;
+			pd->ddrval = MesaDP2Error(qctx);
+			TRACE("MesaDP2Push(...) queued");
+			return DDHAL_DRIVER_HANDLED;
 		}
+	}
 
-		rc = MesaDraw6(ctx, cmdBufferStart, cmdBufferEnd, vertices, UMVertices, pd->dwVertexType, &pd->dwErrorOffset, RStates, pd->dwVertexLength);
+	GL_BLOCK_BEGIN(pd->dwhContext)
+		if(MESA_TRACE_ON(entry))
+		{
+			uint64_t trace_start = MesaTraceDP2(ctx, cmdBufferStart, pd->dwCommandLength, vertices, pd->dwVertexType, pd->dwVertexLength, pd->dwFlags);
+			rc = MesaDraw6(ctx, cmdBufferStart, cmdBufferEnd, vertices, UMVertices, pd->dwVertexType, &pd->dwErrorOffset, RStates, pd->dwVertexLength);
+			MesaTraceDP2Done(ctx, trace_start);
+		}
+		else
+		{
+			rc = MesaDraw6(ctx, cmdBufferStart, cmdBufferEnd, vertices, UMVertices, pd->dwVertexType, &pd->dwErrorOffset, RStates, pd->dwVertexLength);
+		}
 
 		//MesaSpaceIdentityReset(ctx);
 	GL_BLOCK_END
 
+	if(rc == DD_OK)
+	{
+		pd->dwErrorOffset = 0;
+		rc = MesaDP2Error(qctx);
+	}
+
 	pd->ddrval = rc;
 	TRACE("MesaDraw6(...) = %d", rc);
 
@@ -653,6 +684,14 @@ DDENTRY_FPUSAVE(DestroyDDLocal32, LPDDHAL_DESTROYDDLOCALDATA, lpdddd)
 	return DDHAL_DRIVER_HANDLED;
 }
 
+#ifdef DDI9_AUTOGENMIPMAP
+/* D3DUSAGE_AUTOGENMIPMAP textures are generated by glGenerateMipmap */
+static BOOL CanAutogenMipmap(mesa3d_entry_t *entry)
+{
+	return (entry != NULL && entry->autogenmipmap) ? TRUE : FALSE;
+}
+#endif
+
 static void GetDriverInfo2(DD_GETDRIVERINFO2DATA* pgdi2, LONG *lpRVal, DWORD *lpActualSize, void *lpvData)
 {
 	VMHAL_enviroment_t env;
@@ -712,6 +751,12 @@ static void GetDriverInfo2(DD_GETDRIVERINFO2DATA* pgdi2, LONG *lpRVal, DWORD *lp
 				break;
 			}
 			memcpy(&pgfd->format, &myTextureFormatsDX8[pgfd->dwFormatIndex], sizeof(pgfd->format));
+#ifdef DDI9_AUTOGENMIPMAP
+			if(!CanAutogenMipmap(Mesa3DGet(GetCurrentProcessId(), TRUE)))
+			{
+				pgfd->format.dwRBitMask &= ~D3DFORMAT_OP_AUTOGENMIPMAP; /* dwOperations */
+			}
+#endif
 			*lpActualSize = sizeof(DD_GETFORMATDATA);
 			*lpRVal = DD_OK;
 			break;
@@ -723,6 +768,12 @@ static void GetDriverInfo2(DD_GETDRIVERINFO2DATA* pgdi2, LONG *lpRVal, DWORD *lp
 			// The runtime is requesting the DX8 D3D caps 
 			D3DCAPS8 caps;
 			memset(&caps, 0, sizeof(D3DCAPS8));
+
+			/* global env doesn't know which GL entry points were loaded */
+			mesa3d_entry_t *entry = Mesa3DGet(GetCurrentProcessId(), TRUE);
+			BOOL vertexshader = (entry != NULL && entry->env.vertexshader) ? TRUE : FALSE;
+			BOOL pixelshader  = (entry != NULL && entry->env.pixelshader) ? TRUE : FALSE;
+
 			caps.DeviceType = D3DDEVTYPE_HAL;
 			caps.AdapterOrdinal = 0;
 
@@ -746,6 +797,12 @@ static void GetDriverInfo2(DD_GETDRIVERINFO2DATA* pgdi2, LONG *lpRVal, DWORD *lp
 			caps.Caps2 = D3DCAPS2_CANRENDERWINDOWED;
 			caps.Caps3 = 0;
 #endif
+#ifdef DDI9_AUTOGENMIPMAP
+			if(CanAutogenMipmap(entry))
+			{
+				caps.Caps2 |= D3DCAPS2_CANAUTOGENMIPMAP;
+			}
+#endif
 			
 			caps.PresentationIntervals = D3DPRESENT_INTERVAL_IMMEDIATE | D3DPRESENT_INTERVAL_ONE;
 			caps.CursorCaps = D3DCURSORCAPS_COLOR | D3DCURSORCAPS_LOWRES;
@@ -884,6 +941,19 @@ static void GetDriverInfo2(DD_GETDRIVERINFO2DATA* pgdi2, LONG *lpRVal, DWORD *lp
 				{
 					caps.DevCaps |= D3DDEVCAPS_SEPARATETEXTUREMEMORIES;
 				}
+
+				if(vertexshader)
+				{
+					caps.VertexShaderVersion = D3DVS_VERSION(1, 1);
+					caps.MaxVertexShaderConst = MESA_VS_MAX_CONST;
+				}
+			}
+
+			/* ps_1_4 can sample 6 textures, ps_1_1 - ps_1_3 only 4 */
+			if(pixelshader && env.texture_num_units >= 4)
+			{
+				caps.PixelShaderVersion = env.texture_num_units >= 6 ? D3DPS_VERSION(1, 4) : D3DPS_VERSION(1, 3);
+				caps.MaxPixelShaderValue = 8.0f; /* fragment program registers are floats */
 			}
 
 			TRACE("sizeof(D3DCAPS8) = %d, pgdi2->dwExpectedSize = %d",
@@ -1867,6 +1937,9 @@ DDENTRY_FPUSAVE(DestroyExecuteBuffer32, LPDDHAL_DESTROYSURFACEDATA, dsd)
 {
 	TRACE_ENTRY
 
+	/* DP2 worker may still read vertices/indices from this buffer */
+	SurfaceCtxSync();
+
 	TOPIC("MEMORY", "DestroyExecuteBuffer32 mem=0x%X", 
 		dsd->lpDDSurface->lpGbl->fpVidMem
 		);
@@ -1886,7 +1959,11 @@ DDENTRY_FPUSAVE(DestroyExecuteBuffer32, LPDDHAL_DESTROYSURFACEDATA, dsd)
 DDENTRY(LockExecuteBuffer32, LPDDHAL_LOCKDATA, lock)
 {
 	TRACE_ENTRY
-	/* nop */
+	/* DP2 worker may still read this buffer */
+	SurfaceCtxSync();
+
+	/* GL mirror of vertex buffer is refreshed on next draw */
+	SurfaceVertexBufferLock(lock->lpDDSurface, lock->bHasRect ? &lock->rArea : NULL);
 	
 	lock->lpSurfData = (void*)lock->lpDDSurface->lpGbl->fpVidMem;
 	lock->ddRVal = DD_OK;
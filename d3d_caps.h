@@ -486,18 +486,27 @@ static DDSURFACEDESC myTextureFormats[] = {
 #define FORMAT_VOLUME_TEX 0
 #endif
 
+/* D3DUSAGE_AUTOGENMIPMAP is passed only to DDI9 drivers */
+#ifdef DDI9_AUTOGENMIPMAP
+#define FORMAT_AUTOGEN_MIP D3DFORMAT_OP_AUTOGENMIPMAP
+#else
+#define FORMAT_AUTOGEN_MIP 0
+#endif
+
 static DDPIXELFORMAT myTextureFormatsDX8[] =
 {
 	DX8_FORMAT(D3DFMT_X1R5G5B5,
 			D3DFORMAT_OP_TEXTURE |
 			D3DFORMAT_OP_CUBETEXTURE |
 			D3DFORMAT_OP_SAME_FORMAT_RENDERTARGET |
+			FORMAT_AUTOGEN_MIP |
 			FORMAT_VOLUME_TEX,
 		D3DMULTISAMPLE_NUM_SAMPLES),
 	DX8_FORMAT(D3DFMT_A1R5G5B5,
 			D3DFORMAT_OP_TEXTURE |
 			D3DFORMAT_OP_CUBETEXTURE |
 			D3DFORMAT_OP_SAME_FORMAT_RENDERTARGET |
+			FORMAT_AUTOGEN_MIP |
 			FORMAT_VOLUME_TEX,
 		D3DMULTISAMPLE_NUM_SAMPLES),
 	DX8_FORMAT(D3DFMT_R5G6B5,
@@ -506,6 +515,7 @@ static DDPIXELFORMAT myTextureFormatsDX8[] =
 			D3DFORMAT_OP_3DACCELERATION |
 			D3DFORMAT_OP_CUBETEXTURE |
 			D3DFORMAT_OP_SAME_FORMAT_RENDERTARGET |
+			FORMAT_AUTOGEN_MIP |
 			FORMAT_VOLUME_TEX,
 		D3DMULTISAMPLE_NUM_SAMPLES),
 	DX8_FORMAT(D3DFMT_X8R8G8B8,
@@ -514,6 +524,7 @@ static DDPIXELFORMAT myTextureFormatsDX8[] =
 			D3DFORMAT_OP_3DACCELERATION |
 			D3DFORMAT_OP_CUBETEXTURE |
 			D3DFORMAT_OP_SAME_FORMAT_RENDERTARGET |
+			FORMAT_AUTOGEN_MIP |
 			FORMAT_VOLUME_TEX,
 		D3DMULTISAMPLE_NUM_SAMPLES),
 	DX8_FORMAT(D3DFMT_A4R4G4B4,
@@ -526,6 +537,7 @@ static DDPIXELFORMAT myTextureFormatsDX8[] =
 			D3DFORMAT_OP_SAME_FORMAT_RENDERTARGET |
 			D3DFORMAT_OP_SAME_FORMAT_UP_TO_ALPHA_RENDERTARGET |
 			D3DFORMAT_OP_CUBETEXTURE |
+			FORMAT_AUTOGEN_MIP |
 			FORMAT_VOLUME_TEX,
 		D3DMULTISAMPLE_NUM_SAMPLES),
 	DX8_FORMAT(D3DFMT_R8G8B8,
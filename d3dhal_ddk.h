@@ -1869,6 +1869,13 @@ typedef enum _D3DBLENDOP {
 #define D3DVTXPCAPS_NO_TEXGEN_NONLOCALVIEWER   0x00000200L
 #endif
 
+#ifndef D3DCAPS2_CANAUTOGENMIPMAP
+#define D3DCAPS2_CANAUTOGENMIPMAP       0x40000000L
+#endif
+#ifndef DDSCAPS3_AUTOGENMIPMAP
+#define DDSCAPS3_AUTOGENMIPMAP          0x00000800L
+#endif
+
 #define D3DTADDRESS_MIRRORONCE 5
 
 typedef enum _D3DTEXTUREFILTERTYPE
@@ -1958,4 +1965,6 @@ typedef enum _D3DTEXTUREFILTERTYPE
 #define D3DVSDE_POSITION2       15
 #define D3DVSDE_NORMAL2         16
 
+#include "d3dshader_ddk.h"
+
 #endif /* _D3DHAL_H */
@@ -0,0 +1,127 @@
+/*
+ * DX shader bytecode tokens (vs_1_1, ps_1_x)
+ *
+ * Only macros without types, so shader translators can be tested on host
+ * without DDK headers.
+ */
+#ifndef __D3DSHADER_DDK_H__INCLUDED__
+#define __D3DSHADER_DDK_H__INCLUDED__
+
+#define D3DSI_OPCODE_MASK        0x0000FFFF
+#define D3DSI_COMMENTSIZE_SHIFT  16
+#define D3DSI_COMMENTSIZE_MASK   0x7FFF0000
+
+#define D3DSIO_NOP           0
+#define D3DSIO_MOV           1
+#define D3DSIO_ADD           2
+#define D3DSIO_SUB           3
+#define D3DSIO_MAD           4
+#define D3DSIO_MUL           5
+#define D3DSIO_RCP           6
+#define D3DSIO_RSQ           7
+#define D3DSIO_DP3           8
+#define D3DSIO_DP4           9
+#define D3DSIO_MIN           10
+#define D3DSIO_MAX           11
+#define D3DSIO_SLT           12
+#define D3DSIO_SGE           13
+#define D3DSIO_EXP           14
+#define D3DSIO_LOG           15
+#define D3DSIO_LIT           16
+#define D3DSIO_DST           17
+#define D3DSIO_LRP           18
+#define D3DSIO_FRC           19
+#define D3DSIO_M4x4          20
+#define D3DSIO_M4x3          21
+#define D3DSIO_M3x4          22
+#define D3DSIO_M3x3          23
+#define D3DSIO_M3x2          24
+#define D3DSIO_TEXCOORD      64
+#define D3DSIO_TEXKILL       65
+#define D3DSIO_TEX           66
+#define D3DSIO_TEXBEM        67
+#define D3DSIO_TEXBEML       68
+#define D3DSIO_TEXREG2AR     69
+#define D3DSIO_TEXREG2GB     70
+#define D3DSIO_TEXM3x2PAD    71
+#define D3DSIO_TEXM3x2TEX    72
+#define D3DSIO_TEXM3x3PAD    73
+#define D3DSIO_TEXM3x3TEX    74
+#define D3DSIO_TEXM3x3DIFF   75
+#define D3DSIO_TEXM3x3SPEC   76
+#define D3DSIO_TEXM3x3VSPEC  77
+#define D3DSIO_EXPP          78
+#define D3DSIO_LOGP          79
+#define D3DSIO_CND           80
+#define D3DSIO_DEF           81
+#define D3DSIO_TEXREG2RGB    82
+#define D3DSIO_TEXDP3TEX     83
+#define D3DSIO_TEXM3x2DEPTH  84
+#define D3DSIO_TEXDP3        85
+#define D3DSIO_TEXM3x3       86
+#define D3DSIO_TEXDEPTH      87
+#define D3DSIO_CMP           88
+#define D3DSIO_BEM           89
+#define D3DSIO_PHASE         0xFFFD
+#define D3DSIO_COMMENT       0xFFFE
+#define D3DSIO_END           0xFFFF
+
+#define D3DSI_COISSUE        0x40000000
+
+#define D3DSP_REGNUM_MASK    0x000007FF
+
+#define D3DSP_WRITEMASK_0    0x00010000
+#define D3DSP_WRITEMASK_1    0x00020000
+#define D3DSP_WRITEMASK_2    0x00040000
+#define D3DSP_WRITEMASK_3    0x00080000
+#define D3DSP_WRITEMASK_ALL  0x000F0000
+
+#define D3DSP_DSTMOD_SHIFT   20
+#define D3DSP_DSTMOD_MASK    0x00F00000
+#define D3DSPDM_NONE         0
+#define D3DSPDM_SATURATE     1
+
+#define D3DSP_DSTSHIFT_SHIFT 24
+#define D3DSP_DSTSHIFT_MASK  0x0F000000
+
+#define D3DSP_REGTYPE_SHIFT  28
+#define D3DSP_REGTYPE_MASK   0x70000000
+
+#define D3DSPR_TEMP          0
+#define D3DSPR_INPUT         1
+#define D3DSPR_CONST         2
+#define D3DSPR_ADDR          3
+#define D3DSPR_TEXTURE       3
+#define D3DSPR_RASTOUT       4
+#define D3DSPR_ATTROUT       5
+#define D3DSPR_TEXCRDOUT     6
+
+#define D3DSRO_POSITION      0
+#define D3DSRO_FOG           1
+#define D3DSRO_POINT_SIZE    2
+
+#define D3DVS_ADDRESSMODE_SHIFT 13
+#define D3DVS_ADDRESSMODE_MASK  (1 << D3DVS_ADDRESSMODE_SHIFT)
+
+#define D3DSP_SWIZZLE_SHIFT  16
+#define D3DSP_SWIZZLE_MASK   0x00FF0000
+#define D3DSP_NOSWIZZLE      (0xE4 << D3DSP_SWIZZLE_SHIFT)
+
+#define D3DSP_SRCMOD_SHIFT   24
+#define D3DSP_SRCMOD_MASK    0x0F000000
+#define D3DSPSM_NONE         0
+#define D3DSPSM_NEG          1
+#define D3DSPSM_BIAS         2
+#define D3DSPSM_BIASNEG      3
+#define D3DSPSM_SIGN         4
+#define D3DSPSM_SIGNNEG      5
+#define D3DSPSM_COMP         6
+#define D3DSPSM_X2           7
+#define D3DSPSM_X2NEG        8
+#define D3DSPSM_DZ           9
+#define D3DSPSM_DW           10
+
+#define D3DSHADER_VERSION_MAJOR(_Version) (((_Version)>>8)&0xFF)
+#define D3DSHADER_VERSION_MINOR(_Version) (((_Version)>>0)&0xFF)
+
+#endif /* __D3DSHADER_DDK_H__INCLUDED__ */
@@ -311,6 +311,8 @@ DDENTRY_FPUSAVE(DestroySurface32, LPDDHAL_DESTROYSURFACEDATA, lpd)
   if(!hal) return DDHAL_DRIVER_NOTHANDLED;
 
 	TOPIC("DESTROY", "Detroying surface caps:  0x%X", lpd->lpDDSurface->ddsCaps.dwCaps);
+
+	FlipWaitSurface((void*)lpd->lpDDSurface->lpGbl->fpVidMem);
 	TOPIC("DESTROY", "Detroying surface flags: 0x%X, refs: %d", lpd->lpDDSurface->dwFlags, lpd->lpDDSurface->dwLocalRefCnt);
 	TOPIC("DESTROY", "Detroying surface dim:  %d x %d (pitch: %d), global flags: 0x%X",
 		lpd->lpDDSurface->lpGbl->wWidth,
@@ -322,6 +324,7 @@ DDENTRY_FPUSAVE(DestroySurface32, LPDDHAL_DESTROYSURFACEDATA, lpd)
 	TOPIC("GARBAGE", "destroy surface vram=%X", lpd->lpDDSurface->lpGbl->fpVidMem);
 
 #ifdef D3DHAL
+	SurfaceCtxSync();
 	SurfaceDelete(lpd->lpDDSurface->dwReserved1);
 	
 	BOOL is_primary = (lpd->lpDDSurface->ddsCaps.dwCaps & (DDSCAPS_PRIMARYSURFACE | DDSCAPS_FLIP)) == 0 ? FALSE : TRUE;
@@ -370,26 +373,20 @@ DDENTRY_FPUSAVE(WaitForVerticalBlank32, LPDDHAL_WAITFORVERTICALBLANKDATA, pwd)
 			       may waited in loop to vertical blank. Thats why I emulating VGA timing here.
 			 */
 			pwd->ddRVal = DD_OK;
-			const DWORD period = 10000/60;
-			DWORD frame_pos = GetTimeTMS() % period;
-			DWORD visible_time = (period*4800)/5250;
-			if(frame_pos <= visible_time)
-			{
-				pwd->bIsInVB = FALSE;
-			}
-			else
-			{
-				pwd->bIsInVB = TRUE;
-			}
+			pwd->bIsInVB = VBlankIsIn();
 			return DDHAL_DRIVER_HANDLED;
 			break;
 		case DDWAITVB_BLOCKBEGIN:
-			/* wait until vertical blank is over and wait display period to the end */
+			/* wait until next vertical blank begins */
+			VBlankWaitBegin();
+			pwd->bIsInVB = TRUE;
 			pwd->ddRVal = DD_OK;
 			return DDHAL_DRIVER_HANDLED;
 			break;
 		case DDWAITVB_BLOCKEND:
 			/* wait for blank end */
+			VBlankWaitEnd();
+			pwd->bIsInVB = FALSE;
 			pwd->ddRVal = DD_OK;
 			return DDHAL_DRIVER_HANDLED;
 			break;
@@ -404,19 +401,29 @@ DDENTRY_FPUSAVE(Lock32, LPDDHAL_LOCKDATA, pld)
 	TRACE_ENTRY
 	
 	VMDAHAL_t *ddhal = GetHAL(pld->lpDD);
+
+	/* surface is still copied to screen by present thread */
+	if(FlipIsPending((void*)pld->lpDDSurface->lpGbl->fpVidMem))
+	{
+		PERF_ADD(lock_stalls, 1);
+		if((pld->dwFlags & DDLOCK_WAIT) == 0)
+		{
+			pld->ddRVal = DDERR_WASSTILLDRAWING;
+			return DDHAL_DRIVER_HANDLED;
+		}
+		uint64_t wait_start = GetTimeTMS();
+		FlipWaitSurface((void*)pld->lpDDSurface->lpGbl->fpVidMem);
+		PERF_ADD(lock_time, GetTimeTMS() - wait_start);
+	}
+
 	if(IsInFront(ddhal, (void*)pld->lpDDSurface->lpGbl->fpVidMem))
 	{
 #if 0
 		/* idea from sample driver, where they need wait to be done flipping before can be surface locked */
-		uint64_t timestamp = GetTimeTMS();
-		
-		if(timestamp >= last_flip_time)
+		if(VBlankFlipPending())
 		{
-			if((last_flip_time + SCREEN_TIME) >= timestamp)
-			{
-				pld->ddRVal = DDERR_WASSTILLDRAWING;
-				return DDHAL_DRIVER_HANDLED;
-			}
+			pld->ddRVal = DDERR_WASSTILLDRAWING;
+			return DDHAL_DRIVER_HANDLED;
 		}
 #endif
 		TOPIC("READBACK", "LOCK %X (primary)", pld->lpDDSurface->lpGbl->fpVidMem);
@@ -437,6 +444,9 @@ DDENTRY_FPUSAVE(Lock32, LPDDHAL_LOCKDATA, pld)
 	}
 
 #ifdef D3DHAL
+	/* surface can be still used by queued DP2 */
+	SurfaceCtxSync();
+
   // FIXME: implement DDLOCK_DISCARDCONTENTS flags
 	surface_id sid = pld->lpDDSurface->dwReserved1;
 	if(sid)
@@ -449,6 +459,7 @@ DDENTRY_FPUSAVE(Lock32, LPDDHAL_LOCKDATA, pld)
 //			TOPIC("CLEAR", "clear in lock 0x%X", pld->lpDDSurface->lpGbl->fpVidMem);
 		}
 		SurfaceFromMesa(pld->lpDDSurface, FALSE);
+		SurfaceVertexBufferLock(pld->lpDDSurface, NULL);
 		SurfaceLock(pld->lpDDSurface);
 	}
 #endif
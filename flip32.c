@@ -37,6 +37,14 @@
 
 #include "nocrt.h"
 
+#ifndef DDFLIP_WAIT
+#define DDFLIP_WAIT 0x00000001l
+#endif
+
+#ifndef DDFLIP_DONOTWAIT
+#define DDFLIP_DONOTWAIT 0x00000020l
+#endif
+
 DWORD GetOffset(VMDAHAL_t *ddhal, void *ptr)
 {
 	DWORD vram_begin = (DWORD)(ddhal->pFBHDA32->vram_pm32);
@@ -102,6 +110,390 @@ static void CopyFrontByLines(VMDAHAL_t *ddhal, void *src, DWORD src_pitch)
 	FBHDA_access_end(0);
 }
 
+/*
+ * Flip queue
+ *
+ * When the surface has to be copied to the screen (no HW flipping or
+ * different pitch), the copy is done by present thread, so application can
+ * render next frame meanwhile. Queue holds up to 2 pending surfaces
+ * (triple buffering).
+ *
+ * This library memory is shared, but thread and event handles are valid only
+ * in process which created them, so every process has own queue in table.
+ * Queue is stopped on DLL detach, queue of terminated process is released
+ * by first process which meets it.
+ */
+#define FLIP_QUEUE_MAX 2
+#define FLIP_QUEUE_PROCS 8
+
+typedef struct flip_item
+{
+	void *src;   /* NULL = free slot */
+	DWORD pitch; /* 0 = same layout as screen */
+	DWORD seq;
+} flip_item_t;
+
+typedef struct flip_queue
+{
+	DWORD pid; /* 0 = free queue */
+	HANDLE thread;
+	HANDLE work; /* new item in queue or stop request */
+	HANDLE done; /* item was presented (manual reset) */
+	volatile BOOL quit;
+	DWORD seq;
+	VMDAHAL_t *ddhal;
+	flip_item_t items[FLIP_QUEUE_MAX];
+} flip_queue_t;
+
+static flip_queue_t flipq[FLIP_QUEUE_PROCS] = {0};
+static LONG flipq_lock = 0;
+
+static void FlipQueueLock()
+{
+	LONG tmp;
+	do
+	{
+		tmp = InterlockedExchange(&flipq_lock, 1);
+		if(tmp == 1)
+		{
+			Sleep(0);
+		}
+	} while(tmp == 1);
+}
+
+static void FlipQueueUnlock()
+{
+	InterlockedExchange(&flipq_lock, 0);
+}
+
+/* needs lock */
+static flip_queue_t *FlipQueueGet(DWORD pid)
+{
+	int i;
+	for(i = 0; i < FLIP_QUEUE_PROCS; i++)
+	{
+		if(flipq[i].pid == pid)
+			return &flipq[i];
+	}
+	return NULL;
+}
+
+/* needs lock */
+static flip_item_t *FlipQueueFirst(flip_queue_t *q)
+{
+	flip_item_t *first = NULL;
+	int i;
+
+	for(i = 0; i < FLIP_QUEUE_MAX; i++)
+	{
+		if(q->items[i].src != NULL)
+		{
+			if(first == NULL || (LONG)(q->items[i].seq - first->seq) < 0)
+			{
+				first = &q->items[i];
+			}
+		}
+	}
+
+	return first;
+}
+
+/* needs lock */
+static BOOL FlipQueueFull(flip_queue_t *q)
+{
+	int i;
+	for(i = 0; i < FLIP_QUEUE_MAX; i++)
+	{
+		if(q->items[i].src == NULL)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* needs lock, returns queue where surface is waiting to present */
+static flip_queue_t *FlipQueuePending(void *ptr)
+{
+	int i, j;
+	for(i = 0; i < FLIP_QUEUE_PROCS; i++)
+	{
+		if(flipq[i].pid == 0)
+			continue;
+
+		for(j = 0; j < FLIP_QUEUE_MAX; j++)
+		{
+			if(flipq[i].items[j].src == ptr)
+				return &flipq[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Owner of the queue terminated without DLL detach, handles are lost
+ * with the process, so only release the slot.
+ */
+static void FlipQueueCheckOwner(DWORD pid)
+{
+	if(!ProcessExists(pid))
+	{
+		FlipQueueLock();
+		flip_queue_t *q = FlipQueueGet(pid);
+		if(q)
+		{
+			memset(q, 0, sizeof(flip_queue_t));
+		}
+		FlipQueueUnlock();
+	}
+}
+
+static DWORD WINAPI FlipThread(LPVOID lpParameter)
+{
+	flip_queue_t *q = (flip_queue_t*)lpParameter;
+	flip_item_t *item;
+
+	for(;;)
+	{
+		WaitForSingleObject(q->work, INFINITE);
+		if(q->quit)
+		{
+			break;
+		}
+
+		for(;;)
+		{
+			FlipQueueLock();
+			item = FlipQueueFirst(q);
+			FlipQueueUnlock();
+
+			if(item == NULL)
+			{
+				break;
+			}
+
+			/* item can't be changed by producer until src is cleared */
+			if(item->pitch)
+			{
+				CopyFrontByLines(q->ddhal, item->src, item->pitch);
+			}
+			else
+			{
+				CopyFront(q->ddhal, item->src);
+			}
+
+			FlipQueueLock();
+			item->src = NULL;
+			SetEvent(q->done);
+			FlipQueueUnlock();
+		}
+	}
+
+	return 0;
+}
+
+static flip_queue_t *FlipQueueInit(VMDAHAL_t *ddhal)
+{
+	DWORD pid = GetCurrentProcessId();
+	flip_queue_t *q;
+	int i;
+
+	if(!GlobalVMHALenv()->async_flip)
+	{
+		return NULL;
+	}
+
+	FlipQueueLock();
+	q = FlipQueueGet(pid);
+	if(q)
+	{
+		q->ddhal = ddhal;
+		FlipQueueUnlock();
+		return q;
+	}
+	FlipQueueUnlock();
+
+	/* release queues of dead processes before taking new one */
+	for(i = 0; i < FLIP_QUEUE_PROCS; i++)
+	{
+		DWORD owner = flipq[i].pid;
+		if(owner != 0)
+		{
+			FlipQueueCheckOwner(owner);
+		}
+	}
+
+	FlipQueueLock();
+	q = FlipQueueGet(0);
+	if(q)
+	{
+		/* reserve slot, handles are created outside lock */
+		memset(q, 0, sizeof(flip_queue_t));
+		q->pid = pid;
+		q->ddhal = ddhal;
+	}
+	FlipQueueUnlock();
+
+	if(q == NULL)
+	{
+		WARN("no free flip queue, flipping synchronously");
+		return NULL;
+	}
+
+	q->work = CreateEventA(NULL, FALSE, FALSE, NULL);
+	q->done = CreateEventA(NULL, TRUE, FALSE, NULL);
+	if(q->work != NULL && q->done != NULL)
+	{
+		q->thread = CreateThread(NULL, 0, FlipThread, q, 0, NULL);
+	}
+
+	if(q->thread == NULL)
+	{
+		WARN("present thread creation failed");
+		if(q->work) CloseHandle(q->work);
+		if(q->done) CloseHandle(q->done);
+
+		FlipQueueLock();
+		memset(q, 0, sizeof(flip_queue_t));
+		FlipQueueUnlock();
+		return NULL;
+	}
+
+	TOPIC("FLIP", "present thread for pid=%X", pid);
+
+	return q;
+}
+
+/* called from DllMain on process detach */
+void FlipQueueDestroy()
+{
+	DWORD pid = GetCurrentProcessId();
+	flip_queue_t *q;
+
+	FlipQueueLock();
+	q = FlipQueueGet(pid);
+	FlipQueueUnlock();
+
+	if(q == NULL || q->thread == NULL)
+	{
+		return;
+	}
+
+	q->quit = TRUE;
+	SetEvent(q->work);
+	/* on process exit the thread is already terminated and handle signaled */
+	if(WaitForSingleObject(q->thread, 1000) != WAIT_OBJECT_0)
+	{
+		WARN("present thread is not responding");
+		TerminateThread(q->thread, 0);
+	}
+
+	CloseHandle(q->thread);
+	CloseHandle(q->work);
+	CloseHandle(q->done);
+
+	FlipQueueLock();
+	memset(q, 0, sizeof(flip_queue_t));
+	FlipQueueUnlock();
+
+	TOPIC("FLIP", "present thread for pid=%X stopped", pid);
+}
+
+static BOOL FlipQueuePush(VMDAHAL_t *ddhal, void *src, DWORD pitch)
+{
+	flip_queue_t *q;
+	int i;
+
+	q = FlipQueueInit(ddhal);
+	if(q == NULL)
+	{
+		return FALSE;
+	}
+
+	for(;;)
+	{
+		FlipQueueLock();
+		for(i = 0; i < FLIP_QUEUE_MAX; i++)
+		{
+			if(q->items[i].src == NULL)
+			{
+				q->items[i].pitch = pitch;
+				q->items[i].seq   = q->seq++;
+				q->items[i].src   = src;
+				FlipQueueUnlock();
+
+				SetEvent(q->work);
+				return TRUE;
+			}
+		}
+		/* reset under lock: any item presented after this sets event again */
+		ResetEvent(q->done);
+		FlipQueueUnlock();
+
+		WaitForSingleObject(q->done, INFINITE);
+	}
+}
+
+/* no free slot in queue of current process */
+static BOOL FlipQueueBusy()
+{
+	flip_queue_t *q;
+	BOOL busy = FALSE;
+
+	FlipQueueLock();
+	q = FlipQueueGet(GetCurrentProcessId());
+	if(q)
+	{
+		busy = FlipQueueFull(q);
+	}
+	FlipQueueUnlock();
+
+	return busy;
+}
+
+BOOL FlipIsPending(void *ptr)
+{
+	flip_queue_t *q;
+
+	FlipQueueLock();
+	q = FlipQueuePending(ptr);
+	FlipQueueUnlock();
+
+	return q != NULL ? TRUE : FALSE;
+}
+
+/* block until surface memory isn't read by present thread */
+void FlipWaitSurface(void *ptr)
+{
+	DWORD pid = GetCurrentProcessId();
+	flip_queue_t *q;
+	DWORD owner;
+
+	for(;;)
+	{
+		FlipQueueLock();
+		q = FlipQueuePending(ptr);
+		if(q == NULL)
+		{
+			FlipQueueUnlock();
+			break;
+		}
+
+		owner = q->pid;
+		if(owner == pid)
+		{
+			ResetEvent(q->done);
+			FlipQueueUnlock();
+			WaitForSingleObject(q->done, INFINITE);
+		}
+		else
+		{
+			/* event handle of other process isn't usable here */
+			FlipQueueUnlock();
+			FlipQueueCheckOwner(owner);
+			Sleep(1);
+		}
+	}
+}
+
 static void DoFlipping(VMDAHAL_t *ddhal, void *from, void *to, DWORD from_pitch, DWORD to_pitch)
 {
 	TRACE_ENTRY
@@ -117,7 +509,10 @@ static void DoFlipping(VMDAHAL_t *ddhal, void *from, void *to, DWORD from_pitch,
 		{
 			if(from_pitch != to_pitch) /* surface is not same as screen */
 			{
-				CopyFrontByLines(ddhal, to, to_pitch);
+				if(!FlipQueuePush(ddhal, to, to_pitch))
+				{
+					CopyFrontByLines(ddhal, to, to_pitch);
+				}
 			}
 			else if(ddhal->pFBHDA32->flags & FB_SUPPORT_FLIPING) /* HW flip support */
 			{
@@ -128,7 +523,10 @@ static void DoFlipping(VMDAHAL_t *ddhal, void *from, void *to, DWORD from_pitch,
 			}
 			else /* nope, copy it to fixed frame buffer surface */
 			{
-				CopyFront(ddhal, to);
+				if(!FlipQueuePush(ddhal, to, 0))
+				{
+					CopyFront(ddhal, to);
+				}
 			}
 		}
 	}
@@ -149,8 +547,6 @@ BOOL FlipPrimary(VMDAHAL_t *ddhal, void *to)
 	return FALSE;
 }
 
-uint64_t last_flip_time = 0;
-
 volatile BOOL is_flipping = FALSE;
 
 DDENTRY_FPUSAVE(Flip32, LPDDHAL_FLIPDATA, pfd)
@@ -169,7 +565,7 @@ DDENTRY_FPUSAVE(Flip32, LPDDHAL_FLIPDATA, pfd)
 	 * done being displayed
 	 */
 	VMDAHAL_t *ddhal = GetHAL(pfd->lpDD);	
-	uint64_t flip_time = GetTimeTMS();
+	BOOL vsync = (halVSync && (pfd->dwFlags & DDFLIP_NOVSYNC) == 0) ? TRUE : FALSE;
 
 	if(is_flipping)
 	{
@@ -177,15 +573,25 @@ DDENTRY_FPUSAVE(Flip32, LPDDHAL_FLIPDATA, pfd)
 		return DDHAL_DRIVER_HANDLED;
 	}
 
-	if(halVSync && (pfd->dwFlags & DDFLIP_NOVSYNC) == 0)
+#ifdef D3DHAL
+	/* frame can be still rendered by DP2 worker */
+	SurfaceCtxSync();
+#endif
+
+	if((pfd->dwFlags & DDFLIP_DONOTWAIT) != 0 && FlipQueueBusy())
+	{
+		pfd->ddRVal = DDERR_WASSTILLDRAWING;
+		return DDHAL_DRIVER_HANDLED;
+	}
+
+	if(vsync)
 	{
-		if(last_flip_time <= flip_time) /* not in overflow */
+		/* previous flip is queued to next vblank, block until it is done
+		   only when application asks for it (DDFLIP_WAIT) */
+		if(!VBlankFlipBegin((pfd->dwFlags & DDFLIP_WAIT) != 0))
 		{
-			if(last_flip_time + SCREEN_TIME > flip_time)
-			{
-				pfd->ddRVal = DDERR_WASSTILLDRAWING;
-				return DDHAL_DRIVER_HANDLED;
-			}
+			pfd->ddRVal = DDERR_WASSTILLDRAWING;
+			return DDHAL_DRIVER_HANDLED;
 		}
 	}
 
@@ -245,7 +651,8 @@ DDENTRY_FPUSAVE(Flip32, LPDDHAL_FLIPDATA, pfd)
 	}
 #endif
 
-	last_flip_time = flip_time;
+	VBlankFlipDone(vsync);
+	PerfFrame();
 	pfd->ddRVal = DD_OK;
 
 	return DDHAL_DRIVER_HANDLED;
@@ -256,12 +663,24 @@ DDENTRY_FPUSAVE(GetFlipStatus32, LPDDHAL_GETFLIPSTATUSDATA, pfd)
 	TRACE_ENTRY
 	VMDAHAL_t *ddhal = GetHAL(pfd->lpDD);	
 	
-	if(is_flipping)
+	if(pfd->dwFlags == DDGFS_CANFLIP)
 	{
+		if(FlipQueueBusy())
+		{
+			pfd->ddRVal = DDERR_WASSTILLDRAWING;
+			return DDHAL_DRIVER_HANDLED;
+		}
+	}
+	else if(FlipIsPending((void*)pfd->lpDDSurface->lpGbl->fpVidMem))
+	{
+		/* DDGFS_ISFLIPDONE: surface is still copied to screen */
 		pfd->ddRVal = DDERR_WASSTILLDRAWING;
 		return DDHAL_DRIVER_HANDLED;
 	}
-	else if(ddhal->pFBHDA32->onflip)
+
+	/* triple buffering on host, one more swap can be queued */
+	if(ddhal->pFBHDA32->onflip &&
+		!(pfd->dwFlags == DDGFS_CANFLIP && (ddhal->pFBHDA32->flags & FB_SUPPORT_TRIPLE)))
 	{
 		FBHDA_swap(0, FBHDA_SWAP_QUERY);
 		if(ddhal->pFBHDA32->onflip)
@@ -273,26 +692,22 @@ DDENTRY_FPUSAVE(GetFlipStatus32, LPDDHAL_GETFLIPSTATUSDATA, pfd)
 
 	if(pfd->dwFlags == DDGFS_CANFLIP && halVSync)
 	{
-		uint64_t flip_time = GetTimeTMS();
-		if(last_flip_time <= flip_time) /* not in overflow */
+		if(VBlankFlipPending())
 		{
-			if(last_flip_time + SCREEN_TIME > flip_time)
-			{
-				pfd->ddRVal = DDERR_WASSTILLDRAWING;
-				return DDHAL_DRIVER_HANDLED;
-			}
+			pfd->ddRVal = DDERR_WASSTILLDRAWING;
+			return DDHAL_DRIVER_HANDLED;
 		}
 	}
 	else if(pfd->dwFlags == DDGFS_ISFLIPDONE)
 	{
-		if(!IsInFront(ddhal, (void*)pfd->lpDDSurface->lpGbl->fpVidMem))
+		if(!IsInFront(ddhal, (void*)pfd->lpDDSurface->lpGbl->fpVidMem) || (halVSync && VBlankFlipPending()))
 		{
 			pfd->ddRVal = DDERR_WASSTILLDRAWING;
 			return DDHAL_DRIVER_HANDLED;
 		}
 	}
 	
-	/* we do nothing async yet, so return always success */	
+	/* flip is done after its vblank */
 	pfd->ddRVal = DD_OK;
 	
 	return DDHAL_DRIVER_HANDLED;
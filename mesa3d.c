@@ -90,6 +90,10 @@ static mesa3d_entry_t *mesa_entry_ht[MESA_HT_MOD] = {};
 		mesa->proc.p ## _n = (_n ## _h)GetProcAddress(mesa->lib, #_n); if(!mesa->proc.p ## _n){valid = FALSE; ERR("GetProcAddress fail for %s", #_n); break;} \
 	}else{mesa->proc.p ## _n = NULL;}
 
+/* optional extension, NULL when not available */
+#define MESA_API_EXT(_n, _t, _p) \
+	mesa->proc.p ## _n = (_n ## _h)mesa->GetProcAddress(#_n); if(!mesa->proc.p ## _n){WARN("GetProcAddress fail for %s (optional)", #_n);}
+
 static mesa3d_entry_t *Mesa3DCreate(DWORD pid, mesa3d_entry_t *mesa)
 {
 	TRACE_ENTRY
@@ -135,8 +139,39 @@ static mesa3d_entry_t *Mesa3DCreate(DWORD pid, mesa3d_entry_t *mesa)
 
 		GetVMHALenv(&mesa->env);
 		UpdateVMHALenv(&mesa->env);
+
+		if(mesa->proc.pglGenProgramsARB == NULL || mesa->proc.pglDeleteProgramsARB == NULL ||
+			mesa->proc.pglBindProgramARB == NULL || mesa->proc.pglProgramStringARB == NULL ||
+			mesa->proc.pglProgramLocalParameter4fvARB == NULL || mesa->proc.pglProgramEnvParameter4fvARB == NULL ||
+			mesa->proc.pglVertexAttrib4fARB == NULL || mesa->proc.pglVertexAttrib4fvARB == NULL)
+		{
+			mesa->env.vertexshader = FALSE;
+		}
+
+		if(mesa->proc.pglGenProgramsARB == NULL || mesa->proc.pglDeleteProgramsARB == NULL ||
+			mesa->proc.pglBindProgramARB == NULL || mesa->proc.pglProgramStringARB == NULL ||
+			mesa->proc.pglProgramLocalParameter4fvARB == NULL || mesa->proc.pglProgramEnvParameter4fvARB == NULL)
+		{
+			mesa->env.pixelshader = FALSE;
+		}
+
+		if(mesa->proc.pglGenBuffers == NULL || mesa->proc.pglDeleteBuffers == NULL ||
+			mesa->proc.pglBindBuffer == NULL || mesa->proc.pglBufferData == NULL ||
+			mesa->proc.pglBufferSubData == NULL || mesa->proc.pglEnableClientState == NULL ||
+			mesa->proc.pglDisableClientState == NULL || mesa->proc.pglClientActiveTexture == NULL ||
+			mesa->proc.pglVertexPointer == NULL || mesa->proc.pglNormalPointer == NULL ||
+			mesa->proc.pglColorPointer == NULL || mesa->proc.pglTexCoordPointer == NULL ||
+			mesa->proc.pglDrawArrays == NULL || mesa->proc.pglDrawElements == NULL)
+		{
+			mesa->env.vbo = FALSE;
+		}
+
+		mesa->autogenmipmap = (mesa->proc.pglGenerateMipmap != NULL) ? TRUE : FALSE;
 		//memcpy(&mesa->env, &VMHALenv, sizeof(VMHAL_enviroment_t));
 
+		MesaTraceOpen(mesa);
+		MesaTexCacheInit(mesa);
+
 	} while(0);
 
 	if(!valid)
@@ -160,6 +195,7 @@ static mesa3d_entry_t *Mesa3DCreate(DWORD pid, mesa3d_entry_t *mesa)
 #undef MESA_API
 #undef MESA_API_OS
 #undef MESA_API_DRV
+#undef MESA_API_EXT
 
 #define FBO_WND_CLASS_NAME "vmhal9x_fbo_win"
 
@@ -252,6 +288,8 @@ NUKED_LOCAL void Mesa3DFree(DWORD pid, BOOL unload)
 			entry = entry->next;
 			
 			MesaDestroyAllCtx(clean_ptr);
+			MesaTraceClose(clean_ptr);
+			MesaTexCacheFree(clean_ptr);
 			if(unload)
 			{
 				FreeLibrary(clean_ptr->lib);
@@ -909,6 +947,12 @@ NUKED_LOCAL mesa3d_ctx_t *MesaCreateCtx(mesa3d_entry_t *entry, DWORD dds_sid, DW
 						entry->env.zfloat = FALSE;
 					}
 
+					/* D3DCOLOR as GL_BGRA color array needs GL 3.2 (ARB_vertex_array_bgra) */
+					if(entry->gl_major < 3 || (entry->gl_major == 3 && entry->gl_minor < 2))
+					{
+						entry->env.vbo = FALSE;
+					}
+
 					GLint max_tex_size = 0;
 					GLint max_clips = 0;
 
@@ -1059,6 +1103,9 @@ NUKED_LOCAL BOOL MesaSetTarget(mesa3d_ctx_t *ctx, surface_id dds_sid, surface_id
 	//UpdateScreenCoords(ctx, (GLfloat)width, (GLfloat)height);
 	ctx->state.textarget = (dds->dwCaps & DDSCAPS_TEXTURE) ? TRUE : FALSE;
 
+	if(MESA_TRACE_ON(ctx->entry))
+		MesaTraceSurface(ctx, dds_sid);
+
 	if(viewport_set)
 		MesaApplyViewport(ctx, 0, 0, width, height, FALSE);
 
@@ -1116,6 +1163,9 @@ NUKED_LOCAL void MesaDestroyCtx(mesa3d_ctx_t *ctx)
 	
 	TOPIC("GL", "OSMesaDestroyContext");
 
+	/* worker has to release GL context before it is destroyed */
+	MesaDP2Free(ctx);
+
 	if(entry->pid == GetCurrentProcessId())
 	{
 		if(ctx->osctx != NULL)
@@ -1142,6 +1192,9 @@ NUKED_LOCAL void MesaDestroyCtx(mesa3d_ctx_t *ctx)
 #endif
 	
 	entry->ctx[id] = NULL;
+
+	/* FBOs are released with GL context */
+	entry->fbo_stats.bytes -= ctx->fbo_bytes;
 	
 	for(i = 0; i < MESA3D_MAX_TEXS; i++)
 	{
@@ -1157,16 +1210,14 @@ NUKED_LOCAL void MesaDestroyCtx(mesa3d_ctx_t *ctx)
 		hal_free(HEAP_LARGE, ctx->osbuf);
 	}
 	
-	if(ctx->temp.buf)
-	{
-		hal_free(HEAP_LARGE, ctx->temp.buf);
-		ctx->temp.size = ctx->temp.width = 0;
-		ctx->temp.buf = NULL;
-	}
+	MesaTempRelease(ctx);
 	
 	MesaLightDestroyAll(ctx);
 	MesaFreePals(ctx);
+	MesaPSDestroyAll(ctx);
 	MesaVSDestroyAll(ctx);
+	MesaRecDestroyAll(ctx);
+	MesaVBODestroyAll(ctx);
 	hal_free(HEAP_NORMAL, ctx);
 }
 
@@ -1309,6 +1360,8 @@ NUKED_LOCAL void MesaInitCtx(mesa3d_ctx_t *ctx)
 
 	//GL_CHECK(entry->proc.pglDisable(GL_MULTISAMPLE));
 	GL_CHECK(entry->proc.pglDisable(GL_LIGHTING));
+	GL_CHECK(entry->proc.pglDisable(GL_COLOR_MATERIAL));
+	ctx->state.material.color_mode_gl = GL_NONE;
 	//GL_CHECK(entry->proc.pglLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE));
 
 	GL_CHECK(entry->proc.pglLightModeli(GL_LIGHT_MODEL_COLOR_CONTROL, GL_SEPARATE_SPECULAR_COLOR));
@@ -1325,6 +1378,7 @@ NUKED_LOCAL void MesaInitCtx(mesa3d_ctx_t *ctx)
 	if(ctx->entry->env.lowdetail >= 3)
 	{
 		GL_CHECK(entry->proc.pglShadeModel(GL_FLAT));
+		ctx->state.flatshade = TRUE;
 	}
 
 	// enable edge filtering on cubemap
@@ -1425,8 +1479,11 @@ NUKED_LOCAL void MesaInitCtx(mesa3d_ctx_t *ctx)
 	//ctx->state.bind_vertices = 0;
 	ctx->state.bind_indices = NULL;
 	ctx->vstream[0].mem.ptr = NULL;
+	ctx->vstream[0].vbo = NULL;
 
 	ctx->shader.vs = NULL;
+	ctx->shader.ps = NULL;
+	ctx->shader.ps_program = 0;
 
 	MesaDrawRefreshState(ctx);
 
@@ -1487,6 +1544,22 @@ NUKED_INLINE int GetCubeSide(DWORD dwCaps2)
 	return 0;
 }
 
+/* keep rendered image (render target texture), surface can outlive the texture */
+static void TextureGPUSync(mesa3d_texture_t *tex, surface_id skip_sid)
+{
+	int side, level;
+	for(side = 0; side < tex->sides; side++)
+	{
+		for(level = 0; level <= tex->mipmap_level; level++)
+		{
+			if(tex->gpu_dirty[side][level] && tex->data_sid[side][level] != skip_sid)
+			{
+				MesaBufferDownloadTexture(tex->ctx, tex, level, side);
+			}
+		}
+	}
+}
+
 NUKED_LOCAL mesa3d_texture_t *MesaCreateTexture(mesa3d_ctx_t *ctx, surface_id sid)
 {
 	mesa3d_texture_t *tex = NULL;
@@ -1495,6 +1568,9 @@ NUKED_LOCAL mesa3d_texture_t *MesaCreateTexture(mesa3d_ctx_t *ctx, surface_id si
 	if(surf == NULL)
 		return NULL;
 
+	if(MESA_TRACE_ON(ctx->entry))
+		MesaTraceSurface(ctx, sid);
+
 	if(sid >= MESA3D_MAX_TEXS)
 	{
 		ERR("sid exceed limit (%d, limit %d)", sid, MAX_SURFACES);
@@ -1508,6 +1584,7 @@ NUKED_LOCAL mesa3d_texture_t *MesaCreateTexture(mesa3d_ctx_t *ctx, surface_id si
 		tex = ctx->tex[sid];
 		if(tex->gltex)
 		{
+			TextureGPUSync(tex, 0);
 			GL_CHECK(entry->proc.pglDeleteTextures(1, &tex->gltex));
 			TOPIC("TEXMEM", "delete texture: %d (overwrite)", tex->gltex);
 		}
@@ -1653,6 +1730,22 @@ NUKED_LOCAL mesa3d_texture_t *MesaCreateTexture(mesa3d_ctx_t *ctx, surface_id si
 				TOPIC("NEWTEX", "Created %d without mipmap", tex->gltex);
 			}
 
+#ifdef DDI9_AUTOGENMIPMAP
+			if((surf->dwCaps3 & DDSCAPS3_AUTOGENMIPMAP) && tex->mipmap)
+			{
+				if(MesaBufferCanGenTextureMips(ctx, tex))
+				{
+					tex->autogen = TRUE;
+					TOPIC("NEWTEX", "Texture %d has GPU generated mipmaps", tex->gltex);
+				}
+				else
+				{
+					/* format isn't advertised with D3DFORMAT_OP_AUTOGENMIPMAP */
+					WARN("texture %d: mipmap autogeneration is not possible", tex->gltex);
+				}
+			}
+#endif
+
 /*
 			if(surf->dwCaps & DDSCAPS_ALLOCONLOAD)
 			{
@@ -1679,6 +1772,7 @@ NUKED_LOCAL void MesaReloadTexture(mesa3d_texture_t *tex, int tmu)
 {
 	BOOL reload = tex->dirty;
 	BOOL reload_done = FALSE;
+	BOOL gen_mips = FALSE;
 	int level;
 	int side;
 
@@ -1712,7 +1806,23 @@ NUKED_LOCAL void MesaReloadTexture(mesa3d_texture_t *tex, int tmu)
 			{
 				DDSURF *primary = SurfaceGetSURF(tex->data_sid[0][0]);
 				BOOL has_color_key = tex->ctx->state.tmu[tmu].colorkey && (primary->dwFlags & DDRAWISURF_HASCKEYSRCBLT);
-				if(tex->palette)
+				if(tex->gpu_dirty[side][level] && has_color_key && !(tex->autogen && level > 0))
+				{
+					/* chroma key needs rendered image in surface memory */
+					MesaBufferDownloadTexture(tex->ctx, tex, level, side);
+				}
+
+				if(tex->gpu_dirty[side][level])
+				{
+					/* GL texture already contains rendered image (MesaBufferCopyTexture) */
+				}
+				else if(tex->autogen && level > 0)
+				{
+					/* generated from level 0 below (with color key already applied),
+					   surface memory of sub-levels isn't written by application */
+					gen_mips = TRUE;
+				}
+				else if(tex->palette)
 				{
 					MesaBufferUploadTexturePalette(tex->ctx, tex, level, side, tmu,
 						has_color_key, primary->dwColorKeyLowPal, primary->dwColorKeyHighPal);
@@ -1721,10 +1831,18 @@ NUKED_LOCAL void MesaReloadTexture(mesa3d_texture_t *tex, int tmu)
 				{
 					MesaBufferUploadTextureChroma(tex->ctx, tex, level, side, tmu,
 						primary->dwColorKeyLow, primary->dwColorKeyHigh);
+					if(level == 0 && tex->autogen)
+					{
+						gen_mips = TRUE;
+					}
 				}
 				else
 				{
 					MesaBufferUploadTexture(tex->ctx, tex, level, side, tmu);
+					if(level == 0 && tex->autogen)
+					{
+						gen_mips = TRUE;
+					}
 				}
 
 				tex->data_dirty[side][level] = FALSE;
@@ -1736,6 +1854,11 @@ NUKED_LOCAL void MesaReloadTexture(mesa3d_texture_t *tex, int tmu)
 		}
 	}
 
+	if(gen_mips)
+	{
+		MesaBufferGenTextureMips(tex->ctx, tex, tmu);
+	}
+
 	if(reload_done)
 	{
 		tex->colorkey = tex->ctx->state.tmu[tmu].colorkey;
@@ -1761,6 +1884,7 @@ NUKED_LOCAL void MesaDestroyTexture(mesa3d_texture_t *tex, BOOL ctx_cleanup, sur
 
 		if(!ctx_cleanup)
 		{
+			TextureGPUSync(tex, surface_delete);
 			GL_CHECK(entry->proc.pglDeleteTextures(1, &tex->gltex));
 			TOPIC("TEXMEM", "detele texture: %d", tex->gltex);
 		}
@@ -1961,6 +2085,9 @@ NUKED_LOCAL void MesaApplyMaterial(mesa3d_ctx_t *ctx)
 
 	GL_CHECK(entry->proc.pglMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, ctx->state.material.shininess));
 
+	ctx->state.material.last_valid[0] = FALSE;
+	ctx->state.material.last_valid[1] = FALSE;
+
 	TOPIC("LIGHT", "Material ambient=(%f %f %f %f), diffuse=(%f %f %f %f)",
 		ctx->state.material.ambient[0], ctx->state.material.ambient[1],
 		ctx->state.material.ambient[2], ctx->state.material.ambient[3],
@@ -2008,6 +2135,41 @@ static void MesaApplyColorMaterial(mesa3d_ctx_t *ctx)
 	else
 		ctx->state.specular_vertex = FALSE;
 
+	/*
+	 * Vertex color 1 can be tracked by GL_COLOR_MATERIAL (only one mode),
+	 * rest of targets and vertex color 2 stay for glMaterial per vertex.
+	 */
+	if((ctx->state.material.untracked & (MESA_MAT_DIFFUSE_C1 | MESA_MAT_AMBIENT_C1)) ==
+		(MESA_MAT_DIFFUSE_C1 | MESA_MAT_AMBIENT_C1))
+	{
+		ctx->state.material.color_mode = GL_AMBIENT_AND_DIFFUSE;
+		ctx->state.material.untracked &= ~(MESA_MAT_DIFFUSE_C1 | MESA_MAT_AMBIENT_C1);
+	}
+	else if(ctx->state.material.untracked & MESA_MAT_DIFFUSE_C1)
+	{
+		ctx->state.material.color_mode = GL_DIFFUSE;
+		ctx->state.material.untracked &= ~MESA_MAT_DIFFUSE_C1;
+	}
+	else if(ctx->state.material.untracked & MESA_MAT_AMBIENT_C1)
+	{
+		ctx->state.material.color_mode = GL_AMBIENT;
+		ctx->state.material.untracked &= ~MESA_MAT_AMBIENT_C1;
+	}
+	else if(ctx->state.material.untracked & MESA_MAT_EMISSIVE_C1)
+	{
+		ctx->state.material.color_mode = GL_EMISSION;
+		ctx->state.material.untracked &= ~MESA_MAT_EMISSIVE_C1;
+	}
+	else if(ctx->state.material.untracked & MESA_MAT_SPECULAR_C1)
+	{
+		ctx->state.material.color_mode = GL_SPECULAR;
+		ctx->state.material.untracked &= ~MESA_MAT_SPECULAR_C1;
+	}
+	else
+	{
+		ctx->state.material.color_mode = GL_NONE;
+	}
+
 	TOPIC("LIGHT", "Vertex color: primary=%d%d%d%d, secondary=%d%d%d%d",
 		ctx->state.material.diffuse_source  == D3DMCS_COLOR1 ? 1 : 0,
 		ctx->state.material.ambient_source  == D3DMCS_COLOR1 ? 1 : 0,
@@ -2022,6 +2184,47 @@ static void MesaApplyColorMaterial(mesa3d_ctx_t *ctx)
 	MesaApplyMaterial(ctx);
 }
 
+/*
+ * Enable GL_COLOR_MATERIAL by state from MesaApplyColorMaterial, called
+ * before glBegin. When vertex hasn't diffuse color, D3D uses material
+ * color, so tracking has to be disabled.
+ */
+NUKED_LOCAL void MesaColorMaterialUpdate(mesa3d_ctx_t *ctx, BOOL vertex_diffuse)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	GLenum mode = GL_NONE;
+
+	if(vertex_diffuse && ctx->state.material.lighting && ctx->state.material.color_vertex)
+	{
+		mode = ctx->state.material.color_mode;
+	}
+
+	if(mode == ctx->state.material.color_mode_gl)
+		return;
+
+	if(mode != GL_NONE)
+	{
+		GL_CHECK(entry->proc.pglColorMaterial(GL_FRONT_AND_BACK, mode));
+		if(ctx->state.material.color_mode_gl == GL_NONE)
+		{
+			GL_CHECK(entry->proc.pglEnable(GL_COLOR_MATERIAL));
+		}
+	}
+	else
+	{
+		GL_CHECK(entry->proc.pglDisable(GL_COLOR_MATERIAL));
+	}
+
+	if(ctx->state.material.color_mode_gl != GL_NONE)
+	{
+		/* previously tracked property holds last vertex color */
+		MesaApplyMaterial(ctx);
+	}
+
+	TOPIC("LIGHT", "GL_COLOR_MATERIAL mode=0x%X", mode);
+	ctx->state.material.color_mode_gl = mode;
+}
+
 static void MesaApplyDX5TexBlend(mesa3d_ctx_t *ctx, int tmu, D3DTEXTUREBLEND blend)
 {
 	switch(blend)
@@ -2189,15 +2392,23 @@ NUKED_LOCAL void MesaSetTextureState(mesa3d_ctx_t *ctx, int tmu, DWORD state, vo
 			break;
 		/* D3DVALUE (bump mapping matrix) */
 		RENDERSTATE(D3DTSS_BUMPENVMAT00)
+			ts->bumpenv[0] = TSS_FLOAT;
+			ctx->shader.ps_bump_dirty = TRUE;
 			break;
 		/* D3DVALUE (bump mapping matrix) */
 		RENDERSTATE(D3DTSS_BUMPENVMAT01)
+			ts->bumpenv[1] = TSS_FLOAT;
+			ctx->shader.ps_bump_dirty = TRUE;
 			break;
 		/* D3DVALUE (bump mapping matrix) */
 		RENDERSTATE(D3DTSS_BUMPENVMAT10)
+			ts->bumpenv[2] = TSS_FLOAT;
+			ctx->shader.ps_bump_dirty = TRUE;
 			break;
 		/* D3DVALUE (bump mapping matrix) */
 		RENDERSTATE(D3DTSS_BUMPENVMAT11)
+			ts->bumpenv[3] = TSS_FLOAT;
+			ctx->shader.ps_bump_dirty = TRUE;
 			break;
 		/* identifies which set of texture coordinates index this texture */
 		RENDERSTATE(D3DTSS_TEXCOORDINDEX)
@@ -2347,9 +2558,13 @@ NUKED_LOCAL void MesaSetTextureState(mesa3d_ctx_t *ctx, int tmu, DWORD state, vo
 			break;
 		/* D3DVALUE scale for bump map luminance */
 		RENDERSTATE(D3DTSS_BUMPENVLSCALE)
+			ts->bumplum[0] = TSS_FLOAT;
+			ctx->shader.ps_bump_dirty = TRUE;
 			break;
 		/* D3DVALUE offset for bump map luminance */
 		RENDERSTATE(D3DTSS_BUMPENVLOFFSET)
+			ts->bumplum[1] = TSS_FLOAT;
+			ctx->shader.ps_bump_dirty = TRUE;
 			break;
 		/* D3DTEXTURETRANSFORMFLAGS controls texture transform (DX7) */
 		RENDERSTATE(D3DTSS_TEXTURETRANSFORMFLAGS)
@@ -2611,6 +2826,7 @@ NUKED_LOCAL void MesaSetRenderState(mesa3d_ctx_t *ctx, LPD3DHAL_DP2RENDERSTATE s
 			if(ctx->entry->env.lowdetail >= 3)
 			{
 				GL_CHECK(entry->proc.pglShadeModel(GL_FLAT));
+				ctx->state.flatshade = TRUE;
 			}
 			else
 			{
@@ -2618,12 +2834,14 @@ NUKED_LOCAL void MesaSetRenderState(mesa3d_ctx_t *ctx, LPD3DHAL_DP2RENDERSTATE s
 				{
 	        case D3DSHADE_FLAT:
 						GL_CHECK(entry->proc.pglShadeModel(GL_FLAT));
+						ctx->state.flatshade = TRUE;
 						break;
 					case D3DSHADE_GOURAUD:
 					/* Note from WINE: D3DSHADE_PHONG in practice is the same as D3DSHADE_GOURAUD in D3D */
 					case D3DSHADE_PHONG:
 					default:
 						GL_CHECK(entry->proc.pglShadeModel(GL_SMOOTH));
+						ctx->state.flatshade = FALSE;
 						break;
 				}
 			}
@@ -3502,7 +3720,9 @@ static void ApplyTextureState(mesa3d_entry_t *entry, mesa3d_ctx_t *ctx, int tmu)
 			}
 		}
 
-		if(ts->color_op == D3DTOP_DISABLE && ts->alpha_op == D3DTOP_DISABLE)
+		/* stage operations are ignored when pixel shader is set */
+		if(ts->color_op == D3DTOP_DISABLE && ts->alpha_op == D3DTOP_DISABLE &&
+			ctx->state.current.pixelshader == 0)
 		{
 			ts->active = FALSE;
 		}
@@ -4736,6 +4956,8 @@ NUKED_LOCAL void MesaDraw5(mesa3d_ctx_t *ctx, D3DPRIMITIVETYPE dx_ptype, D3DVERT
 
 	if(gl_ptype != GL_NOOP)
 	{
+		MesaColorMaterialUpdate(ctx, vtype != D3DVT_VERTEX);
+
 		TOPIC("GL", "glBegin(%d)", gl_ptype);
 		entry->proc.pglBegin(gl_ptype);
 		switch(vtype)
@@ -4785,6 +5007,8 @@ NUKED_LOCAL void MesaDraw3(mesa3d_ctx_t *ctx, DWORD op, void *prim, LPBYTE verti
 	LPD3DTLVERTEX vertex = (LPD3DTLVERTEX)vertices;
 	int i;
 
+	MesaColorMaterialUpdate(ctx, TRUE);
+
 	switch(op)
 	{
 		case D3DOP_POINT:
@@ -4834,6 +5058,8 @@ NUKED_LOCAL void MesaDraw5Index(mesa3d_ctx_t *ctx, D3DPRIMITIVETYPE dx_ptype, D3
 
 	if(gl_ptype != GL_NOOP)
 	{
+		MesaColorMaterialUpdate(ctx, vtype != D3DVT_VERTEX);
+
 		TOPIC("GL", "glBegin(%d)", gl_ptype);
 		entry->proc.pglBegin(gl_ptype);
 
@@ -4869,13 +5095,89 @@ NUKED_LOCAL void MesaDraw5Index(mesa3d_ctx_t *ctx, D3DPRIMITIVETYPE dx_ptype, D3
 	}
 }
 
-NUKED_INLINE BOOL IsFullSurface(mesa3d_ctx_t *ctx, RECT *rect)
+#define CLEAR_RECTS_MAX 32
+
+/*
+ * Clip rects to the surface, drop empty and covered ones and merge
+ * neighbours with common edge. Returns number of rects in 'out', or -1
+ * when the rects cover whole surface. Caller passes at most
+ * CLEAR_RECTS_MAX rects.
+ */
+static int MesaClearRects(mesa3d_ctx_t *ctx, int rects_cnt, RECT *rects, RECT *out)
 {
-	return
-		rect->left == 0 &&
-		rect->top == 0 &&
-		rect->right == ctx->state.sw &&
-		rect->bottom == ctx->state.sh;
+	LONG sw = ctx->state.sw;
+	LONG sh = ctx->state.sh;
+	int cnt = 0;
+	int i, j;
+	BOOL merged;
+
+	for(i = 0; i < rects_cnt; i++)
+	{
+		RECT r = rects[i];
+		if(r.left < 0) r.left = 0;
+		if(r.top  < 0) r.top  = 0;
+		if(r.right  > sw) r.right  = sw;
+		if(r.bottom > sh) r.bottom = sh;
+
+		if(r.left >= r.right || r.top >= r.bottom)
+			continue;
+
+		if(r.left == 0 && r.top == 0 && r.right == sw && r.bottom == sh)
+			return -1;
+
+		out[cnt++] = r;
+	}
+
+	/* merge until nothing changes */
+	do
+	{
+		merged = FALSE;
+		for(i = 0; i < cnt; i++)
+		{
+			for(j = i+1; j < cnt; j++)
+			{
+				RECT *a = &out[i];
+				RECT *b = &out[j];
+				BOOL join = FALSE;
+
+				if(b->left >= a->left && b->right <= a->right && b->top >= a->top && b->bottom <= a->bottom)
+				{
+					join = TRUE; /* b inside a */
+				}
+				else if(a->left >= b->left && a->right <= b->right && a->top >= b->top && a->bottom <= b->bottom)
+				{
+					*a = *b;
+					join = TRUE;
+				}
+				else if(a->top == b->top && a->bottom == b->bottom && a->right >= b->left && b->right >= a->left)
+				{
+					a->left  = NOCRT_MIN(a->left,  b->left);
+					a->right = NOCRT_MAX(a->right, b->right);
+					join = TRUE;
+				}
+				else if(a->left == b->left && a->right == b->right && a->bottom >= b->top && b->bottom >= a->top)
+				{
+					a->top    = NOCRT_MIN(a->top,    b->top);
+					a->bottom = NOCRT_MAX(a->bottom, b->bottom);
+					join = TRUE;
+				}
+
+				if(join)
+				{
+					out[j] = out[--cnt];
+					merged = TRUE;
+					j--;
+				}
+			}
+		}
+	} while(merged);
+
+	if(cnt == 1 && out[0].left == 0 && out[0].top == 0 && out[0].right == sw && out[0].bottom == sh)
+	{
+		return -1;
+	}
+
+	return cnt;
 }
 
 NUKED_LOCAL void MesaClear(mesa3d_ctx_t *ctx, DWORD flags, D3DCOLOR color, D3DVALUE depth, DWORD stencil, int rects_cnt, RECT *rects)
@@ -4883,6 +5185,8 @@ NUKED_LOCAL void MesaClear(mesa3d_ctx_t *ctx, DWORD flags, D3DCOLOR color, D3DVA
 	GLfloat cv[4];
 	int i;
 	mesa3d_entry_t *entry = ctx->entry;
+	RECT clear_rects[CLEAR_RECTS_MAX];
+	int clear_cnt = -1;
 
 	TOPIC("DEPTHCONV", "Clear=%X", flags);
 
@@ -4910,7 +5214,7 @@ NUKED_LOCAL void MesaClear(mesa3d_ctx_t *ctx, DWORD flags, D3DCOLOR color, D3DVA
 		entry->proc.pglClearStencil(stencil);
 	}
 
-	if(rects_cnt == 0 || IsFullSurface(ctx, &rects[0])) // full surface
+	if(rects_cnt <= 0) // full surface, driver can use fast clear
 	{
 		TOPIC("DEPTHCONV", "full clear");
 		entry->proc.pglClear(mask);
@@ -4918,6 +5222,9 @@ NUKED_LOCAL void MesaClear(mesa3d_ctx_t *ctx, DWORD flags, D3DCOLOR color, D3DVA
 	}
 	else
 	{
+		BOOL scissor = FALSE;
+		int done;
+
 		TOPIC("CLEAR", "partly clean");
 #if 0
 		if(flags & D3DCLEAR_TARGET)
@@ -4936,15 +5243,46 @@ NUKED_LOCAL void MesaClear(mesa3d_ctx_t *ctx, DWORD flags, D3DCOLOR color, D3DVA
 		}
 #endif
 		TOPIC("DEPTHCONV", "Clear %X => %X, %f, %X", flags, color, depth, stencil);
-		for(i = 0; i < rects_cnt; i++)
+
+		/* too many rects are flushed in batches, not merged to bounding box
+		   which would clear pixels outside them */
+		for(done = 0; done < rects_cnt; done += CLEAR_RECTS_MAX)
+		{
+			int batch = NOCRT_MIN(rects_cnt - done, CLEAR_RECTS_MAX);
+			clear_cnt = MesaClearRects(ctx, batch, rects + done, clear_rects);
+
+			if(clear_cnt < 0)
+			{
+				TOPIC("DEPTHCONV", "full clear");
+				if(scissor)
+				{
+					entry->proc.pglDisable(GL_SCISSOR_TEST);
+					scissor = FALSE;
+				}
+				entry->proc.pglClear(mask);
+				break;
+			}
+
+			TOPIC("CLEAR", "rects %d => %d", batch, clear_cnt);
+			if(clear_cnt > 0 && !scissor)
+			{
+				entry->proc.pglEnable(GL_SCISSOR_TEST);
+				scissor = TRUE;
+			}
+
+			for(i = 0; i < clear_cnt; i++)
+			{
+				entry->proc.pglScissor(
+					clear_rects[i].left, clear_rects[i].top,
+					clear_rects[i].right - clear_rects[i].left,
+					clear_rects[i].bottom - clear_rects[i].top);
+
+				entry->proc.pglClear(mask);
+			}
+		}
+
+		if(scissor)
 		{
-			entry->proc.pglEnable(GL_SCISSOR_TEST);
-			entry->proc.pglScissor(
-				rects[i].left, rects[i].top,
-				rects[i].right - rects[i].left,
-				rects[i].bottom - rects[i].top);
-	
-			entry->proc.pglClear(mask);
 			entry->proc.pglDisable(GL_SCISSOR_TEST);
 		}
 	}
@@ -4985,14 +5323,25 @@ NUKED_LOCAL void MesaBlockLock(mesa3d_ctx_t *ctx)
 {
 #ifdef OPENGL_BLOCK_LOCK
 	LONG tmp;
+	uint64_t wait_start = 0;
 	do
 	{
 		tmp = InterlockedExchange(&ctx->thread_lock, 1);
 		if(tmp == 1)
 		{
+			if(wait_start == 0)
+			{
+				wait_start = GetTimeTMS();
+				PERF_ADD(lock_stalls, 1);
+			}
 			Sleep(10);
 		}
 	} while(tmp == 1);
+
+	if(wait_start != 0)
+	{
+		PERF_ADD(lock_time, GetTimeTMS() - wait_start);
+	}
 #endif
 }
 
@@ -5021,16 +5370,28 @@ NUKED_LOCAL void MesaSceneEnd(mesa3d_ctx_t *ctx)
 	void *ptr = SurfaceGetVidMem(ctx->backbuffer, MesaOldFlip(ctx));
 	if(ptr)
 	{
+		FlipWaitSurface(ptr);
+
 		if(is_visible) /* fixme: check for DDSCAPS_PRIMARYSURFACE */
 			FBHDA_access_begin(0);
 
+		BOOL tex_gpu = FALSE;
+		if(ctx->state.textarget && ctx->render.dirty && !MESA_TRACE_ON(ctx->entry))
+		{
+			/* render to texture: copy FBO to GL texture, surface memory is updated on lock or blit */
+			tex_gpu = SurfaceTexFromFBO(ctx->backbuffer, ctx);
+		}
+
 		TOPIC("TARGET", "MesaBufferDownloadColor(ctx, 0x%X)", ptr);
-		if(ctx->render.dirty)
+		if(ctx->render.dirty && !tex_gpu)
 		{
 			MesaBufferDownloadColor(ctx, ptr);
 		}
+
+		if(MESA_TRACE_ON(ctx->entry))
+			MesaTraceFrame(ctx, ptr);
 		
-		if(ctx->state.textarget)
+		if(ctx->state.textarget && !tex_gpu)
 		{
 			TOPIC("TEXTARGET", "Render to texture");
 			SurfaceToMesaTex(ctx->backbuffer);
@@ -5042,6 +5403,12 @@ NUKED_LOCAL void MesaSceneEnd(mesa3d_ctx_t *ctx)
 			FBHDA_access_end(0);
 	}
 
+	MesaTempFrame(ctx);
+	MesaTexCacheFrame(ctx);
+
+	TOPIC("LIGHT", "glLight calls in frame: %u", ctx->light.calls);
+	ctx->light.calls = 0;
+
 	//ctx->entry->proc.pglFinish();
 
 #ifdef DEBUG
@@ -5175,61 +5542,138 @@ NUKED_LOCAL mesa3d_texture_t *MesaTextureFromSurfaceHandle(mesa3d_ctx_t *ctx, DW
 	return NULL;
 }
 
+/*
+ * Scratch memory for conversions. There are several slots, so the nested
+ * or concurrent requests (chroma conversion during flip) don't need heap.
+ * Slot is grown to power of two size and kept, so in steady state there is
+ * no heap allocation. Slots unused for MESA_TEMP_IDLE_FRAMES are released
+ * by MesaTempFrame.
+ */
 NUKED_LOCAL void *MesaTempAlloc(mesa3d_ctx_t *ctx, DWORD w, DWORD size)
 {
-	if(ctx->temp.width == 0)
+	int i;
+	int best = -1;
+	int grow = -1;
+
+	ctx->temp.allocs++;
+
+	for(i = 0; i < MESA_TEMP_SLOTS; i++)
 	{
-		DWORD cmp_w = w;
-		DWORD dst_w = 0;
-		DWORD i;
-		
-		FBHDA_t *hda = FBHDA_setup();
-		if(hda)
+		if(ctx->temp.slot[i].lock != 0)
+			continue;
+
+		if(ctx->temp.slot[i].size >= size)
 		{
-			if(hda->width > cmp_w)
-			{
-				cmp_w = hda->width;
-			}
+			/* smallest which fits */
+			if(best < 0 || ctx->temp.slot[i].size < ctx->temp.slot[best].size)
+				best = i;
 		}
-		
-		for(i = 0; i < sizeof(DWORD)*8; i++)
+		else
 		{
-			dst_w = 1 << i;
-			if(dst_w >= cmp_w)
-			{
-				break;
-			}
+			/* empty or largest, which is too small */
+			if(grow < 0 || ctx->temp.slot[i].size > ctx->temp.slot[grow].size)
+				grow = i;
 		}
-		
-		ctx->temp.width = dst_w;
-		ctx->temp.size = dst_w*dst_w*4;
-		ctx->temp.buf = hal_alloc(HEAP_LARGE, ctx->temp.size, dst_w);
 	}
 
-	if(ctx->temp.buf == NULL ||
-		w > ctx->temp.width ||
-		size > ctx->temp.size ||
-		ctx->temp.lock != 0
-		)
+	if(best >= 0)
 	{
-		return hal_alloc(HEAP_LARGE, size, w);
+		if(InterlockedExchange(&ctx->temp.slot[best].lock, 1) == 0)
+		{
+			ctx->temp.slot[best].last_frame = ctx->temp.frame;
+			return ctx->temp.slot[best].buf;
+		}
 	}
-	
-	ctx->temp.lock = 1;
-	return ctx->temp.buf;
+	else if(grow >= 0)
+	{
+		if(InterlockedExchange(&ctx->temp.slot[grow].lock, 1) == 0)
+		{
+			DWORD new_size = MESA_TEMP_MIN_SIZE;
+			while(new_size < size)
+			{
+				new_size <<= 1;
+			}
+
+			if(ctx->temp.slot[grow].buf)
+			{
+				hal_free(HEAP_LARGE, ctx->temp.slot[grow].buf);
+			}
+
+			ctx->temp.slot[grow].buf = hal_alloc(HEAP_LARGE, new_size, w);
+			if(ctx->temp.slot[grow].buf)
+			{
+				TOPIC("GC", "temp slot %d: %u -> %u", grow, ctx->temp.slot[grow].size, new_size);
+				ctx->temp.slot[grow].size = new_size;
+				ctx->temp.slot[grow].last_frame = ctx->temp.frame;
+				ctx->temp.grows++;
+				return ctx->temp.slot[grow].buf;
+			}
+
+			ctx->temp.slot[grow].size = 0;
+			InterlockedExchange(&ctx->temp.slot[grow].lock, 0);
+		}
+	}
+
+	/* all slots busy */
+	ctx->temp.fallbacks++;
+	return hal_alloc(HEAP_LARGE, size, w);
 }
 
 NUKED_LOCAL void MesaTempFree(mesa3d_ctx_t *ctx, void *ptr)
 {
+	int i;
+
 	if(ptr != NULL)
 	{
-		if(ptr == ctx->temp.buf)
+		for(i = 0; i < MESA_TEMP_SLOTS; i++)
 		{
-			ctx->temp.lock = 0;
+			if(ptr == ctx->temp.slot[i].buf)
+			{
+				InterlockedExchange(&ctx->temp.slot[i].lock, 0);
+				return;
+			}
 		}
-		else
+
+		hal_free(HEAP_LARGE, ptr);
+	}
+}
+
+/* call at end of frame, release slots which aren't needed anymore */
+NUKED_LOCAL void MesaTempFrame(mesa3d_ctx_t *ctx)
+{
+	int i;
+
+	ctx->temp.frame++;
+
+	/* first slot is kept all time */
+	for(i = 1; i < MESA_TEMP_SLOTS; i++)
+	{
+		if(ctx->temp.slot[i].buf != NULL &&
+			ctx->temp.frame - ctx->temp.slot[i].last_frame > MESA_TEMP_IDLE_FRAMES)
 		{
-			hal_free(HEAP_LARGE, ptr);
+			if(InterlockedExchange(&ctx->temp.slot[i].lock, 1) == 0)
+			{
+				TOPIC("GC", "temp slot %d: release %u", i, ctx->temp.slot[i].size);
+				hal_free(HEAP_LARGE, ctx->temp.slot[i].buf);
+				ctx->temp.slot[i].buf = NULL;
+				ctx->temp.slot[i].size = 0;
+				InterlockedExchange(&ctx->temp.slot[i].lock, 0);
+			}
+		}
+	}
+}
+
+NUKED_LOCAL void MesaTempRelease(mesa3d_ctx_t *ctx)
+{
+	int i;
+
+	for(i = 0; i < MESA_TEMP_SLOTS; i++)
+	{
+		if(ctx->temp.slot[i].buf)
+		{
+			hal_free(HEAP_LARGE, ctx->temp.slot[i].buf);
+			ctx->temp.slot[i].buf = NULL;
+			ctx->temp.slot[i].size = 0;
 		}
 	}
 }
@@ -5395,6 +5839,29 @@ NUKED_LOCAL void MesaMemInfo(mesa3d_entry_t *entry)
 		ms.dwMemoryLoad, ms.dwTotalPhys, ms.dwAvailPhys, ms.dwTotalPageFile, ms.dwAvailPageFile, ms.dwTotalVirtual, ms.dwAvailVirtual
 	);
 
+	TOPIC("GC", "FBO pool created=%u reused=%u evicted=%u bytes=%u",
+		entry->fbo_stats.created, entry->fbo_stats.reused, entry->fbo_stats.evicted, entry->fbo_stats.bytes
+	);
+
+	TOPIC("GC", "Texture cache items=%u (packed %u) bytes=%u/%u packed=%u lookups=%u hits=%u (%u%%) saved=%u evicted=%u",
+		entry->texcache.items, entry->texcache.packed_items, entry->texcache.bytes, entry->texcache.budget,
+		entry->texcache.packed_bytes, entry->texcache.lookups, entry->texcache.hits,
+		entry->texcache.lookups ? (entry->texcache.hits * 100) / entry->texcache.lookups : 0,
+		entry->texcache.saved, entry->texcache.evicted
+	);
+
+	int i;
+	for(i = 0; i < MESA3D_MAX_CTXS; i++)
+	{
+		mesa3d_ctx_t *ctx = entry->ctx[i];
+		if(ctx)
+		{
+			TOPIC("GC", "ctx %d temp allocs=%u grows=%u heap fallbacks=%u",
+				i, ctx->temp.allocs, ctx->temp.grows, ctx->temp.fallbacks
+			);
+		}
+	}
+
 # ifdef DEBUG_MEMORY
 	hal_alloc_info();
 # endif
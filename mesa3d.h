@@ -14,6 +14,9 @@ struct mesa3d_texture;
 struct mesa3d_ctx;
 struct mesa3d_entry;
 
+/* specialized vertex emitter (MesaVertexEmitSelect) */
+typedef void (*mesa_vertex_emit_t)(struct mesa3d_entry *entry, struct mesa3d_ctx *ctx, const BYTE *v);
+
 typedef OSMESAproc (APIENTRYP OSMesaGetProcAddress_h)(const char *funcName);
 
 typedef struct _D3DHAL_DP2RENDERSTATE D3DHAL_DP2RENDERSTATE, *LPD3DHAL_DP2RENDERSTATE;
@@ -22,11 +25,13 @@ typedef struct _D3DHAL_DP2RENDERSTATE D3DHAL_DP2RENDERSTATE, *LPD3DHAL_DP2RENDER
 	typedef _t (APIENTRYP _n ## _h)_p;
 #define MESA_API_OS  MESA_API
 #define MESA_API_DRV MESA_API
+#define MESA_API_EXT MESA_API
 
 #include "mesa3d_api.h"
 #undef MESA_API
 #undef MESA_API_OS
 #undef MESA_API_DRV
+#undef MESA_API_EXT
 
 #define MESA3D_MAX_TEXS MAX_SURFACES
 #define MESA3D_MAX_CTXS 128
@@ -47,6 +52,9 @@ typedef struct _D3DHAL_DP2RENDERSTATE D3DHAL_DP2RENDERSTATE, *LPD3DHAL_DP2RENDER
 #define MESA_MAT_EMISSIVE_C2 0x40
 #define MESA_MAT_SPECULAR_C2 0x80
 
+#define MESA_MAT_C1 0x0F
+#define MESA_MAT_C2 0xF0
+
 #define MESA_POSITIVEX 0
 #define MESA_NEGATIVEX 1
 #define MESA_POSITIVEY 2
@@ -64,7 +72,63 @@ typedef struct _D3DHAL_DP2RENDERSTATE D3DHAL_DP2RENDERSTATE, *LPD3DHAL_DP2RENDER
 
 #define DX_STORED_MATICES 256
 
-#define FBO_COUNT 4
+/* render target pool (per context, FBOs aren't shared between GL contexts) */
+#define FBO_COUNT 16
+#define FBO_BUDGET (64*1024*1024)
+
+/* scratch buffers for conversions (MesaTempAlloc) */
+#define MESA_TEMP_SLOTS 4
+#define MESA_TEMP_MIN_SIZE (64*1024)
+#define MESA_TEMP_IDLE_FRAMES 600
+
+/* DP2 worker thread queue (MesaDP2*) */
+#define MESA_DP2Q_MAX 16
+
+typedef struct mesa_dp2_item
+{
+	BYTE *cmd; /* copy of command buffer */
+	DWORD cmd_size; /* allocated */
+	DWORD cmd_len;
+	BYTE *vertices_mem; /* copy of user memory vertices */
+	DWORD vertices_size; /* allocated */
+	LPBYTE vertices;
+	LPBYTE UMVertices;
+	DWORD fvf;
+	DWORD vertices_cnt;
+} mesa_dp2_item_t;
+
+/* cache of CPU converted textures (MesaTexCache*) */
+#define MESA_TEXCACHE_HT_MOD 256
+#define MESA_TEXCACHE_COLD_FRAMES 300
+
+#define MESA_TEXCACHE_CHROMA  1
+#define MESA_TEXCACHE_DXT     2
+#define MESA_TEXCACHE_PALETTE 3
+
+typedef struct mesa_texcache_key
+{
+	DWORD hash[2]; /* source level */
+	DWORD src_size;
+	DWORD kind; /* MESA_TEXCACHE_* */
+	DWORD format;
+	DWORD w;
+	DWORD h;
+	DWORD param[3]; /* color key, palette... */
+} mesa_texcache_key_t;
+
+typedef struct mesa_texcache_item
+{
+	struct mesa_texcache_item *ht_next;
+	struct mesa_texcache_item *lru_prev;
+	struct mesa_texcache_item *lru_next;
+	mesa_texcache_key_t key;
+	DWORD size; /* converted data size */
+	DWORD stored; /* size of data (packed or not) */
+	BOOL packed;
+	BOOL incompressible;
+	DWORD last_frame;
+	BYTE *data;
+} mesa_texcache_item_t;
 
 typedef struct mesa3d_texture
 {
@@ -77,6 +141,7 @@ typedef struct mesa3d_texture
 	GLenum  format;
 	GLenum  type;
 	BOOL    data_dirty[MESA3D_CUBE_SIDES][MESA3D_MAX_MIPS];
+	BOOL    gpu_dirty[MESA3D_CUBE_SIDES][MESA3D_MAX_MIPS]; /* rendered to GL texture, surface memory is old */
 	surface_id data_sid[MESA3D_CUBE_SIDES][MESA3D_MAX_MIPS];
 	BOOL dirty;
 	struct mesa3d_ctx *ctx;
@@ -88,6 +153,7 @@ typedef struct mesa3d_texture
 	BOOL compressed;
 	BOOL palette;
 	BOOL alwaysdirty;
+	BOOL autogen; /* sub-levels are generated on GPU from level 0 (DDSCAPS3_AUTOGENMIPMAP) */
 	BOOL tmu[MESA_TMU_MAX];
 } mesa3d_texture_t;
 
@@ -109,8 +175,16 @@ typedef struct mesa3d_light
 	GLfloat theta;
 	GLfloat phi;
 	GLfloat exponent;
+	DWORD dirty; // MESA_LIGHT_DIRTY_*
 } mesa3d_light_t;
 
+#define MESA_LIGHT_DIRTY_DATA  1 /* colors, attenuation, spot cone */
+#define MESA_LIGHT_DIRTY_SPACE 2 /* position and direction (modelview dependent) */
+#define MESA_LIGHT_DIRTY_ALL   (MESA_LIGHT_DIRTY_DATA | MESA_LIGHT_DIRTY_SPACE)
+
+/* GL light slots, limited by active_bitfield size */
+#define MESA_LIGHT_SLOTS 32
+
 struct mesa3d_tmustate
 {
 	BOOL active;
@@ -159,6 +233,8 @@ struct mesa3d_tmustate
 	BOOL projected;
 	GLfloat matrix[16];
 	BOOL matrix_idx;
+	GLfloat bumpenv[4]; /* D3DTSS_BUMPENVMAT00, 01, 10, 11 */
+	GLfloat bumplum[2]; /* D3DTSS_BUMPENVLSCALE, D3DTSS_BUMPENVLOFFSET */
 	
 	DWORD wrap;
 	
@@ -185,6 +261,10 @@ typedef struct mesa_fbo
 	GLuint width;
 	GLuint height;
 	GLuint bpp;
+	BOOL zfloat;
+	/* pool */
+	DWORD lru;
+	DWORD bytes;
 	/* main plain */
 	GLuint plane_fb;
 	GLuint plane_color_tex;
@@ -197,11 +277,24 @@ typedef struct mesa_fbo
 
 #define MESA_MAX_STREAM 16
 
+/* GL buffer object mirror of vertex buffer surface */
+typedef struct mesa_vbo
+{
+	struct mesa_vbo *next;
+	struct mesa3d_ctx *ctx;
+	surface_id sid;
+	GLuint buf;
+	DWORD size;
+	DWORD dirty_start; /* locked range in bytes, start >= end = nothing to upload */
+	DWORD dirty_end;
+} mesa_vbo_t;
+
 typedef struct mesa_vertex_stream
 {
 	DWORD VBHandle; /* DX surface ID */
 //	surface_id sid;
 	DWORD stride;
+	mesa_vbo_t *vbo; /* GL mirror, NULL = draw from memory */
 	union
 	{
 		BYTE *ptr;
@@ -218,7 +311,17 @@ typedef struct mesa_rec_tmu
 
 #define MESA_REC_MAX_STATE 255
 #define MESA_REC_MAX_TMU_STATE 32
-#define MESA_RECS_MAX 32
+#define MESA_RECS_HT_MOD 64
+
+/* compiled state block entry */
+typedef struct mesa_rec_op
+{
+	WORD tmu; /* MESA_REC_OP_RS for render state */
+	WORD state;
+	DWORD value;
+} mesa_rec_op_t;
+
+#define MESA_REC_OP_RS 0xFFFF
 
 #define MESA_REC_MAX_MATICES D3DTRANSFORMSTATE_TEXTURE7
 
@@ -226,9 +329,19 @@ typedef struct mesa_rec_tmu
 #define MESA_REC_EXTRA_MATERIAL 1
 #define MESA_REC_EXTRA_VERTEXSHADER 2
 #define MESA_REC_EXTRA_LIGHTS 3
+#define MESA_REC_EXTRA_VSCONST 4
+#define MESA_REC_EXTRA_PIXELSHADER 5
+#define MESA_REC_EXTRA_PSCONST 6
 
 #define MESA_REC_MAX_LIGHTS 32
 
+/* vs_1_1 limits */
+#define MESA_VS_INPUTS 16
+#define MESA_VS_MAX_CONST 96
+
+/* ps_1_x limits */
+#define MESA_PS_MAX_CONST 8
+
 typedef struct mesa_rec_state
 {
 	DWORD handle;
@@ -242,8 +355,19 @@ typedef struct mesa_rec_state
 	D3DHAL_DP2VIEWPORTINFO viewport;
 	D3DHAL_DP2SETMATERIAL material;
 	DWORD vertexshader;
+	DWORD vs_constset[MESA_VS_MAX_CONST/32];
+	GLfloat vs_const[MESA_VS_MAX_CONST][4];
+	DWORD pixelshader;
+	DWORD ps_constset[1];
+	GLfloat ps_const[MESA_PS_MAX_CONST][4];
 	mesa3d_light_t lights[MESA_REC_MAX_LIGHTS];
 	// TODO: missing: clips
+	/* render and texture states packed by MesaRecCompile */
+	mesa_rec_op_t *ops;
+	DWORD ops_cnt;
+	DWORD ops_size;
+	BOOL compiled;
+	struct mesa_rec_state *next; /* ctx->records chain */
 } mesa_rec_state_t;
 
 #define SURFACE_TABLES_PER_ENTRY 8 /* in theory there should by only 1 */
@@ -256,6 +380,20 @@ typedef struct mesa_pal8
 	struct mesa_pal8 *next;
 } mesa_pal8_t;
 
+/* translated shader program, shared by all shaders with same code */
+typedef struct mesa_dx_prog
+{
+	DWORD hash;
+	DWORD code_size;
+	GLenum target;
+	DWORD variant; /* PSARB_VARIANT_*, 0 for vertex programs */
+	GLuint prog; /* 0 = translation failed */
+	BYTE *code;
+	struct mesa_dx_prog *next;
+} mesa_dx_prog_t;
+
+#define MESA_PROG_HT_MOD 64
+
 typedef struct mesa_dx_shader
 {
 	DWORD handle;
@@ -263,6 +401,8 @@ typedef struct mesa_dx_shader
 	DWORD code_size;
 	BYTE *decl;
 	BYTE *code;
+	mesa_dx_prog_t *prog;
+	DWORD variant; /* variant of 'prog' (pixel shaders) */
 	struct mesa_dx_shader *next;
 } mesa_dx_shader_t;
 
@@ -297,6 +437,26 @@ typedef struct mesa3d_ctx
 	HWND fbo_win;
 	
 	DWORD thread_id;
+
+	/* DP2 worker thread (mesa3d_dp2q.c) */
+	struct {
+		HANDLE thread;
+		DWORD thread_id;
+		HANDLE work;
+		HANDLE space; /* auto-reset, item removed from queue */
+		HANDLE idle; /* manual-reset, sync_done changed */
+		LONG head;
+		LONG tail;
+		LONG sync_req; /* sync generation requested by MesaDP2Sync */
+		LONG sync_done; /* sync generation published by worker */
+		LONG sync_lock;
+		LONG error; /* first failure of queued call (MesaDP2Error) */
+		BOOL quit;
+		BOOL disabled; /* thread cannot be used, process calls synchronously */
+		DWORD depth;
+		mesa_dp2_item_t items[MESA_DP2Q_MAX];
+	} dp2q;
+
 	GLint front_bpp;
 	GLint depth_bpp;
 	//DDRAWI_DDRAWSURFACE_LCL flips[MESA3D_MAX_FLIPS];
@@ -333,6 +493,7 @@ typedef struct mesa3d_ctx
 		DWORD stipple[32];
 		GLfloat tfactor[4]; // TEXTUREFACTOR eq. GL_CONSTANT
 		BOOL texperspective;
+		BOOL flatshade; /* GL_FLAT, D3D takes color from first vertex, GL from last */
 		BOOL textarget;
 		struct {
 			BOOL     enabled;
@@ -380,9 +541,26 @@ typedef struct mesa3d_ctx
 				GLfloat *texcoords[MESA_TMU_MAX];
 				DWORD    texcoords_stride32[MESA_TMU_MAX];
 			} ptr;
+			struct {
+				mesa_vertex_data_t type;
+				DWORD *ptr;
+				DWORD  stride32;
+			} attrib[MESA_VS_INPUTS]; /* vertex shader inputs */
+			DWORD attrib_mask;
+			GLuint program; /* bound ARB vertex program, 0 = fixed function */
+			BOOL blend_gpu; /* program is blend program, betas goes to attrib 1 */
 			int betas;
 			/* opts latches */
 			BOOL fast_draw;
+			mesa_vertex_emit_t emit; /* NULL = generic MesaVertexStream/MesaVertexBuffer */
+			mesa_vertex_emit_t emit_attr; /* emit without position */
+			GLfloat emit_diffuse[4];
+			struct {
+				const BYTE *ptr; /* vertex 0 of buffer, NULL = not active */
+				DWORD first;
+				DWORD cnt;
+				GLfloat *pos; /* 4 floats per vertex */
+			} unproj; /* MesaVertexUnprojectBegin */
 		} vertex;
 		struct {
 			BOOL enabled;
@@ -410,8 +588,12 @@ typedef struct mesa3d_ctx
 			GLfloat specular[4];
 			GLfloat emissive[4];
 			GLfloat shininess;
-			DWORD untracked;
+			DWORD untracked; /* vertex color to glMaterial in LoadColor1/LoadColor2 */
 			BOOL lighting;
+			GLenum color_mode; /* vertex color 1 tracked by GL_COLOR_MATERIAL, GL_NONE = no tracking */
+			GLenum color_mode_gl; /* applied by MesaColorMaterialUpdate */
+			DWORD last_color[2]; /* last glMaterial from LoadColor1/LoadColor2 */
+			BOOL last_valid[2];
 		} material;
 		struct {
 			BOOL enabled;
@@ -431,14 +613,29 @@ typedef struct mesa3d_ctx
 	} state;
 	struct {
 		mesa_dx_shader_t *vs;
+		mesa_dx_prog_t *progs[MESA_PROG_HT_MOD];
+		GLfloat vs_const[MESA_VS_MAX_CONST][4]; /* c0-c95 */
+		DWORD vs_const_dirty_from;
+		DWORD vs_const_dirty_to; /* 0 = nothing to upload */
+		GLuint blend_prog;
+		BOOL blend_failed;
+		mesa_dx_shader_t *ps;
+		GLuint ps_program; /* bound fragment program, 0 = fixed function */
+		GLfloat ps_const[MESA_PS_MAX_CONST][4]; /* c0-c7 */
+		BOOL ps_const_dirty;
+		BOOL ps_bump_dirty;
 	} shader;
-	mesa_rec_state_t *records[MESA_RECS_MAX];
+	mesa_rec_state_t *records[MESA_RECS_HT_MOD];
 	mesa_vertex_stream_t vstream[MESA_MAX_STREAM];
+	mesa_vbo_t *vbo_first;
 
 	/* fbo */
 	mesa_fbo_t *fbo;
 	mesa_fbo_t fbo_swap[FBO_COUNT];
+	DWORD fbo_lru;
+	DWORD fbo_bytes;
 	int fbo_tmu; /* can be higher than tmu_count, if using extra TMU for FBO operations */
+	GLuint tex_fb; /* render to texture copies, see MesaBufferCopyTexture */
 
 	/* rendering state */
 	struct {
@@ -446,6 +643,9 @@ typedef struct mesa3d_ctx
 		BOOL zdirty;
 		DWORD planemask;
 		DWORD rop2;
+		GLenum batch;     /* open list primitive (GL_NOOP = none), see MesaDraw6 */
+		DWORD batch_fvf;
+		DWORD batch_merged;
 	} render;
 
 	/* dimensions */
@@ -464,6 +664,11 @@ typedef struct mesa3d_ctx
 		BOOL identity_mode;
 		DWORD outdated_stack; // MesaApplyTransform -> changes
 		int weight;
+		/* vertex blending */
+		GLfloat blend[16]; /* combined world matrix for blend_w */
+		GLfloat blend_w[MESA_WORLDS_MAX];
+		BOOL blend_valid;
+		BOOL blend_upload; /* world matrices changed, need upload to blend program */
 //		GLfloat stored[DX_STORED_MATICES][16];
 	} matrix;
 
@@ -471,15 +676,24 @@ typedef struct mesa3d_ctx
 		DWORD lights_size;
 		DWORD active_bitfield;
 		mesa3d_light_t **lights;
+		DWORD slot_id[MESA_LIGHT_SLOTS]; /* id+1 of light which data are in GL slot */
+		DWORD calls; /* glLight* calls in current frame */
 	} light;
 
 	mesa_surfaces_table_t *surfaces;
 
 	struct {
-		DWORD width;
-		DWORD size;
-		void *buf;
-		DWORD lock;
+		struct {
+			void *buf;
+			DWORD size;
+			LONG lock;
+			DWORD last_frame;
+		} slot[MESA_TEMP_SLOTS];
+		DWORD frame;
+		/* statistics */
+		DWORD allocs;
+		DWORD grows;
+		DWORD fallbacks;
 	} temp;
 	
 	mesa_pal8_t *first_pal;
@@ -506,6 +720,7 @@ typedef struct _mesa3d_vertex_t
 #define MESA_API(_n, _t, _p) _n ## _h p ## _n;
 #define MESA_API_OS MESA_API
 #define MESA_API_DRV MESA_API
+#define MESA_API_EXT MESA_API
 typedef struct mesa3d_entry
 {
 	DWORD pid;
@@ -515,6 +730,7 @@ typedef struct mesa3d_entry
 	BOOL runtime_ver; // 3, 5, 6, 7
 	int gl_major;
 	int gl_minor;
+	BOOL autogenmipmap; /* glGenerateMipmap is available (resolved once when library is loaded) */
 	VMHAL_enviroment_t env;
 	mesa3d_ctx_t *ctx[MESA3D_MAX_CTXS];
 	mesa_surfaces_table_t surfaces_tables[SURFACE_TABLES_PER_ENTRY];
@@ -523,10 +739,47 @@ typedef struct mesa3d_entry
 #include "mesa3d_api.h"
 	} proc;
 	DWORD D3DParseUnknownCommand;
+	struct {
+		HANDLE file; /* NULL = not tracing */
+		uint64_t start;
+		DWORD frame;
+		DWORD frame_cpu;
+		DWORD frame_calls;
+		DWORD last_cpu;
+		DWORD perf_commands;
+		DWORD perf_draws;
+		DWORD buf_handle[MESA_MAX_STREAM];
+		DWORD buf_hash[MESA_MAX_STREAM];
+	} trace;
+	struct {
+		DWORD created;
+		DWORD reused;
+		DWORD evicted;
+		DWORD bytes; /* held by all contexts */
+	} fbo_stats;
+	struct {
+		LONG lock;
+		mesa_texcache_item_t *ht[MESA_TEXCACHE_HT_MOD];
+		mesa_texcache_item_t *lru_first; /* most recently used */
+		mesa_texcache_item_t *lru_last;
+		DWORD *lz_table;
+		DWORD budget;
+		DWORD bytes;
+		DWORD frame;
+		/* statistics */
+		DWORD items;
+		DWORD packed_items;
+		DWORD packed_bytes;
+		DWORD lookups;
+		DWORD hits;
+		DWORD saved; /* converted bytes served from cache */
+		DWORD evicted;
+	} texcache;
 } mesa3d_entry_t;
 #undef MESA_API
 #undef MESA_API_OS
 #undef MESA_API_DRV
+#undef MESA_API_EXT
 
 NUKED_LOCAL mesa3d_entry_t *Mesa3DGet(DWORD pid, BOOL create);
 NUKED_LOCAL void Mesa3DFree(DWORD pid, BOOL unload);
@@ -537,6 +790,7 @@ NUKED_LOCAL void Mesa3DFree(DWORD pid, BOOL unload);
 		mesa3d_entry_t *entry = ctx->entry; \
 		OSMesaContext oldos = NULL; \
 		HGLRC oldgrc = NULL; \
+		MesaDP2Sync(ctx); \
 		MesaBlockLock(ctx); \
 		do { \
 			if(ctx->thread_id != GetCurrentThreadId()){ \
@@ -599,6 +853,7 @@ NUKED_LOCAL void MesaDestroyAllCtx(mesa3d_entry_t *entry);
 NUKED_LOCAL void MesaInitCtx(mesa3d_ctx_t *ctx);
 NUKED_LOCAL void MesaLightCreate(mesa3d_ctx_t *ctx, DWORD id);
 NUKED_LOCAL void MesaLightApply(mesa3d_ctx_t *ctx, DWORD id);
+NUKED_LOCAL void MesaLightUpdate(mesa3d_ctx_t *ctx, DWORD id, DWORD dirty);
 NUKED_LOCAL void MesaLightDestroyAll(mesa3d_ctx_t *ctx);
 
 NUKED_LOCAL void MesaBlockLock(mesa3d_ctx_t *ctx);
@@ -632,6 +887,7 @@ NUKED_LOCAL void MesaSetTextureState(mesa3d_ctx_t *ctx, int tmu, DWORD state, vo
 NUKED_LOCAL void MesaDrawRefreshState(mesa3d_ctx_t *ctx);
 NUKED_LOCAL void MesaDraw3(mesa3d_ctx_t *ctx, DWORD op, void *prim, LPBYTE vertices);
 NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx, LPBYTE cmdBufferStart, LPBYTE cmdBufferEnd, LPBYTE vertices, LPBYTE UMVertices, DWORD fvf, DWORD *error_offset, LPDWORD RStates, DWORD vertices_size);
+NUKED_LOCAL BOOL MesaDraw6Queueable(LPBYTE cmdBufferStart, LPBYTE cmdBufferEnd);
 
 NUKED_LOCAL void MesaClear(mesa3d_ctx_t *ctx, DWORD flags, D3DCOLOR color, D3DVALUE depth, DWORD stencil, int rects_cnt, RECT *rects);
 
@@ -646,6 +902,15 @@ NUKED_LOCAL void MesaBufferUploadTexture(mesa3d_ctx_t *ctx, mesa3d_texture_t *te
 NUKED_LOCAL void MesaBufferUploadTextureChroma(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex, int level, int side, int tmu, DWORD chroma_lw, DWORD chroma_hi);
 NUKED_LOCAL void MesaBufferUploadTexturePalette(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex, int level, int side, int tmu, BOOL chroma_key, DWORD chroma_lw, DWORD chroma_hi);
 NUKED_LOCAL BOOL MesaBufferFBOSetup(mesa3d_ctx_t *ctx, int width, int height, int bpp);
+NUKED_LOCAL BOOL MesaBufferCanCopyTexture(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex, int level, int side);
+NUKED_LOCAL void MesaBufferCopyTexture(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex, int level, int side);
+NUKED_LOCAL void MesaBufferDownloadTexture(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex, int level, int side);
+NUKED_LOCAL BOOL MesaBufferCanGenTextureMips(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex);
+NUKED_LOCAL void MesaBufferGenTextureMips(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex, int tmu);
+NUKED_LOCAL mesa_vbo_t *MesaVBOGet(mesa3d_ctx_t *ctx, surface_id sid);
+NUKED_LOCAL void MesaVBOUpdate(mesa3d_ctx_t *ctx, mesa_vbo_t *vbo);
+NUKED_LOCAL void MesaVBODestroy(mesa_vbo_t *vbo, BOOL ctx_cleanup, surface_id surface_delete);
+NUKED_LOCAL void MesaVBODestroyAll(mesa3d_ctx_t *ctx);
 
 /* calculation */
 /*NUKED_LOCAL BOOL MesaUnprojectf(GLfloat winx, GLfloat winy, GLfloat winz, GLfloat clipw,
@@ -662,6 +927,8 @@ NUKED_LOCAL void MesaSpaceModelviewReset(mesa3d_ctx_t *ctx);
 //void MesaConvProjection(GLfloat m[16]);
 //void MesaConvView(GLfloat m[16]);
 NUKED_LOCAL void MesaVetexBlend(mesa3d_ctx_t *ctx, GLfloat coords[3], GLfloat *betas, int betas_cnt, GLfloat out[4]);
+NUKED_LOCAL void MesaVetexBlendNormal(mesa3d_ctx_t *ctx, GLfloat normal[3], GLfloat *betas, int betas_cnt, GLfloat out[4]);
+NUKED_LOCAL void MesaVetexBlendWeights(mesa3d_ctx_t *ctx, GLfloat *betas, int betas_cnt, GLfloat out[MESA_WORLDS_MAX]);
 NUKED_FAST void MesaTMUApplyMatrix(mesa3d_ctx_t *ctx, int tmu);
 
 /* vertex (needs GL_BLOCK + glBegin) */
@@ -671,6 +938,7 @@ NUKED_LOCAL void MesaDrawTLVertex(mesa3d_ctx_t *ctx, LPD3DTLVERTEX vertex);
 
 /* DX6+ */
 NUKED_LOCAL void MesaFVFSet(mesa3d_ctx_t *ctx, DWORD type/*, DWORD size*/);
+NUKED_LOCAL DWORD MesaFVFSize(DWORD fvf);
 NUKED_LOCAL void MesaFVFRecalc(mesa3d_ctx_t *ctx);
 NUKED_LOCAL void MesaFVFRecalcCoords(mesa3d_ctx_t *ctx);
 
@@ -689,11 +957,14 @@ NUKED_FAST void *MesaSurfacesGetBuffer(mesa3d_ctx_t *ctx, DWORD dwSurfacehandle)
 NUKED_LOCAL BOOL SurfaceExInsert(mesa3d_entry_t *entry, LPDDRAWI_DIRECTDRAW_LCL lpDDLcl, LPDDRAWI_DDRAWSURFACE_LCL surface);
 NUKED_LOCAL void SurfaceFree(mesa3d_entry_t *entry, LPDDRAWI_DIRECTDRAW_LCL lpDDLcl, LPDDRAWI_DDRAWSURFACE_LCL surface);
 NUKED_LOCAL mesa3d_texture_t *SurfaceGetTexture(surface_id sid, void *ctx, int level, int side);
+NUKED_LOCAL BOOL SurfaceTexFromFBO(surface_id sid, void *mesa_ctx);
+NUKED_LOCAL mesa_vbo_t *SurfaceGetVBO(surface_id sid, void *ctx);
 NUKED_LOCAL void SurfaceExInsertBuffer(mesa3d_entry_t *entry, LPDDRAWI_DIRECTDRAW_LCL lpDDLcl, DWORD dwSurfaceHandle, void *mem);
 
 /* need GL block */
 NUKED_LOCAL mesa3d_texture_t *MesaTextureFromSurfaceHandle(mesa3d_ctx_t *ctx, DWORD surfaceHandle);
 NUKED_LOCAL void MesaApplyMaterial(mesa3d_ctx_t *ctx);
+NUKED_LOCAL void MesaColorMaterialUpdate(mesa3d_ctx_t *ctx, BOOL vertex_diffuse);
 NUKED_LOCAL void MesaApplyMaterialSet(mesa3d_ctx_t *ctx, D3DHAL_DP2SETMATERIAL *material);
 NUKED_FAST  void MesaSetCull(mesa3d_ctx_t *ctx);
 NUKED_FAST  void MesaReverseCull(mesa3d_ctx_t *ctx);
@@ -715,6 +986,18 @@ NUKED_LOCAL void MesaVertexDrawStream(mesa3d_ctx_t *ctx, GLenum gltype, DWORD st
 NUKED_LOCAL void MesaVertexDrawStreamIndex(mesa3d_ctx_t *ctx, GLenum gltype, DWORD start, int base, DWORD cnt, void *index, DWORD index_stride8);
 NUKED_LOCAL void MesaVertexDrawBlock(mesa3d_ctx_t *ctx, GLenum gltype, BYTE *ptr, DWORD start, DWORD cnt, DWORD stride);
 NUKED_LOCAL void MesaVertexDrawBlockIndex(mesa3d_ctx_t *ctx, GLenum gltype, BYTE *ptr, DWORD start, DWORD cnt, DWORD stride, void *index, DWORD index_stride8);
+NUKED_LOCAL void MesaVertexEmitStream(mesa3d_ctx_t *ctx, GLenum gltype, DWORD start, DWORD cnt);
+NUKED_LOCAL void MesaVertexEmitStreamIndex(mesa3d_ctx_t *ctx, GLenum gltype, DWORD start, int base, DWORD cnt, void *index, DWORD index_stride8);
+NUKED_LOCAL void MesaVertexEmitBlock(mesa3d_ctx_t *ctx, GLenum gltype, BYTE *ptr, DWORD start, DWORD cnt, DWORD stride);
+NUKED_LOCAL void MesaVertexEmitSelect(mesa3d_ctx_t *ctx);
+NUKED_LOCAL BOOL MesaVertexDrawVBO(mesa3d_ctx_t *ctx, GLenum gltype, DWORD start, int base, DWORD cnt, void *index, DWORD index_stride8);
+NUKED_LOCAL BOOL MesaVertexDrawUnproject(mesa3d_ctx_t *ctx, GLenum gltype, BYTE *ptr, DWORD start, DWORD cnt, DWORD stride);
+NUKED_LOCAL BOOL MesaVertexUnprojectBegin(mesa3d_ctx_t *ctx, const BYTE *ptr, DWORD stride, DWORD first, DWORD cnt, DWORD refs);
+NUKED_LOCAL void MesaVertexUnprojectEnd(mesa3d_ctx_t *ctx);
+
+/* shorter draws are faster per vertex than client arrays setup or batch unprojection */
+#define UNPROJECT_MIN_VERTICES 16
+#define MESA_UNPROJECT_BATCH(_ctx, _refs) ((_ctx)->state.vertex.xyzrhw && (_ctx)->state.vertex.emit_attr != NULL && (_refs) >= UNPROJECT_MIN_VERTICES)
 
 /* chroma to alpha conversion */
 NUKED_LOCAL void *MesaChroma32(mesa3d_ctx_t *ctx, const void *buf, DWORD w, DWORD h, DWORD lwkey, DWORD hikey);
@@ -729,13 +1012,17 @@ NUKED_LOCAL void *MesaDXT5(mesa3d_ctx_t *ctx, const void *buf, DWORD w, DWORD h,
 
 /* state recording (needs GL block) */
 NUKED_LOCAL void MesaRecStart(mesa3d_ctx_t *ctx, DWORD handle, D3DSTATEBLOCKTYPE sbType);
+NUKED_LOCAL void MesaRecCreate(mesa3d_ctx_t *ctx, DWORD handle, D3DSTATEBLOCKTYPE sbType);
 NUKED_LOCAL void MesaRecStop(mesa3d_ctx_t *ctx);
 NUKED_LOCAL void MesaRecApply(mesa3d_ctx_t *ctx, DWORD handle);
 NUKED_LOCAL void MesaRecDelete(mesa3d_ctx_t *ctx, DWORD handle);
 NUKED_LOCAL void MesaRecState(mesa3d_ctx_t *ctx, DWORD state, DWORD value);
 NUKED_LOCAL void MesaRecTMUState(mesa3d_ctx_t *ctx, DWORD tmu, DWORD state, DWORD value);
+NUKED_LOCAL void MesaRecVSConst(mesa3d_ctx_t *ctx, DWORD reg, DWORD count, const GLfloat *data);
+NUKED_LOCAL void MesaRecPSConst(mesa3d_ctx_t *ctx, DWORD reg, DWORD count, const GLfloat *data);
 NUKED_LOCAL void MesaRecCaptureInit(mesa3d_ctx_t *ctx);
 NUKED_LOCAL void MesaRecCapture(mesa3d_ctx_t *ctx, DWORD handle);
+NUKED_LOCAL void MesaRecDestroyAll(mesa3d_ctx_t *ctx);
 
 #define MESA_1OVER16       0.0625f
 #define MESA_1OVER255	     0.003921568627451f
@@ -763,12 +1050,45 @@ NUKED_LOCAL void MesaFreePals(mesa3d_ctx_t *ctx);
 /* memory */
 NUKED_LOCAL void *MesaTempAlloc(mesa3d_ctx_t *ctx, DWORD w, DWORD size);
 NUKED_LOCAL void MesaTempFree(mesa3d_ctx_t *ctx, void *ptr);
+NUKED_LOCAL void MesaTempFrame(mesa3d_ctx_t *ctx);
+NUKED_LOCAL void MesaTempRelease(mesa3d_ctx_t *ctx);
+
+/* converted textures cache */
+NUKED_LOCAL void MesaTexCacheKey(mesa_texcache_key_t *key, DWORD kind, DWORD format, DWORD w, DWORD h,
+	const void *src, DWORD src_size, DWORD param0, DWORD param1, DWORD param2);
+NUKED_LOCAL void *MesaTexCacheGet(mesa3d_ctx_t *ctx, const mesa_texcache_key_t *key, DWORD size);
+NUKED_LOCAL void MesaTexCacheDone(mesa3d_ctx_t *ctx, void *data);
+NUKED_LOCAL void MesaTexCachePut(mesa3d_ctx_t *ctx, const mesa_texcache_key_t *key, const void *data, DWORD size);
+NUKED_LOCAL void MesaTexCacheFrame(mesa3d_ctx_t *ctx);
+NUKED_LOCAL void MesaTexCacheInit(mesa3d_entry_t *entry);
+NUKED_LOCAL void MesaTexCacheFree(mesa3d_entry_t *entry);
+
+/* DP2 worker thread */
+NUKED_LOCAL BOOL MesaDP2Push(mesa3d_ctx_t *ctx, LPBYTE cmdBufferStart, DWORD cmdLength,
+	LPBYTE vertices, LPBYTE UMVertices, DWORD fvf, DWORD vertices_cnt, DWORD vertex_size, BOOL usermem);
+NUKED_LOCAL void MesaDP2Sync(mesa3d_ctx_t *ctx);
+NUKED_LOCAL DWORD MesaDP2Error(mesa3d_ctx_t *ctx);
+NUKED_LOCAL void MesaDP2Free(mesa3d_ctx_t *ctx);
 
 NUKED_LOCAL void MesaVSCreate(mesa3d_ctx_t *ctx, D3DHAL_DP2CREATEVERTEXSHADER *shader, const BYTE *buffer);
 NUKED_LOCAL void MesaVSDestroy(mesa3d_ctx_t *ctx, DWORD handle);
 NUKED_LOCAL void MesaVSDestroyAll(mesa3d_ctx_t *ctx);
 NUKED_LOCAL mesa_dx_shader_t *MesaVSGet(mesa3d_ctx_t *ctx, DWORD handle);
 NUKED_LOCAL BOOL MesaVSSetVertex(mesa3d_ctx_t *ctx, mesa_dx_shader_t *vs);
+/* need GL block */
+NUKED_LOCAL GLuint MesaVSProgram(mesa3d_ctx_t *ctx, mesa_dx_shader_t *vs);
+NUKED_LOCAL void MesaVSBind(mesa3d_ctx_t *ctx, GLuint prog);
+NUKED_LOCAL void MesaBlendUpdate(mesa3d_ctx_t *ctx);
+NUKED_LOCAL void MesaVSConstSet(mesa3d_ctx_t *ctx, DWORD reg, DWORD count, const GLfloat *data);
+NUKED_LOCAL void MesaVSConstFlush(mesa3d_ctx_t *ctx);
+
+NUKED_LOCAL void MesaPSCreate(mesa3d_ctx_t *ctx, D3DHAL_DP2CREATEPIXELSHADER *shader, const BYTE *buffer);
+NUKED_LOCAL void MesaPSDestroy(mesa3d_ctx_t *ctx, DWORD handle);
+NUKED_LOCAL void MesaPSDestroyAll(mesa3d_ctx_t *ctx);
+NUKED_LOCAL mesa_dx_shader_t *MesaPSGet(mesa3d_ctx_t *ctx, DWORD handle);
+NUKED_LOCAL void MesaPSConstSet(mesa3d_ctx_t *ctx, DWORD reg, DWORD count, const GLfloat *data);
+/* need GL block */
+NUKED_LOCAL void MesaPSUpdate(mesa3d_ctx_t *ctx);
 
 /* need GL block */
 NUKED_LOCAL void MesaTexImage2D(mesa3d_ctx_t *ctx, GLenum target, GLint level, GLint internalformat,
@@ -780,6 +1100,17 @@ NUKED_LOCAL void MesaGC(mesa3d_ctx_t *ctx, BOOL oom);
 
 NUKED_FAST BOOL MesaOldFlip(mesa3d_ctx_t *ctx);
 
+/* DP2 trace */
+#define MESA_TRACE_ON(_entry) ((_entry)->trace.file != NULL)
+
+NUKED_LOCAL void MesaTraceOpen(mesa3d_entry_t *entry);
+NUKED_LOCAL void MesaTraceClose(mesa3d_entry_t *entry);
+NUKED_LOCAL void MesaTraceSurface(mesa3d_ctx_t *ctx, surface_id sid);
+NUKED_LOCAL void MesaTraceTexture(mesa3d_ctx_t *ctx, surface_id sid, int level, int side, DDSURF *surf, BOOL compressed);
+NUKED_LOCAL uint64_t MesaTraceDP2(mesa3d_ctx_t *ctx, LPBYTE cmd, DWORD cmd_size, LPBYTE vertices, DWORD fvf, DWORD vertex_count, DWORD flags);
+NUKED_LOCAL void MesaTraceDP2Done(mesa3d_ctx_t *ctx, uint64_t start);
+NUKED_LOCAL void MesaTraceFrame(mesa3d_ctx_t *ctx, void *ptr);
+
 #ifdef DEBUG
 /* heavy debug */
 #define MESA_KEY_DUMP 1
@@ -117,3 +117,26 @@ MESA_API(glBlendEquation, void, (GLenum mode))
 MESA_API(glScalef, void, (GLfloat x, GLfloat y, GLfloat z))
 MESA_API(glGenerateMipmap, void, (GLenum target))
 MESA_API(glHint, void, (GLenum target, GLenum mode))
+MESA_API_EXT(glGenProgramsARB, void, (GLsizei n, GLuint *programs))
+MESA_API_EXT(glDeleteProgramsARB, void, (GLsizei n, const GLuint *programs))
+MESA_API_EXT(glBindProgramARB, void, (GLenum target, GLuint program))
+MESA_API_EXT(glProgramStringARB, void, (GLenum target, GLenum format, GLsizei len, const void *string))
+MESA_API_EXT(glProgramLocalParameter4fvARB, void, (GLenum target, GLuint index, const GLfloat *params))
+MESA_API_EXT(glProgramEnvParameter4fvARB, void, (GLenum target, GLuint index, const GLfloat *params))
+MESA_API_EXT(glProgramEnvParameters4fvEXT, void, (GLenum target, GLuint index, GLsizei count, const GLfloat *params))
+MESA_API_EXT(glVertexAttrib4fARB, void, (GLuint index, GLfloat x, GLfloat y, GLfloat z, GLfloat w))
+MESA_API_EXT(glVertexAttrib4fvARB, void, (GLuint index, const GLfloat *v))
+MESA_API_EXT(glGenBuffers, void, (GLsizei n, GLuint *buffers))
+MESA_API_EXT(glDeleteBuffers, void, (GLsizei n, const GLuint *buffers))
+MESA_API_EXT(glBindBuffer, void, (GLenum target, GLuint buffer))
+MESA_API_EXT(glBufferData, void, (GLenum target, GLsizeiptr size, const void *data, GLenum usage))
+MESA_API_EXT(glBufferSubData, void, (GLenum target, GLintptr offset, GLsizeiptr size, const void *data))
+MESA_API_EXT(glEnableClientState, void, (GLenum array))
+MESA_API_EXT(glDisableClientState, void, (GLenum array))
+MESA_API_EXT(glClientActiveTexture, void, (GLenum texture))
+MESA_API_EXT(glVertexPointer, void, (GLint size, GLenum type, GLsizei stride, const void *pointer))
+MESA_API_EXT(glNormalPointer, void, (GLenum type, GLsizei stride, const void *pointer))
+MESA_API_EXT(glColorPointer, void, (GLint size, GLenum type, GLsizei stride, const void *pointer))
+MESA_API_EXT(glTexCoordPointer, void, (GLint size, GLenum type, GLsizei stride, const void *pointer))
+MESA_API_EXT(glDrawArrays, void, (GLenum mode, GLint first, GLsizei count))
+MESA_API_EXT(glDrawElements, void, (GLenum mode, GLsizei count, GLenum type, const void *indices))
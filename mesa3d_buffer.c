@@ -97,6 +97,8 @@ NUKED_LOCAL void MesaBufferUploadColor(mesa3d_ctx_t *ctx, const void *src)
 
 	GL_CHECK(entry->proc.pglFinish());
 
+	PERF_ADD(upload_bytes, SurfacePitch(ctx->state.sw, ctx->front_bpp) * ctx->state.sh);
+
 	if(ctx->front_bpp == 32)
 	{
 		GL_CHECK(entry->proc.pglActiveTexture(GL_TEXTURE0+ctx->fbo_tmu));
@@ -216,6 +218,7 @@ NUKED_LOCAL void MesaBufferDownloadColor(mesa3d_ctx_t *ctx, void *dst)
 	mesa3d_entry_t *entry = entry = ctx->entry;
 
 	GL_CHECK(entry->proc.pglReadPixels(0, 0, ctx->state.sw, ctx->state.sh, format, type, dst));
+	PERF_ADD(readback_bytes, SurfacePitch(ctx->state.sw, ctx->front_bpp) * ctx->state.sh);
 	
 	if(front_surface)
 		FBHDA_access_end(0);
@@ -269,6 +272,8 @@ NUKED_LOCAL void MesaBufferUploadDepth(mesa3d_ctx_t *ctx, const void *src)
 	
 	TRACE("depth_bpp=%d, type=0x%X, format=0x%X, ?stencil = %d", ctx->depth_bpp, type, format, ctx->depth_stencil);
 	GL_CHECK(entry->proc.pglFinish());
+
+	PERF_ADD(upload_bytes, SurfacePitch(ctx->state.sw, ctx->depth_bpp) * ctx->state.sh);
 	
 	if(convert_type == DS_NATIVE) /* DX depth buffer is in GL native format */
 	{
@@ -335,6 +340,8 @@ NUKED_LOCAL void MesaBufferDownloadDepth(mesa3d_ctx_t *ctx, void *dst)
 	}
 
 	TOPIC("DEPTHCONV", "Z GL->DX, bpp=%d", ctx->depth_bpp);
+	PERF_ADD(readback_bytes, SurfacePitch(ctx->state.sw, ctx->depth_bpp) * ctx->state.sh);
+
 	if(ctx->depth_bpp != 24)
 	{
 		GL_CHECK(entry->proc.pglReadPixels(0, 0, ctx->state.sw, ctx->state.sh, format, type, dst));
@@ -428,6 +435,142 @@ static const int Mesa2GLSide[MESA3D_CUBE_SIDES] = {
 // not needed
 //#include "mesa3d_flip.h"
 
+static void *chroma_convert(mesa3d_ctx_t *ctx,
+	int width, int height, int bpp, GLenum type, void *ptr,
+	DWORD chroma_lw, DWORD chroma_hi)
+{
+	void *data = NULL;
+
+	TOPIC("CHROMA", "chroma - bpp: %d, chroma_lw=0x%X, chroma_hi=0x%X", bpp, chroma_lw, chroma_hi);
+
+	switch(bpp)
+	{
+		case 12:
+			data = MesaChroma12(ctx, ptr, width, height, chroma_lw, chroma_hi);
+			break;
+		case 15:
+			data = MesaChroma15(ctx, ptr, width, height, chroma_lw, chroma_hi);
+			break;
+		case 16:
+			if(type == GL_UNSIGNED_SHORT_4_4_4_4_REV || type == GL_UNSIGNED_SHORT_4_4_4_4)
+			{
+				data = MesaChroma12(ctx, ptr, width, height, chroma_lw, chroma_hi);
+			}
+			else if(type == GL_UNSIGNED_SHORT_5_5_5_1 || type == GL_UNSIGNED_SHORT_1_5_5_5_REV)
+			{
+				data = MesaChroma15(ctx, ptr, width, height, chroma_lw, chroma_hi);
+			}
+			else
+			{
+				data = MesaChroma16(ctx, ptr, width, height, chroma_lw, chroma_hi);
+			}
+			break;
+		case 24:
+			data = MesaChroma24(ctx, ptr, width, height, chroma_lw, chroma_hi);
+			break;
+		case 32:
+			data = MesaChroma32(ctx, ptr, width, height, chroma_lw, chroma_hi);
+			break;
+		default:
+			WARN("wrong chroma bpp: %d", bpp);
+			break;
+	}
+
+	return data;
+}
+
+static void *chroma_convert_compress(mesa3d_ctx_t *ctx, int w, int h, GLenum iternalformat, void *ptr,
+	BOOL chroma, DWORD chroma_lw, DWORD chroma_hi)
+{
+	void *data = NULL;
+
+	switch(iternalformat)
+	{
+		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+			data = MesaDXT1(ctx, ptr, w, h, chroma, chroma_lw, chroma_hi);
+			break;
+		case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+			data = MesaDXT3(ctx, ptr, w, h, chroma, chroma_lw, chroma_hi);
+			break;
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+			data = MesaDXT5(ctx, ptr, w, h, chroma, chroma_lw, chroma_hi);
+			break;
+		default:
+			WARN("wrong format (GL) 0x%X", iternalformat);
+			break;
+	}
+
+	return data;
+}
+
+/*
+ * CPU conversion of DXT (chroma = FALSE) or color keyed level to 32bpp,
+ * converted data are looked up in texture cache first. Release result by
+ * texture_convert_free.
+ */
+static void *texture_convert(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex, DDSURF *dds,
+	BOOL chroma, DWORD chroma_lw, DWORD chroma_hi, BOOL *cached)
+{
+	mesa_texcache_key_t key;
+	void *ptr = (void*)dds->fpVidMem;
+	GLuint w = dds->width;
+	GLuint h = dds->height;
+	DWORD src_size;
+	DWORD size;
+	void *data;
+
+	if(tex->compressed)
+	{
+		src_size = compressed_size(tex->internalformat, w, h);
+		size = SurfacePitch((w + 3) & 0xFFFFFFFC, 32) * ((h + 3) & 0xFFFFFFFC);
+	}
+	else
+	{
+		src_size = SurfacePitch(w, dds->bpp) * h;
+		size = SurfacePitch(w, 32) * h;
+	}
+
+	*cached = FALSE;
+	if(ctx->entry->texcache.budget > 0)
+	{
+		MesaTexCacheKey(&key, chroma ? MESA_TEXCACHE_CHROMA : MESA_TEXCACHE_DXT,
+			tex->compressed ? tex->internalformat : tex->type, w, h, ptr, src_size,
+			chroma ? chroma_lw : 0, chroma ? chroma_hi : 0, tex->bpp);
+
+		data = MesaTexCacheGet(ctx, &key, size);
+		if(data != NULL)
+		{
+			TOPIC("TEXCACHE", "hit: w=%d, h=%d, size=%u", w, h, size);
+			*cached = TRUE;
+			return data;
+		}
+	}
+
+	if(tex->compressed)
+	{
+		data = chroma_convert_compress(ctx, w, h, tex->internalformat, ptr, chroma, chroma_lw, chroma_hi);
+	}
+	else
+	{
+		data = chroma_convert(ctx, w, h, tex->bpp, tex->type, ptr, chroma_lw, chroma_hi);
+	}
+
+	if(data != NULL && ctx->entry->texcache.budget > 0)
+	{
+		MesaTexCachePut(ctx, &key, data, size);
+	}
+
+	return data;
+}
+
+static void texture_convert_free(mesa3d_ctx_t *ctx, void *data, BOOL cached)
+{
+	if(cached)
+		MesaTexCacheDone(ctx, data);
+	else
+		MesaTempFree(ctx, data);
+}
+
 NUKED_LOCAL void MesaBufferUploadTexture(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex, int level, int side, int tmu)
 {
 	TRACE_ENTRY
@@ -466,6 +609,14 @@ NUKED_LOCAL void MesaBufferUploadTexture(mesa3d_ctx_t *ctx, mesa3d_texture_t *te
 	}
 #endif
 
+	if(MESA_TRACE_ON(entry))
+		MesaTraceTexture(ctx, sid, level, side, surf, tex->compressed);
+
+	if(tex->compressed && surf->lpGbl != NULL)
+		PERF_ADD(upload_bytes, surf->lpGbl->dwLinearSize);
+	else
+		PERF_ADD(upload_bytes, SurfacePitch(w, surf->bpp) * h);
+
 	GL_CHECK(entry->proc.pglActiveTexture(GL_TEXTURE0+tmu));
 	GL_CHECK(entry->proc.pglEnable(GL_TEXTURE_CUBE_MAP));
 	GL_CHECK(entry->proc.pglEnable(GL_TEXTURE_2D));
@@ -485,24 +636,13 @@ NUKED_LOCAL void MesaBufferUploadTexture(mesa3d_ctx_t *ctx, mesa3d_texture_t *te
 		{
 			if(ctx->entry->env.s3tc_bug || w < 4 || h < 4)
 			{
-				void *data = NULL;
-				switch(tex->internalformat)
-				{
-					case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
-						data = MesaDXT1(ctx, ptr, w, h, FALSE, 0, 0);
-						break;
-					case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
-						data = MesaDXT3(ctx, ptr, w, h, FALSE, 0, 0);
-						break;
-					case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
-						data = MesaDXT5(ctx, ptr, w, h, FALSE, 0, 0);
-						break;
-				}
+				BOOL cached;
+				void *data = texture_convert(ctx, tex, surf, FALSE, 0, 0, &cached);
 
 				if(data != NULL)
 				{
 					MesaTexImage2D(ctx, Mesa2GLSide[side], level, GL_RGBA, w, h, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, data, sid);
-					MesaTempFree(ctx, data);
+					texture_convert_free(ctx, data, cached);
 				}
 			}
 			else
@@ -532,24 +672,13 @@ NUKED_LOCAL void MesaBufferUploadTexture(mesa3d_ctx_t *ctx, mesa3d_texture_t *te
 		{
 			if(ctx->entry->env.s3tc_bug || w < 4 || h < 4)
 			{
-				void *data = NULL;
-				switch(tex->internalformat)
-				{
-					case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
-						data = MesaDXT1(ctx, ptr, w, h, FALSE, 0, 0);
-						break;
-					case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
-						data = MesaDXT3(ctx, ptr, w, h, FALSE, 0, 0);
-						break;
-					case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
-						data = MesaDXT5(ctx, ptr, w, h, FALSE, 0, 0);
-						break;
-				}
+				BOOL cached;
+				void *data = texture_convert(ctx, tex, surf, FALSE, 0, 0, &cached);
 
 				if(data != NULL)
 				{
 					MesaTexImage2D(ctx, GL_TEXTURE_2D, level, GL_RGBA, w, h, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, data, sid);
-					MesaTempFree(ctx, data);
+					texture_convert_free(ctx, data, cached);
 				}
 			}
 			else
@@ -568,74 +697,6 @@ NUKED_LOCAL void MesaBufferUploadTexture(mesa3d_ctx_t *ctx, mesa3d_texture_t *te
 	ctx->state.tmu[tmu].update = TRUE;
 }
 
-static void *chroma_convert(mesa3d_ctx_t *ctx,
-	int width, int height, int bpp, GLenum type, void *ptr,
-	DWORD chroma_lw, DWORD chroma_hi)
-{
-	void *data = NULL;
-
-	TOPIC("CHROMA", "chroma - bpp: %d, chroma_lw=0x%X, chroma_hi=0x%X", bpp, chroma_lw, chroma_hi);
-
-	switch(bpp)
-	{
-		case 12:
-			data = MesaChroma12(ctx, ptr, width, height, chroma_lw, chroma_hi);
-			break;
-		case 15:
-			data = MesaChroma15(ctx, ptr, width, height, chroma_lw, chroma_hi);
-			break;
-		case 16:
-			if(type == GL_UNSIGNED_SHORT_4_4_4_4_REV || type == GL_UNSIGNED_SHORT_4_4_4_4)
-			{
-				data = MesaChroma12(ctx, ptr, width, height, chroma_lw, chroma_hi);
-			}
-			else if(type == GL_UNSIGNED_SHORT_5_5_5_1 || type == GL_UNSIGNED_SHORT_1_5_5_5_REV)
-			{
-				data = MesaChroma15(ctx, ptr, width, height, chroma_lw, chroma_hi);
-			}
-			else
-			{
-				data = MesaChroma16(ctx, ptr, width, height, chroma_lw, chroma_hi);
-			}
-			break;
-		case 24:
-			data = MesaChroma24(ctx, ptr, width, height, chroma_lw, chroma_hi);
-			break;
-		case 32:
-			data = MesaChroma32(ctx, ptr, width, height, chroma_lw, chroma_hi);
-			break;
-		default:
-			WARN("wrong chroma bpp: %d", bpp);
-			break;
-	}
-
-	return data;
-}
-
-static void *chroma_convert_compress(mesa3d_ctx_t *ctx, int w, int h, GLenum iternalformat, void *ptr,
-	DWORD chroma_lw, DWORD chroma_hi)
-{
-	void *data = NULL;
-
-	switch(iternalformat)
-	{
-		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
-			data = MesaDXT1(ctx, ptr, w, h, TRUE, chroma_lw, chroma_hi);
-			break;
-		case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
-			data = MesaDXT3(ctx, ptr, w, h, TRUE, chroma_lw, chroma_hi);
-			break;
-		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
-			data = MesaDXT5(ctx, ptr, w, h, TRUE, chroma_lw, chroma_hi);
-			break;
-		default:
-			WARN("wrong format (GL) 0x%X", iternalformat);
-			break;
-	}
-
-	return data;
-}
-
 NUKED_LOCAL void MesaBufferUploadTextureChroma(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex, int level, int side, int tmu, DWORD chroma_lw, DWORD chroma_hi)
 {
 	TRACE_ENTRY
@@ -659,10 +720,10 @@ NUKED_LOCAL void MesaBufferUploadTextureChroma(mesa3d_ctx_t *ctx, mesa3d_texture
 	GLuint w = dds->width;
 	GLuint h = dds->height;
 
-	void *vidmem = (void*)dds->fpVidMem;
+	PERF_ADD(upload_bytes, SurfacePitch(w, dds->bpp) * h);
 
 #ifdef DEBUG
-	DWORD *test_ptr = (DWORD*)vidmem;
+	DWORD *test_ptr = (DWORD*)dds->fpVidMem;
 	if(*test_ptr == HAL_UNINITIALIZED_MAGIC)
 	{
 		WARN("Uninitialized texture memory, sid=%d", sid);
@@ -675,23 +736,11 @@ NUKED_LOCAL void MesaBufferUploadTextureChroma(mesa3d_ctx_t *ctx, mesa3d_texture
 
 	TOPIC("CHROMA", "MesaBufferUploadTextureChroma - level=%d", level);
 
-	void *data = NULL;
-
-	switch(tex->internalformat)
-	{
-		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
-		case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
-		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
-			data = chroma_convert_compress(ctx, w, h, tex->internalformat, vidmem, chroma_lw, chroma_hi);
-			TOPIC("NEWTEX", "downloaded compr.chroma GL format: 0x%X, success: %X", tex->internalformat, data);
-			break;
-		default:
-			data = chroma_convert(ctx, w, h, tex->bpp, tex->type, vidmem, chroma_lw, chroma_hi);
-			TOPIC("NEWTEX", "downloaded chroma bpp: %d (lw:0x%08X, hi:0x%08X), success: %X", tex->bpp,
-				chroma_lw, chroma_hi, data
-			);
-			break;
-	}
+	BOOL cached;
+	void *data = texture_convert(ctx, tex, dds, TRUE, chroma_lw, chroma_hi, &cached);
+	TOPIC("NEWTEX", "downloaded chroma bpp: %d, format: 0x%X (lw:0x%08X, hi:0x%08X), success: %X", tex->bpp,
+		tex->internalformat, chroma_lw, chroma_hi, data
+	);
 
 	if(data)
 	{
@@ -712,53 +761,146 @@ NUKED_LOCAL void MesaBufferUploadTextureChroma(mesa3d_ctx_t *ctx, mesa3d_texture
 				w, h, GL_BGRA, GL_UNSIGNED_BYTE, data, sid);
 		}
 		
-		MesaTempFree(ctx, data);
+		texture_convert_free(ctx, data, cached);
 	}
 	ctx->state.tmu[tmu].update = TRUE;
 }
 
-static mesa_fbo_t *fbo_find_empty(mesa3d_ctx_t *ctx)
+static DWORD fbo_size(int width, int height, BOOL zfloat)
+{
+	DWORD pixels = width * height;
+	/* RGBA8 color + D24S8 or D32F_S8 (64-bit) depth plane */
+	return pixels*4 + pixels*(zfloat ? 8 : 4);
+}
+
+static void fbo_release(mesa3d_ctx_t *ctx, mesa_fbo_t *fbo)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+
+	if(fbo->plane_fb)
+	{
+		TOPIC("FRAMEBUFFER", "delete frambuffer: %d", fbo->plane_fb);
+		GL_CHECK(entry->proc.pglDeleteFramebuffers(1, &fbo->plane_fb));
+	}
+
+	if(fbo->plane_color_tex)
+	{
+		TOPIC("FRAMEBUFFER", "delete texture: %d", fbo->plane_color_tex);
+		GL_CHECK(entry->proc.pglDeleteTextures(1, &fbo->plane_color_tex));
+	}
+
+	if(fbo->plane_depth_tex)
+	{
+		TOPIC("FRAMEBUFFER", "delete texture: %d", fbo->plane_depth_tex);
+		GL_CHECK(entry->proc.pglDeleteTextures(1, &fbo->plane_depth_tex));
+	}
+
+	if(fbo->color16_fb)
+	{
+		GL_CHECK(entry->proc.pglDeleteFramebuffers(1, &fbo->color16_fb));
+	}
+
+	if(fbo->color16_tex)
+	{
+		GL_CHECK(entry->proc.pglDeleteTextures(1, &fbo->color16_tex));
+	}
+
+	ctx->fbo_bytes -= fbo->bytes;
+	entry->fbo_stats.bytes -= fbo->bytes;
+	entry->fbo_stats.evicted++;
+
+	memset(fbo, 0, sizeof(mesa_fbo_t));
+}
+
+/* least recently used FBO, except active one */
+static mesa_fbo_t *fbo_find_lru(mesa3d_ctx_t *ctx)
 {
 	unsigned int i;
+	mesa_fbo_t *fbo_lru = NULL;
+
+	for(i = 0; i < FBO_COUNT; i++)
+	{
+		mesa_fbo_t *fbo = &ctx->fbo_swap[i];
+		if(fbo->allocated && fbo != ctx->fbo)
+		{
+			if(fbo_lru == NULL || (LONG)(fbo->lru - fbo_lru->lru) < 0)
+			{
+				fbo_lru = fbo;
+			}
+		}
+	}
+
+	return fbo_lru;
+}
+
+static mesa_fbo_t *fbo_find_empty(mesa3d_ctx_t *ctx, DWORD need_bytes)
+{
+	unsigned int i;
+	mesa_fbo_t *fbo;
+
+	/* keep pool under budget */
+	while(ctx->fbo_bytes + need_bytes > FBO_BUDGET)
+	{
+		fbo = fbo_find_lru(ctx);
+		if(fbo == NULL)
+			break;
+
+		TOPIC("FBSWAP", "evict FBO - %d (%dx%d)", (fbo - &ctx->fbo_swap[0]), fbo->width, fbo->height);
+		fbo_release(ctx, fbo);
+	}
+
 	for(i = 0; i < FBO_COUNT; i++)
 	{
 		if(!ctx->fbo_swap[i].allocated)
 		{
-			ctx->fbo_swap[i].allocated = TRUE;
 			TOPIC("FBSWAP", "new empty FBO - %d", i);
 			return &ctx->fbo_swap[i];
 		}
 	}
 
-	mesa_fbo_t *fbo_min = &ctx->fbo_swap[i];
-	for(i = 1; i < FBO_COUNT; i++)
+	/* pool is full */
+	fbo = fbo_find_lru(ctx);
+	if(fbo == NULL)
 	{
-		if(ctx->fbo_swap[i].width < fbo_min->width)
-		{
-			fbo_min = &ctx->fbo_swap[i];
-		}
+		/* only active FBO left (first use of slot 0) */
+		fbo = ctx->fbo;
 	}
 
-	TOPIC("FBSWAP", "reusing FBO - %d", (fbo_min - &ctx->fbo_swap[0]));
+	TOPIC("FBSWAP", "reusing FBO - %d", (fbo - &ctx->fbo_swap[0]));
+	if(fbo->allocated)
+	{
+		fbo_release(ctx, fbo);
+	}
 
-	return fbo_min;
+	return fbo;
 }
 
-static mesa_fbo_t *fbo_find_match(mesa3d_ctx_t *ctx, int width, int height)
+/* exact match of (width, height, bpp, zfloat) first, then same size with different color depth */
+static mesa_fbo_t *fbo_find_match(mesa3d_ctx_t *ctx, int width, int height, int bpp)
 {
 	unsigned int i;
+	mesa_fbo_t *fbo_size_match = NULL;
+	BOOL zfloat = ctx->entry->env.zfloat;
+
 	for(i = 0; i < FBO_COUNT; i++)
 	{
-		if(ctx->fbo_swap[i].allocated)
+		mesa_fbo_t *fbo = &ctx->fbo_swap[i];
+		if(fbo->allocated && fbo->width == width && fbo->height == height && fbo->zfloat == zfloat)
 		{
-			if(ctx->fbo_swap[i].width == width && ctx->fbo_swap[i].height == height)
+			if(fbo->bpp == bpp)
 			{
 				TOPIC("FBSWAP", "match exists FBO - %d", i);
-				return &ctx->fbo_swap[i];
+				return fbo;
+			}
+
+			if(fbo_size_match == NULL || (LONG)(fbo->lru - fbo_size_match->lru) < 0)
+			{
+				fbo_size_match = fbo;
 			}
 		}
 	}
-	return NULL;
+
+	return fbo_size_match;
 }
 
 NUKED_LOCAL BOOL MesaBufferFBOSetup(mesa3d_ctx_t *ctx, int width, int height, int bpp)
@@ -771,10 +913,12 @@ NUKED_LOCAL BOOL MesaBufferFBOSetup(mesa3d_ctx_t *ctx, int width, int height, in
 	//if(ctx->fbo->width >= width && ctx->fbo->height >= height)
 	if(ctx->fbo->width != width || ctx->fbo->height != height)
 	{
-		mesa_fbo_t *fbo = fbo_find_match(ctx, width, height);
+		mesa_fbo_t *fbo = fbo_find_match(ctx, width, height, bpp);
 		if(fbo != NULL)
 		{
 			ctx->fbo = fbo;
+			fbo->lru = ++ctx->fbo_lru;
+			entry->fbo_stats.reused++;
 			GL_CHECK(entry->proc.pglActiveTexture(GL_TEXTURE0 + ctx->fbo_tmu));
 			GL_CHECK(entry->proc.pglBindFramebuffer(GL_FRAMEBUFFER, fbo->plane_fb));
 
@@ -794,26 +938,16 @@ NUKED_LOCAL BOOL MesaBufferFBOSetup(mesa3d_ctx_t *ctx, int width, int height, in
 	{
 		GL_CHECK(entry->proc.pglBindFramebuffer(GL_FRAMEBUFFER, 0));
 
-		mesa_fbo_t *fbo = fbo_find_empty(ctx);
+		DWORD bytes = fbo_size(width, height, entry->env.zfloat);
+		mesa_fbo_t *fbo = fbo_find_empty(ctx, bytes);
 
-		if(fbo->plane_fb)
-		{
-			TOPIC("FRAMEBUFFER", "delete frambuffer: %d", fbo->plane_fb);
-			GL_CHECK(entry->proc.pglDeleteFramebuffers(1, &fbo->plane_fb));
-			TOPIC("FBSWAP", "delete fbo_swap");
-		}
-
-		if(fbo->plane_color_tex)
-		{
-			TOPIC("FRAMEBUFFER", "delete texture: %d", fbo->plane_color_tex);
-			GL_CHECK(entry->proc.pglDeleteTextures(1, &fbo->plane_color_tex));
-		}
-
-		if(fbo->plane_depth_tex)
-		{
-			TOPIC("FRAMEBUFFER", "delete texture: %d", fbo->plane_depth_tex);
-			GL_CHECK(entry->proc.pglDeleteTextures(1, &fbo->plane_depth_tex));
-		}
+		fbo->allocated = TRUE;
+		fbo->zfloat = entry->env.zfloat;
+		fbo->bytes = bytes;
+		fbo->lru = ++ctx->fbo_lru;
+		ctx->fbo_bytes += bytes;
+		entry->fbo_stats.bytes += bytes;
+		entry->fbo_stats.created++;
 
 		GL_CHECK(entry->proc.pglGenFramebuffers(1, &fbo->plane_fb));
 		TOPIC("FRAMEBUFFER", "new frambuffer: %d", fbo->plane_fb);
@@ -861,6 +995,187 @@ NUKED_LOCAL BOOL MesaBufferFBOSetup(mesa3d_ctx_t *ctx, int width, int height, in
 	return TRUE;
 }
 
+static void tex_fb_attach(mesa3d_ctx_t *ctx, GLenum target, mesa3d_texture_t *tex, int level, int side)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+
+	if(ctx->tex_fb == 0)
+	{
+		GL_CHECK(entry->proc.pglGenFramebuffers(1, &ctx->tex_fb));
+		TOPIC("FRAMEBUFFER", "new texture frambuffer: %d", ctx->tex_fb);
+	}
+
+	GL_CHECK(entry->proc.pglBindFramebuffer(target, ctx->tex_fb));
+	GL_CHECK(entry->proc.pglFramebufferTexture2D(target, GL_COLOR_ATTACHMENT0,
+		tex->cube ? Mesa2GLSide[side] : GL_TEXTURE_2D, tex->gltex, level));
+}
+
+/* render target texture can be copied on GPU only when GL texture is plain copy of surface */
+NUKED_LOCAL BOOL MesaBufferCanCopyTexture(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex, int level, int side)
+{
+	if(tex->ctx != ctx || tex->compressed || tex->palette || tex->colorkey)
+		return FALSE;
+
+	if(level > tex->mipmap_level || side >= MESA3D_CUBE_SIDES)
+		return FALSE;
+
+	switch(tex->format)
+	{
+		case GL_RGB:
+		case GL_RGBA:
+		case GL_BGR:
+		case GL_BGRA:
+			break;
+		default:
+			return FALSE;
+	}
+
+	DDSURF *surf = SurfaceGetSURF(tex->data_sid[side][level]);
+	if(surf == NULL || surf->fpVidMem == 0)
+		return FALSE;
+
+	if(surf->width != ctx->state.sw || surf->height != ctx->state.sh)
+		return FALSE;
+
+	return TRUE;
+}
+
+/* copy FBO color to texture level, surface memory is downloaded later by MesaBufferDownloadTexture */
+NUKED_LOCAL void MesaBufferCopyTexture(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex, int level, int side)
+{
+	TRACE_ENTRY
+
+	mesa3d_entry_t *entry = ctx->entry;
+	surface_id sid = tex->data_sid[side][level];
+	GLsizei w = ctx->state.sw;
+	GLsizei h = ctx->state.sh;
+
+	if(tex->data_dirty[side][level])
+	{
+		/* level may not exist yet, but whole content will be replaced */
+		GL_CHECK(entry->proc.pglActiveTexture(GL_TEXTURE0+ctx->fbo_tmu));
+		if(tex->cube)
+		{
+			GL_CHECK(entry->proc.pglBindTexture(GL_TEXTURE_CUBE_MAP, tex->gltex));
+			MesaTexImage2D(ctx, Mesa2GLSide[side], level, tex->internalformat, w, h, tex->format, tex->type, NULL, sid);
+		}
+		else
+		{
+			GL_CHECK(entry->proc.pglBindTexture(GL_TEXTURE_2D, tex->gltex));
+			MesaTexImage2D(ctx, GL_TEXTURE_2D, level, tex->internalformat, w, h, tex->format, tex->type, NULL, sid);
+		}
+
+		if(ctx->fbo_tmu < ctx->tmu_count)
+		{
+			ctx->state.tmu[ctx->fbo_tmu].update = TRUE;
+			MesaDrawRefreshState(ctx);
+		}
+	}
+
+	tex_fb_attach(ctx, GL_DRAW_FRAMEBUFFER, tex, level, side);
+	GL_CHECK(entry->proc.pglBindFramebuffer(GL_READ_FRAMEBUFFER, ctx->fbo->plane_fb));
+	GL_CHECK(entry->proc.pglBlitFramebuffer(
+		0, 0, w, h,
+		0, 0, w, h,
+		GL_COLOR_BUFFER_BIT, GL_NEAREST));
+
+	GL_CHECK(entry->proc.pglBindFramebuffer(GL_FRAMEBUFFER, ctx->fbo->plane_fb));
+
+	tex->data_dirty[side][level] = FALSE;
+	tex->gpu_dirty[side][level] = TRUE;
+
+	if(level == 0 && tex->autogen)
+	{
+		if(tex->cube)
+		{
+			/* other faces don't have to be in GL yet, generate on next reload */
+			tex->dirty = TRUE;
+		}
+		else
+		{
+			MesaBufferGenTextureMips(ctx, tex, ctx->fbo_tmu);
+			if(ctx->fbo_tmu < ctx->tmu_count)
+			{
+				ctx->state.tmu[ctx->fbo_tmu].update = TRUE;
+				MesaDrawRefreshState(ctx);
+			}
+		}
+	}
+
+	TOPIC("TEXTARGET", "FBO -> texture %d, level=%d, side=%d", tex->gltex, level, side);
+}
+
+NUKED_LOCAL void MesaBufferDownloadTexture(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex, int level, int side)
+{
+	TRACE_ENTRY
+
+	mesa3d_entry_t *entry = ctx->entry;
+	DDSURF *surf = SurfaceGetSURF(tex->data_sid[side][level]);
+
+	tex->gpu_dirty[side][level] = FALSE;
+
+	if(surf == NULL || surf->fpVidMem == 0)
+	{
+		ERR("no surface on side %d, level %d", side, level);
+		return;
+	}
+
+	tex_fb_attach(ctx, GL_READ_FRAMEBUFFER, tex, level, side);
+	GL_CHECK(entry->proc.pglReadPixels(0, 0, surf->width, surf->height, tex->format, tex->type, (void*)surf->fpVidMem));
+	PERF_ADD(readback_bytes, SurfacePitch(surf->width, surf->bpp) * surf->height);
+
+	GL_CHECK(entry->proc.pglBindFramebuffer(GL_FRAMEBUFFER, ctx->fbo->plane_fb));
+
+	TOPIC("TEXTARGET", "%X <- download texture %d, level=%d, side=%d", surf->fpVidMem, tex->gltex, level, side);
+}
+
+/* GPU generated levels are read back by MesaBufferDownloadTexture, so only plain RGB(A) textures */
+NUKED_LOCAL BOOL MesaBufferCanGenTextureMips(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex)
+{
+	if(!ctx->entry->autogenmipmap)
+		return FALSE;
+
+	if(!tex->mipmap || tex->compressed || tex->palette)
+		return FALSE;
+
+	switch(tex->format)
+	{
+		case GL_RGB:
+		case GL_RGBA:
+		case GL_BGR:
+		case GL_BGRA:
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* build sub-levels from level 0, surface memory of them is downloaded on lock */
+NUKED_LOCAL void MesaBufferGenTextureMips(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex, int tmu)
+{
+	TRACE_ENTRY
+
+	mesa3d_entry_t *entry = ctx->entry;
+	GLenum target = tex->cube ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+	int level;
+	int side;
+
+	/* cube map: all faces of level 0 are uploaded by MesaReloadTexture before */
+	GL_CHECK(entry->proc.pglActiveTexture(GL_TEXTURE0+tmu));
+	GL_CHECK(entry->proc.pglBindTexture(target, tex->gltex));
+	GL_CHECK(entry->proc.pglGenerateMipmap(target));
+
+	for(side = 0; side < tex->sides; side++)
+	{
+		for(level = 1; level <= tex->mipmap_level; level++)
+		{
+			tex->data_dirty[side][level] = FALSE;
+			tex->gpu_dirty[side][level] = TRUE;
+		}
+	}
+
+	TOPIC("TEXTARGET", "generated mipmaps of texture %d, levels=%d", tex->gltex, tex->mipmap_level);
+}
 
 NUKED_LOCAL void MesaBufferUploadTexturePalette(mesa3d_ctx_t *ctx, mesa3d_texture_t *tex, int level, int side, int tmu, BOOL chroma_key, DWORD chroma_lw, DWORD chroma_hi)
 {
@@ -893,6 +1208,8 @@ NUKED_LOCAL void MesaBufferUploadTexturePalette(mesa3d_ctx_t *ctx, mesa3d_textur
 	}
 	DWORD pal_flags = dds->dwPaletteFlags;
 
+	PERF_ADD(upload_bytes, SurfacePitch(w, dds->bpp) * h);
+
 	GL_CHECK(entry->proc.pglActiveTexture(GL_TEXTURE0+tmu));
 	GL_CHECK(entry->proc.pglEnable(GL_TEXTURE_CUBE_MAP));
 	GL_CHECK(entry->proc.pglEnable(GL_TEXTURE_2D));
@@ -914,88 +1231,114 @@ NUKED_LOCAL void MesaBufferUploadTexturePalette(mesa3d_ctx_t *ctx, mesa3d_textur
 #if 0
 	data = MesaTempAlloc(ctx, w, pitch4*4*h);
 #endif
-	if(!dds->cache)
+	mesa_texcache_key_t key;
+	BOOL cached = FALSE;
+	if(entry->texcache.budget > 0)
 	{
-		dds->cache = hal_alloc(HEAP_LARGE, sizeof(DDSURF_cache_t)+pitch4*4*h, w);
-		if(dds->cache == NULL)
+		mesa_texcache_key_t palkey;
+		MesaTexCacheKey(&palkey, MESA_TEXCACHE_PALETTE, 0, 256, 1, pal->colors, sizeof(pal->colors), 0, 0, 0);
+
+		MesaTexCacheKey(&key, MESA_TEXCACHE_PALETTE, (pal_flags & DDRAWIPAL_ALPHA) ? 1 : 0,
+			w, h, src, src_pitch*h, palkey.hash[0] ^ palkey.hash[1],
+			chroma_key ? chroma_lw : 0xFFFFFFFF, chroma_key ? chroma_hi : 0xFFFFFFFF);
+
+		data = MesaTexCacheGet(ctx, &key, pitch4*4*h);
+		if(data != NULL)
 		{
-			ERR("Malloc fail");
-			return;
+			cached = TRUE;
 		}
-		dds->cache->pal_stamp = 0xFFFFFFFF;
-		dds->cache->color_key = TRUE;
-		dds->cache->dwColorKeyLowPal  = 0xFFFFFFFF;
-		dds->cache->dwColorKeyHighPal = 0xFFFFFFFF;
-		
-		dds->cache->data = (DWORD*)(dds->cache+1);
 	}
-	data = dds->cache->data;
 
-/*
-	P = pal->stamp == dds->cache->pal_stamp
-	S = chroma_key
-	C = dds->cache->color_key
-	L = dds->cache->dwColorKeyLowPal == chroma_lw
-	H = dds->cache->dwColorKeyHighPal == chroma_hi
-
-	P S C L H   update
-	---------
-	0 X X X X = 1
-	1 0 0 0 0 = 0
-	1 0 0 0 1 = 0
-	1 0 0 1 0 = 0
-	1 0 0 1 1 = 0
-	1 0 1 0 0 = 1
-	1 0 1 0 1 = 1
-	1 0 1 1 0 = 1
-	1 0 1 1 1 = 1
-	1 1 0 0 0 = 1
-	1 1 0 0 1 = 1
-	1 1 0 1 0 = 1
-	1 1 0 1 1 = 1
-	1 1 1 0 0 = 1
-	1 1 1 0 1 = 1
-	1 1 1 1 0 = 1
-	1 1 1 1 1 = 0
-
-	minimal form:
-	~bc + b~c + ~a + c~e + c~d
-	~SC + S~C + ~P + C~H + C~L
-*/
-	if(
-		((!chroma_key) &&  dds->cache->color_key  ) ||
-	 	(  chroma_key  && (!dds->cache->color_key)) ||
-	 	(pal->stamp != dds->cache->pal_stamp)	||
-		(dds->cache->color_key && (dds->cache->dwColorKeyHighPal != chroma_hi)) ||
-		(dds->cache->color_key && (dds->cache->dwColorKeyLowPal != chroma_lw))
-	)
-	{
-		dds->cache->color_key = chroma_key;
-		dds->cache->dwColorKeyLowPal  = chroma_lw;
-		dds->cache->dwColorKeyHighPal = chroma_hi;
-
-		DWORD *ptr = data;
-		GLuint x, y;
-		for(y = 0; y < h; y++)
+	if(!cached)
+	{
+		if(!dds->cache)
 		{
-			for(x = 0; x < w; x++)
+			dds->cache = hal_alloc(HEAP_LARGE, sizeof(DDSURF_cache_t)+pitch4*4*h, w);
+			if(dds->cache == NULL)
 			{
-				ptr[x] = pal->colors[src[x]];
-				if((pal_flags & DDRAWIPAL_ALPHA) == 0)
-				{
-					ptr[x] |= 0xFF000000; // set alpha to 1.0, when is not valid on palette
-				}
+				ERR("Malloc fail");
+				return;
+			}
+			dds->cache->pal_stamp = 0xFFFFFFFF;
+			dds->cache->color_key = TRUE;
+			dds->cache->dwColorKeyLowPal  = 0xFFFFFFFF;
+			dds->cache->dwColorKeyHighPal = 0xFFFFFFFF;
+		
+			dds->cache->data = (DWORD*)(dds->cache+1);
+		}
+		data = dds->cache->data;
+
+	/*
+		P = pal->stamp == dds->cache->pal_stamp
+		S = chroma_key
+		C = dds->cache->color_key
+		L = dds->cache->dwColorKeyLowPal == chroma_lw
+		H = dds->cache->dwColorKeyHighPal == chroma_hi
+
+		P S C L H   update
+		---------
+		0 X X X X = 1
+		1 0 0 0 0 = 0
+		1 0 0 0 1 = 0
+		1 0 0 1 0 = 0
+		1 0 0 1 1 = 0
+		1 0 1 0 0 = 1
+		1 0 1 0 1 = 1
+		1 0 1 1 0 = 1
+		1 0 1 1 1 = 1
+		1 1 0 0 0 = 1
+		1 1 0 0 1 = 1
+		1 1 0 1 0 = 1
+		1 1 0 1 1 = 1
+		1 1 1 0 0 = 1
+		1 1 1 0 1 = 1
+		1 1 1 1 0 = 1
+		1 1 1 1 1 = 0
+
+		minimal form:
+		~bc + b~c + ~a + c~e + c~d
+		~SC + S~C + ~P + C~H + C~L
+	*/
+		if(
+			((!chroma_key) &&  dds->cache->color_key  ) ||
+		 	(  chroma_key  && (!dds->cache->color_key)) ||
+		 	(pal->stamp != dds->cache->pal_stamp)	||
+			(dds->cache->color_key && (dds->cache->dwColorKeyHighPal != chroma_hi)) ||
+			(dds->cache->color_key && (dds->cache->dwColorKeyLowPal != chroma_lw))
+		)
+		{
+			dds->cache->color_key = chroma_key;
+			dds->cache->dwColorKeyLowPal  = chroma_lw;
+			dds->cache->dwColorKeyHighPal = chroma_hi;
 
-				if(chroma_key)
+			DWORD *ptr = data;
+			GLuint x, y;
+			for(y = 0; y < h; y++)
+			{
+				for(x = 0; x < w; x++)
 				{
-					if(src[x] >= chroma_lw && src[x] <= chroma_hi)
+					ptr[x] = pal->colors[src[x]];
+					if((pal_flags & DDRAWIPAL_ALPHA) == 0)
 					{
-						ptr[x] &= 0x00FFFFFF;
+						ptr[x] |= 0xFF000000; // set alpha to 1.0, when is not valid on palette
+					}
+
+					if(chroma_key)
+					{
+						if(src[x] >= chroma_lw && src[x] <= chroma_hi)
+						{
+							ptr[x] &= 0x00FFFFFF;
+						}
 					}
 				}
+				src += src_pitch;
+				ptr += pitch4;
+			}
+
+			if(entry->texcache.budget > 0)
+			{
+				MesaTexCachePut(ctx, &key, data, pitch4*4*h);
 			}
-			src += src_pitch;
-			ptr += pitch4;
 		}
 	}
 	
@@ -1017,6 +1360,10 @@ NUKED_LOCAL void MesaBufferUploadTexturePalette(mesa3d_ctx_t *ctx, mesa3d_textur
 #if 0
 	MesaTempFree(ctx, data);
 #endif
+	if(cached)
+	{
+		MesaTexCacheDone(ctx, data);
+	}
 	ctx->state.tmu[tmu].update = TRUE;
 }
 
@@ -1045,3 +1392,127 @@ NUKED_LOCAL void MesaTexImage2D(mesa3d_ctx_t *ctx, GLenum target, GLint level, G
 #endif
 }
 
+/* vertex buffer mirrors, created on first SETSTREAMSOURCE, refreshed after lock */
+NUKED_LOCAL mesa_vbo_t *MesaVBOGet(mesa3d_ctx_t *ctx, surface_id sid)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	mesa_vbo_t *vbo = SurfaceGetVBO(sid, ctx);
+	if(vbo)
+	{
+		return vbo;
+	}
+
+	DDSURF *surf = SurfaceGetSURF(sid);
+	if(surf == NULL || surf->fpVidMem == 0 || surf->lpGbl == NULL)
+	{
+		return NULL;
+	}
+
+	/* only explicit (write only) vertex buffers, see CreateExecuteBuffer32 */
+	if((surf->dwCaps2 & DDSCAPS2_VERTEXBUFFER) == 0 || (surf->dwCaps & DDSCAPS_WRITEONLY) == 0)
+	{
+		return NULL;
+	}
+
+	vbo = hal_calloc(HEAP_NORMAL, sizeof(mesa_vbo_t), 0);
+	if(vbo)
+	{
+		vbo->ctx = ctx;
+		vbo->sid = sid;
+		vbo->size = surf->lpGbl->dwLinearSize;
+
+		GL_CHECK(entry->proc.pglGenBuffers(1, &vbo->buf));
+		GL_CHECK(entry->proc.pglBindBuffer(GL_ARRAY_BUFFER, vbo->buf));
+		GL_CHECK(entry->proc.pglBufferData(GL_ARRAY_BUFFER, vbo->size, (void*)surf->fpVidMem, GL_STATIC_DRAW));
+		GL_CHECK(entry->proc.pglBindBuffer(GL_ARRAY_BUFFER, 0));
+		PERF_ADD(upload_bytes, vbo->size);
+
+		vbo->next = ctx->vbo_first;
+		ctx->vbo_first = vbo;
+
+		SurfaceAttachVBO(sid, vbo);
+
+		TOPIC("VBO", "new VBO: %d, sid=%d, size=%d", vbo->buf, sid, vbo->size);
+	}
+
+	return vbo;
+}
+
+NUKED_LOCAL void MesaVBOUpdate(mesa3d_ctx_t *ctx, mesa_vbo_t *vbo)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+
+	if(vbo->dirty_start < vbo->dirty_end)
+	{
+		DDSURF *surf = SurfaceGetSURF(vbo->sid);
+		if(surf && surf->fpVidMem)
+		{
+			DWORD size = vbo->dirty_end - vbo->dirty_start;
+
+			GL_CHECK(entry->proc.pglBindBuffer(GL_ARRAY_BUFFER, vbo->buf));
+			GL_CHECK(entry->proc.pglBufferSubData(GL_ARRAY_BUFFER, vbo->dirty_start, size,
+				((BYTE*)surf->fpVidMem) + vbo->dirty_start));
+			PERF_ADD(upload_bytes, size);
+
+			TOPIC("VBO", "VBO %d update %d - %d", vbo->buf, vbo->dirty_start, vbo->dirty_end);
+		}
+
+		vbo->dirty_start = 0;
+		vbo->dirty_end = 0;
+	}
+}
+
+NUKED_LOCAL void MesaVBODestroy(mesa_vbo_t *vbo, BOOL ctx_cleanup, surface_id surface_delete)
+{
+	mesa3d_ctx_t *ctx = vbo->ctx;
+	mesa_vbo_t *item = ctx->vbo_first;
+	mesa_vbo_t *last = NULL;
+	int i;
+
+	for(i = 0; i < MESA_MAX_STREAM; i++)
+	{
+		if(ctx->vstream[i].vbo == vbo)
+		{
+			ctx->vstream[i].vbo = NULL;
+		}
+	}
+
+	while(item)
+	{
+		if(item == vbo)
+		{
+			if(last)
+			{
+				last->next = item->next;
+			}
+			else
+			{
+				ctx->vbo_first = item->next;
+			}
+			break;
+		}
+		last = item;
+		item = item->next;
+	}
+
+	if(!ctx_cleanup)
+	{
+		GL_CHECK(ctx->entry->proc.pglDeleteBuffers(1, &vbo->buf));
+		TOPIC("VBO", "delete VBO: %d", vbo->buf);
+	}
+
+	if(vbo->sid != surface_delete)
+	{
+		SurfaceDeattachVBO(vbo->sid, vbo);
+	}
+
+	hal_free(HEAP_NORMAL, vbo);
+}
+
+NUKED_LOCAL void MesaVBODestroyAll(mesa3d_ctx_t *ctx)
+{
+	while(ctx->vbo_first)
+	{
+		MesaVBODestroy(ctx->vbo_first, TRUE, 0);
+	}
+}
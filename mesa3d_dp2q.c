@@ -0,0 +1,399 @@
+/******************************************************************************
+ * Copyright (c) 2025 Jaroslav Hensl                                          *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+ ******************************************************************************/
+#ifndef NUKED_SKIP
+#include <windows.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ddraw.h>
+#include <ddrawi.h>
+#include "ddrawi_ddk.h"
+#include "d3dhal_ddk.h"
+#include "vmdahal32.h"
+#include "vmhal9x.h"
+#include "mesa3d.h"
+#include "osmesa.h"
+
+#include "nocrt.h"
+#endif
+
+/*
+ * DP2 worker thread (env.dp2thread).
+ *
+ * DrawPrimitives2 command buffer and user memory vertices are copied to
+ * bounded ring (env.dp2queue items) and translated by MesaDraw6 on
+ * per-context thread, so application can continue with next frame.
+ * Worker owns GL context only when translating, any other GL_BLOCK_BEGIN
+ * (and Lock32, Blt32, Flip32 through SurfaceCtxSync) waits until queue is
+ * empty and worker released the context (MesaDP2Sync).
+ *
+ * Only buffers which MesaDraw6 can fully parse are queued, anything else
+ * (unknown command for runtime callback, invalid buffer) is processed on
+ * caller thread, so runtime gets correct error offset. Failure of queued
+ * buffer is returned by next DrawPrimitives2 call (MesaDP2Error).
+ */
+
+#define DP2Q_ITEM(_ctx, _n) (&(_ctx)->dp2q.items[(_n) % (_ctx)->dp2q.depth])
+
+static void dp2q_release(mesa3d_ctx_t *ctx)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+
+	if(ctx->thread_id == GetCurrentThreadId())
+	{
+		if(entry->os)
+		{
+			entry->proc.pOSMesaMakeCurrent(NULL, NULL, 0, 0, 0);
+		}
+		else
+		{
+			entry->proc.pDrvSetContext(NULL, NULL, NULL);
+		}
+		ctx->thread_id = 0;
+	}
+}
+
+static void dp2q_sync_lock(mesa3d_ctx_t *ctx)
+{
+	while(InterlockedExchange(&ctx->dp2q.sync_lock, 1) != 0)
+	{
+		Sleep(0);
+	}
+}
+
+static void dp2q_sync_unlock(mesa3d_ctx_t *ctx)
+{
+	InterlockedExchange(&ctx->dp2q.sync_lock, 0);
+}
+
+/* worker is only writer, keep first failure until MesaDP2Error */
+static void dp2q_error(mesa3d_ctx_t *ctx, DWORD rc)
+{
+	if(ctx->dp2q.error == DD_OK)
+	{
+		InterlockedExchange(&ctx->dp2q.error, (LONG)rc);
+	}
+}
+
+static BOOL dp2q_copy(BYTE **buf, DWORD *buf_size, const void *src, DWORD size)
+{
+	if(*buf_size < size)
+	{
+		DWORD new_size = (size + 0xFFFF) & ~((DWORD)0xFFFF);
+		if(!hal_realloc(HEAP_LARGE, (void**)buf, new_size, FALSE))
+		{
+			return FALSE;
+		}
+		*buf_size = new_size;
+	}
+	memcpy(*buf, src, size);
+
+	return TRUE;
+}
+
+static DWORD WINAPI MesaDP2Thread(LPVOID lpParameter)
+{
+	mesa3d_ctx_t *ctx = (mesa3d_ctx_t*)lpParameter;
+
+	for(;;)
+	{
+		LONG req;
+
+		WaitForSingleObject(ctx->dp2q.work, INFINITE);
+
+		while(ctx->dp2q.head != ctx->dp2q.tail)
+		{
+			mesa_dp2_item_t *item = DP2Q_ITEM(ctx, ctx->dp2q.head);
+			DWORD error_offset = 0;
+			DWORD rc;
+
+			MesaBlockLock(ctx);
+			if(ctx->thread_id == GetCurrentThreadId() || MesaSetCtx(ctx))
+			{
+				rc = MesaDraw6(ctx, item->cmd, item->cmd + item->cmd_len,
+					item->vertices, item->UMVertices, item->fvf, &error_offset, NULL, item->vertices_cnt);
+
+				if(rc != DD_OK)
+				{
+					WARN("MesaDraw6(...) = %d, offset=%u", rc, error_offset);
+					dp2q_error(ctx, rc);
+				}
+			}
+			else
+			{
+				/* next calls are processed on caller thread, which set context itself */
+				WARN("DP2 thread: cannot set context");
+				dp2q_error(ctx, DDERR_GENERIC);
+				ctx->dp2q.disabled = TRUE;
+			}
+			MesaBlockUnlock(ctx);
+
+			InterlockedIncrement(&ctx->dp2q.head);
+			SetEvent(ctx->dp2q.space);
+		}
+
+		if(ctx->dp2q.quit)
+		{
+			break;
+		}
+
+		/* every waiter with generation <= req is done now */
+		req = ctx->dp2q.sync_req;
+		if(req != ctx->dp2q.sync_done)
+		{
+			MesaBlockLock(ctx);
+			dp2q_release(ctx);
+			MesaBlockUnlock(ctx);
+
+			dp2q_sync_lock(ctx);
+			InterlockedExchange(&ctx->dp2q.sync_done, req);
+			SetEvent(ctx->dp2q.idle);
+			dp2q_sync_unlock(ctx);
+		}
+	}
+
+	MesaBlockLock(ctx);
+	dp2q_release(ctx);
+	MesaBlockUnlock(ctx);
+
+	return 0;
+}
+
+static BOOL dp2q_init(mesa3d_ctx_t *ctx)
+{
+	DWORD depth = ctx->entry->env.dp2queue;
+
+	if(depth < 1)
+		depth = 1;
+
+	if(depth > MESA_DP2Q_MAX)
+		depth = MESA_DP2Q_MAX;
+
+	ctx->dp2q.depth = depth;
+	ctx->dp2q.head = 0;
+	ctx->dp2q.tail = 0;
+	ctx->dp2q.sync_req = 0;
+	ctx->dp2q.sync_done = 0;
+	ctx->dp2q.sync_lock = 0;
+	ctx->dp2q.error = DD_OK;
+	ctx->dp2q.quit = FALSE;
+
+	ctx->dp2q.work  = CreateEventA(NULL, FALSE, FALSE, NULL);
+	ctx->dp2q.space = CreateEventA(NULL, FALSE, FALSE, NULL);
+	ctx->dp2q.idle  = CreateEventA(NULL, TRUE, FALSE, NULL);
+	if(ctx->dp2q.work == NULL || ctx->dp2q.space == NULL || ctx->dp2q.idle == NULL)
+	{
+		WARN("CreateEvent failed");
+		MesaDP2Free(ctx);
+		return FALSE;
+	}
+
+	ctx->dp2q.thread = CreateThread(NULL, 0, MesaDP2Thread, ctx, 0, &ctx->dp2q.thread_id);
+	if(ctx->dp2q.thread == NULL)
+	{
+		WARN("CreateThread failed");
+		MesaDP2Free(ctx);
+		return FALSE;
+	}
+
+	TOPIC("DP2Q", "DP2 thread for ctx=%d, depth=%u", ctx->id, depth);
+
+	return TRUE;
+}
+
+/*
+ * Queue DP2 call, return FALSE when it has to be processed synchronously
+ * (disabled, unknown size of user memory vertices, buffer not fully parsable
+ * by MesaDraw6). vertex_size = 0 means size by FVF code.
+ */
+NUKED_LOCAL BOOL MesaDP2Push(mesa3d_ctx_t *ctx, LPBYTE cmdBufferStart, DWORD cmdLength,
+	LPBYTE vertices, LPBYTE UMVertices, DWORD fvf, DWORD vertices_cnt, DWORD vertex_size, BOOL usermem)
+{
+	mesa_dp2_item_t *item;
+
+	if(!ctx->entry->env.dp2thread || ctx->dp2q.disabled)
+		return FALSE;
+
+	if(vertex_size == 0)
+		vertex_size = MesaFVFSize(fvf);
+
+	if(usermem && vertices != NULL && vertex_size == 0)
+		return FALSE;
+
+	if(!MesaDraw6Queueable(cmdBufferStart, cmdBufferStart + cmdLength))
+	{
+		TOPIC("DP2Q", "ctx=%d: buffer processed synchronously", ctx->id);
+		return FALSE;
+	}
+
+	if(ctx->dp2q.thread == NULL)
+	{
+		if(!dp2q_init(ctx))
+		{
+			ctx->dp2q.disabled = TRUE;
+			return FALSE;
+		}
+	}
+
+	/* queue full, worker sets space event after every item */
+	if((DWORD)(ctx->dp2q.tail - ctx->dp2q.head) >= ctx->dp2q.depth)
+	{
+		uint64_t wait_start = GetTimeTMS();
+		PERF_ADD(lock_stalls, 1);
+		while((DWORD)(ctx->dp2q.tail - ctx->dp2q.head) >= ctx->dp2q.depth)
+		{
+			WaitForSingleObject(ctx->dp2q.space, INFINITE);
+		}
+		PERF_ADD(lock_time, GetTimeTMS() - wait_start);
+	}
+
+	item = DP2Q_ITEM(ctx, ctx->dp2q.tail);
+
+	if(!dp2q_copy(&item->cmd, &item->cmd_size, cmdBufferStart, cmdLength))
+		return FALSE;
+
+	item->cmd_len      = cmdLength;
+	item->fvf          = fvf;
+	item->vertices_cnt = vertices_cnt;
+	item->vertices     = vertices;
+	item->UMVertices   = UMVertices;
+
+	if(usermem && vertices != NULL)
+	{
+		if(!dp2q_copy(&item->vertices_mem, &item->vertices_size, vertices, vertices_cnt*vertex_size))
+			return FALSE;
+
+		/* both points to lpVertices + dwVertexOffset */
+		item->vertices   = item->vertices_mem;
+		item->UMVertices = item->vertices_mem;
+	}
+
+	/* context has to be free for worker */
+	MesaBlockLock(ctx);
+	dp2q_release(ctx);
+	MesaBlockUnlock(ctx);
+
+	InterlockedIncrement(&ctx->dp2q.tail);
+	SetEvent(ctx->dp2q.work);
+
+	return TRUE;
+}
+
+/*
+ * Wait to empty queue and take GL context back from worker. Every caller
+ * takes own sync generation and waits until worker publishes it, idle
+ * event is reset only by waiter which generation is not done yet, so
+ * worker will set it again.
+ */
+NUKED_LOCAL void MesaDP2Sync(mesa3d_ctx_t *ctx)
+{
+	uint64_t wait_start;
+	LONG gen;
+
+	if(ctx->dp2q.thread == NULL || ctx->dp2q.thread_id == GetCurrentThreadId())
+		return;
+
+	if(ctx->dp2q.head == ctx->dp2q.tail && ctx->thread_id != ctx->dp2q.thread_id)
+		return;
+
+	wait_start = GetTimeTMS();
+	gen = InterlockedIncrement(&ctx->dp2q.sync_req);
+	SetEvent(ctx->dp2q.work);
+	for(;;)
+	{
+		dp2q_sync_lock(ctx);
+		if((LONG)(ctx->dp2q.sync_done - gen) >= 0)
+		{
+			dp2q_sync_unlock(ctx);
+			break;
+		}
+		ResetEvent(ctx->dp2q.idle);
+		dp2q_sync_unlock(ctx);
+
+		WaitForSingleObject(ctx->dp2q.idle, INFINITE);
+	}
+	PERF_ADD(lock_time, GetTimeTMS() - wait_start);
+
+	TOPIC("DP2Q", "sync ctx=%d", ctx->id);
+}
+
+/* return and clear failure of queued DP2 calls */
+NUKED_LOCAL DWORD MesaDP2Error(mesa3d_ctx_t *ctx)
+{
+	return (DWORD)InterlockedExchange(&ctx->dp2q.error, (LONG)DD_OK);
+}
+
+NUKED_LOCAL void MesaDP2Free(mesa3d_ctx_t *ctx)
+{
+	int i;
+
+	if(ctx->dp2q.thread != NULL)
+	{
+		if(ctx->entry->pid == GetCurrentProcessId())
+		{
+			ctx->dp2q.quit = TRUE;
+			SetEvent(ctx->dp2q.work);
+			if(WaitForSingleObject(ctx->dp2q.thread, 5000) != WAIT_OBJECT_0)
+			{
+				WARN("DP2 thread not terminated");
+			}
+		}
+		CloseHandle(ctx->dp2q.thread);
+		ctx->dp2q.thread = NULL;
+		ctx->dp2q.thread_id = 0;
+	}
+
+	if(ctx->dp2q.work != NULL)
+	{
+		CloseHandle(ctx->dp2q.work);
+		ctx->dp2q.work = NULL;
+	}
+
+	if(ctx->dp2q.space != NULL)
+	{
+		CloseHandle(ctx->dp2q.space);
+		ctx->dp2q.space = NULL;
+	}
+
+	if(ctx->dp2q.idle != NULL)
+	{
+		CloseHandle(ctx->dp2q.idle);
+		ctx->dp2q.idle = NULL;
+	}
+
+	for(i = 0; i < MESA_DP2Q_MAX; i++)
+	{
+		if(ctx->dp2q.items[i].cmd)
+		{
+			hal_free(HEAP_LARGE, ctx->dp2q.items[i].cmd);
+		}
+
+		if(ctx->dp2q.items[i].vertices_mem)
+		{
+			hal_free(HEAP_LARGE, ctx->dp2q.items[i].vertices_mem);
+		}
+	}
+	memset(&ctx->dp2q.items[0], 0, sizeof(ctx->dp2q.items));
+}
@@ -92,8 +92,16 @@ NUKED_INLINE void LoadColor1(mesa3d_entry_t *entry, mesa3d_ctx_t *ctx, DWORD col
 	MESA_D3DCOLOR_TO_FV(color, cv);
 	entry->proc.pglColor4fv(&cv[0]);
 
-	if(!localonly && ctx->state.material.lighting && ctx->state.material.color_vertex)
+	if(!localonly && ctx->state.material.lighting && ctx->state.material.color_vertex &&
+		(ctx->state.material.untracked & MESA_MAT_C1) != 0)
 	{
+		/* usually same color for whole primitive or mesh */
+		if(ctx->state.material.last_valid[0] && ctx->state.material.last_color[0] == color)
+			return;
+
+		ctx->state.material.last_color[0] = color;
+		ctx->state.material.last_valid[0] = TRUE;
+
 		if((ctx->state.material.untracked & (MESA_MAT_DIFFUSE_C1 | MESA_MAT_AMBIENT_C1)) == 
 			(MESA_MAT_DIFFUSE_C1 | MESA_MAT_AMBIENT_C1))
 		{
@@ -123,10 +131,18 @@ NUKED_INLINE void LoadColor1(mesa3d_entry_t *entry, mesa3d_ctx_t *ctx, DWORD col
 NUKED_INLINE void LoadColor2(mesa3d_entry_t *entry, mesa3d_ctx_t *ctx, DWORD color)
 {
 	GLfloat cv[4];
-	MESA_D3DCOLOR_TO_FV(color, cv);
 
-	if(ctx->state.material.lighting && ctx->state.material.color_vertex)
+	if(ctx->state.material.lighting && ctx->state.material.color_vertex &&
+		((ctx->state.material.untracked & MESA_MAT_C2) != 0 || ctx->state.specular_vertex))
 	{
+		if(ctx->state.material.last_valid[1] && ctx->state.material.last_color[1] == color)
+			return;
+
+		ctx->state.material.last_color[1] = color;
+		ctx->state.material.last_valid[1] = TRUE;
+
+		MESA_D3DCOLOR_TO_FV(color, cv);
+
 		if((ctx->state.material.untracked & (MESA_MAT_DIFFUSE_C2 | MESA_MAT_AMBIENT_C2)) ==
 			(MESA_MAT_DIFFUSE_C2 | MESA_MAT_AMBIENT_C2))
 		{
@@ -199,6 +215,46 @@ NUKED_LOCAL void MesaDrawVertex(mesa3d_ctx_t *ctx, LPD3DVERTEX vertex)
 	entry->proc.pglVertex3f(vertex->x, vertex->y, vertex->z);
 }
 
+/* size of one vertex in bytes */
+NUKED_LOCAL DWORD MesaFVFSize(DWORD fvf)
+{
+	DWORD size = 0;
+	DWORD i, cnt;
+
+	if(fvf & D3DFVF_RESERVED0)
+		size += 4;
+
+	switch(fvf & D3DFVF_POSITION_MASK)
+	{
+		case D3DFVF_XYZ:    size += 3*4; break;
+		case D3DFVF_XYZRHW: size += 4*4; break;
+		case D3DFVF_XYZB1:  size += 4*4; break;
+		case D3DFVF_XYZB2:  size += 5*4; break;
+		case D3DFVF_XYZB3:  size += 6*4; break;
+		case D3DFVF_XYZB4:  size += 7*4; break;
+		case D3DFVF_XYZB5:  size += 8*4; break;
+	}
+
+	if(fvf & D3DFVF_NORMAL)    size += 3*4;
+	if(fvf & D3DFVF_RESERVED1) size += 4;
+	if(fvf & D3DFVF_DIFFUSE)   size += 4;
+	if(fvf & D3DFVF_SPECULAR)  size += 4;
+
+	cnt = (fvf & D3DFVF_TEXCOUNT_MASK) >> D3DFVF_TEXCOUNT_SHIFT;
+	for(i = 0; i < cnt; i++)
+	{
+		switch((fvf >> (16 + i*2)) & 0x3)
+		{
+			case D3DFVF_TEXTUREFORMAT1: size += 1*4; break;
+			case D3DFVF_TEXTUREFORMAT2: size += 2*4; break;
+			case D3DFVF_TEXTUREFORMAT3: size += 3*4; break;
+			case D3DFVF_TEXTUREFORMAT4: size += 4*4; break;
+		}
+	}
+
+	return size;
+}
+
 NUKED_LOCAL void MesaFVFSet(mesa3d_ctx_t *ctx, DWORD fvf_code)
 {
 	if(ctx->state.vertex.code == fvf_code)
@@ -212,6 +268,7 @@ NUKED_LOCAL void MesaFVFSet(mesa3d_ctx_t *ctx, DWORD fvf_code)
 
 	ctx->state.vertex.code = fvf_code;
 	MesaFVFRecalc(ctx);
+	MesaVertexEmitSelect(ctx);
 	ctx->state.fvf_shader_dirty = FALSE;
 
 	TOPIC("SHADER", "MesaFVFSet type=0x%X, realsize=%d",
@@ -237,6 +294,7 @@ NUKED_LOCAL void MesaFVFRecalc(mesa3d_ctx_t *ctx)
 	int offset = 0; // in DW
 	int i;
 	int num_coords;
+	GLuint prog = 0;
 
 	DWORD fvf_code = ctx->state.vertex.code;
 
@@ -404,8 +462,12 @@ NUKED_LOCAL void MesaFVFRecalc(mesa3d_ctx_t *ctx)
 
 		if(vs->code_size != 0)
 		{
-			ERR("VS contain code (handle=0x%X)", fvf_code);
-			return;
+			prog = MesaVSProgram(ctx, vs);
+			if(prog == 0)
+			{
+				ERR("VS code cannot be used (handle=0x%X)", fvf_code);
+				return;
+			}
 		}
 
 		TOPIC("SHADER", "shader handle = 0x%X", fvf_code);
@@ -415,6 +477,7 @@ NUKED_LOCAL void MesaFVFRecalc(mesa3d_ctx_t *ctx)
 		MesaVSSetVertex(ctx, vs);
 	}
 
+	MesaVSBind(ctx, prog);
 	MesaFVFRecalcCoords(ctx);
 	
 	ctx->state.vertex.fast_draw = FALSE;
@@ -482,11 +545,253 @@ NUKED_LOCAL void MesaFVFRecalcCoords(mesa3d_ctx_t *ctx)
 #endif
 
 
+/*
+ * Specialized vertex emitters for common FVF combinations (list is in
+ * mesa3d_fvflist.h). Selected by MesaVertexEmitSelect only when state
+ * doesn't need any per vertex decision: texture coordinates sets maps 1:1
+ * to TMUs, no vertex blending and no color material by glMaterial.
+ */
+#define FVFITEM(_n, _rhw, _normal, _diffuse, _tex) \
+	static void MesaVertexEmitAttr_ ## _n(mesa3d_entry_t *entry, mesa3d_ctx_t *ctx, const BYTE *v){ \
+		const GLfloat *fv = (const GLfloat*)v; \
+		if(_tex >= 1){ \
+			const GLfloat *tc = fv + ctx->state.vertex.pos.texcoords[0]; \
+			entry->proc.pglMultiTexCoord4f(GL_TEXTURE0, tc[0], tc[1], 0.0f, 1.0f);} \
+		if(_tex >= 2){ \
+			const GLfloat *tc = fv + ctx->state.vertex.pos.texcoords[1]; \
+			entry->proc.pglMultiTexCoord4f(GL_TEXTURE1, tc[0], tc[1], 0.0f, 1.0f);} \
+		if(_diffuse){ \
+			GLfloat cv[4]; \
+			MESA_D3DCOLOR_TO_FV(((const DWORD*)v)[ctx->state.vertex.pos.diffuse], cv); \
+			entry->proc.pglColor4fv(&cv[0]); \
+		}else{ \
+			entry->proc.pglColor4fv(&ctx->state.vertex.emit_diffuse[0]);} \
+		if(_normal){ \
+			entry->proc.pglNormal3fv(fv + ctx->state.vertex.pos.normal); \
+		}else{ \
+			entry->proc.pglNormal3f(0.0f, 0.0f, 1.0f);} \
+	} \
+	static void MesaVertexEmit_ ## _n(mesa3d_entry_t *entry, mesa3d_ctx_t *ctx, const BYTE *v){ \
+		const GLfloat *fv = (const GLfloat*)v; \
+		MesaVertexEmitAttr_ ## _n(entry, ctx, v); \
+		if(_rhw){ \
+			GLfloat tmp4[4]; \
+			const GLfloat *pv = fv + ctx->state.vertex.pos.xyzw; \
+			SV_UNPROJECT(tmp4, pv[0], pv[1], pv[2], pv[3]); \
+			entry->proc.pglVertex4fv(&tmp4[0]); \
+		}else{ \
+			entry->proc.pglVertex3fv(fv + ctx->state.vertex.pos.xyzw);} \
+	}
+
+#include "mesa3d_fvflist.h"
+#undef FVFITEM
+
+typedef struct mesa_vertex_emit_item
+{
+	BOOL xyzrhw;
+	BOOL normal;
+	BOOL diffuse;
+	int texcoords;
+	mesa_vertex_emit_t emit;
+	mesa_vertex_emit_t emit_attr;
+} mesa_vertex_emit_item_t;
+
+#define FVFITEM(_n, _rhw, _normal, _diffuse, _tex) {_rhw, _normal, _diffuse, _tex, MesaVertexEmit_ ## _n, MesaVertexEmitAttr_ ## _n},
+
+static const mesa_vertex_emit_item_t vertex_emit_table[] = {
+#include "mesa3d_fvflist.h"
+};
+
+#undef FVFITEM
+
+/* select specialized emitter for current FVF and state, NULL = use generic */
+NUKED_LOCAL void MesaVertexEmitSelect(mesa3d_ctx_t *ctx)
+{
+	BOOL normal = FALSE;
+	BOOL diffuse = FALSE;
+	int tex = 0;
+	int i;
+
+	ctx->state.vertex.emit = NULL;
+	ctx->state.vertex.emit_attr = NULL;
+
+	if(ctx->state.vertex.shader || ctx->state.vertex.program ||
+		ctx->matrix.weight != 0 || ctx->state.vertex.betas != 0)
+	{
+		return;
+	}
+
+	/* glMaterial per vertex in LoadColor1/LoadColor2 */
+	if(ctx->state.material.lighting && ctx->state.material.color_vertex)
+	{
+		if(ctx->state.material.untracked != 0 || ctx->state.specular_vertex)
+			return;
+	}
+
+	if(!ctx->state.vertex.xyzrhw)
+	{
+		if(ctx->state.vertex.type.xyzw != MESA_VDT_FLOAT3)
+			return;
+
+		switch(ctx->state.vertex.type.normal)
+		{
+			case MESA_VDT_NONE:
+				break;
+			case MESA_VDT_FLOAT3:
+				normal = TRUE;
+				break;
+			default:
+				return;
+		}
+	}
+	else if(ctx->state.vertex.type.xyzw != MESA_VDT_FLOAT4)
+	{
+		return;
+	}
+
+	switch(ctx->state.vertex.type.diffuse)
+	{
+		case MESA_VDT_NONE:
+			break;
+		case MESA_VDT_D3DCOLOR:
+			diffuse = TRUE;
+			break;
+		default:
+			return;
+	}
+
+	/* textured units have to be first and use own 2D coordinates */
+	for(i = 0; i < ctx->tmu_count; i++)
+	{
+		if(!ctx->state.tmu[i].image)
+			break;
+
+		if(ctx->state.tmu[i].coordindex != i || ctx->state.tmu[i].coordscalc_used ||
+			ctx->state.tmu[i].projected || ctx->state.vertex.type.texcoords[i] != MESA_VDT_FLOAT2)
+		{
+			return;
+		}
+		tex++;
+	}
+
+	for(; i < ctx->tmu_count; i++)
+	{
+		if(ctx->state.tmu[i].image)
+			return;
+	}
+
+	for(i = 0; i < sizeof(vertex_emit_table)/sizeof(vertex_emit_table[0]); i++)
+	{
+		const mesa_vertex_emit_item_t *item = &vertex_emit_table[i];
+		if(item->xyzrhw == ctx->state.vertex.xyzrhw && item->normal == normal &&
+			item->diffuse == diffuse && item->texcoords == tex)
+		{
+			MESA_D3DCOLOR_TO_FV(ctx->dxif >= MESA_CTX_IF_DX8 ? DEF_DIFFUSE_DX8 : DEF_DIFFUSE,
+				ctx->state.vertex.emit_diffuse);
+			ctx->state.vertex.emit = item->emit;
+			ctx->state.vertex.emit_attr = item->emit_attr;
+			break;
+		}
+	}
+}
+
+NUKED_INLINE void MesaVertexAttrib(mesa3d_entry_t *entry, mesa3d_ctx_t *ctx, int reg, int index)
+{
+	const DWORD *dw = ctx->state.vertex.attrib[reg].ptr + ctx->state.vertex.attrib[reg].stride32*index;
+	const GLfloat *fv = (const GLfloat*)dw;
+	GLfloat tmp4[4];
+
+	switch(ctx->state.vertex.attrib[reg].type)
+	{
+		case MESA_VDT_FLOAT1:
+			entry->proc.pglVertexAttrib4fARB(reg, fv[0], 0.0f, 0.0f, 1.0f);
+			break;
+		case MESA_VDT_FLOAT2:
+			entry->proc.pglVertexAttrib4fARB(reg, fv[0], fv[1], 0.0f, 1.0f);
+			break;
+		case MESA_VDT_FLOAT3:
+			entry->proc.pglVertexAttrib4fARB(reg, fv[0], fv[1], fv[2], 1.0f);
+			break;
+		case MESA_VDT_FLOAT4:
+			entry->proc.pglVertexAttrib4fvARB(reg, fv);
+			break;
+		case MESA_VDT_D3DCOLOR:
+			MESA_D3DCOLOR_TO_FV(dw[0], tmp4);
+			entry->proc.pglVertexAttrib4fvARB(reg, tmp4);
+			break;
+		case MESA_VDT_UBYTE4:
+		{
+			const BYTE *b = (const BYTE*)dw;
+			entry->proc.pglVertexAttrib4fARB(reg, b[0], b[1], b[2], b[3]);
+			break;
+		}
+		case MESA_VDT_USHORT2:
+		{
+			const SHORT *s = (const SHORT*)dw;
+			entry->proc.pglVertexAttrib4fARB(reg, s[0], s[1], 0.0f, 1.0f);
+			break;
+		}
+		case MESA_VDT_USHORT4:
+		{
+			const SHORT *s = (const SHORT*)dw;
+			entry->proc.pglVertexAttrib4fARB(reg, s[0], s[1], s[2], s[3]);
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+/* vertex data for ARB vertex program */
+NUKED_FAST void MesaVertexAttribStream(mesa3d_entry_t *entry, mesa3d_ctx_t *ctx, int index)
+{
+	DWORD mask = ctx->state.vertex.attrib_mask;
+	int i;
+
+	for(i = 1; i < MESA_VS_INPUTS; i++)
+	{
+		if(mask & (1 << i))
+		{
+			MesaVertexAttrib(entry, ctx, i, index);
+		}
+	}
+
+	/* attribute 0 emits vertex, so must be last */
+	if(mask & 1)
+	{
+		MesaVertexAttrib(entry, ctx, 0, index);
+	}
+	else
+	{
+		entry->proc.pglVertexAttrib4fARB(0, 0.0f, 0.0f, 0.0f, 1.0f);
+	}
+}
+
 NUKED_FAST void MesaVertexStream(mesa3d_entry_t *entry, mesa3d_ctx_t *ctx, int index)
 {
 	int i;
 	GLfloat tmp4[4];
 
+	if(ctx->state.vertex.emit != NULL)
+	{
+		const BYTE *v = ctx->vstream[0].mem.ptr + ctx->vstream[0].stride*index;
+		DWORD n = (DWORD)index - ctx->state.vertex.unproj.first;
+		if(ctx->state.vertex.unproj.ptr == ctx->vstream[0].mem.ptr && n < ctx->state.vertex.unproj.cnt)
+		{
+			ctx->state.vertex.emit_attr(entry, ctx, v);
+			entry->proc.pglVertex4fv(ctx->state.vertex.unproj.pos + n*4);
+			return;
+		}
+		ctx->state.vertex.emit(entry, ctx, v);
+		return;
+	}
+
+	if(ctx->state.vertex.program && !ctx->state.vertex.blend_gpu)
+	{
+		MesaVertexAttribStream(entry, ctx, index);
+		return;
+	}
+
 	for(i = 0; i < ctx->tmu_count; i++)
 	{
 		if(ctx->state.tmu[i].image)
@@ -606,6 +911,15 @@ NUKED_FAST void MesaVertexStream(mesa3d_entry_t *entry, mesa3d_ctx_t *ctx, int i
 					break;
 			}
 		}
+		else if(ctx->state.vertex.blend_gpu)
+		{
+			/* blending is done by vertex program, only pass weights */
+			GLfloat *fv = ctx->state.vertex.ptr.xyzw + ctx->state.vertex.ptr.xyzw_stride32*index;
+
+			MesaVetexBlendWeights(ctx, fv+3, ctx->state.vertex.betas, tmp4);
+			entry->proc.pglVertexAttrib4fvARB(1, &tmp4[0]);
+			entry->proc.pglVertex3fv(&fv[0]);
+		}
 		else
 		{
 			GLfloat normal[3];
@@ -628,9 +942,9 @@ NUKED_FAST void MesaVertexStream(mesa3d_entry_t *entry, mesa3d_ctx_t *ctx, int i
 					break;
 			}
 
-			fv = ctx->state.vertex.ptr.normal + ctx->state.vertex.ptr.normal_stride32*index;
+			fv = ctx->state.vertex.ptr.xyzw + ctx->state.vertex.ptr.xyzw_stride32*index;
 
-			MesaVetexBlend(ctx, normal, fv+3, ctx->state.vertex.betas, tmp4);
+			MesaVetexBlendNormal(ctx, normal, fv+3, ctx->state.vertex.betas, tmp4);
 			entry->proc.pglNormal3fv(&tmp4[0]);
 
 			MesaVetexBlend(ctx, fv, fv+3, ctx->state.vertex.betas, tmp4);
@@ -644,6 +958,20 @@ NUKED_FAST void MesaVertexBuffer(mesa3d_entry_t *entry, mesa3d_ctx_t *ctx, BYTE
 	int i;
 	GLfloat tmp4[4];
 
+	if(ctx->state.vertex.emit != NULL)
+	{
+		const BYTE *v = buf + stride8*index;
+		DWORD n = (DWORD)index - ctx->state.vertex.unproj.first;
+		if(ctx->state.vertex.unproj.ptr == buf && n < ctx->state.vertex.unproj.cnt)
+		{
+			ctx->state.vertex.emit_attr(entry, ctx, v);
+			entry->proc.pglVertex4fv(ctx->state.vertex.unproj.pos + n*4);
+			return;
+		}
+		ctx->state.vertex.emit(entry, ctx, v);
+		return;
+	}
+
 	for(i = 0; i < ctx->tmu_count; i++)
 	{
 		if(ctx->state.tmu[i].image)
@@ -765,6 +1093,15 @@ NUKED_FAST void MesaVertexBuffer(mesa3d_entry_t *entry, mesa3d_ctx_t *ctx, BYTE
 					break;
 			}
 		}
+		else if(ctx->state.vertex.blend_gpu)
+		{
+			/* blending is done by vertex program, only pass weights */
+			GLfloat *fv = ((GLfloat*)(buf + index*stride8))+ctx->state.vertex.pos.xyzw;
+
+			MesaVetexBlendWeights(ctx, fv+3, ctx->state.vertex.betas, tmp4);
+			entry->proc.pglVertexAttrib4fvARB(1, &tmp4[0]);
+			entry->proc.pglVertex3fv(&fv[0]);
+		}
 		else
 		{
 			GLfloat normal[3];
@@ -789,7 +1126,7 @@ NUKED_FAST void MesaVertexBuffer(mesa3d_entry_t *entry, mesa3d_ctx_t *ctx, BYTE
 
 			fv = ((GLfloat*)(buf + index*stride8))+ctx->state.vertex.pos.xyzw;
 
-			MesaVetexBlend(ctx, normal, fv+3, ctx->state.vertex.betas, tmp4);
+			MesaVetexBlendNormal(ctx, normal, fv+3, ctx->state.vertex.betas, tmp4);
 			entry->proc.pglNormal3fv(&tmp4[0]);
 
 			MesaVetexBlend(ctx, fv, fv+3, ctx->state.vertex.betas, tmp4);
@@ -893,6 +1230,9 @@ NUKED_LOCAL void MesaVertexDrawStream(mesa3d_ctx_t *ctx, GLenum gltype, DWORD st
 	mesa3d_entry_t *entry = ctx->entry;
 	int i;
 
+	if(MesaVertexDrawUnproject(ctx, gltype, ctx->vstream[0].mem.ptr, start, cnt, ctx->vstream[0].stride))
+		return;
+
 	VETREX_DRAW_SWITCH
 }
 
@@ -924,6 +1264,9 @@ NUKED_LOCAL void MesaVertexDrawBlock(mesa3d_ctx_t *ctx, GLenum gltype, BYTE *ptr
 	mesa3d_entry_t *entry = ctx->entry;
 	int i;
 
+	if(MesaVertexDrawUnproject(ctx, gltype, ptr, start, cnt, stride))
+		return;
+
 	VETREX_DRAW_SWITCH
 }
 
@@ -948,3 +1291,351 @@ NUKED_LOCAL void MesaVertexDrawBlockIndex(mesa3d_ctx_t *ctx, GLenum gltype, BYTE
 #undef INDEX_GET
 
 #undef VETREX_DRAW_SWITCH
+
+/*
+ * Vertices only, for list primitives (GL_TRIANGLES, GL_LINES, GL_POINTS)
+ * which are already open (and culling reversed for triangles), so more
+ * DP2 commands can be merged to one glBegin/glEnd block.
+ */
+#define VERTEX_EMIT_LIST \
+	if(gltype == GL_TRIANGLES){ \
+		for(i = 0; i + 2 < cnt; i += 3){ \
+			VERTEX_GET(start+i+2); \
+			VERTEX_GET(start+i+1); \
+			VERTEX_GET(start+i+0); \
+		} \
+	}else{ \
+		for(i = 0; i < cnt; i++){ \
+			VERTEX_GET(start+i); \
+		} \
+	}
+
+#define VERTEX_GET(_n) MesaVertexStream(entry, ctx, _n)
+
+NUKED_LOCAL void MesaVertexEmitStream(mesa3d_ctx_t *ctx, GLenum gltype, DWORD start, DWORD cnt)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	int i;
+
+	BOOL unproj = MesaVertexUnprojectBegin(ctx, ctx->vstream[0].mem.ptr, ctx->vstream[0].stride, start, cnt, cnt);
+
+	VERTEX_EMIT_LIST
+
+	if(unproj)
+		MesaVertexUnprojectEnd(ctx);
+}
+
+#undef VERTEX_GET
+
+#define INDEX_GET(_p) (index_stride8 == 4 ? dindex[_p]+base : ((DWORD)windex[_p])+base)
+#define VERTEX_GET(_n) MesaVertexStream(entry, ctx, INDEX_GET(_n))
+
+NUKED_LOCAL void MesaVertexEmitStreamIndex(mesa3d_ctx_t *ctx, GLenum gltype, DWORD start, int base, DWORD cnt, void *index, DWORD index_stride8)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	int i;
+
+	WORD  *windex =  (WORD*)index;
+	DWORD *dindex = (DWORD*)index;
+	BOOL unproj = FALSE;
+
+	/* referenced vertex range */
+	if(MESA_UNPROJECT_BATCH(ctx, cnt))
+	{
+		DWORD vmin = ~0UL, vmax = 0, v;
+		for(i = 0; i < cnt; i++)
+		{
+			v = INDEX_GET(start+i);
+			if(v < vmin) vmin = v;
+			if(v > vmax) vmax = v;
+		}
+		unproj = MesaVertexUnprojectBegin(ctx, ctx->vstream[0].mem.ptr, ctx->vstream[0].stride, vmin, vmax - vmin + 1, cnt);
+	}
+
+	VERTEX_EMIT_LIST
+
+	if(unproj)
+		MesaVertexUnprojectEnd(ctx);
+}
+
+#undef VERTEX_GET
+#undef INDEX_GET
+
+#define VERTEX_GET(_n) MesaVertexBuffer(entry, ctx, ptr, _n, stride)
+
+NUKED_LOCAL void MesaVertexEmitBlock(mesa3d_ctx_t *ctx, GLenum gltype, BYTE *ptr, DWORD start, DWORD cnt, DWORD stride)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	int i;
+
+	BOOL unproj = MesaVertexUnprojectBegin(ctx, ptr, stride, start, cnt, cnt);
+
+	VERTEX_EMIT_LIST
+
+	if(unproj)
+		MesaVertexUnprojectEnd(ctx);
+}
+
+#undef VERTEX_GET
+
+#undef VERTEX_EMIT_LIST
+
+NUKED_INLINE GLint vbo_size(mesa_vertex_data_t type)
+{
+	switch(type)
+	{
+		case MESA_VDT_FLOAT1: return 1;
+		case MESA_VDT_FLOAT2: return 2;
+		case MESA_VDT_FLOAT3: return 3;
+		case MESA_VDT_FLOAT4: return 4;
+		default: return 0;
+	}
+}
+
+/*
+ * Draw from GL mirror of vertex buffer (stream 0) by vertex arrays. Returns
+ * FALSE when state needs per-vertex processing, then caller has to use
+ * MesaVertexDrawStream/MesaVertexDrawStreamIndex.
+ */
+NUKED_LOCAL BOOL MesaVertexDrawVBO(mesa3d_ctx_t *ctx, GLenum gltype, DWORD start, int base, DWORD cnt, void *index, DWORD index_stride8)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	mesa_vbo_t *vbo = ctx->vstream[0].vbo;
+	GLsizei stride = ctx->vstream[0].stride;
+	BYTE *offset = NULL;
+	GLint xyzw_size = vbo_size(ctx->state.vertex.type.xyzw);
+	int i;
+
+	if(vbo == NULL || cnt == 0 || xyzw_size < 3 || base < 0)
+		return FALSE;
+
+	if(ctx->state.vertex.shader || ctx->state.vertex.program || ctx->state.vertex.xyzrhw || ctx->matrix.weight != 0)
+		return FALSE;
+
+	/* per-vertex material or specular from LoadColor1/LoadColor2 */
+	if(ctx->state.material.lighting && ctx->state.material.color_vertex &&
+		(ctx->state.material.untracked || ctx->state.specular_vertex))
+		return FALSE;
+
+	/* GL_TRIANGLES are reversed in MesaVertexDrawStream to keep D3D flat shading color */
+	if(ctx->state.flatshade && gltype == GL_TRIANGLES)
+		return FALSE;
+
+	switch(ctx->state.vertex.type.normal)
+	{
+		case MESA_VDT_NONE:
+		case MESA_VDT_FLOAT3:
+		case MESA_VDT_FLOAT4:
+			break;
+		default:
+			return FALSE;
+	}
+
+	for(i = 0; i < ctx->tmu_count; i++)
+	{
+		if(ctx->state.tmu[i].image)
+		{
+			if(ctx->state.tmu[i].coordscalc_used || ctx->state.tmu[i].projected)
+				return FALSE;
+		}
+	}
+
+	MesaVBOUpdate(ctx, vbo);
+
+	if(index != NULL)
+	{
+		offset += base * stride;
+	}
+
+	GL_CHECK(entry->proc.pglBindBuffer(GL_ARRAY_BUFFER, vbo->buf));
+
+	GL_CHECK(entry->proc.pglEnableClientState(GL_VERTEX_ARRAY));
+	GL_CHECK(entry->proc.pglVertexPointer(xyzw_size, GL_FLOAT, stride, offset + ctx->state.vertex.pos.xyzw*4));
+
+	if(ctx->state.vertex.type.normal != MESA_VDT_NONE)
+	{
+		GL_CHECK(entry->proc.pglEnableClientState(GL_NORMAL_ARRAY));
+		GL_CHECK(entry->proc.pglNormalPointer(GL_FLOAT, stride, offset + ctx->state.vertex.pos.normal*4));
+	}
+	else
+	{
+		entry->proc.pglNormal3f(0.0, 0.0, 1.0f);
+	}
+
+	if(ctx->state.vertex.type.diffuse == MESA_VDT_D3DCOLOR)
+	{
+		GL_CHECK(entry->proc.pglEnableClientState(GL_COLOR_ARRAY));
+		GL_CHECK(entry->proc.pglColorPointer(GL_BGRA, GL_UNSIGNED_BYTE, stride, offset + ctx->state.vertex.pos.diffuse*4));
+	}
+	else
+	{
+		LoadColor1(entry, ctx, ctx->dxif >= MESA_CTX_IF_DX8 ? DEF_DIFFUSE_DX8 : DEF_DIFFUSE, TRUE);
+	}
+
+	for(i = 0; i < ctx->tmu_count; i++)
+	{
+		if(ctx->state.tmu[i].image)
+		{
+			int coordindex = ctx->state.tmu[i].coordindex;
+			GLint size = vbo_size(ctx->state.vertex.type.texcoords[coordindex]);
+			if(size > 0)
+			{
+				GL_CHECK(entry->proc.pglClientActiveTexture(GL_TEXTURE0+i));
+				GL_CHECK(entry->proc.pglEnableClientState(GL_TEXTURE_COORD_ARRAY));
+				GL_CHECK(entry->proc.pglTexCoordPointer(size, GL_FLOAT, stride, offset + ctx->state.vertex.pos.texcoords[coordindex]*4));
+			}
+			else
+			{
+				entry->proc.pglMultiTexCoord4f(GL_TEXTURE0+i, 0.0, 0.0f, 0.0f, 1.0f);
+			}
+		}
+	}
+
+	if(index != NULL)
+	{
+		GL_CHECK(entry->proc.pglDrawElements(gltype, cnt,
+			index_stride8 == 4 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT,
+			((BYTE*)index) + start*index_stride8));
+	}
+	else
+	{
+		GL_CHECK(entry->proc.pglDrawArrays(gltype, start, cnt));
+	}
+
+	for(i = 0; i < ctx->tmu_count; i++)
+	{
+		if(ctx->state.tmu[i].image)
+		{
+			GL_CHECK(entry->proc.pglClientActiveTexture(GL_TEXTURE0+i));
+			GL_CHECK(entry->proc.pglDisableClientState(GL_TEXTURE_COORD_ARRAY));
+		}
+	}
+	GL_CHECK(entry->proc.pglClientActiveTexture(GL_TEXTURE0));
+	GL_CHECK(entry->proc.pglDisableClientState(GL_COLOR_ARRAY));
+	GL_CHECK(entry->proc.pglDisableClientState(GL_NORMAL_ARRAY));
+	GL_CHECK(entry->proc.pglDisableClientState(GL_VERTEX_ARRAY));
+	GL_CHECK(entry->proc.pglBindBuffer(GL_ARRAY_BUFFER, 0));
+
+	TOPIC("VBO", "draw VBO %d: type=%d start=%d base=%d cnt=%d indexed=%d", vbo->buf, gltype, start, base, cnt, index != NULL);
+
+	return TRUE;
+}
+
+#include "mesa3d_unproject.h"
+
+/* unprojected range may be larger than number of emitted vertices (sparse indices) */
+#define UNPROJECT_MAX_SPARSE 2
+
+/*
+ * Pre-transformed (XYZRHW) vertices inside open glBegin/glEnd block
+ * (MesaVertexEmit* and indexed DP2 lists): positions of vertices first..
+ * first+cnt-1 are unprojected in one pass and MesaVertexBuffer/MesaVertexStream
+ * emits them by emit_attr + glVertex4fv until MesaVertexUnprojectEnd. refs
+ * is number of vertices which will be emitted.
+ */
+NUKED_LOCAL BOOL MesaVertexUnprojectBegin(mesa3d_ctx_t *ctx, const BYTE *ptr, DWORD stride, DWORD first, DWORD cnt, DWORD refs)
+{
+	GLfloat *pos;
+
+	if(!MESA_UNPROJECT_BATCH(ctx, refs) || ptr == NULL || cnt == 0 || cnt > refs*UNPROJECT_MAX_SPARSE)
+		return FALSE;
+
+	if(ctx->state.vertex.unproj.ptr != NULL)
+		return FALSE;
+
+	pos = MesaTempAlloc(ctx, cnt, cnt*4*sizeof(GLfloat));
+	if(pos == NULL)
+		return FALSE;
+
+	unproject_batch(pos, ptr + first*stride + ctx->state.vertex.pos.xyzw*4, stride, cnt, ctx->matrix.vpnorm, ctx->matrix.zscale);
+
+	ctx->state.vertex.unproj.ptr   = ptr;
+	ctx->state.vertex.unproj.first = first;
+	ctx->state.vertex.unproj.cnt   = cnt;
+	ctx->state.vertex.unproj.pos   = pos;
+
+	return TRUE;
+}
+
+NUKED_LOCAL void MesaVertexUnprojectEnd(mesa3d_ctx_t *ctx)
+{
+	if(ctx->state.vertex.unproj.ptr != NULL)
+	{
+		MesaTempFree(ctx, ctx->state.vertex.unproj.pos);
+		ctx->state.vertex.unproj.ptr = NULL;
+		ctx->state.vertex.unproj.pos = NULL;
+		ctx->state.vertex.unproj.cnt = 0;
+	}
+}
+
+/*
+ * Non-indexed range of pre-transformed (XYZRHW) vertices. Positions are
+ * unprojected in one pass to scratch buffer and drawn together with
+ * colors and texture coordinates as client arrays. Only for states
+ * accepted by MesaVertexEmitSelect, otherwise return FALSE and caller
+ * have to use glBegin/glEnd path.
+ */
+NUKED_LOCAL BOOL MesaVertexDrawUnproject(mesa3d_ctx_t *ctx, GLenum gltype, BYTE *ptr, DWORD start, DWORD cnt, DWORD stride)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	GLfloat *pos;
+	BYTE *vert;
+	int i;
+
+	if(!entry->env.vbo || ptr == NULL || cnt < UNPROJECT_MIN_VERTICES)
+		return FALSE;
+
+	if(!ctx->state.vertex.xyzrhw || ctx->state.vertex.emit == NULL)
+		return FALSE;
+
+	/* GL_TRIANGLES are reversed in glBegin/glEnd path to keep D3D flat shading color */
+	if(ctx->state.flatshade && gltype == GL_TRIANGLES)
+		return FALSE;
+
+	pos = MesaTempAlloc(ctx, cnt, cnt*4*sizeof(GLfloat));
+	if(pos == NULL)
+		return FALSE;
+
+	vert = ptr + start*stride;
+	unproject_batch(pos, vert + ctx->state.vertex.pos.xyzw*4, stride, cnt, ctx->matrix.vpnorm, ctx->matrix.zscale);
+
+	GL_CHECK(entry->proc.pglEnableClientState(GL_VERTEX_ARRAY));
+	GL_CHECK(entry->proc.pglVertexPointer(4, GL_FLOAT, 0, pos));
+
+	entry->proc.pglNormal3f(0.0, 0.0, 1.0f);
+
+	if(ctx->state.vertex.type.diffuse == MESA_VDT_D3DCOLOR)
+	{
+		GL_CHECK(entry->proc.pglEnableClientState(GL_COLOR_ARRAY));
+		GL_CHECK(entry->proc.pglColorPointer(GL_BGRA, GL_UNSIGNED_BYTE, stride, vert + ctx->state.vertex.pos.diffuse*4));
+	}
+	else
+	{
+		entry->proc.pglColor4fv(&ctx->state.vertex.emit_diffuse[0]);
+	}
+
+	/* MesaVertexEmitSelect: textured TMUs are first and coordindex == TMU */
+	for(i = 0; i < ctx->tmu_count && ctx->state.tmu[i].image; i++)
+	{
+		GL_CHECK(entry->proc.pglClientActiveTexture(GL_TEXTURE0+i));
+		GL_CHECK(entry->proc.pglEnableClientState(GL_TEXTURE_COORD_ARRAY));
+		GL_CHECK(entry->proc.pglTexCoordPointer(2, GL_FLOAT, stride, vert + ctx->state.vertex.pos.texcoords[i]*4));
+	}
+
+	GL_CHECK(entry->proc.pglDrawArrays(gltype, 0, cnt));
+
+	for(i = 0; i < ctx->tmu_count && ctx->state.tmu[i].image; i++)
+	{
+		GL_CHECK(entry->proc.pglClientActiveTexture(GL_TEXTURE0+i));
+		GL_CHECK(entry->proc.pglDisableClientState(GL_TEXTURE_COORD_ARRAY));
+	}
+	GL_CHECK(entry->proc.pglClientActiveTexture(GL_TEXTURE0));
+	GL_CHECK(entry->proc.pglDisableClientState(GL_COLOR_ARRAY));
+	GL_CHECK(entry->proc.pglDisableClientState(GL_VERTEX_ARRAY));
+
+	MesaTempFree(ctx, pos);
+
+	TOPIC("GL", "draw unprojected: type=%d start=%d cnt=%d", gltype, start, cnt);
+
+	return TRUE;
+}
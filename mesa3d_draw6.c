@@ -44,7 +44,14 @@
 
 //#define STRICT_DATA 1
 
-NUKED_LOCAL void MesaLightApply(mesa3d_ctx_t *ctx, DWORD id)
+/*
+ * Emit light to GL, 'dirty' is combination of MESA_LIGHT_DIRTY_*. Colors,
+ * attenuation and spot cone stay in GL light slot, so they are emitted only
+ * when changed or when slot was used by another light. Position and
+ * direction are transformed by current modelview and need to be emitted
+ * every time when view matrix is changed.
+ */
+NUKED_LOCAL void MesaLightUpdate(mesa3d_ctx_t *ctx, DWORD id, DWORD dirty)
 {
 	TRACE_ENTRY
 
@@ -60,55 +67,123 @@ NUKED_LOCAL void MesaLightApply(mesa3d_ctx_t *ctx, DWORD id)
 
 	mesa3d_entry_t *entry = ctx->entry;
 	GLenum lindex = GL_LIGHT0 + light->active_index;
+	DWORD calls = 0;
 
-	GL_CHECK(entry->proc.pglLightfv(lindex, GL_DIFFUSE,  &light->diffuse[0]));
-	GL_CHECK(entry->proc.pglLightfv(lindex, GL_SPECULAR, &light->specular[0]));
-	GL_CHECK(entry->proc.pglLightfv(lindex, GL_AMBIENT,  &light->ambient[0]));
+	dirty |= light->dirty;
+	if(ctx->light.slot_id[light->active_index] != id + 1)
+	{
+		dirty = MESA_LIGHT_DIRTY_ALL;
+	}
 
-	switch(light->type)
+	if(dirty & MESA_LIGHT_DIRTY_DATA)
 	{
-		case D3DLIGHT_POINT:
-			TOPIC("LIGHT", "D3DLIGHT_POINT");
-			GL_CHECK(entry->proc.pglLightfv(lindex, GL_POSITION,              &light->pos[0]));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_SPOT_EXPONENT,         0.0f));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_SPOT_CUTOFF,           180.0f));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_CONSTANT_ATTENUATION,  light->attenuation[0]));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_LINEAR_ATTENUATION,    light->attenuation[1]));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_QUADRATIC_ATTENUATION, light->attenuation[3]));
-			break;
-		case D3DLIGHT_SPOT:
-			TOPIC("LIGHT", "D3DLIGHT_SPOT");
-			GL_CHECK(entry->proc.pglLightfv(lindex, GL_POSITION,              &light->pos[0]));
-			GL_CHECK(entry->proc.pglLightfv(lindex, GL_SPOT_DIRECTION,        &light->dir[0]));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_SPOT_EXPONENT,         light->exponent));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_SPOT_CUTOFF,           (light->phi * 90) / M_PI));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_CONSTANT_ATTENUATION,  light->attenuation[0]));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_LINEAR_ATTENUATION,    light->attenuation[1]));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_QUADRATIC_ATTENUATION, light->attenuation[3]));
-			break;
-		case D3DLIGHT_DIRECTIONAL:
+		GL_CHECK(entry->proc.pglLightfv(lindex, GL_DIFFUSE,  &light->diffuse[0]));
+		GL_CHECK(entry->proc.pglLightfv(lindex, GL_SPECULAR, &light->specular[0]));
+		GL_CHECK(entry->proc.pglLightfv(lindex, GL_AMBIENT,  &light->ambient[0]));
+		calls += 3;
+
+		switch(light->type)
 		{
-			TOPIC("LIGHT", "D3DLIGHT_DIRECTIONAL");
-			GLfloat vd[4];
-			vd[0] = -light->dir[0];
-			vd[1] = -light->dir[1];
-			vd[2] = -light->dir[2];
-			vd[3] = 0.0f;
-
-			/* Note GL uses w position of 0 for direction! */
-			GL_CHECK(entry->proc.pglLightfv(lindex, GL_POSITION,      &vd[0]));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_SPOT_EXPONENT,   0.0f));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_SPOT_CUTOFF,   180.0f));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_CONSTANT_ATTENUATION,  1.0f));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_LINEAR_ATTENUATION,    0.0f));
-			GL_CHECK(entry->proc.pglLightf(lindex,  GL_QUADRATIC_ATTENUATION, 0.0f));
-			break;
-		}
-		case D3DLIGHT_PARALLELPOINT:
-		case D3DLIGHT_GLSPOT:
-		default:
-			break;
-	} // switch(light->type)
+			case D3DLIGHT_POINT:
+				TOPIC("LIGHT", "D3DLIGHT_POINT");
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_SPOT_EXPONENT,         0.0f));
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_SPOT_CUTOFF,           180.0f));
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_CONSTANT_ATTENUATION,  light->attenuation[0]));
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_LINEAR_ATTENUATION,    light->attenuation[1]));
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_QUADRATIC_ATTENUATION, light->attenuation[3]));
+				calls += 5;
+				break;
+			case D3DLIGHT_SPOT:
+				TOPIC("LIGHT", "D3DLIGHT_SPOT");
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_SPOT_EXPONENT,         light->exponent));
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_SPOT_CUTOFF,           (light->phi * 90) / M_PI));
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_CONSTANT_ATTENUATION,  light->attenuation[0]));
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_LINEAR_ATTENUATION,    light->attenuation[1]));
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_QUADRATIC_ATTENUATION, light->attenuation[3]));
+				calls += 5;
+				break;
+			case D3DLIGHT_DIRECTIONAL:
+				TOPIC("LIGHT", "D3DLIGHT_DIRECTIONAL");
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_SPOT_EXPONENT,   0.0f));
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_SPOT_CUTOFF,   180.0f));
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_CONSTANT_ATTENUATION,  1.0f));
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_LINEAR_ATTENUATION,    0.0f));
+				GL_CHECK(entry->proc.pglLightf(lindex,  GL_QUADRATIC_ATTENUATION, 0.0f));
+				calls += 5;
+				break;
+			case D3DLIGHT_PARALLELPOINT:
+			case D3DLIGHT_GLSPOT:
+			default:
+				break;
+		} // switch(light->type)
+	}
+
+	if(dirty & MESA_LIGHT_DIRTY_SPACE)
+	{
+		switch(light->type)
+		{
+			case D3DLIGHT_POINT:
+				GL_CHECK(entry->proc.pglLightfv(lindex, GL_POSITION,              &light->pos[0]));
+				calls++;
+				break;
+			case D3DLIGHT_SPOT:
+				GL_CHECK(entry->proc.pglLightfv(lindex, GL_POSITION,              &light->pos[0]));
+				GL_CHECK(entry->proc.pglLightfv(lindex, GL_SPOT_DIRECTION,        &light->dir[0]));
+				calls += 2;
+				break;
+			case D3DLIGHT_DIRECTIONAL:
+			{
+				GLfloat vd[4];
+				vd[0] = -light->dir[0];
+				vd[1] = -light->dir[1];
+				vd[2] = -light->dir[2];
+				vd[3] = 0.0f;
+
+				/* Note GL uses w position of 0 for direction! */
+				GL_CHECK(entry->proc.pglLightfv(lindex, GL_POSITION,      &vd[0]));
+				calls++;
+				break;
+			}
+			case D3DLIGHT_PARALLELPOINT:
+			case D3DLIGHT_GLSPOT:
+			default:
+				break;
+		} // switch(light->type)
+	}
+
+	light->dirty = 0;
+	ctx->light.slot_id[light->active_index] = id + 1;
+	if(calls)
+	{
+		ctx->light.calls += calls;
+		PERF_ADD(light_calls, calls);
+	}
+}
+
+/* emit all light data */
+NUKED_LOCAL void MesaLightApply(mesa3d_ctx_t *ctx, DWORD id)
+{
+	MesaLightUpdate(ctx, id, MESA_LIGHT_DIRTY_ALL);
+}
+
+/* compare data which aren't depend on modelview */
+static BOOL MesaLightDataEqual(mesa3d_light_t *a, mesa3d_light_t *b)
+{
+	if(a->type != b->type)
+		return FALSE;
+
+	if(memcmp(a->diffuse, b->diffuse, sizeof(a->diffuse)) != 0 ||
+		memcmp(a->specular, b->specular, sizeof(a->specular)) != 0 ||
+		memcmp(a->ambient, b->ambient, sizeof(a->ambient)) != 0 ||
+		memcmp(a->attenuation, b->attenuation, sizeof(a->attenuation)) != 0)
+	{
+		return FALSE;
+	}
+
+	if(a->exponent != b->exponent || a->phi != b->phi)
+		return FALSE;
+
+	return TRUE;
 }
 
 static void MesaLightData(mesa3d_ctx_t *ctx, DWORD id, D3DLIGHT7 *dxlight)
@@ -124,6 +199,9 @@ static void MesaLightData(mesa3d_ctx_t *ctx, DWORD id, D3DLIGHT7 *dxlight)
 
 	TOPIC("LIGHT", "LightData light=%X, dxlight=%X", light, dxlight);
 
+	mesa3d_light_t old;
+	memcpy(&old, light, sizeof(mesa3d_light_t));
+
 	light->id = id;
 	light->type = dxlight->dltType;
 
@@ -195,7 +273,12 @@ static void MesaLightData(mesa3d_ctx_t *ctx, DWORD id, D3DLIGHT7 *dxlight)
 		}
 	}
 
-	MesaLightApply(ctx, id);
+	if(!MesaLightDataEqual(&old, light))
+	{
+		light->dirty |= MESA_LIGHT_DIRTY_DATA;
+	}
+
+	MesaLightUpdate(ctx, id, MESA_LIGHT_DIRTY_SPACE);
 }
 
 NUKED_LOCAL void MesaLightCreate(mesa3d_ctx_t *ctx, DWORD id)
@@ -238,6 +321,7 @@ NUKED_LOCAL void MesaLightDestroyAll(mesa3d_ctx_t *ctx)
 		ctx->light.lights_size = 0;
 		ctx->light.lights = NULL;
 	}
+	memset(ctx->light.slot_id, 0, sizeof(ctx->light.slot_id));
 }
 
 static void MesaLightActive(mesa3d_ctx_t *ctx, DWORD id, BOOL activate)
@@ -286,8 +370,9 @@ static void MesaLightActive(mesa3d_ctx_t *ctx, DWORD id, BOOL activate)
 				ctx->light.active_bitfield |= 1 << gl_id;
 				ctx->entry->proc.pglEnable(GL_LIGHT0 + gl_id);
 
+				/* light data are still in slot, when it was last used by same light */
 				MesaSpaceModelviewSet(ctx);
-				MesaLightApply(ctx, id);
+				MesaLightUpdate(ctx, id, MESA_LIGHT_DIRTY_SPACE);
 				MesaSpaceModelviewReset(ctx);
 
 			}
@@ -337,7 +422,7 @@ NUKED_LOCAL void MesaTLRecalcModelview(mesa3d_ctx_t *ctx)
 		{
 			if(ctx->light.lights[i]->active)
 			{
-				MesaLightApply(ctx, i);
+				MesaLightUpdate(ctx, i, MESA_LIGHT_DIRTY_SPACE);
 			}
 		}
 	}
@@ -368,6 +453,22 @@ NUKED_INLINE void draw_fvf(mesa3d_ctx_t *ctx, DWORD fvf)
 		MesaApplyLighting(ctx);
 		MesaApplyMaterial(ctx);
 	}
+
+	if(!ctx->state.vertex.shader)
+	{
+		MesaBlendUpdate(ctx);
+	}
+	else if(ctx->state.vertex.program)
+	{
+		MesaVSConstFlush(ctx);
+	}
+
+	MesaPSUpdate(ctx);
+
+	MesaColorMaterialUpdate(ctx, ctx->state.vertex.type.diffuse == MESA_VDT_D3DCOLOR);
+
+	/* texture and material state can change without new FVF */
+	MesaVertexEmitSelect(ctx);
 }
 
 NUKED_INLINE void draw_fvf_end(mesa3d_ctx_t *ctx)
@@ -393,7 +494,113 @@ NUKED_INLINE void draw_fvf_end(mesa3d_ctx_t *ctx)
 
 #define RENDER_END draw_fvf_end(ctx); SET_DIRTY
 
-#define PD2_ERROR *error_offset = (LPBYTE)inst - (LPBYTE)cmdBufferStart; WARN("D3DERR_COMMAND_UNPARSED"); return D3DERR_COMMAND_UNPARSED
+/*
+ * Draw merging: list primitives (triangles, lines, points) are kept open
+ * across DP2 commands while only draws with same primitive and FVF follow.
+ * Any other command closes the block first, so no state can change
+ * between merged draws.
+ */
+NUKED_INLINE void draw_batch_flush(mesa3d_ctx_t *ctx)
+{
+	if(ctx->render.batch != GL_NOOP)
+	{
+		mesa3d_entry_t *entry = ctx->entry;
+		GL_CHECK(entry->proc.pglEnd());
+		if(ctx->render.batch == GL_TRIANGLES)
+		{
+			MesaSetCull(ctx);
+		}
+		ctx->render.batch = GL_NOOP;
+		RENDER_END;
+	}
+}
+
+NUKED_INLINE void draw_batch_begin(mesa3d_ctx_t *ctx, GLenum gltype, DWORD fvf)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+
+	if(ctx->render.batch == gltype && ctx->render.batch_fvf == fvf)
+	{
+		ctx->render.batch_merged++;
+		return;
+	}
+
+	draw_batch_flush(ctx);
+
+	RENDER_BEGIN(fvf);
+	if(gltype == GL_TRIANGLES)
+	{
+		/* vertices are emitted in reverse order, see MesaVertexDrawBlock */
+		MesaReverseCull(ctx);
+	}
+	TOPIC("GL", "glBegin(%d)", gltype);
+	entry->proc.pglBegin(gltype);
+	ctx->render.batch = gltype;
+	ctx->render.batch_fvf = fvf;
+}
+
+/*
+ * Batch unprojection (MesaVertexUnprojectBegin) of vertices referenced by
+ * indexed list command, items are item_size structures starting with
+ * words vertex indices relative to base.
+ */
+NUKED_INLINE BOOL draw_unproject_index(mesa3d_ctx_t *ctx, LPBYTE vertices, const BYTE *prim, DWORD items, DWORD item_size, DWORD words, WORD base)
+{
+	DWORD refs = items*words;
+	WORD vmin = 0xFFFF, vmax = 0;
+	DWORD i, j;
+
+	if(!MESA_UNPROJECT_BATCH(ctx, refs))
+		return FALSE;
+
+	for(i = 0; i < items; i++)
+	{
+		const WORD *w = (const WORD*)(prim + i*item_size);
+		for(j = 0; j < words; j++)
+		{
+			WORD v = base + w[j];
+			if(v < vmin) vmin = v;
+			if(v > vmax) vmax = v;
+		}
+	}
+
+	return MesaVertexUnprojectBegin(ctx, vertices, ctx->state.vertex.stride, vmin, (DWORD)vmax - vmin + 1, refs);
+}
+
+/* commands which can continue open block */
+NUKED_INLINE BOOL draw_batch_keep(LPD3DHAL_DP2COMMAND inst)
+{
+	switch((D3DHAL_DP2OPERATION)inst->bCommand)
+	{
+		case D3DDP2OP_POINTS:
+		case D3DDP2OP_LINELIST:
+		case D3DDP2OP_TRIANGLELIST:
+		case D3DDP2OP_INDEXEDLINELIST:
+		case D3DDP2OP_INDEXEDTRIANGLELIST:
+		case D3DDP2OP_INDEXEDLINELIST2:
+		case D3DDP2OP_INDEXEDTRIANGLELIST2:
+		case D3DDP2OP_LINELIST_IMM:
+		case D3DDP2OP_DRAWPRIMITIVE:
+		case D3DDP2OP_DRAWINDEXEDPRIMITIVE:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/* GL list primitive for D3D type, GL_NOOP if primitive cannot be merged */
+NUKED_INLINE GLenum draw_batch_type(D3DPRIMITIVETYPE dx_ptype)
+{
+	switch(dx_ptype)
+	{
+		case D3DPT_POINTLIST:    return GL_POINTS;
+		case D3DPT_LINELIST:     return GL_LINES;
+		case D3DPT_TRIANGLELIST: return GL_TRIANGLES;
+		default:                 return GL_NOOP;
+	}
+}
+
+#define PD2_ERROR draw_batch_flush(ctx); *error_offset = (LPBYTE)inst - (LPBYTE)cmdBufferStart; WARN("D3DERR_COMMAND_UNPARSED"); return D3DERR_COMMAND_UNPARSED
 
 #define CHECK_LIMITS(_t, _c) if(prim + (sizeof(_t) * (_c)) > cmdBufferEnd){ \
 	 PD2_ERROR;}
@@ -422,6 +629,42 @@ NUKED_INLINE void draw_fvf_end(mesa3d_ctx_t *ctx)
 	case 0: case 2: case 4: break; \
 	default: ERR("Invalid DX8 indices stride: %d", _s); return D3DERR_COMMAND_UNPARSED; break;}
 
+/* draw calls in same way as tests/dp2trace counts them */
+NUKED_INLINE void draw_perf(LPD3DHAL_DP2COMMAND inst)
+{
+	PERF_ADD(dp2_commands, 1);
+
+	switch((D3DHAL_DP2OPERATION)inst->bCommand)
+	{
+		case D3DDP2OP_DRAWPRIMITIVE:
+		case D3DDP2OP_DRAWINDEXEDPRIMITIVE:
+		case D3DDP2OP_CLIPPEDTRIANGLEFAN:
+		case D3DDP2OP_DRAWPRIMITIVE2:
+		case D3DDP2OP_DRAWINDEXEDPRIMITIVE2:
+			PERF_ADD(draws, inst->wPrimitiveCount);
+			break;
+		case D3DDP2OP_POINTS:
+		case D3DDP2OP_INDEXEDLINELIST:
+		case D3DDP2OP_INDEXEDTRIANGLELIST:
+		case D3DDP2OP_LINELIST:
+		case D3DDP2OP_LINESTRIP:
+		case D3DDP2OP_TRIANGLELIST:
+		case D3DDP2OP_TRIANGLESTRIP:
+		case D3DDP2OP_TRIANGLEFAN:
+		case D3DDP2OP_INDEXEDLINESTRIP:
+		case D3DDP2OP_INDEXEDTRIANGLESTRIP:
+		case D3DDP2OP_INDEXEDTRIANGLEFAN:
+		case D3DDP2OP_INDEXEDTRIANGLELIST2:
+		case D3DDP2OP_INDEXEDLINELIST2:
+		case D3DDP2OP_TRIANGLEFAN_IMM:
+		case D3DDP2OP_LINELIST_IMM:
+			PERF_ADD(draws, 1);
+			break;
+		default:
+			break;
+	}
+}
+
 NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 	LPBYTE cmdBufferStart, LPBYTE cmdBufferEnd,
 	LPBYTE vertices, LPBYTE UMVertices, DWORD fvf,
@@ -438,6 +681,10 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 	int i;
 	WORD *pos;
 
+	/* no GL block is open between DP2 calls */
+	ctx->render.batch = GL_NOOP;
+	ctx->render.batch_merged = 0;
+
 	/* update user memory vertex if set */
 	if(ctx->vstream[0].VBHandle == 0
 		&& ctx->vstream[0].mem.ptr != NULL)
@@ -452,6 +699,12 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 	while((LPBYTE)inst < cmdBufferEnd)
 	{
 		LPBYTE prim = (LPBYTE)(inst + 1);
+		draw_perf(inst);
+		if(ctx->state.recording || !draw_batch_keep(inst))
+		{
+			draw_batch_flush(ctx);
+		}
+
 		if(!ctx->state.recording)
 		{
 			switch((D3DHAL_DP2OPERATION)inst->bCommand)
@@ -468,17 +721,16 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 					// field of D3DHAL_DP2COMMAND.
 					TOPIC("DRAW", "DRAW - D3DDP2OP_POINTS, blocks = %d", inst->wPrimitiveCount);
 					CHECK_LIMITS(D3DHAL_DP2POINTS, inst->wPrimitiveCount);
-					RENDER_BEGIN(fvf);
+					draw_batch_begin(ctx, GL_POINTS, fvf);
 					for(i = 0; i < inst->wPrimitiveCount; i++)
 					{
 						D3DHAL_DP2POINTS *points = (D3DHAL_DP2POINTS*)prim;
 						CHECK_DATA2(points->wVStart, points->wCount);
 
 						//MesaDrawFVFs(ctx, GL_POINTS, vertices, points->wVStart, points->wCount);
-						MesaVertexDrawBlock(ctx, GL_POINTS, vertices, points->wVStart, points->wCount, ctx->state.vertex.stride);
+						MesaVertexEmitBlock(ctx, GL_POINTS, vertices, points->wVStart, points->wCount, ctx->state.vertex.stride);
 						prim += sizeof(D3DHAL_DP2POINTS);
 					}
-					RENDER_END;
 					NEXT_INST(0);
 					break;
 				COMMAND(D3DDP2OP_LINELIST)
@@ -496,9 +748,8 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 					start = ((D3DHAL_DP2LINELIST*)prim)->wVStart;
 					CHECK_DATA2(start, inst->wPrimitiveCount*2);
 
-					RENDER_BEGIN(fvf);
-					MesaVertexDrawBlock(ctx, GL_LINES, vertices, start, inst->wPrimitiveCount*2, ctx->state.vertex.stride);
-					RENDER_END;
+					draw_batch_begin(ctx, GL_LINES, fvf);
+					MesaVertexEmitBlock(ctx, GL_LINES, vertices, start, inst->wPrimitiveCount*2, ctx->state.vertex.stride);
 					NEXT_INST(sizeof(D3DHAL_DP2LINELIST));
 					break;
 				COMMAND(D3DDP2OP_LINESTRIP)
@@ -536,9 +787,8 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 					start = ((D3DHAL_DP2TRIANGLELIST*)prim)->wVStart;
 					CHECK_DATA2(start, inst->wPrimitiveCount*3);
 
-					RENDER_BEGIN(fvf);
-					MesaVertexDrawBlock(ctx, GL_TRIANGLES, vertices, start, inst->wPrimitiveCount*3, ctx->state.vertex.stride);
-					RENDER_END;
+					draw_batch_begin(ctx, GL_TRIANGLES, fvf);
+					MesaVertexEmitBlock(ctx, GL_TRIANGLES, vertices, start, inst->wPrimitiveCount*3, ctx->state.vertex.stride);
 					NEXT_INST(sizeof(D3DHAL_DP2TRIANGLELIST));
 					break;
 				COMMAND(D3DDP2OP_TRIANGLESTRIP)
@@ -593,8 +843,8 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 					// (wVStart[(wPrimitiveCount-1)*2], wVStart[wPrimitiveCount*2-1]).
 					CHECK_LIMITS(D3DHAL_DP2INDEXEDLINELIST, inst->wPrimitiveCount);
 					TOPIC("DRAW", "DRAW - D3DDP2OP_INDEXEDLINELIST, primitives = %d, vertices = %d", inst->wPrimitiveCount, inst->wPrimitiveCount*2);
-					RENDER_BEGIN(fvf);
-					entry->proc.pglBegin(GL_LINES);
+					draw_batch_begin(ctx, GL_LINES, fvf);
+					draw_unproject_index(ctx, vertices, prim, inst->wPrimitiveCount, sizeof(D3DHAL_DP2INDEXEDLINELIST), 2, 0);
 					for(i = 0; i < inst->wPrimitiveCount; i++)
 					{
 #ifdef STRICT_DATA
@@ -618,12 +868,11 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 #endif
 						prim += sizeof(D3DHAL_DP2INDEXEDLINELIST);
 					}
-					entry->proc.pglEnd();
+					MesaVertexUnprojectEnd(ctx);
 					if(i != inst->wPrimitiveCount)
 					{
 						PD2_ERROR;
 					}
-					RENDER_END;
 					NEXT_INST(0);
 					break;
 				COMMAND(D3DDP2OP_INDEXEDLINESTRIP)
@@ -688,9 +937,8 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 					TOPIC("DRAW", "DRAW - D3DDP2OP_INDEXEDTRIANGLELIST, primitives = %d, vertices = %d", inst->wPrimitiveCount, inst->wPrimitiveCount*3);
 					CHECK_LIMITS(D3DHAL_DP2INDEXEDTRIANGLELIST, inst->wPrimitiveCount);
 
-					RENDER_BEGIN(fvf);
-					MesaReverseCull(ctx);
-					entry->proc.pglBegin(GL_TRIANGLES);
+					draw_batch_begin(ctx, GL_TRIANGLES, fvf);
+					draw_unproject_index(ctx, vertices, prim, inst->wPrimitiveCount, sizeof(D3DHAL_DP2INDEXEDTRIANGLELIST), 3, 0);
 					for(i = 0; i < inst->wPrimitiveCount; i++)
 					{
 #ifdef STRICT_DATA
@@ -719,13 +967,11 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 #endif
 						prim += sizeof(D3DHAL_DP2INDEXEDTRIANGLELIST);
 					}
-					entry->proc.pglEnd();
-					MesaSetCull(ctx);
+					MesaVertexUnprojectEnd(ctx);
 					if(i != inst->wPrimitiveCount)
 					{
 						PD2_ERROR;
 					}
-					RENDER_END;
 					NEXT_INST(0);
 					break;
 				COMMAND(D3DDP2OP_INDEXEDTRIANGLESTRIP)
@@ -828,9 +1074,8 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 					base = ((D3DHAL_DP2STARTVERTEX*)prim)->wVStart;
 					prim += sizeof(D3DHAL_DP2STARTVERTEX);
 
-					RENDER_BEGIN(fvf);
-					MesaReverseCull(ctx);
-					entry->proc.pglBegin(GL_TRIANGLES);
+					draw_batch_begin(ctx, GL_TRIANGLES, fvf);
+					draw_unproject_index(ctx, vertices, prim, inst->wPrimitiveCount, sizeof(D3DHAL_DP2INDEXEDTRIANGLELIST2), 3, base);
 					for(i = 0; i < inst->wPrimitiveCount; i++)
 					{
 #ifdef STRICT_DATA
@@ -860,14 +1105,12 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 #endif
 						prim += sizeof(D3DHAL_DP2INDEXEDTRIANGLELIST2);
 					}
-					GL_CHECK(entry->proc.pglEnd());
-					MesaSetCull(ctx);
+					MesaVertexUnprojectEnd(ctx);
 					if(i != inst->wPrimitiveCount)
 					{
 						WARN("i = %d", i);
 						PD2_ERROR;
 					}
-					RENDER_END;
 					NEXT_INST(0);
 					break;
 				COMMAND(D3DDP2OP_INDEXEDLINELIST2)
@@ -887,8 +1130,8 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 					prim += sizeof(D3DHAL_DP2STARTVERTEX);
 					CHECK_LIMITS(D3DHAL_DP2INDEXEDLINELIST, inst->wPrimitiveCount);
 
-					RENDER_BEGIN(fvf);
-					entry->proc.pglBegin(GL_LINES);
+					draw_batch_begin(ctx, GL_LINES, fvf);
+					draw_unproject_index(ctx, vertices, prim, inst->wPrimitiveCount, sizeof(D3DHAL_DP2INDEXEDLINELIST), 2, base);
 					for(i = 0; i < inst->wPrimitiveCount; i++)
 					{
 #ifdef STRICT_DATA
@@ -912,12 +1155,11 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 #endif
 						prim += sizeof(D3DHAL_DP2INDEXEDLINELIST);
 					}
-					GL_CHECK(entry->proc.pglEnd());
+					MesaVertexUnprojectEnd(ctx);
 					if(i != inst->wPrimitiveCount)
 					{
 						PD2_ERROR;
 					}
-					RENDER_END;
 					NEXT_INST(0);
 					break;
 				COMMAND(D3DDP2OP_TRIANGLEFAN_IMM)
@@ -964,12 +1206,11 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 					PRIM_ALIGN;
 					CHECK_LIMITS_SIZE(ctx->state.vertex.stride * count);
 
-					RENDER_BEGIN(fvf);
+					draw_batch_begin(ctx, GL_LINES, fvf);
 					//MesaDrawFVFs(ctx, GL_LINES, prim, 0, count);
-					MesaVertexDrawBlock(ctx, GL_LINES, prim, 0, count, ctx->state.vertex.stride);
+					MesaVertexEmitBlock(ctx, GL_LINES, prim, 0, count, ctx->state.vertex.stride);
 					prim += ctx->state.vertex.stride * count;
 					//PRIM_ALIGN;
-					RENDER_END;
 					NEXT_INST(0);
 					break;
 				COMMAND(D3DDP2OP_RENDERSTATE)
@@ -1269,7 +1510,7 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 								// On receipt of this request the driver should create
 								// a state block of the type given in the field sbType
 								// and capture the current given state into it.
-								MesaRecStart(ctx, pStateSetOp->dwParam, pStateSetOp->sbType);
+								MesaRecCreate(ctx, pStateSetOp->dwParam, pStateSetOp->sbType);
 									TOPIC("STATESET", "STATESET create(%d), type=%d", pStateSetOp->dwParam, pStateSetOp->sbType);
 								ctx->state.recording = TRUE;
 								break;
@@ -1511,6 +1752,7 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 						CHECK_LIMITS(D3DHAL_DP2SETVERTEXSHADERCONST, 1);
 						prim += sizeof(D3DHAL_DP2SETVERTEXSHADERCONST);
 						CHECK_LIMITS_SIZE(shaderconstset->dwCount * 4 * sizeof(D3DVALUE));
+						MesaVSConstSet(ctx, shaderconstset->dwRegister, shaderconstset->dwCount, (GLfloat*)prim);
 						prim += shaderconstset->dwCount * 4 * sizeof(D3DVALUE);
 					}
 					NEXT_INST(0);
@@ -1534,6 +1776,11 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 									ctx->vstream[vsrc->dwStream].VBHandle = vsrc->dwVBHandle;
 									ctx->vstream[vsrc->dwStream].stride = vsrc->dwStride;
 									ctx->vstream[vsrc->dwStream].mem.ptr = buffer;
+									ctx->vstream[vsrc->dwStream].vbo = NULL;
+									if(entry->env.vbo && ctx->surfaces->table[vsrc->dwVBHandle])
+									{
+										ctx->vstream[vsrc->dwStream].vbo = MesaVBOGet(ctx, ctx->surfaces->table[vsrc->dwVBHandle]);
+									}
 									ctx->state.fvf_shader_dirty = TRUE;
 //									ctx->state.bind_vertices = vsrc->dwStream;
 
@@ -1548,6 +1795,7 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 							{
 								ctx->vstream[vsrc->dwStream].VBHandle = 0;
 								ctx->vstream[vsrc->dwStream].mem.ptr = NULL;
+								ctx->vstream[vsrc->dwStream].vbo = NULL;
 								TRACE("D3DHAL_DP2SETSTREAMSOURCE: stream=%d invalidated", vsrc->dwStream);
 							}
 						}
@@ -1569,6 +1817,7 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 							ctx->vstream[um->dwStream].VBHandle = 0;
 							ctx->vstream[um->dwStream].stride   = um->dwStride;
 							ctx->vstream[um->dwStream].mem.ptr  = UMVertices;
+							ctx->vstream[um->dwStream].vbo      = NULL;
 							ctx->state.fvf_shader_dirty = TRUE;
 
 //							ctx->state.bind_vertices = um->dwStream;
@@ -1598,47 +1847,93 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 					CHECK_LIMITS(D3DHAL_DP2DRAWPRIMITIVE, inst->wStateCount);
 					TRACE("DRAWPRIMITIVE, wStateCount=%d", inst->wStateCount);
 
-					RENDER_BEGIN(ctx->state.fvf_shader);
 					for(i = 0; i < inst->wStateCount; i++)
 					{
 						D3DHAL_DP2DRAWPRIMITIVE *draw = (D3DHAL_DP2DRAWPRIMITIVE*)prim;
 						TRACE("DRAWPRIMITIVE, (DX)primType=%d, PrimitiveCount=%d", draw->primType, draw->PrimitiveCount);
 						prim += sizeof(D3DHAL_DP2DRAWPRIMITIVE);
 						GLenum prim = MesaConvPrimType(draw->primType);
-						if(prim != GL_NOOP)
+						GLenum list = draw_batch_type(draw->primType);
+						if(ctx->vstream[0].vbo != NULL && prim != GL_NOOP)
+						{
+							/* stream has GL mirror, draw it by vertex arrays */
+							DWORD cnt = MesaConvPrimVertex(draw->primType, draw->PrimitiveCount);
+							draw_batch_flush(ctx);
+							RENDER_BEGIN(ctx->state.fvf_shader);
+							if(!MesaVertexDrawVBO(ctx, prim, draw->VStart, 0, cnt, NULL, 0))
+							{
+								MesaVertexDrawStream(ctx, prim, draw->VStart, cnt);
+							}
+							RENDER_END;
+						}
+						else if(list != GL_NOOP)
+						{
+							draw_batch_begin(ctx, list, ctx->state.fvf_shader);
+							MesaVertexEmitStream(ctx, list, draw->VStart, MesaConvPrimVertex(draw->primType, draw->PrimitiveCount));
+						}
+						else if(prim != GL_NOOP)
 						{
 							/* using active stream */
+							draw_batch_flush(ctx);
+							RENDER_BEGIN(ctx->state.fvf_shader);
 							MesaVertexDrawStream(ctx, prim, draw->VStart, MesaConvPrimVertex(draw->primType, draw->PrimitiveCount));
+							RENDER_END;
 						}
 					}
-					RENDER_END;
 					NEXT_INST(0);
 					break;
 		    COMMAND(D3DDP2OP_DRAWINDEXEDPRIMITIVE)
 					CHECK_LIMITS(D3DHAL_DP2DRAWINDEXEDPRIMITIVE, inst->wStateCount);
 
-					RENDER_BEGIN(ctx->state.fvf_shader);
 					for(i = 0; i < inst->wStateCount; i++)
 					{
 						D3DHAL_DP2DRAWINDEXEDPRIMITIVE *draw = (D3DHAL_DP2DRAWINDEXEDPRIMITIVE*)prim;
 						prim += sizeof(D3DHAL_DP2DRAWINDEXEDPRIMITIVE);
 						GLenum prim = MesaConvPrimType(draw->primType);
+						GLenum list = draw_batch_type(draw->primType);
 						TOPIC("MININDEX", "primType=%d MinIndex=%d NumVertices=%d StartIndex=%d PrimitiveCount=%d",
 							draw->primType, draw->MinIndex, draw->NumVertices, draw->StartIndex, draw->PrimitiveCount
 						);
-						if(prim != GL_NOOP)
+						/* using active stream */
+						if(prim == GL_NOOP || !ctx->state.bind_indices)
 						{
-							/* using active stream */
-							if(ctx->state.bind_indices)
+							continue;
+						}
+
+						if(ctx->vstream[0].vbo != NULL)
+						{
+							DWORD cnt = MesaConvPrimVertex(draw->primType, draw->PrimitiveCount);
+							draw_batch_flush(ctx);
+							RENDER_BEGIN(ctx->state.fvf_shader);
+							if(!MesaVertexDrawVBO(ctx, prim, draw->StartIndex, draw->BaseVertexIndex, cnt,
+								ctx->state.bind_indices, ctx->state.bind_indices_stride))
 							{
 								MesaVertexDrawStreamIndex(ctx, prim,
-									draw->StartIndex, draw->BaseVertexIndex, MesaConvPrimVertex(draw->primType, draw->PrimitiveCount),
+									draw->StartIndex, draw->BaseVertexIndex, cnt,
 									ctx->state.bind_indices, ctx->state.bind_indices_stride
 								);
 							}
+							RENDER_END;
+						}
+						else if(list != GL_NOOP)
+						{
+							draw_batch_begin(ctx, list, ctx->state.fvf_shader);
+							MesaVertexEmitStreamIndex(ctx, list,
+								draw->StartIndex, draw->BaseVertexIndex, MesaConvPrimVertex(draw->primType, draw->PrimitiveCount),
+								ctx->state.bind_indices, ctx->state.bind_indices_stride
+							);
+						}
+						else
+						{
+							draw_batch_flush(ctx);
+							RENDER_BEGIN(ctx->state.fvf_shader);
+							MesaVertexDrawStreamIndex(ctx, prim,
+								draw->StartIndex, draw->BaseVertexIndex, MesaConvPrimVertex(draw->primType, draw->PrimitiveCount),
+								ctx->state.bind_indices, ctx->state.bind_indices_stride
+							);
+							RENDER_END;
 						}
 					}
-					RENDER_END;
 					NEXT_INST(0);
 					break;
 		    COMMAND(D3DDP2OP_CREATEPIXELSHADER)
@@ -1648,6 +1943,10 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 						CHECK_LIMITS(D3DHAL_DP2CREATEPIXELSHADER, 1);
 						prim += sizeof(D3DHAL_DP2CREATEPIXELSHADER);
 						CHECK_LIMITS_SIZE(shader->dwCodeSize);
+						TOPIC("SHADER", "CREATEPIXELSHADER dwHandle=%d, dwCodeSize=%d",
+							shader->dwHandle, shader->dwCodeSize
+						);
+						MesaPSCreate(ctx, shader, prim);
 						prim += shader->dwCodeSize;
 					}
 					NEXT_INST(0);
@@ -1656,6 +1955,8 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 					CHECK_LIMITS(D3DHAL_DP2PIXELSHADER, inst->wStateCount);
 					for(i = 0; i < inst->wStateCount; i++)
 					{
+						D3DHAL_DP2PIXELSHADER *shader = (D3DHAL_DP2PIXELSHADER*)prim;
+						MesaPSDestroy(ctx, shader->dwHandle);
 						prim += sizeof(D3DHAL_DP2PIXELSHADER);
 					}
 					NEXT_INST(0);
@@ -1664,8 +1965,24 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 					CHECK_LIMITS(D3DHAL_DP2PIXELSHADER, inst->wStateCount);
 					for(i = 0; i < inst->wStateCount; i++)
 					{
+						D3DHAL_DP2PIXELSHADER *shader = (D3DHAL_DP2PIXELSHADER*)prim;
+
+						/* 0 = fixed function pixel processing, stage activity depends on it */
+						if((ctx->state.current.pixelshader == 0) != (shader->dwHandle == 0))
+						{
+							int t;
+							for(t = 0; t < ctx->tmu_count; t++)
+							{
+								ctx->state.tmu[t].update = TRUE;
+							}
+						}
+						ctx->state.current.pixelshader = shader->dwHandle;
+						ctx->state.current.extraset[0] |= 1 << MESA_REC_EXTRA_PIXELSHADER;
+						TOPIC("SHADER", "SETPIXELSHADER dwHandle=%d", shader->dwHandle);
+
 						prim += sizeof(D3DHAL_DP2PIXELSHADER);
 					}
+					MesaDrawRefreshState(ctx);
 					NEXT_INST(0);
 					break;
 		    COMMAND(D3DDP2OP_SETPIXELSHADERCONST)
@@ -1675,6 +1992,7 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 						CHECK_LIMITS(D3DHAL_DP2SETPIXELSHADERCONST, 1);
 						prim += sizeof(D3DHAL_DP2SETPIXELSHADERCONST);
 						CHECK_LIMITS_SIZE(shaderconstset->dwCount * 4 * sizeof(D3DVALUE));
+						MesaPSConstSet(ctx, shaderconstset->dwRegister, shaderconstset->dwCount, (GLfloat*)prim);
 						prim += shaderconstset->dwCount * 4 * sizeof(D3DVALUE);
 					}
 					NEXT_INST(0);
@@ -1864,7 +2182,8 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 
 					WARN("Unknown command: 0x%X", inst->bCommand);
 
-					if(!entry->D3DParseUnknownCommand)
+					/* runtime callback is valid only on runtime thread (MesaDraw6Queueable) */
+					if(!entry->D3DParseUnknownCommand || ctx->dp2q.thread_id == GetCurrentThreadId())
 					{
 						*error_offset = (LPBYTE)inst - (LPBYTE)cmdBufferStart;
 						return D3DERR_COMMAND_UNPARSED;
@@ -2087,7 +2406,7 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 						switch(pStateSetOp->dwOperation)
 						{
 							case D3DHAL_STATESETCREATE:
-								MesaRecStart(ctx, pStateSetOp->dwParam, pStateSetOp->sbType);
+								MesaRecCreate(ctx, pStateSetOp->dwParam, pStateSetOp->sbType);
 								ctx->state.recording = TRUE;
 								break;
 							case D3DHAL_STATESETBEGIN:
@@ -2193,6 +2512,7 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 					{
 						D3DHAL_DP2SETVERTEXSHADERCONST *shaderconstset = (D3DHAL_DP2SETVERTEXSHADERCONST*)prim;
 						prim += sizeof(D3DHAL_DP2SETVERTEXSHADERCONST);
+						MesaRecVSConst(ctx, shaderconstset->dwRegister, shaderconstset->dwCount, (GLfloat*)prim);
 						prim += shaderconstset->dwCount * 4 * sizeof(D3DVALUE);
 					}
 					NEXT_INST(0);
@@ -2225,13 +2545,24 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 					NEXT_INST_TC(D3DHAL_DP2PIXELSHADER, inst->wStateCount);
 					break;
 		    COMMAND(D3DDP2OP_SETPIXELSHADER)
-					NEXT_INST_TC(D3DHAL_DP2PIXELSHADER, inst->wStateCount);
+					for(i = 0; i < inst->wStateCount; i++)
+					{
+						D3DHAL_DP2PIXELSHADER *shader = (D3DHAL_DP2PIXELSHADER*)prim;
+						prim += sizeof(D3DHAL_DP2PIXELSHADER);
+						if(ctx->state.record != NULL)
+						{
+							ctx->state.record->pixelshader = shader->dwHandle;
+							ctx->state.record->extraset[0] |= 1 << MESA_REC_EXTRA_PIXELSHADER;
+						}
+					}
+					NEXT_INST(0);
 					break;
 		    COMMAND(D3DDP2OP_SETPIXELSHADERCONST)
 					for(i = 0; i < inst->wStateCount; i++)
 					{
 						D3DHAL_DP2SETPIXELSHADERCONST *shaderconstset = (D3DHAL_DP2SETPIXELSHADERCONST*)prim;
 						prim += sizeof(D3DHAL_DP2SETPIXELSHADERCONST);
+						MesaRecPSConst(ctx, shaderconstset->dwRegister, shaderconstset->dwCount, (GLfloat*)prim);
 						prim += shaderconstset->dwCount * 4 * sizeof(D3DVALUE);
 					}
 					NEXT_INST(0);
@@ -2313,7 +2644,8 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 
 					WARN("Unknown command: 0x%X", inst->bCommand);
 
-					if(!entry->D3DParseUnknownCommand)
+					/* runtime callback is valid only on runtime thread (MesaDraw6Queueable) */
+					if(!entry->D3DParseUnknownCommand || ctx->dp2q.thread_id == GetCurrentThreadId())
 					{
 						*error_offset = (LPBYTE)inst - (LPBYTE)cmdBufferStart;
 						return D3DERR_COMMAND_UNPARSED;
@@ -2334,5 +2666,290 @@ NUKED_LOCAL DWORD MesaDraw6(mesa3d_ctx_t *ctx,
 		} // recoring
 	} // while
 
+	draw_batch_flush(ctx);
+	if(ctx->render.batch_merged)
+	{
+		TOPIC("DRAW", "merged draws: %d", ctx->render.batch_merged);
+		PERF_ADD(draws_merged, ctx->render.batch_merged);
+	}
+
 	return DD_OK;
 }
+
+/*
+ * Walk DP2 command buffer without executing it (MesaDP2Push). Returns FALSE
+ * when buffer has to be translated on caller thread: unknown command (runtime
+ * D3DParseUnknownCommand callback), truncated buffer (runtime needs error
+ * offset) or command which size depends on current vertex stride.
+ */
+#define SCAN_SIZE(_s) if(prim + (_s) > cmdBufferEnd){return FALSE;} prim += (_s)
+#define SCAN_TC(_t, _c) SCAN_SIZE(sizeof(_t) * (_c))
+
+NUKED_LOCAL BOOL MesaDraw6Queueable(LPBYTE cmdBufferStart, LPBYTE cmdBufferEnd)
+{
+	LPD3DHAL_DP2COMMAND inst = (LPD3DHAL_DP2COMMAND)cmdBufferStart;
+	DWORD extraBytes;
+	int i;
+
+	while((LPBYTE)inst < cmdBufferEnd)
+	{
+		LPBYTE prim = (LPBYTE)(inst + 1);
+		if(prim > cmdBufferEnd)
+		{
+			return FALSE;
+		}
+
+		switch((D3DHAL_DP2OPERATION)inst->bCommand)
+		{
+			case D3DDP2OP_POINTS:
+				SCAN_TC(D3DHAL_DP2POINTS, inst->wPrimitiveCount);
+				break;
+			case D3DDP2OP_LINELIST:
+				SCAN_TC(D3DHAL_DP2LINELIST, 1);
+				break;
+			case D3DDP2OP_LINESTRIP:
+				SCAN_TC(D3DHAL_DP2LINESTRIP, 1);
+				break;
+			case D3DDP2OP_TRIANGLELIST:
+				SCAN_TC(D3DHAL_DP2TRIANGLELIST, 1);
+				break;
+			case D3DDP2OP_TRIANGLESTRIP:
+				SCAN_TC(D3DHAL_DP2TRIANGLESTRIP, 1);
+				break;
+			case D3DDP2OP_TRIANGLEFAN:
+				SCAN_TC(D3DHAL_DP2TRIANGLEFAN, 1);
+				break;
+			case D3DDP2OP_INDEXEDLINELIST:
+				SCAN_TC(D3DHAL_DP2INDEXEDLINELIST, inst->wPrimitiveCount);
+				break;
+			case D3DDP2OP_INDEXEDLINESTRIP:
+				SCAN_TC(D3DHAL_DP2STARTVERTEX, 1);
+				SCAN_TC(WORD, inst->wPrimitiveCount+1);
+				break;
+			case D3DDP2OP_INDEXEDTRIANGLELIST:
+				SCAN_TC(D3DHAL_DP2INDEXEDTRIANGLELIST, inst->wPrimitiveCount);
+				break;
+			case D3DDP2OP_INDEXEDTRIANGLESTRIP:
+			case D3DDP2OP_INDEXEDTRIANGLEFAN:
+				SCAN_TC(D3DHAL_DP2STARTVERTEX, 1);
+				SCAN_TC(WORD, inst->wPrimitiveCount+2);
+				break;
+			case D3DDP2OP_INDEXEDTRIANGLELIST2:
+				SCAN_TC(D3DHAL_DP2STARTVERTEX, 1);
+				SCAN_TC(D3DHAL_DP2INDEXEDTRIANGLELIST2, inst->wPrimitiveCount);
+				break;
+			case D3DDP2OP_INDEXEDLINELIST2:
+				SCAN_TC(D3DHAL_DP2STARTVERTEX, 1);
+				SCAN_TC(D3DHAL_DP2INDEXEDLINELIST, inst->wPrimitiveCount);
+				break;
+			case D3DDP2OP_RENDERSTATE:
+				SCAN_TC(D3DHAL_DP2RENDERSTATE, inst->wStateCount);
+				break;
+			case D3DDP2OP_TEXTURESTAGESTATE:
+				SCAN_TC(D3DHAL_DP2TEXTURESTAGESTATE, inst->wStateCount);
+				break;
+			case D3DDP2OP_VIEWPORTINFO:
+				SCAN_TC(D3DHAL_DP2VIEWPORTINFO, inst->wStateCount);
+				break;
+			case D3DDP2OP_WINFO:
+				SCAN_TC(D3DHAL_DP2WINFO, inst->wStateCount);
+				break;
+			case D3DDP2OP_SETPALETTE:
+				SCAN_TC(D3DHAL_DP2SETPALETTE, inst->wStateCount);
+				break;
+			case D3DDP2OP_UPDATEPALETTE:
+			{
+				D3DHAL_DP2UPDATEPALETTE *lpPalUpdate = (D3DHAL_DP2UPDATEPALETTE*)prim;
+				SCAN_TC(D3DHAL_DP2UPDATEPALETTE, 1);
+				SCAN_TC(DWORD, lpPalUpdate->wNumEntries);
+				break;
+			}
+			case D3DDP2OP_ZRANGE:
+				SCAN_TC(D3DHAL_DP2ZRANGE, inst->wStateCount);
+				break;
+			case D3DDP2OP_SETMATERIAL:
+				SCAN_TC(D3DHAL_DP2SETMATERIAL, inst->wStateCount);
+				break;
+			case D3DDP2OP_SETLIGHT:
+				for(i = 0; i < inst->wStateCount; i++)
+				{
+					LPD3DHAL_DP2SETLIGHT lightset = (LPD3DHAL_DP2SETLIGHT)prim;
+					SCAN_TC(D3DHAL_DP2SETLIGHT, 1);
+					if(lightset->dwDataType == D3DHAL_SETLIGHT_DATA)
+					{
+						SCAN_TC(D3DLIGHT7, 1);
+					}
+				}
+				break;
+			case D3DDP2OP_CREATELIGHT:
+				SCAN_TC(D3DHAL_DP2CREATELIGHT, inst->wStateCount);
+				break;
+			case D3DDP2OP_SETTRANSFORM:
+				SCAN_TC(D3DHAL_DP2SETTRANSFORM, inst->wStateCount);
+				break;
+			case D3DDP2OP_EXT:
+				SCAN_TC(D3DHAL_DP2EXT, inst->wStateCount);
+				break;
+			case D3DDP2OP_TEXBLT:
+				SCAN_TC(D3DHAL_DP2TEXBLT, inst->wStateCount);
+				break;
+			case D3DDP2OP_STATESET:
+				SCAN_TC(D3DHAL_DP2STATESET, inst->wStateCount);
+				break;
+			case D3DDP2OP_SETPRIORITY:
+				SCAN_TC(D3DHAL_DP2SETPRIORITY, inst->wStateCount);
+				break;
+			case D3DDP2OP_SETRENDERTARGET:
+				SCAN_TC(D3DHAL_DP2SETRENDERTARGET, 1);
+				break;
+			case D3DDP2OP_CLEAR:
+				if(prim + sizeof(D3DHAL_DP2CLEAR) > cmdBufferEnd)
+				{
+					return FALSE;
+				}
+				prim += sizeof(D3DHAL_DP2CLEAR) - sizeof(RECT);
+				SCAN_TC(RECT, inst->wStateCount);
+				break;
+			case D3DDP2OP_SETTEXLOD:
+				SCAN_TC(D3DHAL_DP2SETTEXLOD, inst->wStateCount);
+				break;
+			case D3DDP2OP_SETCLIPPLANE:
+				SCAN_TC(D3DHAL_DP2SETCLIPPLANE, inst->wStateCount);
+				break;
+			case D3DDP2OP_CREATEVERTEXSHADER:
+				for(i = 0; i < inst->wStateCount; i++)
+				{
+					D3DHAL_DP2CREATEVERTEXSHADER *shader = (D3DHAL_DP2CREATEVERTEXSHADER*)prim;
+					SCAN_TC(D3DHAL_DP2CREATEVERTEXSHADER, 1);
+					SCAN_SIZE(shader->dwDeclSize + shader->dwCodeSize);
+				}
+				break;
+			case D3DDP2OP_DELETEVERTEXSHADER:
+			case D3DDP2OP_SETVERTEXSHADER:
+				SCAN_TC(D3DHAL_DP2VERTEXSHADER, inst->wStateCount);
+				break;
+			case D3DDP2OP_SETVERTEXSHADERCONST:
+				for(i = 0; i < inst->wStateCount; i++)
+				{
+					D3DHAL_DP2SETVERTEXSHADERCONST *shaderconstset = (D3DHAL_DP2SETVERTEXSHADERCONST*)prim;
+					SCAN_TC(D3DHAL_DP2SETVERTEXSHADERCONST, 1);
+					SCAN_SIZE(shaderconstset->dwCount * 4 * sizeof(D3DVALUE));
+				}
+				break;
+			case D3DDP2OP_SETSTREAMSOURCE:
+				SCAN_TC(D3DHAL_DP2SETSTREAMSOURCE, inst->wStateCount);
+				break;
+			case D3DDP2OP_SETSTREAMSOURCEUM:
+				SCAN_TC(D3DHAL_DP2SETSTREAMSOURCEUM, inst->wStateCount);
+				break;
+			case D3DDP2OP_SETINDICES:
+				for(i = 0; i < inst->wStateCount; i++)
+				{
+					D3DHAL_DP2SETINDICES *si = (D3DHAL_DP2SETINDICES*)prim;
+					SCAN_TC(D3DHAL_DP2SETINDICES, 1);
+					if(si->dwVBHandle > 0 && si->dwStride != 0 && si->dwStride != 2 && si->dwStride != 4)
+					{
+						return FALSE;
+					}
+				}
+				break;
+			case D3DDP2OP_DRAWPRIMITIVE:
+				SCAN_TC(D3DHAL_DP2DRAWPRIMITIVE, inst->wStateCount);
+				break;
+			case D3DDP2OP_DRAWINDEXEDPRIMITIVE:
+				SCAN_TC(D3DHAL_DP2DRAWINDEXEDPRIMITIVE, inst->wStateCount);
+				break;
+			case D3DDP2OP_CREATEPIXELSHADER:
+				for(i = 0; i < inst->wStateCount; i++)
+				{
+					D3DHAL_DP2CREATEPIXELSHADER *shader = (D3DHAL_DP2CREATEPIXELSHADER*)prim;
+					SCAN_TC(D3DHAL_DP2CREATEPIXELSHADER, 1);
+					SCAN_SIZE(shader->dwCodeSize);
+				}
+				break;
+			case D3DDP2OP_DELETEPIXELSHADER:
+			case D3DDP2OP_SETPIXELSHADER:
+				SCAN_TC(D3DHAL_DP2PIXELSHADER, inst->wStateCount);
+				break;
+			case D3DDP2OP_SETPIXELSHADERCONST:
+				for(i = 0; i < inst->wStateCount; i++)
+				{
+					D3DHAL_DP2SETPIXELSHADERCONST *shaderconstset = (D3DHAL_DP2SETPIXELSHADERCONST*)prim;
+					SCAN_TC(D3DHAL_DP2SETPIXELSHADERCONST, 1);
+					SCAN_SIZE(shaderconstset->dwCount * 4 * sizeof(D3DVALUE));
+				}
+				break;
+			case D3DDP2OP_CLIPPEDTRIANGLEFAN:
+				SCAN_TC(D3DHAL_CLIPPEDTRIANGLEFAN, inst->wStateCount);
+				break;
+			case D3DDP2OP_DRAWPRIMITIVE2:
+				SCAN_TC(D3DHAL_DP2DRAWPRIMITIVE2, inst->wStateCount);
+				break;
+			case D3DDP2OP_DRAWINDEXEDPRIMITIVE2:
+				SCAN_TC(D3DHAL_DP2DRAWINDEXEDPRIMITIVE2, inst->wStateCount);
+				break;
+			case D3DDP2OP_DRAWRECTPATCH:
+				extraBytes = 0;
+				for(i = 0; i < inst->wStateCount; i++)
+				{
+					D3DHAL_DP2DRAWRECTPATCH *patch = (D3DHAL_DP2DRAWRECTPATCH*)prim;
+					SCAN_TC(D3DHAL_DP2DRAWRECTPATCH, 1);
+					if(patch->Flags & RTPATCHFLAG_HASSEGS)
+					{
+						extraBytes += sizeof(D3DVALUE)* 4;
+					}
+					if(patch->Flags & RTPATCHFLAG_HASINFO)
+					{
+						extraBytes += sizeof(D3DRECTPATCH_INFO);
+					}
+					SCAN_SIZE(extraBytes);
+				}
+				break;
+			case D3DDP2OP_DRAWTRIPATCH:
+				extraBytes = 0;
+				for(i = 0; i < inst->wStateCount; i++)
+				{
+					D3DHAL_DP2DRAWTRIPATCH *patch = (D3DHAL_DP2DRAWTRIPATCH*)prim;
+					SCAN_TC(D3DHAL_DP2DRAWTRIPATCH, 1);
+					if(patch->Flags & RTPATCHFLAG_HASSEGS)
+					{
+						extraBytes += sizeof(D3DVALUE)* 3;
+					}
+					if(patch->Flags & RTPATCHFLAG_HASINFO)
+					{
+						extraBytes += sizeof(D3DTRIPATCH_INFO);
+					}
+					SCAN_SIZE(extraBytes);
+				}
+				break;
+			case D3DDP2OP_VOLUMEBLT:
+				SCAN_TC(D3DHAL_DP2VOLUMEBLT, inst->wStateCount);
+				break;
+			case D3DDP2OP_BUFFERBLT:
+				SCAN_TC(D3DHAL_DP2BUFFERBLT, inst->wStateCount);
+				break;
+			case D3DDP2OP_MULTIPLYTRANSFORM:
+				SCAN_TC(D3DHAL_DP2MULTIPLYTRANSFORM, inst->wStateCount);
+				break;
+			case D3DDP2OP_ADDDIRTYRECT:
+				SCAN_TC(D3DHAL_DP2ADDDIRTYRECT, inst->wStateCount);
+				break;
+			case D3DDP2OP_ADDDIRTYBOX:
+				SCAN_TC(D3DHAL_DP2ADDDIRTYBOX, inst->wStateCount);
+				break;
+			default:
+				if(inst->bCommand == D3DOP_EXIT)
+				{
+					return TRUE;
+				}
+				/* D3DDP2OP_TRIANGLEFAN_IMM, D3DDP2OP_LINELIST_IMM and unknown */
+				return FALSE;
+		}
+		inst = (LPD3DHAL_DP2COMMAND)prim;
+	}
+
+	return TRUE;
+}
+
+#undef SCAN_SIZE
+#undef SCAN_TC
@@ -50,6 +50,7 @@ DUMP_V(state.material.specular)
 DUMP_V(state.material.emissive)
 DUMP_F(state.material.shininess)
 DUMP_X(state.material.untracked)
+DUMP_X(state.material.color_mode)
 DUMP_X(state.material.lighting)
 DUMP_D(state.clipping.enabled)
 DUMP_D(state.clipping.activeplane[0])
@@ -26,122 +26,152 @@
 #ifndef __MESA3D_FLIP_H__INCLUDED__
 #define __MESA3D_FLIP_H__INCLUDED__
 
-static void *flip_y(mesa3d_ctx_t *ctx, const void *in, int w, int h, int bpp)
-{
-	int pitch = SurfacePitch(w, bpp);
-	BYTE *plane = MesaTempAlloc(ctx, w, pitch*h);
-	const BYTE *src = in;
-	int h1 = h-1;
-	int y;
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-	for(y = 0; y <= h1; y++)
-	{
-		memcpy(plane + (pitch*y), src + (pitch*(h1-y)), pitch);
-	}
-
-	return plane;
-}
-
-static void *flip_x(mesa3d_ctx_t *ctx, const void *in, int w, int h, int bpp)
+/* reverse pixels order of one line */
+static void flip_line_x(BYTE *dst, const BYTE *src, int w, int bpp)
 {
-	int pitch = SurfacePitch(w, bpp);
-	BYTE *plane = MesaTempAlloc(ctx, w, pitch*h);
-	const BYTE *src = in;
-	int w1 = w-1;
-	int x, y;
+	int x = 0;
 
 	switch(bpp)
 	{
 		case 16:
-			for(y = 0; y < h; y++)
+		{
+			const WORD *s = (const WORD*)src;
+			WORD *d = (WORD*)dst;
+#if defined(__GNUC__) && defined(__SSE2__)
+			for(; x + 8 <= w; x += 8)
 			{
-				for(x = 0; x <= w1; x++)
-				{
-					const WORD *s_line = (const WORD*)(src + pitch*y);
-					WORD *d_line = (WORD*)(plane + pitch*y);
-					d_line[x] = s_line[w1-x];
-				}
+				__m128i v = _mm_loadu_si128((const __m128i*)(s + w - x - 8));
+				v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+				v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+				v = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+				_mm_storeu_si128((__m128i*)(d + x), v);
+			}
+#endif
+			for(; x < w; x++)
+			{
+				d[x] = s[w-1-x];
 			}
 			break;
+		}
 		case 32:
-			for(y = 0; y < h; y++)
+		{
+			const DWORD *s = (const DWORD*)src;
+			DWORD *d = (DWORD*)dst;
+#if defined(__GNUC__) && defined(__SSE2__)
+			for(; x + 4 <= w; x += 4)
+			{
+				__m128i v = _mm_loadu_si128((const __m128i*)(s + w - x - 4));
+				v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+				_mm_storeu_si128((__m128i*)(d + x), v);
+			}
+#endif
+			for(; x < w; x++)
 			{
-				for(x = 0; x <= w1; x++)
-				{
-					const DWORD *s_line = (const DWORD*)(src + pitch*y);
-					DWORD *d_line = (DWORD*)(plane + pitch*y);
-					d_line[x] = s_line[w1-x];
-				}
+				d[x] = s[w-1-x];
 			}
 			break;
+		}
 		case 24:
-			for(y = 0; y < h; y++)
+		{
+			const BYTE *s = src + (w-1)*3;
+			for(; x < w; x++)
 			{
-				for(x = 0; x <= w1; x++)
-				{
-					const BYTE *s_line = src + pitch*y;
-					BYTE *d_line = plane + pitch*y;
-					d_line[x*3 + 0] = s_line[(w1-x)*3 + 0];
-					d_line[x*3 + 1] = s_line[(w1-x)*3 + 1];
-					d_line[x*3 + 2] = s_line[(w1-x)*3 + 2];
-				}
+				dst[0] = s[0];
+				dst[1] = s[1];
+				dst[2] = s[2];
+				dst += 3;
+				s   -= 3;
 			}
+			break;
+		}
 	}
+}
 
-	return plane;
+/*
+ * Flip directly to destination (no temporary plane), 'dst' and 'src'
+ * must not overlap.
+ */
+static void flip_y_to(void *dst, const void *src, int w, int h, int bpp)
+{
+	int pitch = SurfacePitch(w, bpp);
+	BYTE *d = dst;
+	const BYTE *s = (const BYTE*)src + pitch*(h-1);
+	int y;
+
+	for(y = 0; y < h; y++)
+	{
+		memcpy(d, s, pitch);
+		d += pitch;
+		s -= pitch;
+	}
 }
 
-static void *flip_xy(mesa3d_ctx_t *ctx, const void *in, int w, int h, int bpp)
+static void flip_x_to(void *dst, const void *src, int w, int h, int bpp)
 {
 	int pitch = SurfacePitch(w, bpp);
-	BYTE *plane = MesaTempAlloc(ctx, w, pitch*h);
-	const BYTE *src = in;
-	int w1 = w-1;
-	int h1 = h-1;
-	int x, y;
+	BYTE *d = dst;
+	const BYTE *s = src;
+	int y;
 
-	switch(bpp)
+	for(y = 0; y < h; y++)
 	{
-		case 16:
-			for(y = 0; y <= h1; y++)
-			{
-				for(x = 0; x <= w1; x++)
-				{
-					const WORD *s_line = (const WORD*)(src + pitch*y);
-					WORD *d_line = (WORD*)(plane + pitch*(h1-y));
-					d_line[x] = s_line[w1-x];
-				}
-			}
-			break;
-		case 32:
-			for(y = 0; y < h; y++)
-			{
-				for(x = 0; x <= w1; x++)
-				{
-					const DWORD *s_line = (const DWORD*)(src + pitch*y);
-					DWORD *d_line = (DWORD*)(plane + pitch*(h1-y));
-					d_line[x] = s_line[w1-x];
-				}
-			}
-			break;
-		case 24:
-			for(y = 0; y < h; y++)
-			{
-				for(x = 0; x <= w1; x++)
-				{
-					const BYTE *s_line = src + pitch*y;
-					BYTE *d_line = plane + pitch*(h1-y);
-					d_line[x*3 + 0] = s_line[(w1-x)*3 + 0];
-					d_line[x*3 + 1] = s_line[(w1-x)*3 + 1];
-					d_line[x*3 + 2] = s_line[(w1-x)*3 + 2];
-				}
-			}
-			break;
+		flip_line_x(d, s, w, bpp);
+		d += pitch;
+		s += pitch;
 	}
+}
+
+static void flip_xy_to(void *dst, const void *src, int w, int h, int bpp)
+{
+	int pitch = SurfacePitch(w, bpp);
+	BYTE *d = dst;
+	const BYTE *s = (const BYTE*)src + pitch*(h-1);
+	int y;
+
+	for(y = 0; y < h; y++)
+	{
+		flip_line_x(d, s, w, bpp);
+		d += pitch;
+		s -= pitch;
+	}
+}
+
+static void *flip_y(mesa3d_ctx_t *ctx, const void *in, int w, int h, int bpp)
+{
+	int pitch = SurfacePitch(w, bpp);
+	BYTE *plane = MesaTempAlloc(ctx, w, pitch*h);
+
+	if(plane)
+		flip_y_to(plane, in, w, h, bpp);
+
+	return plane;
+}
+
+static void *flip_x(mesa3d_ctx_t *ctx, const void *in, int w, int h, int bpp)
+{
+	int pitch = SurfacePitch(w, bpp);
+	BYTE *plane = MesaTempAlloc(ctx, w, pitch*h);
+
+	if(plane)
+		flip_x_to(plane, in, w, h, bpp);
 
 	return plane;
 }
 
+static void *flip_xy(mesa3d_ctx_t *ctx, const void *in, int w, int h, int bpp)
+{
+	int pitch = SurfacePitch(w, bpp);
+	BYTE *plane = MesaTempAlloc(ctx, w, pitch*h);
+
+	if(plane)
+		flip_xy_to(plane, in, w, h, bpp);
+
+	return plane;
+}
 
 #define XY(_mem, _x, _y) _mem[(_y)*bpitch + (_x)]
 #define XY24(_mem, _x, _y, _b) _mem[(_y)*pitch + (_x)*3 + (_b)]
@@ -0,0 +1,23 @@
+/******************************************************************************
+ * Copyright (c) 2025 Jaroslav Hensl                                          *
+ ******************************************************************************/
+
+/* FVFITEM(name, xyzrhw, normal, diffuse, texcoords) */
+FVFITEM(xyz,                     0, 0, 0, 0)
+FVFITEM(xyz_tex1,                0, 0, 0, 1)
+FVFITEM(xyz_tex2,                0, 0, 0, 2)
+FVFITEM(xyz_diffuse,             0, 0, 1, 0)
+FVFITEM(xyz_diffuse_tex1,        0, 0, 1, 1)
+FVFITEM(xyz_diffuse_tex2,        0, 0, 1, 2)
+FVFITEM(xyz_normal,              0, 1, 0, 0)
+FVFITEM(xyz_normal_tex1,         0, 1, 0, 1)
+FVFITEM(xyz_normal_tex2,         0, 1, 0, 2)
+FVFITEM(xyz_normal_diffuse,      0, 1, 1, 0)
+FVFITEM(xyz_normal_diffuse_tex1, 0, 1, 1, 1)
+FVFITEM(xyz_normal_diffuse_tex2, 0, 1, 1, 2)
+FVFITEM(xyzrhw,                  1, 0, 0, 0)
+FVFITEM(xyzrhw_tex1,             1, 0, 0, 1)
+FVFITEM(xyzrhw_tex2,             1, 0, 0, 2)
+FVFITEM(xyzrhw_diffuse,          1, 0, 1, 0)
+FVFITEM(xyzrhw_diffuse_tex1,     1, 0, 1, 1)
+FVFITEM(xyzrhw_diffuse_tex2,     1, 0, 1, 2)
@@ -40,6 +40,10 @@
 #include "nocrt.h"
 #endif
 
+#if defined(__GNUC__) && defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
 /* when 1 invert projection matrix, 0 invert viewmodel matrix */
 #define DX_INVERT_PROJECTION 1
 
@@ -392,6 +396,12 @@ NUKED_LOCAL void MesaApplyTransform(mesa3d_ctx_t *ctx, DWORD changes)
 			entry->proc.pglDisable(GL_VERTEX_BLEND_ARB);
 		}
 #endif
+
+		if(changes & MESA_TF_WORLD)
+		{
+			ctx->matrix.blend_valid = FALSE;
+			ctx->matrix.blend_upload = TRUE;
+		}
 	}
 }
 
@@ -470,38 +480,104 @@ NUKED_LOCAL void MesaSpaceModelviewReset(mesa3d_ctx_t *ctx)
 	GL_CHECK(entry->proc.pglPopMatrix());
 }
 
-NUKED_LOCAL void MesaVetexBlend(mesa3d_ctx_t *ctx, GLfloat coords[3], GLfloat *betas, int betas_cnt, GLfloat out[4])
+/*
+ * D3D blending weights: a_i = b_i for i < weight, a_weight = 1 - sum(b_i)
+ */
+NUKED_LOCAL void MesaVetexBlendWeights(mesa3d_ctx_t *ctx, GLfloat *betas, int betas_cnt, GLfloat out[MESA_WORLDS_MAX])
 {
 	int i;
-	GLfloat in4[4] = {coords[0], coords[1], coords[2], 1.0f};
-	GLfloat a_betas[MESA_WORLDS_MAX] = {1.0f};
-	GLfloat w[16];
-	GLfloat m[16] = {
-		0, 0, 0, 0,
-		0, 0, 0, 0,
-		0, 0, 0, 0,
-		0, 0, 0, 0
-	};
+	GLfloat last = 1.0f;
+
+	for(i = 0; i < MESA_WORLDS_MAX; i++)
+	{
+		out[i] = 0.0f;
+	}
 
 	for(i = 0; i < ctx->matrix.weight; i++)
 	{
-		GLfloat b1 = 0.0;
 		if(i < betas_cnt)
 		{
-			b1 = 1.0 - betas[i];
+			out[i] = betas[i];
+			last -= betas[i];
 		}
-		
-		a_betas[0] -= b1;
-		a_betas[1+i] = b1;
 	}
-	
-	for(i = 0; i <= ctx->matrix.weight; i++)
+
+	out[ctx->matrix.weight] = last;
+}
+
+#if defined(__GNUC__) && defined(__SSE__)
+inline static void matblendf(GLfloat world[MESA_WORLDS_MAX][16], const GLfloat *a, int cnt, GLfloat out[16])
+{
+	int r, i;
+	for(r = 0; r < 16; r += 4)
 	{
-		matmultdotf(ctx->matrix.world[i], a_betas[i], w);
-		mataddf(m, w, m);
+		__m128 acc = _mm_mul_ps(_mm_loadu_ps(&world[0][r]), _mm_set1_ps(a[0]));
+		for(i = 1; i < cnt; i++)
+		{
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(&world[i][r]), _mm_set1_ps(a[i])));
+		}
+		_mm_storeu_ps(&out[r], acc);
 	}
-	
-	matmultvecf(m, in4, out);
+}
+
+inline static void matblendvecf(const GLfloat m[16], const GLfloat in[4], GLfloat out[4])
+{
+	__m128 v = _mm_mul_ps(_mm_loadu_ps(&m[0]), _mm_set1_ps(in[0]));
+	v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(&m[4]),  _mm_set1_ps(in[1])));
+	v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(&m[8]),  _mm_set1_ps(in[2])));
+	v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(&m[12]), _mm_set1_ps(in[3])));
+	_mm_storeu_ps(out, v);
+}
+#else
+inline static void matblendf(GLfloat world[MESA_WORLDS_MAX][16], const GLfloat *a, int cnt, GLfloat out[16])
+{
+	int i;
+	GLfloat w[16];
+
+	matmultdotf(world[0], a[0], out);
+	for(i = 1; i < cnt; i++)
+	{
+		matmultdotf(world[i], a[i], w);
+		mataddf(out, w, out);
+	}
+}
+
+#define matblendvecf matmultvecf
+#endif
+
+/*
+ * Combined world matrix, skinned meshes have usually long runs
+ * of vertices with same weights, so keep the last result.
+ */
+static const GLfloat *MesaVetexBlendMatrix(mesa3d_ctx_t *ctx, GLfloat *betas, int betas_cnt)
+{
+	GLfloat a[MESA_WORLDS_MAX];
+
+	MesaVetexBlendWeights(ctx, betas, betas_cnt, a);
+
+	if(!ctx->matrix.blend_valid || memcmp(a, ctx->matrix.blend_w, sizeof(a)) != 0)
+	{
+		matblendf(ctx->matrix.world, a, ctx->matrix.weight + 1, ctx->matrix.blend);
+		memcpy(ctx->matrix.blend_w, a, sizeof(a));
+		ctx->matrix.blend_valid = TRUE;
+	}
+
+	return ctx->matrix.blend;
+}
+
+NUKED_LOCAL void MesaVetexBlend(mesa3d_ctx_t *ctx, GLfloat coords[3], GLfloat *betas, int betas_cnt, GLfloat out[4])
+{
+	GLfloat in4[4] = {coords[0], coords[1], coords[2], 1.0f};
+
+	matblendvecf(MesaVetexBlendMatrix(ctx, betas, betas_cnt), in4, out);
+}
+
+/* same as MesaVetexBlend but without translation */
+NUKED_LOCAL void MesaVetexBlendNormal(mesa3d_ctx_t *ctx, GLfloat normal[3], GLfloat *betas, int betas_cnt, GLfloat out[4])
+{
+	GLfloat in4[4] = {normal[0], normal[1], normal[2], 0.0f};
+
+	matblendvecf(MesaVetexBlendMatrix(ctx, betas, betas_cnt), in4, out);
 }
 
 NUKED_FAST void MesaSetTextureMatrix(mesa3d_ctx_t *ctx, int tmu, GLfloat matrix[16])
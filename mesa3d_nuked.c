@@ -37,6 +37,7 @@
 #include "vmdahal32.h"
 #include <d3d8caps.h>
 #include "vmhal9x.h"
+#include "vmsetup.h"
 #include "mesa3d.h"
 #include "osmesa.h"
 
@@ -54,5 +55,8 @@
 #include "mesa3d_state.c"
 #include "mesa3d_shader.c"
 #include "mesa3d_test.c"
+#include "mesa3d_trace.c"
+#include "mesa3d_texcache.c"
+#include "mesa3d_dp2q.c"
 #include "surface.c"
 #include "d3d.c"
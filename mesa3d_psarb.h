@@ -0,0 +1,1240 @@
+/******************************************************************************
+ * Copyright (c) 2025 Jaroslav Hensl                                          *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+ ******************************************************************************/
+#ifndef __MESA3D_PSARB_H__INCLUDED__
+#define __MESA3D_PSARB_H__INCLUDED__
+
+/*
+ * ps_1_1 - ps_1_4 bytecode to ARB_fragment_program translator
+ *
+ * v0/v1  -> fragment.color.primary/secondary
+ * r0-r5  -> TEMP rN, r0 is result.color at the end
+ * t0-t7  -> TEMP tN (ps_1_1 - ps_1_3), fragment.texcoord[n] (ps_1_4)
+ * c0-c7  -> program.env[n] (constants from DEF are in program.local[n])
+ * bump environment matrix of stage n is in program.env[8+n] as
+ * (m00, m01, m10, m11), luminance (scale, offset) in program.env[16+n]
+ *
+ * ARB has only negation as source modifier, so _bias, _bx2, 1-x and _x2
+ * are computed to temporary registers first. Destination shift is done by
+ * extra MUL. texm3x2depth and texdepth write result.depth (z/w, 1.0 when w
+ * is zero). Co-issued instruction pair is executed in parallel in D3D,
+ * so when second instruction reads destination of first one, first
+ * result is stored to temporary register until both are done.
+ */
+#define PSARB_MAX_TEMP   6
+#define PSARB_MAX_TEX    8
+#define PSARB_MAX_CONST  8
+
+#define PSARB_ENV_BUMPMAT 8
+#define PSARB_ENV_BUMPLUM 16
+
+/* variant: texture targets and fog, same bytecode can produce more programs */
+#define PSARB_VARIANT_CUBE(_n)  (1 << (_n))
+#define PSARB_VARIANT_FOG_MASK  0x300
+#define PSARB_VARIANT_FOG_LINEAR 0x100
+#define PSARB_VARIANT_FOG_EXP    0x200
+#define PSARB_VARIANT_FOG_EXP2   0x300
+
+/* helper registers */
+#define PSARB_AUX_S0 0x001
+#define PSARB_AUX_S1 0x002
+#define PSARB_AUX_S2 0x004
+#define PSARB_AUX_DM 0x008
+#define PSARB_AUX_CO 0x010
+#define PSARB_AUX_TM 0x020
+#define PSARB_AUX_TR 0x040
+#define PSARB_AUX_TB 0x080
+#define PSARB_AUX_TE 0x100
+#define PSARB_AUX_PJ 0x200
+#define PSARB_AUX_CNT 10
+
+typedef struct psarb
+{
+	char *out;
+	DWORD len;
+	DWORD size;
+	BOOL emit;
+	BOOL error;
+	DWORD minor;
+	DWORD variant;
+	DWORD temps;
+	DWORD texs;
+	DWORD aux;
+	BOOL consts;
+	BOOL redirect;
+	DWORD pads;
+	DWORD pad_stage[2];
+	DWORD def_cnt;
+	DWORD def_reg[PSARB_MAX_CONST];
+	float def_val[PSARB_MAX_CONST][4];
+} psarb_t;
+
+static const char psarb_comp[4] = {'x', 'y', 'z', 'w'};
+
+static const char *psarb_aux_names[PSARB_AUX_CNT] = {
+	"s0", "s1", "s2", "dm", "co", "tm", "tr", "tb", "te", "pj"
+};
+
+static void psarb_puts(psarb_t *st, const char *s)
+{
+	if(!st->emit)
+		return;
+
+	while(*s != '\0')
+	{
+		if(st->len+1 >= st->size)
+		{
+			st->error = TRUE;
+			return;
+		}
+		st->out[st->len++] = *s++;
+	}
+	st->out[st->len] = '\0';
+}
+
+static void psarb_putu(psarb_t *st, DWORD u)
+{
+	char buf[12];
+	int i = sizeof(buf)-1;
+
+	buf[i] = '\0';
+	do
+	{
+		buf[--i] = '0' + (u % 10);
+		u /= 10;
+	} while(u > 0);
+
+	psarb_puts(st, buf+i);
+}
+
+static void psarb_putc(psarb_t *st, char c)
+{
+	char buf[2] = {c, '\0'};
+	psarb_puts(st, buf);
+}
+
+static void psarb_aux(psarb_t *st, DWORD aux)
+{
+	int i;
+	st->aux |= aux;
+	for(i = 0; i < PSARB_AUX_CNT; i++)
+	{
+		if(aux & (1 << i))
+		{
+			psarb_puts(st, psarb_aux_names[i]);
+			break;
+		}
+	}
+}
+
+static void psarb_texcoord(psarb_t *st, DWORD n)
+{
+	psarb_puts(st, "fragment.texcoord[");
+	psarb_putu(st, n);
+	psarb_putc(st, ']');
+}
+
+static void psarb_sampler(psarb_t *st, DWORD n)
+{
+	psarb_puts(st, ", texture[");
+	psarb_putu(st, n);
+	psarb_puts(st, (st->variant & PSARB_VARIANT_CUBE(n)) ? "], CUBE;\n" : "], 2D;\n");
+}
+
+static void psarb_env(psarb_t *st, DWORD base, DWORD n, const char *swz)
+{
+	psarb_puts(st, "program.env[");
+	psarb_putu(st, base + n);
+	psarb_putc(st, ']');
+	psarb_puts(st, swz);
+}
+
+static int psarb_def_find(psarb_t *st, DWORD reg)
+{
+	DWORD i;
+	for(i = 0; i < st->def_cnt; i++)
+	{
+		if(st->def_reg[i] == reg)
+			return i;
+	}
+	return -1;
+}
+
+static void psarb_mask(psarb_t *st, DWORD mask)
+{
+	int i;
+	if(mask == 0xF)
+		return;
+
+	psarb_putc(st, '.');
+	for(i = 0; i < 4; i++)
+	{
+		if(mask & (1 << i))
+			psarb_putc(st, psarb_comp[i]);
+	}
+}
+
+static DWORD psarb_dst_mask(DWORD token)
+{
+	DWORD mask = (token & D3DSP_WRITEMASK_ALL) >> 16;
+	if(mask == 0)
+		mask = 0xF;
+
+	return mask;
+}
+
+static DWORD psarb_regtype(DWORD token)
+{
+	return (token & D3DSP_REGTYPE_MASK) >> D3DSP_REGTYPE_SHIFT;
+}
+
+static DWORD psarb_srcmod(DWORD token)
+{
+	return (token & D3DSP_SRCMOD_MASK) >> D3DSP_SRCMOD_SHIFT;
+}
+
+/* stage number from texture op destination (tN in ps_1_1 - ps_1_3, rN in ps_1_4) */
+static DWORD psarb_stage(psarb_t *st, DWORD token)
+{
+	DWORD num = token & D3DSP_REGNUM_MASK;
+	if(num >= PSARB_MAX_TEX)
+	{
+		st->error = TRUE;
+		return 0;
+	}
+	return num;
+}
+
+static void psarb_dst(psarb_t *st, DWORD token, DWORD mask)
+{
+	DWORD type = psarb_regtype(token);
+	DWORD num  = token & D3DSP_REGNUM_MASK;
+
+	if(st->redirect)
+	{
+		psarb_aux(st, PSARB_AUX_CO);
+		psarb_mask(st, mask);
+		return;
+	}
+
+	switch(type)
+	{
+		case D3DSPR_TEMP:
+			if(num >= PSARB_MAX_TEMP)
+			{
+				st->error = TRUE;
+				return;
+			}
+			st->temps |= 1 << num;
+			psarb_putc(st, 'r');
+			psarb_putu(st, num);
+			break;
+		case D3DSPR_TEXTURE:
+			if(st->minor >= 4 || num >= PSARB_MAX_TEX)
+			{
+				st->error = TRUE;
+				return;
+			}
+			st->texs |= 1 << num;
+			psarb_putc(st, 't');
+			psarb_putu(st, num);
+			break;
+		default:
+			st->error = TRUE;
+			return;
+	}
+
+	psarb_mask(st, mask);
+}
+
+/* register with swizzle, without source modifier */
+static void psarb_reg(psarb_t *st, DWORD token)
+{
+	DWORD type = psarb_regtype(token);
+	DWORD num  = token & D3DSP_REGNUM_MASK;
+	DWORD swz  = (token & D3DSP_SWIZZLE_MASK) >> D3DSP_SWIZZLE_SHIFT;
+	int def;
+	int i;
+
+	switch(type)
+	{
+		case D3DSPR_TEMP:
+			if(num >= PSARB_MAX_TEMP)
+			{
+				st->error = TRUE;
+				return;
+			}
+			st->temps |= 1 << num;
+			psarb_putc(st, 'r');
+			psarb_putu(st, num);
+			break;
+		case D3DSPR_INPUT:
+			if(num == 0)
+				psarb_puts(st, "fragment.color.primary");
+			else if(num == 1)
+				psarb_puts(st, "fragment.color.secondary");
+			else
+			{
+				st->error = TRUE;
+				return;
+			}
+			break;
+		case D3DSPR_CONST:
+			if(num >= PSARB_MAX_CONST)
+			{
+				st->error = TRUE;
+				return;
+			}
+
+			if((def = psarb_def_find(st, num)) >= 0)
+			{
+				psarb_puts(st, "program.local[");
+				psarb_putu(st, def);
+				psarb_putc(st, ']');
+			}
+			else
+			{
+				st->consts = TRUE;
+				psarb_puts(st, "c[");
+				psarb_putu(st, num);
+				psarb_putc(st, ']');
+			}
+			break;
+		case D3DSPR_TEXTURE:
+			if(num >= PSARB_MAX_TEX)
+			{
+				st->error = TRUE;
+				return;
+			}
+
+			if(st->minor >= 4)
+			{
+				psarb_texcoord(st, num);
+			}
+			else
+			{
+				st->texs |= 1 << num;
+				psarb_putc(st, 't');
+				psarb_putu(st, num);
+			}
+			break;
+		default:
+			st->error = TRUE;
+			return;
+	}
+
+	if(swz == 0x00 || swz == 0x55 || swz == 0xAA || swz == 0xFF)
+	{
+		/* replicate */
+		psarb_putc(st, '.');
+		psarb_putc(st, psarb_comp[swz & 3]);
+	}
+	else if(swz != 0xE4)
+	{
+		psarb_putc(st, '.');
+		for(i = 0; i < 4; i++)
+		{
+			psarb_putc(st, psarb_comp[(swz >> (i*2)) & 3]);
+		}
+	}
+}
+
+/* compute source modifier which ARB doesn't have to helper register s<slot> */
+static void psarb_src_prep(psarb_t *st, DWORD token, int slot)
+{
+	DWORD aux = PSARB_AUX_S0 << slot;
+
+	switch(psarb_srcmod(token))
+	{
+		case D3DSPSM_NONE:
+		case D3DSPSM_NEG:
+			break;
+		case D3DSPSM_BIAS:
+		case D3DSPSM_BIASNEG:
+			psarb_puts(st, "SUB ");
+			psarb_aux(st, aux);
+			psarb_puts(st, ", ");
+			psarb_reg(st, token);
+			psarb_puts(st, ", psk.x;\n");
+			break;
+		case D3DSPSM_SIGN:
+		case D3DSPSM_SIGNNEG:
+			psarb_puts(st, "MAD ");
+			psarb_aux(st, aux);
+			psarb_puts(st, ", ");
+			psarb_reg(st, token);
+			psarb_puts(st, ", psk.z, -psk.y;\n");
+			break;
+		case D3DSPSM_COMP:
+			psarb_puts(st, "SUB ");
+			psarb_aux(st, aux);
+			psarb_puts(st, ", psk.y, ");
+			psarb_reg(st, token);
+			psarb_puts(st, ";\n");
+			break;
+		case D3DSPSM_X2:
+		case D3DSPSM_X2NEG:
+			psarb_puts(st, "ADD ");
+			psarb_aux(st, aux);
+			psarb_puts(st, ", ");
+			psarb_reg(st, token);
+			psarb_puts(st, ", ");
+			psarb_reg(st, token);
+			psarb_puts(st, ";\n");
+			break;
+		default:
+			/* _dz, _dw are valid only for texld and texcrd */
+			st->error = TRUE;
+			break;
+	}
+}
+
+static void psarb_src(psarb_t *st, DWORD token, int slot)
+{
+	DWORD aux = PSARB_AUX_S0 << slot;
+
+	switch(psarb_srcmod(token))
+	{
+		case D3DSPSM_NONE:
+			psarb_reg(st, token);
+			break;
+		case D3DSPSM_NEG:
+			psarb_putc(st, '-');
+			psarb_reg(st, token);
+			break;
+		case D3DSPSM_BIAS:
+		case D3DSPSM_SIGN:
+		case D3DSPSM_COMP:
+		case D3DSPSM_X2:
+			psarb_aux(st, aux);
+			break;
+		case D3DSPSM_BIASNEG:
+		case D3DSPSM_SIGNNEG:
+		case D3DSPSM_X2NEG:
+			psarb_putc(st, '-');
+			psarb_aux(st, aux);
+			break;
+		default:
+			st->error = TRUE;
+			break;
+	}
+}
+
+/* _x2, _x4, _x8, _d2, _d4, _d8 */
+static const char *psarb_shift_scale(DWORD shift)
+{
+	switch(shift)
+	{
+		case 1:  return "psx.x";
+		case 2:  return "psx.y";
+		case 3:  return "psx.z";
+		case 15: return "psx.w";
+		case 14: return "psd.x";
+		case 13: return "psd.y";
+	}
+	return NULL;
+}
+
+/*
+ * emit instruction with D3D destination modifiers, 'lit' is optional
+ * first operand already computed to helper register (cnd condition)
+ */
+static void psarb_op(psarb_t *st, const char *name, DWORD dst, const char *lit, const DWORD *src, DWORD nsrc)
+{
+	DWORD shift = (dst & D3DSP_DSTSHIFT_MASK) >> D3DSP_DSTSHIFT_SHIFT;
+	BOOL sat = (((dst & D3DSP_DSTMOD_MASK) >> D3DSP_DSTMOD_SHIFT) & D3DSPDM_SATURATE) ? TRUE : FALSE;
+	DWORD mask = psarb_dst_mask(dst);
+	const char *scale = NULL;
+	DWORD i;
+
+	if(shift != 0)
+	{
+		scale = psarb_shift_scale(shift);
+		if(scale == NULL)
+		{
+			st->error = TRUE;
+			return;
+		}
+	}
+
+	for(i = 0; i < nsrc; i++)
+	{
+		psarb_src_prep(st, src[i], i);
+	}
+
+	psarb_puts(st, name);
+	if(sat && scale == NULL)
+		psarb_puts(st, "_SAT");
+	psarb_putc(st, ' ');
+
+	if(scale != NULL)
+	{
+		psarb_aux(st, PSARB_AUX_DM);
+		psarb_mask(st, mask);
+	}
+	else
+	{
+		psarb_dst(st, dst, mask);
+	}
+
+	if(lit != NULL)
+	{
+		psarb_puts(st, ", ");
+		psarb_puts(st, lit);
+	}
+
+	for(i = 0; i < nsrc; i++)
+	{
+		psarb_puts(st, ", ");
+		psarb_src(st, src[i], i);
+	}
+	psarb_puts(st, ";\n");
+
+	if(scale != NULL)
+	{
+		psarb_puts(st, sat ? "MUL_SAT " : "MUL ");
+		psarb_dst(st, dst, mask);
+		psarb_puts(st, ", dm, ");
+		psarb_puts(st, scale);
+		psarb_puts(st, ";\n");
+	}
+}
+
+static void psarb_arith(psarb_t *st, const char *name, const DWORD *p, DWORD pcnt, DWORD nsrc)
+{
+	if(pcnt != nsrc+1)
+	{
+		st->error = TRUE;
+		return;
+	}
+
+	psarb_op(st, name, p[0], NULL, p+1, nsrc);
+}
+
+/* cmp: dst = (src0 >= 0) ? src1 : src2, ARB CMP selects on src0 < 0 */
+static void psarb_cmp(psarb_t *st, const DWORD *p, DWORD pcnt)
+{
+	DWORD src[3];
+
+	if(pcnt != 4)
+	{
+		st->error = TRUE;
+		return;
+	}
+
+	src[0] = p[1];
+	src[1] = p[3];
+	src[2] = p[2];
+	psarb_op(st, "CMP", p[0], NULL, src, 3);
+}
+
+/* cnd: dst = (src0 > 0.5) ? src1 : src2 */
+static void psarb_cnd(psarb_t *st, const DWORD *p, DWORD pcnt)
+{
+	if(pcnt != 4)
+	{
+		st->error = TRUE;
+		return;
+	}
+
+	psarb_src_prep(st, p[1], 2);
+	psarb_puts(st, "SUB ");
+	psarb_aux(st, PSARB_AUX_TR);
+	psarb_puts(st, ", psk.x, ");
+	psarb_src(st, p[1], 2);
+	psarb_puts(st, ";\n");
+
+	psarb_op(st, "CMP", p[0], "tr", p+2, 2);
+}
+
+/* copy source (with modifiers) to helper register */
+static void psarb_fetch(psarb_t *st, DWORD aux, DWORD token)
+{
+	psarb_src_prep(st, token, 0);
+	psarb_puts(st, "MOV ");
+	psarb_aux(st, aux);
+	psarb_puts(st, ", ");
+	psarb_src(st, token, 0);
+	psarb_puts(st, ";\n");
+}
+
+/* texture coordinates with _dz/_dw projection (ps_1_4 texld and texcrd) to pj */
+static void psarb_project(psarb_t *st, DWORD token)
+{
+	DWORD mod = psarb_srcmod(token);
+	DWORD plain = token & ~D3DSP_SRCMOD_MASK;
+
+	psarb_puts(st, "MOV ");
+	psarb_aux(st, PSARB_AUX_PJ);
+	psarb_puts(st, ", ");
+	psarb_reg(st, plain);
+	psarb_puts(st, ";\n");
+
+	if(mod == D3DSPSM_DZ || mod == D3DSPSM_DW)
+	{
+		psarb_puts(st, mod == D3DSPSM_DZ ? "RCP pj.w, pj.z;\n" : "RCP pj.w, pj.w;\n");
+		psarb_puts(st, "MUL pj.xyz, pj, pj.w;\n");
+	}
+	else if(mod != D3DSPSM_NONE)
+	{
+		st->error = TRUE;
+	}
+}
+
+/* u' = u + m00*du + m10*dv, v' = v + m01*du + m11*dv */
+static void psarb_bump(psarb_t *st, DWORD stage, const char *coord)
+{
+	psarb_puts(st, "MAD ");
+	psarb_aux(st, PSARB_AUX_TB);
+	psarb_puts(st, ".xy, ");
+	psarb_env(st, PSARB_ENV_BUMPMAT, stage, "");
+	psarb_puts(st, ", tr.x, ");
+	psarb_puts(st, coord);
+	psarb_puts(st, ";\n");
+
+	psarb_puts(st, "MAD tb.xy, ");
+	psarb_env(st, PSARB_ENV_BUMPMAT, stage, ".zwzw");
+	psarb_puts(st, ", tr.y, tb;\n");
+}
+
+/* texbem, texbeml */
+static void psarb_texbem(psarb_t *st, const DWORD *p, DWORD pcnt, BOOL lum)
+{
+	DWORD stage;
+
+	if(pcnt != 2)
+	{
+		st->error = TRUE;
+		return;
+	}
+
+	stage = psarb_stage(st, p[0]);
+	psarb_fetch(st, PSARB_AUX_TR, p[1]);
+
+	psarb_puts(st, "MOV ");
+	psarb_aux(st, PSARB_AUX_TB);
+	psarb_puts(st, ", ");
+	psarb_texcoord(st, stage);
+	psarb_puts(st, ";\n");
+	psarb_bump(st, stage, "tb");
+
+	psarb_puts(st, "TEX ");
+	psarb_dst(st, p[0], 0xF);
+	psarb_puts(st, ", tb");
+	psarb_sampler(st, stage);
+
+	if(lum)
+	{
+		psarb_puts(st, "MAD_SAT tr.w, tr.z, ");
+		psarb_env(st, PSARB_ENV_BUMPLUM, stage, ".x");
+		psarb_puts(st, ", ");
+		psarb_env(st, PSARB_ENV_BUMPLUM, stage, ".y");
+		psarb_puts(st, ";\n");
+
+		psarb_puts(st, "MUL ");
+		psarb_dst(st, p[0], 0x7);
+		psarb_puts(st, ", ");
+		psarb_dst(st, p[0], 0xF);
+		psarb_puts(st, ", tr.w;\n");
+	}
+}
+
+/* texreg2ar, texreg2gb, texreg2rgb */
+static void psarb_texreg(psarb_t *st, const DWORD *p, DWORD pcnt, const char *swz)
+{
+	DWORD stage;
+
+	if(pcnt != 2)
+	{
+		st->error = TRUE;
+		return;
+	}
+
+	stage = psarb_stage(st, p[0]);
+	psarb_fetch(st, PSARB_AUX_TR, p[1]);
+
+	psarb_puts(st, "TEX ");
+	psarb_dst(st, p[0], 0xF);
+	psarb_puts(st, ", tr");
+	psarb_puts(st, swz);
+	psarb_sampler(st, stage);
+}
+
+/* one row of texm3x2* and texm3x3* matrix */
+static DWORD psarb_texrow(psarb_t *st, const DWORD *p, DWORD pcnt, DWORD rows)
+{
+	DWORD stage;
+	DWORD row = st->pads;
+
+	if(pcnt < 2 || row >= rows)
+	{
+		st->error = TRUE;
+		return 0;
+	}
+
+	stage = psarb_stage(st, p[0]);
+	psarb_src_prep(st, p[1], 0);
+	psarb_puts(st, "DP3 ");
+	psarb_aux(st, PSARB_AUX_TM);
+	psarb_putc(st, '.');
+	psarb_putc(st, psarb_comp[row]);
+	psarb_puts(st, ", ");
+	psarb_texcoord(st, stage);
+	psarb_puts(st, ", ");
+	psarb_src(st, p[1], 0);
+	psarb_puts(st, ";\n");
+
+	if(row < 2)
+		st->pad_stage[row] = stage;
+
+	st->pads = row + 1;
+	return stage;
+}
+
+static void psarb_texpad(psarb_t *st, const DWORD *p, DWORD pcnt, DWORD rows)
+{
+	if(pcnt != 2 || st->pads + 1 >= rows)
+	{
+		st->error = TRUE;
+		return;
+	}
+
+	psarb_texrow(st, p, pcnt, rows);
+}
+
+/* last row of matrix, 'rows' have to be complete */
+static DWORD psarb_texlast(psarb_t *st, const DWORD *p, DWORD pcnt, DWORD nsrc, DWORD rows)
+{
+	DWORD stage;
+
+	if(pcnt != nsrc+1 || st->pads + 1 != rows)
+	{
+		st->error = TRUE;
+		return 0;
+	}
+
+	stage = psarb_texrow(st, p, pcnt, rows);
+	st->pads = 0;
+
+	return stage;
+}
+
+/* texm3x3spec, texm3x3vspec: R = 2*(N.E)/(N.N)*N - E */
+static void psarb_texspec(psarb_t *st, const DWORD *p, DWORD pcnt, BOOL vspec)
+{
+	DWORD stage;
+	DWORD pad0 = st->pad_stage[0];
+	DWORD pad1 = st->pad_stage[1];
+
+	stage = psarb_texlast(st, p, pcnt, vspec ? 1 : 2, 3);
+	if(st->error)
+		return;
+
+	if(vspec)
+	{
+		/* eye vector is in W of texture coordinates */
+		psarb_puts(st, "MOV ");
+		psarb_aux(st, PSARB_AUX_TE);
+		psarb_puts(st, ".x, ");
+		psarb_texcoord(st, pad0);
+		psarb_puts(st, ".w;\nMOV te.y, ");
+		psarb_texcoord(st, pad1);
+		psarb_puts(st, ".w;\nMOV te.z, ");
+		psarb_texcoord(st, stage);
+		psarb_puts(st, ".w;\n");
+	}
+	else
+	{
+		psarb_fetch(st, PSARB_AUX_TE, p[2]);
+	}
+
+	st->aux |= PSARB_AUX_TR;
+	psarb_puts(st,
+		"DP3 tr.x, tm, te;\n"
+		"DP3 tr.y, tm, tm;\n"
+		"RCP tr.y, tr.y;\n"
+		"MUL tr.x, tr.x, tr.y;\n"
+		"MUL tr.x, tr.x, psk.z;\n"
+		"MAD tr, tm, tr.x, -te;\n"
+		"TEX ");
+	psarb_dst(st, p[0], 0xF);
+	psarb_puts(st, ", tr");
+	psarb_sampler(st, stage);
+}
+
+/* texm3x2depth, texdepth: depth = z/w, 1.0 when w is 0 */
+static void psarb_depth(psarb_t *st, const char *z, const char *w)
+{
+	psarb_puts(st, "RCP ");
+	psarb_aux(st, PSARB_AUX_TR);
+	psarb_puts(st, ".y, ");
+	psarb_puts(st, w);
+	psarb_puts(st, ";\nMUL tr.x, ");
+	psarb_puts(st, z);
+	psarb_puts(st, ", tr.y;\nABS tr.y, ");
+	psarb_puts(st, w);
+	psarb_puts(st,
+		";\nCMP tr.x, -tr.y, tr.x, psk.y;\n"
+		"MOV_SAT result.depth.z, tr.x;\n");
+}
+
+/* texkill operand is destination token */
+static void psarb_texkill(psarb_t *st, const DWORD *p, DWORD pcnt)
+{
+	DWORD type;
+	DWORD num;
+
+	if(pcnt != 1)
+	{
+		st->error = TRUE;
+		return;
+	}
+
+	type = psarb_regtype(p[0]);
+	num = p[0] & D3DSP_REGNUM_MASK;
+
+	psarb_puts(st, "KIL ");
+	if(type == D3DSPR_TEXTURE && num < PSARB_MAX_TEX)
+	{
+		psarb_texcoord(st, num);
+	}
+	else if(type == D3DSPR_TEMP && st->minor >= 4 && num < PSARB_MAX_TEMP)
+	{
+		st->temps |= 1 << num;
+		psarb_putc(st, 'r');
+		psarb_putu(st, num);
+	}
+	else
+	{
+		st->error = TRUE;
+		return;
+	}
+	psarb_puts(st, ".xyzz;\n");
+}
+
+/* texture addressing ops of ps_1_1 - ps_1_3 */
+static void psarb_texop(psarb_t *st, DWORD op, const DWORD *p, DWORD pcnt)
+{
+	DWORD stage;
+
+	switch(op)
+	{
+		case D3DSIO_TEX:
+			if(pcnt != 1)
+			{
+				st->error = TRUE;
+				break;
+			}
+			stage = psarb_stage(st, p[0]);
+			psarb_puts(st, "TEX ");
+			psarb_dst(st, p[0], 0xF);
+			psarb_puts(st, ", ");
+			psarb_texcoord(st, stage);
+			psarb_sampler(st, stage);
+			break;
+		case D3DSIO_TEXCOORD:
+			if(pcnt != 1)
+			{
+				st->error = TRUE;
+				break;
+			}
+			stage = psarb_stage(st, p[0]);
+			psarb_puts(st, "MOV_SAT ");
+			psarb_dst(st, p[0], 0x7);
+			psarb_puts(st, ", ");
+			psarb_texcoord(st, stage);
+			psarb_puts(st, ";\nMOV ");
+			psarb_dst(st, p[0], 0x8);
+			psarb_puts(st, ", psk.y;\n");
+			break;
+		case D3DSIO_TEXKILL:
+			psarb_texkill(st, p, pcnt);
+			break;
+		case D3DSIO_TEXBEM:
+			psarb_texbem(st, p, pcnt, FALSE);
+			break;
+		case D3DSIO_TEXBEML:
+			psarb_texbem(st, p, pcnt, TRUE);
+			break;
+		case D3DSIO_TEXREG2AR:
+			psarb_texreg(st, p, pcnt, ".wxxx");
+			break;
+		case D3DSIO_TEXREG2GB:
+			psarb_texreg(st, p, pcnt, ".yzzz");
+			break;
+		case D3DSIO_TEXREG2RGB:
+			psarb_texreg(st, p, pcnt, ".xyzz");
+			break;
+		case D3DSIO_TEXM3x2PAD:
+			psarb_texpad(st, p, pcnt, 2);
+			break;
+		case D3DSIO_TEXM3x3PAD:
+			psarb_texpad(st, p, pcnt, 3);
+			break;
+		case D3DSIO_TEXM3x2TEX:
+		case D3DSIO_TEXM3x3TEX:
+			stage = psarb_texlast(st, p, pcnt, 1, op == D3DSIO_TEXM3x2TEX ? 2 : 3);
+			if(op == D3DSIO_TEXM3x2TEX)
+				psarb_puts(st, "MOV tm.zw, psk.w;\n");
+			psarb_puts(st, "TEX ");
+			psarb_dst(st, p[0], 0xF);
+			psarb_puts(st, ", tm");
+			psarb_sampler(st, stage);
+			break;
+		case D3DSIO_TEXM3x3:
+			psarb_texlast(st, p, pcnt, 1, 3);
+			psarb_puts(st, "MOV ");
+			psarb_dst(st, p[0], 0x7);
+			psarb_puts(st, ", tm;\nMOV ");
+			psarb_dst(st, p[0], 0x8);
+			psarb_puts(st, ", psk.y;\n");
+			break;
+		case D3DSIO_TEXM3x3SPEC:
+			psarb_texspec(st, p, pcnt, FALSE);
+			break;
+		case D3DSIO_TEXM3x3VSPEC:
+			psarb_texspec(st, p, pcnt, TRUE);
+			break;
+		case D3DSIO_TEXDP3TEX:
+			if(pcnt != 2 || st->pads != 0)
+			{
+				st->error = TRUE;
+				break;
+			}
+			stage = psarb_texrow(st, p, pcnt, 1);
+			st->pads = 0;
+			psarb_puts(st, "MOV tm.yzw, psk.w;\nTEX ");
+			psarb_dst(st, p[0], 0xF);
+			psarb_puts(st, ", tm");
+			psarb_sampler(st, stage);
+			break;
+		case D3DSIO_TEXDP3:
+			if(pcnt != 2)
+			{
+				st->error = TRUE;
+				break;
+			}
+			stage = psarb_stage(st, p[0]);
+			psarb_src_prep(st, p[1], 0);
+			psarb_puts(st, "DP3 ");
+			psarb_dst(st, p[0], 0xF);
+			psarb_puts(st, ", ");
+			psarb_texcoord(st, stage);
+			psarb_puts(st, ", ");
+			psarb_src(st, p[1], 0);
+			psarb_puts(st, ";\n");
+			break;
+		case D3DSIO_TEXM3x2DEPTH:
+			if(st->minor < 3)
+			{
+				st->error = TRUE;
+				break;
+			}
+			psarb_texlast(st, p, pcnt, 1, 2);
+			psarb_depth(st, "tm.x", "tm.y");
+			break;
+		default:
+			/* texm3x3diff */
+			st->error = TRUE;
+			break;
+	}
+}
+
+/* texture ops of ps_1_4, stage is number of destination register */
+static void psarb_texop14(psarb_t *st, DWORD op, const DWORD *p, DWORD pcnt)
+{
+	DWORD stage;
+
+	switch(op)
+	{
+		case D3DSIO_TEX: /* texld */
+			if(pcnt != 2)
+			{
+				st->error = TRUE;
+				break;
+			}
+			stage = psarb_stage(st, p[0]);
+			psarb_project(st, p[1]);
+			psarb_puts(st, "TEX ");
+			psarb_dst(st, p[0], 0xF);
+			psarb_puts(st, ", pj");
+			psarb_sampler(st, stage);
+			break;
+		case D3DSIO_TEXCOORD: /* texcrd */
+			if(pcnt != 2)
+			{
+				st->error = TRUE;
+				break;
+			}
+			psarb_project(st, p[1]);
+			psarb_puts(st, "MOV ");
+			psarb_dst(st, p[0], psarb_dst_mask(p[0]));
+			psarb_puts(st, ", pj;\n");
+			break;
+		case D3DSIO_TEXKILL:
+			psarb_texkill(st, p, pcnt);
+			break;
+		case D3DSIO_BEM:
+			if(pcnt != 3)
+			{
+				st->error = TRUE;
+				break;
+			}
+			stage = psarb_stage(st, p[0]);
+			psarb_fetch(st, PSARB_AUX_TR, p[2]);
+			psarb_src_prep(st, p[1], 1);
+			psarb_puts(st, "MOV ");
+			psarb_aux(st, PSARB_AUX_TB);
+			psarb_puts(st, ", ");
+			psarb_src(st, p[1], 1);
+			psarb_puts(st, ";\n");
+			psarb_bump(st, stage, "tb");
+			psarb_puts(st, "MOV ");
+			psarb_dst(st, p[0], psarb_dst_mask(p[0]) & 0x3);
+			psarb_puts(st, ", tb;\n");
+			break;
+		case D3DSIO_TEXDEPTH:
+			/* only r5 can be used */
+			if(pcnt != 1 || psarb_regtype(p[0]) != D3DSPR_TEMP || (p[0] & D3DSP_REGNUM_MASK) != 5)
+			{
+				st->error = TRUE;
+				break;
+			}
+			st->temps |= 1 << 5;
+			psarb_depth(st, "r5.x", "r5.y");
+			break;
+		default:
+			st->error = TRUE;
+			break;
+	}
+}
+
+/* co-issued instruction reads register written by previous one */
+static BOOL psarb_coissue_conflict(const DWORD *code, DWORD i, DWORD cnt, DWORD dst)
+{
+	DWORD k;
+	DWORD reg = dst & (D3DSP_REGTYPE_MASK | D3DSP_REGNUM_MASK);
+
+	if(i >= cnt || (code[i] & D3DSI_COISSUE) == 0)
+		return FALSE;
+
+	/* skip instruction token and destination */
+	for(k = i + 2; k < cnt && (code[k] & 0x80000000UL) != 0; k++)
+	{
+		if((code[k] & (D3DSP_REGTYPE_MASK | D3DSP_REGNUM_MASK)) == reg)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void psarb_body(psarb_t *st, const DWORD *code, DWORD cnt)
+{
+	DWORD i = 1; /* skip version */
+	BOOL restore = FALSE;
+	DWORD restore_dst = 0;
+
+	st->pads = 0;
+
+	while(i < cnt && !st->error)
+	{
+		DWORD ins = code[i];
+		DWORD op = ins & D3DSI_OPCODE_MASK;
+		const DWORD *p = &code[i+1];
+		DWORD pcnt = 0;
+
+		if(op == D3DSIO_END)
+			break;
+
+		if(op == D3DSIO_COMMENT)
+		{
+			i += 1 + ((ins & D3DSI_COMMENTSIZE_MASK) >> D3DSI_COMMENTSIZE_SHIFT);
+			continue;
+		}
+
+		if(op == D3DSIO_DEF)
+		{
+			/* values are floats, so parameter bit can't be used to count tokens */
+			if(i + 5 >= cnt)
+			{
+				st->error = TRUE;
+				break;
+			}
+
+			if(!st->emit)
+			{
+				DWORD reg = p[0] & D3DSP_REGNUM_MASK;
+				if(st->def_cnt >= PSARB_MAX_CONST || reg >= PSARB_MAX_CONST || psarb_def_find(st, reg) >= 0)
+				{
+					st->error = TRUE;
+					break;
+				}
+				st->def_reg[st->def_cnt] = reg;
+				memcpy(st->def_val[st->def_cnt], &p[1], sizeof(float)*4);
+				st->def_cnt++;
+			}
+			i += 6;
+			continue;
+		}
+
+		while(i + 1 + pcnt < cnt && (p[pcnt] & 0x80000000UL) != 0)
+		{
+			pcnt++;
+		}
+
+		if(pcnt > 0)
+			st->redirect = psarb_coissue_conflict(code, i + 1 + pcnt, cnt, p[0]);
+
+		switch(op)
+		{
+			case D3DSIO_NOP:
+			case D3DSIO_PHASE:
+				break;
+			case D3DSIO_MOV: psarb_arith(st, "MOV", p, pcnt, 1); break;
+			case D3DSIO_ADD: psarb_arith(st, "ADD", p, pcnt, 2); break;
+			case D3DSIO_SUB: psarb_arith(st, "SUB", p, pcnt, 2); break;
+			case D3DSIO_MUL: psarb_arith(st, "MUL", p, pcnt, 2); break;
+			case D3DSIO_MAD: psarb_arith(st, "MAD", p, pcnt, 3); break;
+			case D3DSIO_DP3: psarb_arith(st, "DP3", p, pcnt, 2); break;
+			case D3DSIO_DP4: psarb_arith(st, "DP4", p, pcnt, 2); break;
+			case D3DSIO_LRP: psarb_arith(st, "LRP", p, pcnt, 3); break;
+			case D3DSIO_CND: psarb_cnd(st, p, pcnt); break;
+			case D3DSIO_CMP: psarb_cmp(st, p, pcnt); break;
+			default:
+				if(st->minor >= 4)
+					psarb_texop14(st, op, p, pcnt);
+				else
+					psarb_texop(st, op, p, pcnt);
+				break;
+		}
+
+		if(restore)
+		{
+			psarb_puts(st, "MOV ");
+			psarb_dst(st, restore_dst, psarb_dst_mask(restore_dst));
+			psarb_puts(st, ", co;\n");
+			restore = FALSE;
+		}
+
+		if(st->redirect)
+		{
+			st->redirect = FALSE;
+			restore = TRUE;
+			restore_dst = p[0];
+		}
+
+		i += 1 + pcnt;
+	}
+}
+
+/*
+ * Translate shader to ARB program text, return length of text in 'out'
+ * or 0 when shader cannot be translated. Constants defined by DEF have
+ * to be loaded to program local parameters from st->def_val.
+ */
+static DWORD psarb_translate(psarb_t *st, const DWORD *code, DWORD cnt, DWORD variant, char *out, DWORD size)
+{
+	DWORD i;
+
+	memset(st, 0, sizeof(psarb_t));
+	st->out = out;
+	st->size = size;
+	st->variant = variant;
+
+	if(cnt < 2 || size == 0)
+		return 0;
+
+	if((code[0] & 0xFFFF0000UL) != 0xFFFF0000UL || D3DSHADER_VERSION_MAJOR(code[0]) != 1)
+		return 0;
+
+	st->minor = D3DSHADER_VERSION_MINOR(code[0]);
+	if(st->minor > 4)
+		return 0;
+
+	/* 1st pass: resources usage and DEFs */
+	psarb_body(st, code, cnt);
+	if(st->error)
+		return 0;
+
+	/* 2nd pass: code */
+	st->emit = TRUE;
+	psarb_puts(st, "!!ARBfp1.0\n");
+	switch(variant & PSARB_VARIANT_FOG_MASK)
+	{
+		case PSARB_VARIANT_FOG_LINEAR: psarb_puts(st, "OPTION ARB_fog_linear;\n"); break;
+		case PSARB_VARIANT_FOG_EXP:    psarb_puts(st, "OPTION ARB_fog_exp;\n");    break;
+		case PSARB_VARIANT_FOG_EXP2:   psarb_puts(st, "OPTION ARB_fog_exp2;\n");   break;
+	}
+
+	if(st->consts)
+		psarb_puts(st, "PARAM c[8] = { program.env[0..7] };\n");
+
+	psarb_puts(st, "PARAM psk = {0.5, 1.0, 2.0, 0.0};\n");
+	psarb_puts(st, "PARAM psx = {2.0, 4.0, 8.0, 0.5};\n");
+	psarb_puts(st, "PARAM psd = {0.25, 0.125, 0.0, 1.0};\n");
+
+	st->temps |= 1; /* r0 is result */
+	for(i = 0; i < PSARB_MAX_TEMP; i++)
+	{
+		if(st->temps & (1 << i))
+		{
+			psarb_puts(st, "TEMP r");
+			psarb_putu(st, i);
+			psarb_puts(st, ";\n");
+		}
+	}
+
+	for(i = 0; i < PSARB_MAX_TEX; i++)
+	{
+		if(st->texs & (1 << i))
+		{
+			psarb_puts(st, "TEMP t");
+			psarb_putu(st, i);
+			psarb_puts(st, ";\n");
+		}
+	}
+
+	for(i = 0; i < PSARB_AUX_CNT; i++)
+	{
+		if(st->aux & (1 << i))
+		{
+			psarb_puts(st, "TEMP ");
+			psarb_puts(st, psarb_aux_names[i]);
+			psarb_puts(st, ";\n");
+		}
+	}
+
+	psarb_body(st, code, cnt);
+
+	psarb_puts(st, "MOV result.color, r0;\n");
+	psarb_puts(st, "END\n");
+
+	if(st->error)
+		return 0;
+
+	return st->len;
+}
+
+#endif /* __MESA3D_PSARB_H__INCLUDED__ */
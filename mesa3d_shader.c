@@ -42,6 +42,9 @@
 #include "nocrt.h"
 #endif
 
+#include "mesa3d_vsarb.h"
+#include "mesa3d_psarb.h"
+
 NUKED_LOCAL void MesaVSCreate(mesa3d_ctx_t *ctx, D3DHAL_DP2CREATEVERTEXSHADER *shader, const BYTE *buffer)
 {
 	mesa_dx_shader_t **last_ptr = &ctx->shader.vs;
@@ -75,6 +78,8 @@ NUKED_LOCAL void MesaVSCreate(mesa3d_ctx_t *ctx, D3DHAL_DP2CREATEVERTEXSHADER *s
 		vs->code_size = shader->dwCodeSize;
 		vs->code = buf;
 		vs->handle = shader->dwHandle;
+		vs->prog = NULL;
+		vs->variant = 0;
 
 		memcpy(vs->decl, buffer, vs->decl_size);
 		memcpy(vs->code, buffer+vs->decl_size, vs->code_size);
@@ -105,12 +110,25 @@ NUKED_LOCAL void MesaVSDestroy(mesa3d_ctx_t *ctx, DWORD handle)
 
 NUKED_LOCAL void MesaVSDestroyAll(mesa3d_ctx_t *ctx)
 {
+	int i;
+
 	while(ctx->shader.vs != NULL)
 	{
 		mesa_dx_shader_t *vs = ctx->shader.vs;
 		ctx->shader.vs = vs->next;
 		hal_free(HEAP_NORMAL, vs);
 	}
+
+	/* GL programs are released with GL context */
+	for(i = 0; i < MESA_PROG_HT_MOD; i++)
+	{
+		while(ctx->shader.progs[i] != NULL)
+		{
+			mesa_dx_prog_t *prog = ctx->shader.progs[i];
+			ctx->shader.progs[i] = prog->next;
+			hal_free(HEAP_NORMAL, prog);
+		}
+	}
 }
 
 NUKED_LOCAL mesa_dx_shader_t *MesaVSGet(mesa3d_ctx_t *ctx, DWORD handle)
@@ -243,6 +261,7 @@ NUKED_LOCAL BOOL MesaVSSetVertex(mesa3d_ctx_t *ctx, mesa_dx_shader_t *vs)
 	}
 
 	ctx->state.vertex.betas = 0;
+	ctx->state.vertex.attrib_mask = 0;
 
 	for(i = 0; i < cnt; i++,decl++)
 	{
@@ -250,6 +269,8 @@ NUKED_LOCAL BOOL MesaVSSetVertex(mesa3d_ctx_t *ctx, mesa_dx_shader_t *vs)
 		DWORD type = (*decl) >> D3DVSD_TOKENTYPESHIFT;
 		switch(type)
 		{
+			case D3DVSD_TOKEN_NOP:
+				break;
 			case D3DVSD_TOKEN_STREAM:
 			{
 				DWORD stream_id = (*decl) ^ (D3DVSD_TOKEN_STREAM << D3DVSD_TOKENTYPESHIFT);
@@ -269,6 +290,21 @@ NUKED_LOCAL BOOL MesaVSSetVertex(mesa3d_ctx_t *ctx, mesa_dx_shader_t *vs)
 				DWORD data_type = ((*decl) & D3DVSD_DATATYPEMASK) >> D3DVSD_DATATYPESHIFT;
 				DWORD vertex_type = (*decl) & 0xFFFF;
 
+				if((*decl) & D3DVSD_DATALOADTYPEMASK)
+				{
+					/* D3DVSD_SKIP(n) */
+					offset += ((*decl) & D3DVSD_SKIPCOUNTMASK) >> D3DVSD_SKIPCOUNTSHIFT;
+					break;
+				}
+
+				if(vertex_type < MESA_VS_INPUTS && ctx->vstream[stream].mem.ptr != NULL)
+				{
+					D3DVSD2Mesa(data_type, &ctx->state.vertex.attrib[vertex_type].type, NULL);
+					ctx->state.vertex.attrib[vertex_type].ptr = &ctx->vstream[stream].mem.dw[offset];
+					ctx->state.vertex.attrib[vertex_type].stride32 = ctx->vstream[stream].stride/4;
+					ctx->state.vertex.attrib_mask |= 1 << vertex_type;
+				}
+
 				switch(vertex_type)
 				{
 					case D3DVSDE_POSITION:
@@ -314,6 +350,21 @@ NUKED_LOCAL BOOL MesaVSSetVertex(mesa3d_ctx_t *ctx, mesa_dx_shader_t *vs)
 				} // switch(vertex_type)
 				break;
 			}
+			case D3DVSD_TOKEN_CONSTMEM:
+			{
+				/* constants are loaded by runtime by SETVERTEXSHADERCONST, skip values */
+				DWORD skip = (((*decl) & D3DVSD_CONSTCOUNTMASK) >> D3DVSD_CONSTCOUNTSHIFT) * 4;
+				i    += skip;
+				decl += skip;
+				break;
+			}
+			case D3DVSD_TOKEN_EXT:
+			{
+				DWORD skip = ((*decl) & D3DVSD_EXTCOUNTMASK) >> D3DVSD_EXTCOUNTSHIFT;
+				i    += skip;
+				decl += skip;
+				break;
+			}
 			case D3DVSD_TOKEN_END:
 				i = cnt;
 				break;
@@ -329,3 +380,691 @@ NUKED_LOCAL BOOL MesaVSSetVertex(mesa3d_ctx_t *ctx, mesa_dx_shader_t *vs)
 
 	return TRUE;
 }
+
+NUKED_INLINE DWORD MesaProgHash(const BYTE *code, DWORD size)
+{
+	/* FNV-1a */
+	DWORD h = 2166136261UL;
+	DWORD i;
+
+	for(i = 0; i < size; i++)
+	{
+		h ^= code[i];
+		h *= 16777619UL;
+	}
+
+	return h;
+}
+
+NUKED_LOCAL mesa_dx_prog_t *MesaProgFind(mesa3d_ctx_t *ctx, GLenum target, DWORD variant, const BYTE *code, DWORD code_size, DWORD hash)
+{
+	mesa_dx_prog_t *prog = ctx->shader.progs[hash % MESA_PROG_HT_MOD];
+
+	while(prog != NULL)
+	{
+		if(prog->hash == hash && prog->target == target && prog->variant == variant &&
+			prog->code_size == code_size && memcmp(prog->code, code, code_size) == 0)
+		{
+			return prog;
+		}
+		prog = prog->next;
+	}
+
+	return NULL;
+}
+
+NUKED_LOCAL mesa_dx_prog_t *MesaProgInsert(mesa3d_ctx_t *ctx, GLenum target, DWORD variant, const BYTE *code, DWORD code_size, DWORD hash)
+{
+	mesa_dx_prog_t *prog = hal_alloc(HEAP_NORMAL, sizeof(mesa_dx_prog_t) + code_size, 0);
+	if(prog)
+	{
+		prog->hash = hash;
+		prog->code_size = code_size;
+		prog->target = target;
+		prog->variant = variant;
+		prog->prog = 0;
+		prog->code = (BYTE*)(prog + 1);
+		memcpy(prog->code, code, code_size);
+
+		prog->next = ctx->shader.progs[hash % MESA_PROG_HT_MOD];
+		ctx->shader.progs[hash % MESA_PROG_HT_MOD] = prog;
+	}
+
+	return prog;
+}
+
+static GLuint MesaVSCompile(mesa3d_ctx_t *ctx, const DWORD *code, DWORD cnt)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	DWORD text_size = cnt*128 + 1024;
+	char *text = hal_alloc(HEAP_NORMAL, text_size, 0);
+	vsarb_t *st = hal_alloc(HEAP_NORMAL, sizeof(vsarb_t), 0);
+	GLuint prog = 0;
+	DWORD len;
+	DWORD i;
+
+	if(text != NULL && st != NULL)
+	{
+		len = vsarb_translate(st, code, cnt, text, text_size);
+		if(len > 0)
+		{
+			/* error state is checked after program string load */
+			while(entry->proc.pglGetError() != GL_NO_ERROR);
+
+			entry->proc.pglGenProgramsARB(1, &prog);
+			entry->proc.pglBindProgramARB(GL_VERTEX_PROGRAM_ARB, prog);
+			entry->proc.pglProgramStringARB(GL_VERTEX_PROGRAM_ARB, GL_PROGRAM_FORMAT_ASCII_ARB, len, text);
+			if(entry->proc.pglGetError() != GL_NO_ERROR)
+			{
+				GLint pos = -1;
+				entry->proc.pglGetIntegerv(GL_PROGRAM_ERROR_POSITION_ARB, &pos);
+				ERR("Vertex program error at %d: %s", pos, entry->proc.pglGetString(GL_PROGRAM_ERROR_STRING_ARB));
+				TOPIC("SHADER", "%s", text);
+
+				entry->proc.pglDeleteProgramsARB(1, &prog);
+				prog = 0;
+			}
+			else
+			{
+				/* DEF constants are part of program */
+				for(i = 0; i < st->def_cnt; i++)
+				{
+					GL_CHECK(entry->proc.pglProgramLocalParameter4fvARB(GL_VERTEX_PROGRAM_ARB, i, st->def_val[i]));
+				}
+				TOPIC("SHADER", "new vertex program %d", prog);
+			}
+
+			GL_CHECK(entry->proc.pglBindProgramARB(GL_VERTEX_PROGRAM_ARB, ctx->state.vertex.program));
+		}
+		else
+		{
+			WARN("Unsupported vertex shader, version 0x%X", cnt > 0 ? code[0] : 0);
+		}
+	}
+
+	if(text)
+		hal_free(HEAP_NORMAL, text);
+
+	if(st)
+		hal_free(HEAP_NORMAL, st);
+
+	return prog;
+}
+
+NUKED_LOCAL GLuint MesaVSProgram(mesa3d_ctx_t *ctx, mesa_dx_shader_t *vs)
+{
+	if(vs->prog == NULL)
+	{
+		mesa_dx_prog_t *prog;
+		DWORD hash;
+
+		if(!ctx->entry->env.vertexshader || vs->code_size < 8)
+		{
+			return 0;
+		}
+
+		hash = MesaProgHash(vs->code, vs->code_size);
+		prog = MesaProgFind(ctx, GL_VERTEX_PROGRAM_ARB, 0, vs->code, vs->code_size, hash);
+		if(prog == NULL)
+		{
+			prog = MesaProgInsert(ctx, GL_VERTEX_PROGRAM_ARB, 0, vs->code, vs->code_size, hash);
+			if(prog == NULL)
+			{
+				return 0;
+			}
+			prog->prog = MesaVSCompile(ctx, (const DWORD*)vs->code, vs->code_size/4);
+		}
+		vs->prog = prog;
+	}
+
+	return vs->prog->prog;
+}
+
+NUKED_LOCAL void MesaVSBind(mesa3d_ctx_t *ctx, GLuint prog)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+
+	ctx->state.vertex.blend_gpu = FALSE;
+
+	if(ctx->state.vertex.program == prog)
+		return;
+
+	if(prog != 0)
+	{
+		if(ctx->state.vertex.program == 0)
+		{
+			GL_CHECK(entry->proc.pglEnable(GL_VERTEX_PROGRAM_ARB));
+		}
+		GL_CHECK(entry->proc.pglBindProgramARB(GL_VERTEX_PROGRAM_ARB, prog));
+	}
+	else
+	{
+		GL_CHECK(entry->proc.pglDisable(GL_VERTEX_PROGRAM_ARB));
+	}
+
+	ctx->state.vertex.program = prog;
+}
+
+/*
+ * Vertex blending (D3DRENDERSTATE_VERTEXBLEND) by vertex program. World
+ * matrices are in program.local[0..15] (row by row), blending weights are
+ * in vertex.attrib[1] as complete set (see MesaVetexBlendWeights)
+ */
+static const char blend_prog_head[] =
+	"!!ARBvp1.0\n"
+	"PARAM w[16] = { program.local[0..15] };\n"
+	"PARAM mv[4] = { state.matrix.modelview };\n"
+	"PARAM pj[4] = { state.matrix.projection };\n"
+	"ATTRIB ipos = vertex.position;\n"
+	"ATTRIB iwgt = vertex.attrib[1];\n"
+	"TEMP m, p, eye;\n"
+	"DP4 m.x, w[0], ipos;\n"
+	"DP4 m.y, w[1], ipos;\n"
+	"DP4 m.z, w[2], ipos;\n"
+	"DP4 m.w, w[3], ipos;\n"
+	"MUL p, m, iwgt.x;\n"
+	"DP4 m.x, w[4], ipos;\n"
+	"DP4 m.y, w[5], ipos;\n"
+	"DP4 m.z, w[6], ipos;\n"
+	"DP4 m.w, w[7], ipos;\n"
+	"MAD p, m, iwgt.y, p;\n"
+	"DP4 m.x, w[8], ipos;\n"
+	"DP4 m.y, w[9], ipos;\n"
+	"DP4 m.z, w[10], ipos;\n"
+	"DP4 m.w, w[11], ipos;\n"
+	"MAD p, m, iwgt.z, p;\n"
+	"DP4 m.x, w[12], ipos;\n"
+	"DP4 m.y, w[13], ipos;\n"
+	"DP4 m.z, w[14], ipos;\n"
+	"DP4 m.w, w[15], ipos;\n"
+	"MAD p, m, iwgt.w, p;\n"
+	"DP4 eye.x, mv[0], p;\n"
+	"DP4 eye.y, mv[1], p;\n"
+	"DP4 eye.z, mv[2], p;\n"
+	"DP4 eye.w, mv[3], p;\n"
+	"DP4 result.position.x, pj[0], eye;\n"
+	"DP4 result.position.y, pj[1], eye;\n"
+	"DP4 result.position.z, pj[2], eye;\n"
+	"DP4 result.position.w, pj[3], eye;\n"
+	"MOV result.color.primary, vertex.color.primary;\n"
+	"MOV result.color.secondary, vertex.color.secondary;\n"
+	"ABS result.fogcoord.x, eye.z;\n";
+
+static GLuint MesaBlendProgram(mesa3d_ctx_t *ctx)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	char *text;
+	DWORD len;
+	int i, r;
+
+	if(ctx->shader.blend_prog != 0 || ctx->shader.blend_failed)
+	{
+		return ctx->shader.blend_prog;
+	}
+
+	/* compile only once, even when fails */
+	ctx->shader.blend_failed = TRUE;
+
+	text = hal_alloc(HEAP_NORMAL, sizeof(blend_prog_head) + MESA_TMU_MAX*4*64 + 16, 0);
+	if(text == NULL)
+	{
+		return 0;
+	}
+
+	memcpy(text, blend_prog_head, sizeof(blend_prog_head));
+	len = sizeof(blend_prog_head) - 1;
+	for(i = 0; i < ctx->tmu_count; i++)
+	{
+		for(r = 0; r < 4; r++)
+		{
+			len += sprintf(text + len, "DP4 result.texcoord[%d].%c, state.matrix.texture[%d].row[%d], vertex.texcoord[%d];\n",
+				i, "xyzw"[r], i, r, i);
+		}
+	}
+	memcpy(text + len, "END\n", 5);
+	len += 4;
+
+	while(entry->proc.pglGetError() != GL_NO_ERROR);
+
+	entry->proc.pglGenProgramsARB(1, &ctx->shader.blend_prog);
+	entry->proc.pglBindProgramARB(GL_VERTEX_PROGRAM_ARB, ctx->shader.blend_prog);
+	entry->proc.pglProgramStringARB(GL_VERTEX_PROGRAM_ARB, GL_PROGRAM_FORMAT_ASCII_ARB, len, text);
+	if(entry->proc.pglGetError() != GL_NO_ERROR)
+	{
+		GLint pos = -1;
+		entry->proc.pglGetIntegerv(GL_PROGRAM_ERROR_POSITION_ARB, &pos);
+		ERR("Blend program error at %d: %s", pos, entry->proc.pglGetString(GL_PROGRAM_ERROR_STRING_ARB));
+
+		entry->proc.pglDeleteProgramsARB(1, &ctx->shader.blend_prog);
+		ctx->shader.blend_prog = 0;
+	}
+	else
+	{
+		ctx->shader.blend_failed = FALSE;
+		ctx->matrix.blend_upload = TRUE;
+		TOPIC("SHADER", "blend program %d", ctx->shader.blend_prog);
+	}
+
+	GL_CHECK(entry->proc.pglBindProgramARB(GL_VERTEX_PROGRAM_ARB, ctx->state.vertex.program));
+
+	hal_free(HEAP_NORMAL, text);
+
+	return ctx->shader.blend_prog;
+}
+
+/*
+ * Select between fixed function, vertex program blending and CPU blending,
+ * called before every draw with FVF (not with vertex shader).
+ * Program does only transformation, so when lighting, clip planes or
+ * texture coordinates generation is needed, blending is still done by CPU.
+ */
+NUKED_LOCAL void MesaBlendUpdate(mesa3d_ctx_t *ctx)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	GLuint prog = 0;
+	int i;
+
+	if(ctx->matrix.weight > 0 && !ctx->state.vertex.xyzrhw && entry->env.vertexshader
+		&& !ctx->state.material.lighting)
+	{
+		BOOL fixed_only = FALSE;
+		if(ctx->state.clipping.enabled)
+		{
+			for(i = 0; i < MESA_CLIPS_MAX; i++)
+			{
+				if(ctx->state.clipping.activeplane[i])
+					fixed_only = TRUE;
+			}
+		}
+
+		for(i = 0; i < ctx->tmu_count; i++)
+		{
+			if(ctx->state.tmu[i].image && ctx->state.tmu[i].coordscalc_used)
+				fixed_only = TRUE;
+		}
+
+		if(!fixed_only)
+		{
+			prog = MesaBlendProgram(ctx);
+		}
+	}
+
+	MesaVSBind(ctx, prog);
+	ctx->state.vertex.blend_gpu = (prog != 0) ? TRUE : FALSE;
+
+	if(prog != 0 && ctx->matrix.blend_upload)
+	{
+		GLfloat row[4];
+		int w, r;
+		for(w = 0; w < MESA_WORLDS_MAX; w++)
+		{
+			for(r = 0; r < 4; r++)
+			{
+				row[0] = ctx->matrix.world[w][r];
+				row[1] = ctx->matrix.world[w][4+r];
+				row[2] = ctx->matrix.world[w][8+r];
+				row[3] = ctx->matrix.world[w][12+r];
+				GL_CHECK(entry->proc.pglProgramLocalParameter4fvARB(GL_VERTEX_PROGRAM_ARB, w*4 + r, row));
+			}
+		}
+		ctx->matrix.blend_upload = FALSE;
+	}
+}
+
+NUKED_LOCAL void MesaVSConstSet(mesa3d_ctx_t *ctx, DWORD reg, DWORD count, const GLfloat *data)
+{
+	if(reg >= MESA_VS_MAX_CONST)
+		return;
+
+	if(reg + count > MESA_VS_MAX_CONST)
+		count = MESA_VS_MAX_CONST - reg;
+
+	if(count == 0)
+		return;
+
+	memcpy(&ctx->shader.vs_const[reg][0], data, count * sizeof(GLfloat[4]));
+
+	if(ctx->shader.vs_const_dirty_to == 0)
+	{
+		ctx->shader.vs_const_dirty_from = reg;
+		ctx->shader.vs_const_dirty_to   = reg + count;
+	}
+	else
+	{
+		if(reg < ctx->shader.vs_const_dirty_from)
+			ctx->shader.vs_const_dirty_from = reg;
+
+		if(reg + count > ctx->shader.vs_const_dirty_to)
+			ctx->shader.vs_const_dirty_to = reg + count;
+	}
+}
+
+/* need GL block, constants are shared by all programs as env parameters */
+NUKED_LOCAL void MesaVSConstFlush(mesa3d_ctx_t *ctx)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	DWORD from = ctx->shader.vs_const_dirty_from;
+	DWORD to   = ctx->shader.vs_const_dirty_to;
+	DWORD i;
+
+	if(to == 0)
+		return;
+
+	TOPIC("SHADER", "VS const upload c%d-c%d", from, to-1);
+	if(entry->proc.pglProgramEnvParameters4fvEXT)
+	{
+		GL_CHECK(entry->proc.pglProgramEnvParameters4fvEXT(GL_VERTEX_PROGRAM_ARB, from, to - from, &ctx->shader.vs_const[from][0]));
+	}
+	else
+	{
+		for(i = from; i < to; i++)
+		{
+			entry->proc.pglProgramEnvParameter4fvARB(GL_VERTEX_PROGRAM_ARB, i, &ctx->shader.vs_const[i][0]);
+		}
+	}
+
+	ctx->shader.vs_const_dirty_to = 0;
+}
+
+NUKED_LOCAL void MesaPSCreate(mesa3d_ctx_t *ctx, D3DHAL_DP2CREATEPIXELSHADER *shader, const BYTE *buffer)
+{
+	mesa_dx_shader_t **last_ptr = &ctx->shader.ps;
+	mesa_dx_shader_t *next = NULL;
+
+	while((*last_ptr) != NULL)
+	{
+		if((*last_ptr)->handle == shader->dwHandle)
+		{
+			next = (*last_ptr)->next;
+			break;
+		}
+
+		last_ptr = &((*last_ptr)->next);
+	}
+
+	size_t s = sizeof(mesa_dx_shader_t) + shader->dwCodeSize;
+	BYTE *buf = hal_alloc(HEAP_NORMAL, s, 0);
+	if(buf)
+	{
+		if((*last_ptr) != NULL)
+		{
+			hal_free(HEAP_NORMAL, *last_ptr);
+		}
+
+		mesa_dx_shader_t *ps = (mesa_dx_shader_t *)buf;
+		buf += sizeof(mesa_dx_shader_t);
+		ps->decl_size = 0;
+		ps->decl = NULL;
+		ps->code_size = shader->dwCodeSize;
+		ps->code = buf;
+		ps->handle = shader->dwHandle;
+		ps->prog = NULL;
+		ps->variant = 0;
+
+		memcpy(ps->code, buffer, ps->code_size);
+
+		ps->next = next;
+		*last_ptr = ps;
+	}
+}
+
+NUKED_LOCAL void MesaPSDestroy(mesa3d_ctx_t *ctx, DWORD handle)
+{
+	mesa_dx_shader_t **ptr = &ctx->shader.ps;
+
+	while((*ptr) != NULL)
+	{
+		if((*ptr)->handle == handle)
+		{
+			mesa_dx_shader_t *ps = (*ptr);
+			*ptr = ps->next;
+			hal_free(HEAP_NORMAL, ps);
+		}
+		else
+		{
+			ptr = &((*ptr)->next);
+		}
+	}
+}
+
+/* programs are in shared table and released by MesaVSDestroyAll */
+NUKED_LOCAL void MesaPSDestroyAll(mesa3d_ctx_t *ctx)
+{
+	while(ctx->shader.ps != NULL)
+	{
+		mesa_dx_shader_t *ps = ctx->shader.ps;
+		ctx->shader.ps = ps->next;
+		hal_free(HEAP_NORMAL, ps);
+	}
+}
+
+NUKED_LOCAL mesa_dx_shader_t *MesaPSGet(mesa3d_ctx_t *ctx, DWORD handle)
+{
+	mesa_dx_shader_t *ps = ctx->shader.ps;
+	while(ps != NULL)
+	{
+		if(ps->handle == handle)
+		{
+			return ps;
+		}
+		ps = ps->next;
+	}
+
+	return NULL;
+}
+
+static GLuint MesaPSCompile(mesa3d_ctx_t *ctx, const DWORD *code, DWORD cnt, DWORD variant)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	DWORD text_size = cnt*256 + 1024;
+	char *text = hal_alloc(HEAP_NORMAL, text_size, 0);
+	psarb_t *st = hal_alloc(HEAP_NORMAL, sizeof(psarb_t), 0);
+	GLuint prog = 0;
+	DWORD len;
+	DWORD i;
+
+	if(text != NULL && st != NULL)
+	{
+		len = psarb_translate(st, code, cnt, variant, text, text_size);
+		if(len > 0)
+		{
+			/* error state is checked after program string load */
+			while(entry->proc.pglGetError() != GL_NO_ERROR);
+
+			entry->proc.pglGenProgramsARB(1, &prog);
+			entry->proc.pglBindProgramARB(GL_FRAGMENT_PROGRAM_ARB, prog);
+			entry->proc.pglProgramStringARB(GL_FRAGMENT_PROGRAM_ARB, GL_PROGRAM_FORMAT_ASCII_ARB, len, text);
+			if(entry->proc.pglGetError() != GL_NO_ERROR)
+			{
+				GLint pos = -1;
+				entry->proc.pglGetIntegerv(GL_PROGRAM_ERROR_POSITION_ARB, &pos);
+				ERR("Fragment program error at %d: %s", pos, entry->proc.pglGetString(GL_PROGRAM_ERROR_STRING_ARB));
+				TOPIC("SHADER", "%s", text);
+
+				entry->proc.pglDeleteProgramsARB(1, &prog);
+				prog = 0;
+			}
+			else
+			{
+				for(i = 0; i < st->def_cnt; i++)
+				{
+					GL_CHECK(entry->proc.pglProgramLocalParameter4fvARB(GL_FRAGMENT_PROGRAM_ARB, i, st->def_val[i]));
+				}
+				TOPIC("SHADER", "new fragment program %d (variant 0x%X)", prog, variant);
+			}
+
+			GL_CHECK(entry->proc.pglBindProgramARB(GL_FRAGMENT_PROGRAM_ARB, ctx->shader.ps_program));
+		}
+		else
+		{
+			WARN("Unsupported pixel shader, version 0x%X", cnt > 0 ? code[0] : 0);
+		}
+	}
+
+	if(text)
+		hal_free(HEAP_NORMAL, text);
+
+	if(st)
+		hal_free(HEAP_NORMAL, st);
+
+	return prog;
+}
+
+/* same bytecode needs different program for cube textures and fog mode */
+static DWORD MesaPSVariant(mesa3d_ctx_t *ctx)
+{
+	DWORD variant = 0;
+	int i;
+
+	for(i = 0; i < ctx->tmu_count && i < PSARB_MAX_TEX; i++)
+	{
+		if(ctx->state.tmu[i].image != NULL && ctx->state.tmu[i].image->cube)
+		{
+			variant |= PSARB_VARIANT_CUBE(i);
+		}
+	}
+
+	if(ctx->state.fog.enabled)
+	{
+		GLenum func = ctx->state.fog.vmode;
+		if(func == 0)
+		{
+			func = ctx->state.fog.tmode;
+		}
+
+		switch(func)
+		{
+			case GL_LINEAR: variant |= PSARB_VARIANT_FOG_LINEAR; break;
+			case GL_EXP:    variant |= PSARB_VARIANT_FOG_EXP;    break;
+			case GL_EXP2:   variant |= PSARB_VARIANT_FOG_EXP2;   break;
+		}
+	}
+
+	return variant;
+}
+
+static GLuint MesaPSProgram(mesa3d_ctx_t *ctx, mesa_dx_shader_t *ps, DWORD variant)
+{
+	if(ps->prog == NULL || ps->variant != variant)
+	{
+		mesa_dx_prog_t *prog;
+		DWORD hash;
+
+		if(ps->code_size < 8)
+		{
+			return 0;
+		}
+
+		hash = MesaProgHash(ps->code, ps->code_size);
+		prog = MesaProgFind(ctx, GL_FRAGMENT_PROGRAM_ARB, variant, ps->code, ps->code_size, hash);
+		if(prog == NULL)
+		{
+			prog = MesaProgInsert(ctx, GL_FRAGMENT_PROGRAM_ARB, variant, ps->code, ps->code_size, hash);
+			if(prog == NULL)
+			{
+				return 0;
+			}
+			prog->prog = MesaPSCompile(ctx, (const DWORD*)ps->code, ps->code_size/4, variant);
+		}
+		ps->prog = prog;
+		ps->variant = variant;
+	}
+
+	return ps->prog->prog;
+}
+
+static void MesaPSBind(mesa3d_ctx_t *ctx, GLuint prog)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+
+	if(ctx->shader.ps_program == prog)
+		return;
+
+	if(prog != 0)
+	{
+		if(ctx->shader.ps_program == 0)
+		{
+			GL_CHECK(entry->proc.pglEnable(GL_FRAGMENT_PROGRAM_ARB));
+		}
+		GL_CHECK(entry->proc.pglBindProgramARB(GL_FRAGMENT_PROGRAM_ARB, prog));
+	}
+	else
+	{
+		GL_CHECK(entry->proc.pglDisable(GL_FRAGMENT_PROGRAM_ARB));
+	}
+
+	ctx->shader.ps_program = prog;
+}
+
+NUKED_LOCAL void MesaPSConstSet(mesa3d_ctx_t *ctx, DWORD reg, DWORD count, const GLfloat *data)
+{
+	if(reg >= MESA_PS_MAX_CONST)
+		return;
+
+	if(reg + count > MESA_PS_MAX_CONST)
+		count = MESA_PS_MAX_CONST - reg;
+
+	if(count == 0)
+		return;
+
+	memcpy(&ctx->shader.ps_const[reg][0], data, count * sizeof(GLfloat[4]));
+	ctx->shader.ps_const_dirty = TRUE;
+}
+
+/*
+ * Select fragment program for current pixel shader handle (or fixed function
+ * when shader is not set or cannot be translated) and upload constants.
+ * Bump environment of stage N is in program.env[8+N] and program.env[16+N].
+ */
+NUKED_LOCAL void MesaPSUpdate(mesa3d_ctx_t *ctx)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	mesa_dx_shader_t *ps = NULL;
+	GLuint prog = 0;
+	int i;
+
+	if(ctx->state.current.pixelshader != 0 && entry->env.pixelshader)
+	{
+		ps = MesaPSGet(ctx, ctx->state.current.pixelshader);
+	}
+
+	if(ps != NULL)
+	{
+		prog = MesaPSProgram(ctx, ps, MesaPSVariant(ctx));
+	}
+
+	MesaPSBind(ctx, prog);
+
+	if(prog == 0)
+		return;
+
+	if(ctx->shader.ps_const_dirty)
+	{
+		TOPIC("SHADER", "PS const upload");
+		if(entry->proc.pglProgramEnvParameters4fvEXT)
+		{
+			GL_CHECK(entry->proc.pglProgramEnvParameters4fvEXT(GL_FRAGMENT_PROGRAM_ARB, 0, MESA_PS_MAX_CONST, &ctx->shader.ps_const[0][0]));
+		}
+		else
+		{
+			for(i = 0; i < MESA_PS_MAX_CONST; i++)
+			{
+				entry->proc.pglProgramEnvParameter4fvARB(GL_FRAGMENT_PROGRAM_ARB, i, &ctx->shader.ps_const[i][0]);
+			}
+		}
+		ctx->shader.ps_const_dirty = FALSE;
+	}
+
+	if(ctx->shader.ps_bump_dirty)
+	{
+		for(i = 0; i < ctx->tmu_count && i < PSARB_MAX_TEX; i++)
+		{
+			struct mesa3d_tmustate *ts = &ctx->state.tmu[i];
+			GLfloat lum[4] = {ts->bumplum[0], ts->bumplum[1], 0.0f, 0.0f};
+
+			entry->proc.pglProgramEnvParameter4fvARB(GL_FRAGMENT_PROGRAM_ARB, PSARB_ENV_BUMPMAT + i, ts->bumpenv);
+			entry->proc.pglProgramEnvParameter4fvARB(GL_FRAGMENT_PROGRAM_ARB, PSARB_ENV_BUMPLUM + i, lum);
+		}
+		ctx->shader.ps_bump_dirty = FALSE;
+	}
+}
@@ -61,7 +61,7 @@ NUKED_LOCAL void MesaRecState(mesa3d_ctx_t *ctx, DWORD state, DWORD value)
 
 NUKED_LOCAL void MesaRecTMUState(mesa3d_ctx_t *ctx, DWORD tmu, DWORD state, DWORD value)
 {
-	if(state <= MESA_REC_MAX_TMU_STATE && ctx->state.record != NULL)
+	if(state < MESA_REC_MAX_TMU_STATE && tmu < MESA_TMU_MAX && ctx->state.record != NULL)
 	{
 		DWORD mask_byte = state >> 5; // div 32
 		DWORD mask_bit  = 1 << (state & 31);
@@ -71,6 +71,40 @@ NUKED_LOCAL void MesaRecTMUState(mesa3d_ctx_t *ctx, DWORD tmu, DWORD state, DWOR
 	}
 }
 
+NUKED_LOCAL void MesaRecVSConst(mesa3d_ctx_t *ctx, DWORD reg, DWORD count, const GLfloat *data)
+{
+	if(ctx->state.record != NULL && reg < MESA_VS_MAX_CONST)
+	{
+		DWORD i;
+		if(reg + count > MESA_VS_MAX_CONST)
+			count = MESA_VS_MAX_CONST - reg;
+
+		memcpy(&ctx->state.record->vs_const[reg][0], data, count * sizeof(GLfloat[4]));
+		for(i = reg; i < reg + count; i++)
+		{
+			ctx->state.record->vs_constset[i >> 5] |= 1 << (i & 31);
+		}
+		ctx->state.record->extraset[0] |= _BS(MESA_REC_EXTRA_VSCONST);
+	}
+}
+
+NUKED_LOCAL void MesaRecPSConst(mesa3d_ctx_t *ctx, DWORD reg, DWORD count, const GLfloat *data)
+{
+	if(ctx->state.record != NULL && reg < MESA_PS_MAX_CONST)
+	{
+		DWORD i;
+		if(reg + count > MESA_PS_MAX_CONST)
+			count = MESA_PS_MAX_CONST - reg;
+
+		memcpy(&ctx->state.record->ps_const[reg][0], data, count * sizeof(GLfloat[4]));
+		for(i = reg; i < reg + count; i++)
+		{
+			ctx->state.record->ps_constset[0] |= 1 << i;
+		}
+		ctx->state.record->extraset[0] |= _BS(MESA_REC_EXTRA_PSCONST);
+	}
+}
+
 #define SET_BIT(_v, _dw) (_v)[(_dw) >> 5] |= 1 << ((_dw) & 31)
 
 NUKED_LOCAL void state_apply_mask(mesa_rec_state_t *rec, D3DSTATEBLOCKTYPE sbType)
@@ -220,6 +254,9 @@ NUKED_LOCAL void state_apply_mask(mesa_rec_state_t *rec, D3DSTATEBLOCKTYPE sbTyp
 		SET_BIT(extraset, MESA_REC_EXTRA_MATERIAL);
 		SET_BIT(extraset, MESA_REC_EXTRA_VERTEXSHADER);
 		SET_BIT(extraset, MESA_REC_EXTRA_LIGHTS);
+		SET_BIT(extraset, MESA_REC_EXTRA_VSCONST);
+		SET_BIT(extraset, MESA_REC_EXTRA_PIXELSHADER);
+		SET_BIT(extraset, MESA_REC_EXTRA_PSCONST);
 	}
 	else if(sbType == D3DSBT_PIXELSTATE)
 	{
@@ -297,6 +334,9 @@ NUKED_LOCAL void state_apply_mask(mesa_rec_state_t *rec, D3DSTATEBLOCKTYPE sbTyp
 		SET_BIT(tmu_mask, D3DTSS_COLORARG0);
 		SET_BIT(tmu_mask, D3DTSS_ALPHAARG0);
 		SET_BIT(tmu_mask, D3DTSS_RESULTARG);
+
+		SET_BIT(extraset, MESA_REC_EXTRA_PIXELSHADER);
+		SET_BIT(extraset, MESA_REC_EXTRA_PSCONST);
 	}
 	else if(sbType == D3DSBT_VERTEXSTATE)
 	{
@@ -352,6 +392,7 @@ NUKED_LOCAL void state_apply_mask(mesa_rec_state_t *rec, D3DSTATEBLOCKTYPE sbTyp
 
 		SET_BIT(extraset, MESA_REC_EXTRA_VERTEXSHADER);
 		SET_BIT(extraset, MESA_REC_EXTRA_LIGHTS);
+		SET_BIT(extraset, MESA_REC_EXTRA_VSCONST);
 	}
 	
 	DWORD i;
@@ -371,6 +412,79 @@ NUKED_LOCAL void state_apply_mask(mesa_rec_state_t *rec, D3DSTATEBLOCKTYPE sbTyp
 
 #undef SET_BIT
 
+/*
+ * Pack set render and texture states to (state, value) array,
+ * so applying state block don't need to scan all bitmasks.
+ */
+static void MesaRecCompile(mesa_rec_state_t *rec)
+{
+	DWORD i, j;
+	DWORD cnt = 0;
+
+	for(i = 0; i <= MESA_REC_MAX_STATE; i++)
+	{
+		if(rec->stateset[i >> 5] & (1 << (i & 31)))
+			cnt++;
+	}
+
+	for(j = 0; j < MESA_TMU_MAX; j++)
+	{
+		for(i = 0; i < MESA_REC_MAX_TMU_STATE; i++)
+		{
+			if(rec->tmu[j].set[i >> 5] & (1 << (i & 31)))
+				cnt++;
+		}
+	}
+
+	if(cnt > rec->ops_size)
+	{
+		if(rec->ops)
+		{
+			hal_free(HEAP_NORMAL, rec->ops);
+		}
+
+		rec->ops_size = 0;
+		rec->ops_cnt = 0;
+		rec->ops = hal_alloc(HEAP_NORMAL, cnt*sizeof(mesa_rec_op_t), 0);
+		if(rec->ops == NULL)
+		{
+			ERR("MesaRecCompile: out of memory");
+			return;
+		}
+		rec->ops_size = cnt;
+	}
+
+	cnt = 0;
+	for(i = 0; i <= MESA_REC_MAX_STATE; i++)
+	{
+		if(rec->stateset[i >> 5] & (1 << (i & 31)))
+		{
+			rec->ops[cnt].tmu = MESA_REC_OP_RS;
+			rec->ops[cnt].state = i;
+			rec->ops[cnt].value = rec->state[i];
+			cnt++;
+		}
+	}
+
+	for(j = 0; j < MESA_TMU_MAX; j++)
+	{
+		for(i = 0; i < MESA_REC_MAX_TMU_STATE; i++)
+		{
+			if(rec->tmu[j].set[i >> 5] & (1 << (i & 31)))
+			{
+				rec->ops[cnt].tmu = j;
+				rec->ops[cnt].state = i;
+				rec->ops[cnt].value = rec->tmu[j].state[i];
+				cnt++;
+			}
+		}
+	}
+
+	rec->ops_cnt = cnt;
+	rec->compiled = TRUE;
+	TOPIC("STATESET", "compiled state block %d, ops=%d", rec->handle, cnt);
+}
+
 NUKED_LOCAL void MesaApplyState(mesa3d_ctx_t *ctx, mesa_rec_state_t *rec)
 {
 	DWORD i, j;
@@ -399,6 +513,52 @@ NUKED_LOCAL void MesaApplyState(mesa3d_ctx_t *ctx, mesa_rec_state_t *rec)
 		ctx->state.current.vertexshader = rec->vertexshader;
 		ctx->state.current.extraset[0] |= _BS(MESA_REC_EXTRA_VERTEXSHADER);
 	}
+
+	if(rec->extraset[0] & _BS(MESA_REC_EXTRA_VSCONST))
+	{
+		/* apply set registers as continuous ranges */
+		i = 0;
+		while(i < MESA_VS_MAX_CONST)
+		{
+			if(rec->vs_constset[i >> 5] & (1 << (i & 31)))
+			{
+				j = i;
+				while(j < MESA_VS_MAX_CONST && (rec->vs_constset[j >> 5] & (1 << (j & 31))))
+					j++;
+
+				MesaVSConstSet(ctx, i, j - i, &rec->vs_const[i][0]);
+				i = j;
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	if(rec->extraset[0] & _BS(MESA_REC_EXTRA_PIXELSHADER))
+	{
+		if((ctx->state.current.pixelshader == 0) != (rec->pixelshader == 0))
+		{
+			for(i = 0; i < (DWORD)ctx->tmu_count; i++)
+			{
+				ctx->state.tmu[i].update = TRUE;
+			}
+		}
+		ctx->state.current.pixelshader = rec->pixelshader;
+		ctx->state.current.extraset[0] |= _BS(MESA_REC_EXTRA_PIXELSHADER);
+	}
+
+	if(rec->extraset[0] & _BS(MESA_REC_EXTRA_PSCONST))
+	{
+		for(i = 0; i < MESA_PS_MAX_CONST; i++)
+		{
+			if(rec->ps_constset[0] & (1 << i))
+			{
+				MesaPSConstSet(ctx, i, 1, &rec->ps_const[i][0]);
+			}
+		}
+	}
 	
 	if(rec->extraset[0] & _BS(MESA_REC_EXTRA_LIGHTS))
 	{
@@ -419,32 +579,25 @@ NUKED_LOCAL void MesaApplyState(mesa3d_ctx_t *ctx, mesa_rec_state_t *rec)
 		memcpy(&ctx->state.current.lights[0], &rec->lights[0], sizeof(mesa3d_light_t)*MESA_REC_MAX_LIGHTS);
 	}
 
-	for(i = 0; i <= MESA_REC_MAX_STATE; i++)
+	if(!rec->compiled)
 	{
-		DWORD state_byte = i >> 5;
-		DWORD state_bit = 1 << (i & 31);
+		MesaRecCompile(rec);
+	}
 
-		if(rec->stateset[state_byte] & state_bit)
+	for(i = 0; i < rec->ops_cnt; i++)
+	{
+		mesa_rec_op_t *op = &rec->ops[i];
+		if(op->tmu == MESA_REC_OP_RS)
 		{
 			D3DHAL_DP2RENDERSTATE rstate;
-			rstate.RenderState = i;
-			rstate.dwState = rec->state[i];
-			//TOPIC("STATESET", "MesaApplyState: state=%d value=0x%X", i, rec->state[i]);
+			rstate.RenderState = op->state;
+			rstate.dwState = op->value;
+			//TOPIC("STATESET", "MesaApplyState: state=%d value=0x%X", op->state, op->value);
 			MesaSetRenderState(ctx, &rstate, NULL);
 		}
-	}
-
-	for(j = 0; j < MESA_TMU_MAX; j++)
-	{
-		for(i = 0; i < MESA_REC_MAX_TMU_STATE; i++)
+		else
 		{
-			DWORD state_byte = i >> 5;
-			DWORD state_bit = 1 << (i & 31);
-
-			if(rec->tmu[j].set[state_byte] & state_bit)
-			{
-				MesaSetTextureState(ctx, j, i, &rec->tmu[j].state[i]);
-			}
+			MesaSetTextureState(ctx, op->tmu, op->state, &op->value);
 		}
 	}
 	
@@ -455,43 +608,31 @@ NUKED_LOCAL void MesaApplyState(mesa3d_ctx_t *ctx, mesa_rec_state_t *rec)
 
 NUKED_LOCAL mesa_rec_state_t *MesaRecLookup(mesa3d_ctx_t *ctx, DWORD handle, BOOL create)
 {
-	int empty = -1;
-	int i;
-	for(i = 0; i < MESA_RECS_MAX; i++)
+	mesa_rec_state_t **bucket = &ctx->records[handle % MESA_RECS_HT_MOD];
+	mesa_rec_state_t *rec;
+
+	for(rec = *bucket; rec != NULL; rec = rec->next)
 	{
-		if(ctx->records[i] != NULL)
+		if(rec->handle == handle)
 		{
-			if(ctx->records[i]->handle == handle)
-			{
-#if 0
-				// JH: clear exist state on D3DHAL_STATESETBEGIN?
-				if(create)
-				{
-					memset(ctx->records[i], 0, sizeof(mesa_rec_state_t));
-					ctx->records[i]->handle = handle;
-				}
-#endif
-				return ctx->records[i];
-			}
-		}
-		else if(empty < 0)
-		{
-			empty = i;
+			return rec;
 		}
 	}
 
-	if(empty >= MESA_RECS_MAX || !create)
+	if(!create)
 	{
 		return NULL;
 	}
 
-	ctx->records[empty] = hal_calloc(HEAP_NORMAL, sizeof(mesa_rec_state_t), 0);
-	if(ctx->records[empty])
+	rec = hal_calloc(HEAP_NORMAL, sizeof(mesa_rec_state_t), 0);
+	if(rec)
 	{
-		ctx->records[empty]->handle = handle;
+		rec->handle = handle;
+		rec->next = *bucket;
+		*bucket = rec;
 	}
 
-	return ctx->records[empty];
+	return rec;
 }
 
 NUKED_LOCAL void MesaRecStart(mesa3d_ctx_t *ctx, DWORD handle, D3DSTATEBLOCKTYPE sbType)
@@ -502,11 +643,42 @@ NUKED_LOCAL void MesaRecStart(mesa3d_ctx_t *ctx, DWORD handle, D3DSTATEBLOCKTYPE
 	
 	if(rec)
 	{
+		rec->compiled = FALSE;
 		ctx->state.record = rec;
 		ctx->state.record_type = sbType;
 	}
 }
 
+/*
+ * Block created by D3DHAL_STATESETCREATE holds all shader constants of its
+ * type, not only registers written during recording (state_apply_mask only
+ * filters set bits), so mark them all and take current values.
+ */
+NUKED_LOCAL void MesaRecCreate(mesa3d_ctx_t *ctx, DWORD handle, D3DSTATEBLOCKTYPE sbType)
+{
+	mesa_rec_state_t *rec;
+
+	MesaRecStart(ctx, handle, sbType);
+	rec = ctx->state.record;
+
+	if(rec)
+	{
+		if(sbType == D3DSBT_ALL || sbType == D3DSBT_VERTEXSTATE)
+		{
+			memset(&rec->vs_constset[0], 0xFF, sizeof(rec->vs_constset));
+			memcpy(&rec->vs_const[0][0], &ctx->shader.vs_const[0][0], sizeof(rec->vs_const));
+			rec->extraset[0] |= _BS(MESA_REC_EXTRA_VSCONST);
+		}
+
+		if(sbType == D3DSBT_ALL || sbType == D3DSBT_PIXELSTATE)
+		{
+			rec->ps_constset[0] = (1UL << MESA_PS_MAX_CONST) - 1;
+			memcpy(&rec->ps_const[0][0], &ctx->shader.ps_const[0][0], sizeof(rec->ps_const));
+			rec->extraset[0] |= _BS(MESA_REC_EXTRA_PSCONST);
+		}
+	}
+}
+
 NUKED_LOCAL void MesaRecStop(mesa3d_ctx_t *ctx)
 {
 	TRACE_ENTRY
@@ -514,6 +686,7 @@ NUKED_LOCAL void MesaRecStop(mesa3d_ctx_t *ctx)
 	if(ctx->state.record)
 	{
 		state_apply_mask(ctx->state.record, ctx->state.record_type);
+		MesaRecCompile(ctx->state.record);
 		ctx->state.record = NULL;
 	}
 }
@@ -528,33 +701,60 @@ NUKED_LOCAL void MesaRecApply(mesa3d_ctx_t *ctx, DWORD handle)
 		if(rec == ctx->state.record)
 		{
 			state_apply_mask(rec, ctx->state.record_type);
+			rec->compiled = FALSE;
 		}
 
 		MesaApplyState(ctx, rec);
 	}
 }
 
+static void MesaRecFree(mesa_rec_state_t *rec)
+{
+	if(rec->ops)
+	{
+		hal_free(HEAP_NORMAL, rec->ops);
+	}
+	hal_free(HEAP_NORMAL, rec);
+}
+
 NUKED_LOCAL void MesaRecDelete(mesa3d_ctx_t *ctx, DWORD handle)
 {
 	TRACE_ENTRY
-	
-	DWORD i;
-	for(i = 0; i < MESA_RECS_MAX; i++)
+
+	mesa_rec_state_t **prec = &ctx->records[handle % MESA_RECS_HT_MOD];
+	while(*prec != NULL)
 	{
-		if(ctx->records[i] != NULL)
+		mesa_rec_state_t *rec = *prec;
+		if(rec->handle == handle)
 		{
-			if(ctx->records[i]->handle == handle)
+			if(rec == ctx->state.record)
 			{
-				if(ctx->records[i] == ctx->state.record)
-				{
-					ctx->state.record = NULL;
-					ctx->state.recording = FALSE;
-				}
+				ctx->state.record = NULL;
+				ctx->state.recording = FALSE;
 			}
-			hal_free(HEAP_NORMAL, ctx->records[i]);
-			ctx->records[i] = NULL;
+			*prec = rec->next;
+			MesaRecFree(rec);
+			break;
 		}
-	} // for
+		prec = &rec->next;
+	}
+}
+
+NUKED_LOCAL void MesaRecDestroyAll(mesa3d_ctx_t *ctx)
+{
+	DWORD i;
+	for(i = 0; i < MESA_RECS_HT_MOD; i++)
+	{
+		mesa_rec_state_t *rec = ctx->records[i];
+		while(rec != NULL)
+		{
+			mesa_rec_state_t *next = rec->next;
+			MesaRecFree(rec);
+			rec = next;
+		}
+		ctx->records[i] = NULL;
+	}
+	ctx->state.record = NULL;
 }
 
 NUKED_LOCAL void MesaRecCaptureInit(mesa3d_ctx_t *ctx)
@@ -582,8 +782,24 @@ NUKED_LOCAL void MesaRecCapture(mesa3d_ctx_t *ctx, DWORD handle)
 		}
 		
 		rec->vertexshader = ctx->state.current.vertexshader;
+		for(i = 0; i < MESA_VS_MAX_CONST; i++)
+		{
+			if(rec->vs_constset[i >> 5] & (1 << (i & 31)))
+			{
+				memcpy(&rec->vs_const[i][0], &ctx->shader.vs_const[i][0], sizeof(GLfloat[4]));
+			}
+		}
+		rec->pixelshader = ctx->state.current.pixelshader;
+		for(i = 0; i < MESA_PS_MAX_CONST; i++)
+		{
+			if(rec->ps_constset[0] & (1 << i))
+			{
+				memcpy(&rec->ps_const[i][0], &ctx->shader.ps_const[i][0], sizeof(GLfloat[4]));
+			}
+		}
 		memcpy(&rec->viewport, &ctx->state.current.viewport, sizeof(D3DHAL_DP2VIEWPORTINFO));
 		memcpy(&rec->material, &ctx->state.current.material, sizeof(D3DHAL_DP2SETMATERIAL));
+		MesaRecCompile(rec);
 	}
 	else
 	{
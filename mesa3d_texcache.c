@@ -0,0 +1,590 @@
+/******************************************************************************
+ * Copyright (c) 2025 Jaroslav Hensl                                          *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+ ******************************************************************************/
+#ifndef NUKED_SKIP
+#include <windows.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ddraw.h>
+#include <ddrawi.h>
+#include "ddrawi_ddk.h"
+#include "d3dhal_ddk.h"
+#include "vmdahal32.h"
+#include "vmhal9x.h"
+#include "mesa3d.h"
+#include "osmesa.h"
+
+#include "nocrt.h"
+#endif
+
+/*
+ * Cache of CPU converted textures (chroma key, palette, DXT fallback).
+ *
+ * Items are keyed by hash of source level and conversion parameters, so
+ * same data uploaded to more surfaces are converted only once. Size is
+ * limited by env.texcache (kB), the least recently used items are evicted
+ * first. Items which wasn't used for MESA_TEXCACHE_COLD_FRAMES are packed
+ * by simple LZ4 like compressor and unpacked on next use.
+ */
+
+#define TEXCACHE_LZ_BITS 12
+#define TEXCACHE_LZ_MIN_MATCH 4
+#define TEXCACHE_LZ_LAST_LITERALS 5
+#define TEXCACHE_LZ_MF_LIMIT 12
+
+/* maximum bytes packed on one frame */
+#define TEXCACHE_PACK_PER_FRAME (1024*1024)
+
+static void texcache_lock(mesa3d_entry_t *entry)
+{
+	while(InterlockedExchange(&entry->texcache.lock, 1) != 0)
+	{
+		Sleep(0);
+	}
+}
+
+static void texcache_unlock(mesa3d_entry_t *entry)
+{
+	InterlockedExchange(&entry->texcache.lock, 0);
+}
+
+NUKED_INLINE DWORD texcache_read32(const BYTE *p)
+{
+	DWORD v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+/* 2 lanes over DWORDs (FNV-1a + murmur like multiply), finalized by fmix32 */
+NUKED_LOCAL void MesaTexCacheKey(mesa_texcache_key_t *key, DWORD kind, DWORD format, DWORD w, DWORD h,
+	const void *src, DWORD src_size, DWORD param0, DWORD param1, DWORD param2)
+{
+	const BYTE *ptr = src;
+	DWORD h1 = 2166136261UL ^ src_size;
+	DWORD h2 = 0x9E3779B9UL ^ (w << 16) ^ h;
+	DWORD n = src_size >> 3;
+	DWORD i;
+
+	for(i = 0; i < n; i++)
+	{
+		h1 = (h1 ^ texcache_read32(ptr))   * 16777619UL;
+		h2 = (h2 ^ texcache_read32(ptr+4)) * 0x85EBCA6BUL;
+		h2 = (h2 << 13) | (h2 >> 19);
+		ptr += 8;
+	}
+
+	for(i = n << 3; i < src_size; i++)
+	{
+		h1 = (h1 ^ *ptr++) * 16777619UL;
+	}
+
+	h1 ^= h1 >> 16; h1 *= 0x85EBCA6BUL; h1 ^= h1 >> 13; h1 *= 0xC2B2AE35UL; h1 ^= h1 >> 16;
+	h2 ^= h2 >> 16; h2 *= 0x85EBCA6BUL; h2 ^= h2 >> 13; h2 *= 0xC2B2AE35UL; h2 ^= h2 >> 16;
+
+	key->hash[0] = h1;
+	key->hash[1] = h2;
+	key->src_size = src_size;
+	key->kind = kind;
+	key->format = format;
+	key->w = w;
+	key->h = h;
+	key->param[0] = param0;
+	key->param[1] = param1;
+	key->param[2] = param2;
+}
+
+/* returns size of packed data or 0 when data cannot be packed to dst_max */
+static DWORD texcache_pack(DWORD *table, const BYTE *src, DWORD size, BYTE *dst, DWORD dst_max)
+{
+	const BYTE *ip = src + 1;
+	const BYTE *anchor = src;
+	const BYTE *iend = src + size;
+	const BYTE *mflimit = iend - TEXCACHE_LZ_MF_LIMIT;
+	const BYTE *mlimit  = iend - TEXCACHE_LZ_LAST_LITERALS;
+	BYTE *op = dst;
+	BYTE *oend = dst + dst_max;
+	DWORD lit;
+
+	if(size <= TEXCACHE_LZ_MF_LIMIT)
+		return 0;
+
+	memset(table, 0, sizeof(DWORD) << TEXCACHE_LZ_BITS);
+
+	while(ip < mflimit)
+	{
+		DWORD seq = texcache_read32(ip);
+		DWORD hs = ((DWORD)(seq * 2654435761UL)) >> (32 - TEXCACHE_LZ_BITS);
+		const BYTE *ref = src + table[hs];
+		table[hs] = ip - src;
+
+		if(ip - ref > 0xFFFF || texcache_read32(ref) != seq)
+		{
+			ip++;
+			continue;
+		}
+
+		const BYTE *mstart = ip;
+		DWORD offset = ip - ref;
+		DWORD mlen;
+
+		ip += TEXCACHE_LZ_MIN_MATCH;
+		ref += TEXCACHE_LZ_MIN_MATCH;
+		while(ip < mlimit && *ip == *ref)
+		{
+			ip++;
+			ref++;
+		}
+
+		lit  = mstart - anchor;
+		mlen = (ip - mstart) - TEXCACHE_LZ_MIN_MATCH;
+
+		/* token + literals + offset + lengths */
+		if((DWORD)(oend - op) < 1 + lit + lit/255 + 1 + 2 + mlen/255 + 1)
+			return 0;
+
+		BYTE *token = op++;
+		if(lit >= 15)
+		{
+			DWORD l = lit - 15;
+			*token = 15 << 4;
+			for(; l >= 255; l -= 255) *op++ = 255;
+			*op++ = l;
+		}
+		else
+		{
+			*token = lit << 4;
+		}
+
+		memcpy(op, anchor, lit);
+		op += lit;
+
+		*op++ = offset & 0xFF;
+		*op++ = offset >> 8;
+
+		if(mlen >= 15)
+		{
+			DWORD l = mlen - 15;
+			*token |= 15;
+			for(; l >= 255; l -= 255) *op++ = 255;
+			*op++ = l;
+		}
+		else
+		{
+			*token |= mlen;
+		}
+
+		anchor = ip;
+	}
+
+	/* last literals */
+	lit = iend - anchor;
+	if((DWORD)(oend - op) < 1 + lit + lit/255 + 1)
+		return 0;
+
+	if(lit >= 15)
+	{
+		DWORD l = lit - 15;
+		*op++ = 15 << 4;
+		for(; l >= 255; l -= 255) *op++ = 255;
+		*op++ = l;
+	}
+	else
+	{
+		*op++ = lit << 4;
+	}
+	memcpy(op, anchor, lit);
+	op += lit;
+
+	return op - dst;
+}
+
+static BOOL texcache_unpack(const BYTE *src, DWORD size, BYTE *dst, DWORD dst_size)
+{
+	const BYTE *ip = src;
+	const BYTE *iend = src + size;
+	BYTE *op = dst;
+	BYTE *oend = dst + dst_size;
+
+	while(ip < iend)
+	{
+		DWORD token = *ip++;
+		DWORD lit = token >> 4;
+		DWORD mlen = token & 15;
+		DWORD offset;
+		BYTE b;
+
+		if(lit == 15)
+		{
+			do
+			{
+				if(ip >= iend) return FALSE;
+				b = *ip++;
+				lit += b;
+			} while(b == 255);
+		}
+
+		if(lit > (DWORD)(iend - ip) || lit > (DWORD)(oend - op))
+			return FALSE;
+
+		memcpy(op, ip, lit);
+		op += lit;
+		ip += lit;
+
+		if(ip >= iend)
+			break; /* last sequence has only literals */
+
+		if(iend - ip < 2)
+			return FALSE;
+
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if(offset == 0 || offset > (DWORD)(op - dst))
+			return FALSE;
+
+		if(mlen == 15)
+		{
+			do
+			{
+				if(ip >= iend) return FALSE;
+				b = *ip++;
+				mlen += b;
+			} while(b == 255);
+		}
+		mlen += TEXCACHE_LZ_MIN_MATCH;
+
+		if(mlen > (DWORD)(oend - op))
+			return FALSE;
+
+		const BYTE *ref = op - offset;
+		if(offset >= mlen)
+		{
+			memcpy(op, ref, mlen);
+			op += mlen;
+		}
+		else
+		{
+			/* overlapped copy (repeating pattern) */
+			while(mlen--)
+			{
+				*op++ = *ref++;
+			}
+		}
+	}
+
+	return op == oend;
+}
+
+static void texcache_unlink(mesa3d_entry_t *entry, mesa_texcache_item_t *item)
+{
+	mesa_texcache_item_t **pitem = &entry->texcache.ht[item->key.hash[0] % MESA_TEXCACHE_HT_MOD];
+
+	while(*pitem != NULL)
+	{
+		if(*pitem == item)
+		{
+			*pitem = item->ht_next;
+			break;
+		}
+		pitem = &(*pitem)->ht_next;
+	}
+
+	if(item->lru_prev)
+		item->lru_prev->lru_next = item->lru_next;
+	else
+		entry->texcache.lru_first = item->lru_next;
+
+	if(item->lru_next)
+		item->lru_next->lru_prev = item->lru_prev;
+	else
+		entry->texcache.lru_last = item->lru_prev;
+
+	item->lru_prev = NULL;
+	item->lru_next = NULL;
+}
+
+static void texcache_lru_front(mesa3d_entry_t *entry, mesa_texcache_item_t *item)
+{
+	item->lru_prev = NULL;
+	item->lru_next = entry->texcache.lru_first;
+	if(entry->texcache.lru_first)
+		entry->texcache.lru_first->lru_prev = item;
+	else
+		entry->texcache.lru_last = item;
+
+	entry->texcache.lru_first = item;
+}
+
+static void texcache_free(mesa3d_entry_t *entry, mesa_texcache_item_t *item)
+{
+	texcache_unlink(entry, item);
+	entry->texcache.bytes -= item->stored;
+	entry->texcache.items--;
+	if(item->packed)
+	{
+		entry->texcache.packed_bytes -= item->stored;
+		entry->texcache.packed_items--;
+	}
+	hal_free(HEAP_LARGE, item->data);
+	hal_free(HEAP_NORMAL, item);
+}
+
+/* evict least recently used items until 'need' bytes fit to budget */
+static void texcache_evict(mesa3d_entry_t *entry, DWORD need, mesa_texcache_item_t *keep)
+{
+	DWORD budget = entry->texcache.budget;
+
+	while(entry->texcache.lru_last != NULL && entry->texcache.bytes + need > budget)
+	{
+		mesa_texcache_item_t *item = entry->texcache.lru_last;
+		if(item == keep)
+			break;
+
+		TOPIC("TEXCACHE", "evict %08X%08X, size=%u", item->key.hash[0], item->key.hash[1], item->stored);
+		texcache_free(entry, item);
+		entry->texcache.evicted++;
+	}
+}
+
+/*
+ * Returns converted data or NULL on miss. Cache stays locked until
+ * MesaTexCacheDone is called, when this returns non NULL.
+ */
+NUKED_LOCAL void *MesaTexCacheGet(mesa3d_ctx_t *ctx, const mesa_texcache_key_t *key, DWORD size)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	mesa_texcache_item_t *item;
+
+	if(entry->texcache.budget == 0)
+		return NULL;
+
+	texcache_lock(entry);
+	entry->texcache.lookups++;
+
+	item = entry->texcache.ht[key->hash[0] % MESA_TEXCACHE_HT_MOD];
+	while(item != NULL)
+	{
+		if(item->size == size && memcmp(&item->key, key, sizeof(mesa_texcache_key_t)) == 0)
+			break;
+
+		item = item->ht_next;
+	}
+
+	if(item == NULL)
+	{
+		texcache_unlock(entry);
+		return NULL;
+	}
+
+	if(item->packed)
+	{
+		BYTE *data = hal_alloc(HEAP_LARGE, item->size, key->w);
+		if(data == NULL || !texcache_unpack(item->data, item->stored, data, item->size))
+		{
+			ERR("texcache: unpack failed");
+			if(data) hal_free(HEAP_LARGE, data);
+			texcache_free(entry, item);
+			texcache_unlock(entry);
+			return NULL;
+		}
+
+		TOPIC("TEXCACHE", "unpack %u -> %u", item->stored, item->size);
+		hal_free(HEAP_LARGE, item->data);
+		entry->texcache.bytes += item->size - item->stored;
+		entry->texcache.packed_bytes -= item->stored;
+		entry->texcache.packed_items--;
+		item->data = data;
+		item->stored = item->size;
+		item->packed = FALSE;
+	}
+
+	item->last_frame = entry->texcache.frame;
+	texcache_unlink(entry, item);
+	item->ht_next = entry->texcache.ht[key->hash[0] % MESA_TEXCACHE_HT_MOD];
+	entry->texcache.ht[key->hash[0] % MESA_TEXCACHE_HT_MOD] = item;
+	texcache_lru_front(entry, item);
+
+	/* unpacking can overflow budget */
+	texcache_evict(entry, 0, item);
+
+	entry->texcache.hits++;
+	entry->texcache.saved += size;
+
+	return item->data;
+}
+
+NUKED_LOCAL void MesaTexCacheDone(mesa3d_ctx_t *ctx, void *data)
+{
+	texcache_unlock(ctx->entry);
+}
+
+/* store copy of converted data */
+NUKED_LOCAL void MesaTexCachePut(mesa3d_ctx_t *ctx, const mesa_texcache_key_t *key, const void *data, DWORD size)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	mesa_texcache_item_t *item;
+
+	/* don't let one texture flush whole cache */
+	if(size == 0 || size > entry->texcache.budget/4)
+		return;
+
+	texcache_lock(entry);
+	texcache_evict(entry, size, NULL);
+
+	item = hal_calloc(HEAP_NORMAL, sizeof(mesa_texcache_item_t), 0);
+	if(item)
+	{
+		item->data = hal_alloc(HEAP_LARGE, size, key->w);
+		if(item->data)
+		{
+			memcpy(&item->key, key, sizeof(mesa_texcache_key_t));
+			memcpy(item->data, data, size);
+			item->size = size;
+			item->stored = size;
+			item->last_frame = entry->texcache.frame;
+
+			item->ht_next = entry->texcache.ht[key->hash[0] % MESA_TEXCACHE_HT_MOD];
+			entry->texcache.ht[key->hash[0] % MESA_TEXCACHE_HT_MOD] = item;
+			texcache_lru_front(entry, item);
+
+			entry->texcache.bytes += size;
+			entry->texcache.items++;
+
+			TOPIC("TEXCACHE", "put %08X%08X, size=%u, total=%u", key->hash[0], key->hash[1], size, entry->texcache.bytes);
+		}
+		else
+		{
+			hal_free(HEAP_NORMAL, item);
+		}
+	}
+
+	texcache_unlock(entry);
+}
+
+/* call at end of frame, pack items which are cold */
+NUKED_LOCAL void MesaTexCacheFrame(mesa3d_ctx_t *ctx)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	mesa_texcache_item_t *item;
+	DWORD packed = 0;
+
+	if(entry->texcache.lru_last == NULL)
+		return;
+
+	texcache_lock(entry);
+	entry->texcache.frame++;
+
+	if(entry->env.texcache_pack)
+	{
+		for(item = entry->texcache.lru_last; item != NULL; item = item->lru_prev)
+		{
+			if(entry->texcache.frame - item->last_frame < MESA_TEXCACHE_COLD_FRAMES)
+				break;
+
+			if(item->packed || item->incompressible)
+				continue;
+
+			if(packed >= TEXCACHE_PACK_PER_FRAME)
+				break;
+
+			if(entry->texcache.lz_table == NULL)
+			{
+				entry->texcache.lz_table = hal_alloc(HEAP_NORMAL, sizeof(DWORD) << TEXCACHE_LZ_BITS, 0);
+				if(entry->texcache.lz_table == NULL)
+					break;
+			}
+
+			/* keep packed only when saves at least 1/4 */
+			DWORD max_size = item->size - item->size/4;
+			BYTE *buf = hal_alloc(HEAP_LARGE, max_size, 0);
+			if(buf == NULL)
+				break;
+
+			DWORD stored = texcache_pack(entry->texcache.lz_table, item->data, item->size, buf, max_size);
+			packed += item->size;
+			if(stored > 0)
+			{
+				BYTE *data = hal_alloc(HEAP_LARGE, stored, 0);
+				if(data)
+				{
+					memcpy(data, buf, stored);
+					hal_free(HEAP_LARGE, item->data);
+					item->data = data;
+					entry->texcache.bytes -= item->size - stored;
+					entry->texcache.packed_bytes += stored;
+					entry->texcache.packed_items++;
+					item->stored = stored;
+					item->packed = TRUE;
+					TOPIC("TEXCACHE", "pack %u -> %u", item->size, stored);
+				}
+			}
+			else
+			{
+				item->incompressible = TRUE;
+			}
+			hal_free(HEAP_LARGE, buf);
+		}
+	}
+
+	texcache_unlock(entry);
+}
+
+NUKED_LOCAL void MesaTexCacheInit(mesa3d_entry_t *entry)
+{
+	MEMORYSTATUS ms;
+	DWORD budget = entry->env.texcache * 1024;
+
+	memset(&ms, 0, sizeof(MEMORYSTATUS));
+	ms.dwLength = sizeof(MEMORYSTATUS);
+	GlobalMemoryStatus(&ms);
+
+	/* VM with small RAM */
+	if(ms.dwTotalPhys > 0 && budget > ms.dwTotalPhys/32)
+	{
+		budget = ms.dwTotalPhys/32;
+	}
+
+	entry->texcache.budget = budget;
+	TOPIC("TEXCACHE", "budget=%u", budget);
+}
+
+NUKED_LOCAL void MesaTexCacheFree(mesa3d_entry_t *entry)
+{
+	texcache_lock(entry);
+	while(entry->texcache.lru_first != NULL)
+	{
+		texcache_free(entry, entry->texcache.lru_first);
+	}
+
+	if(entry->texcache.lz_table)
+	{
+		hal_free(HEAP_NORMAL, entry->texcache.lz_table);
+		entry->texcache.lz_table = NULL;
+	}
+	entry->texcache.packed_bytes = 0;
+	entry->texcache.packed_items = 0;
+	entry->texcache.items = 0;
+	texcache_unlock(entry);
+}
@@ -0,0 +1,301 @@
+/******************************************************************************
+ * Copyright (c) 2025 Jaroslav Hensl                                          *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+ ******************************************************************************/
+#ifndef NUKED_SKIP
+#include <windows.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ddraw.h>
+#include <ddrawi.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "d3dhal_ddk.h"
+#include "vmdahal32.h"
+#include "vmhal9x.h"
+#include "vmsetup.h"
+#include "mesa3d.h"
+#include "osmesa.h"
+
+#include "nocrt.h"
+#endif
+
+#include "mesa3d_trace.h"
+
+/*
+ * DP2 command stream capture. Enabled by setting hal/dp2trace to file
+ * prefix, trace is written to <prefix>_<pid>.trc. The format is in
+ * mesa3d_trace.h, tests/dp2trace.c can read it.
+ */
+
+static void MesaTraceWrite(mesa3d_entry_t *entry, const void *data, DWORD size)
+{
+	DWORD written = 0;
+	if(!WriteFile(entry->trace.file, data, size, &written, NULL) || written != size)
+	{
+		ERR("DP2 trace write failed, tracing stopped");
+		CloseHandle(entry->trace.file);
+		entry->trace.file = NULL;
+	}
+}
+
+static void MesaTraceRecord(mesa3d_ctx_t *ctx, DWORD type, DWORD size)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	dp2trace_rec_t rec;
+
+	rec.type = type;
+	rec.size = (size + 3) & ~3;
+	rec.ctx  = MESA_CTX_TO_HANDLE(ctx);
+	rec.time = (DWORD)(GetTimeTMS() - entry->trace.start);
+
+	MesaTraceWrite(entry, &rec, sizeof(rec));
+}
+
+/* pad payload to record size */
+static void MesaTracePad(mesa3d_entry_t *entry, DWORD size)
+{
+	static const BYTE zeros[4] = {0, 0, 0, 0};
+	if(entry->trace.file != NULL && (size & 3) != 0)
+	{
+		MesaTraceWrite(entry, zeros, 4 - (size & 3));
+	}
+}
+
+NUKED_LOCAL void MesaTraceOpen(mesa3d_entry_t *entry)
+{
+	const char *prefix = vmhal_setup_str("hal", "dp2trace", FALSE);
+	char path[MAX_PATH];
+	dp2trace_file_t head;
+
+	entry->trace.file = NULL;
+	if(prefix == NULL || prefix[0] == '\0' || strlen(prefix) > MAX_PATH - 32)
+	{
+		return;
+	}
+
+	sprintf(path, "%s_%lu.trc", prefix, entry->pid);
+	entry->trace.file = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(entry->trace.file == INVALID_HANDLE_VALUE)
+	{
+		WARN("Cannot create DP2 trace %s", path);
+		entry->trace.file = NULL;
+		return;
+	}
+
+	entry->trace.start = GetTimeTMS();
+	entry->trace.frame = 0;
+	entry->trace.frame_cpu = 0;
+	entry->trace.frame_calls = 0;
+	entry->trace.last_cpu = 0;
+	entry->trace.perf_commands = halPerf.dp2_commands;
+	entry->trace.perf_draws = halPerf.draws;
+	memset(entry->trace.buf_handle, 0, sizeof(entry->trace.buf_handle));
+
+	head.magic = DP2TRACE_MAGIC;
+	head.version = DP2TRACE_VERSION;
+	head.pid = entry->pid;
+	head.reserved = 0;
+	MesaTraceWrite(entry, &head, sizeof(head));
+
+	TOPIC("TRACE", "DP2 trace: %s", path);
+}
+
+NUKED_LOCAL void MesaTraceClose(mesa3d_entry_t *entry)
+{
+	if(entry->trace.file != NULL)
+	{
+		CloseHandle(entry->trace.file);
+		entry->trace.file = NULL;
+	}
+}
+
+NUKED_LOCAL void MesaTraceSurface(mesa3d_ctx_t *ctx, surface_id sid)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	DDSURF *surf = SurfaceGetSURF(sid);
+	dp2trace_surface_t s;
+
+	if(surf == NULL)
+		return;
+
+	s.sid    = sid;
+	s.width  = surf->width;
+	s.height = surf->height;
+	s.bpp    = surf->bpp;
+	s.caps   = surf->dwCaps;
+	s.flags  = surf->dwFlags;
+
+	MesaTraceRecord(ctx, DP2TRACE_SURFACE, sizeof(s));
+	if(entry->trace.file)
+		MesaTraceWrite(entry, &s, sizeof(s));
+}
+
+NUKED_LOCAL void MesaTraceTexture(mesa3d_ctx_t *ctx, surface_id sid, int level, int side, DDSURF *surf, BOOL compressed)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	dp2trace_texture_t t;
+	DWORD size;
+
+	if(surf->lpGbl == NULL || surf->fpVidMem == 0)
+		return;
+
+	if(compressed)
+		size = surf->lpGbl->dwLinearSize;
+	else
+		size = surf->lpGbl->lPitch * surf->height;
+
+	t.sid       = sid;
+	t.level     = level;
+	t.side      = side;
+	t.width     = surf->width;
+	t.height    = surf->height;
+	t.bpp       = surf->bpp;
+	t.data_size = size;
+	t.hash      = dp2trace_hash((void*)surf->fpVidMem, size);
+
+	MesaTraceRecord(ctx, DP2TRACE_TEXTURE, sizeof(t) + size);
+	if(entry->trace.file)
+		MesaTraceWrite(entry, &t, sizeof(t));
+	if(entry->trace.file)
+		MesaTraceWrite(entry, (void*)surf->fpVidMem, size);
+	MesaTracePad(entry, sizeof(t) + size);
+}
+
+/* DX8 vertex buffers, data are written only when changed */
+static void MesaTraceStreams(mesa3d_ctx_t *ctx)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	dp2trace_buffer_t b;
+	int i;
+
+	for(i = 0; i < MESA_MAX_STREAM; i++)
+	{
+		DWORD handle = ctx->vstream[i].VBHandle;
+		DDSURF *surf;
+		BYTE *data;
+		surface_id sid;
+
+		if(handle == 0 || ctx->surfaces == NULL || handle >= ctx->surfaces->table_size)
+			continue;
+
+		sid = ctx->surfaces->table[handle];
+		if(sid == 0)
+			continue;
+
+		surf = SurfaceGetSURF(sid);
+		if(surf == NULL || surf->lpGbl == NULL)
+			continue;
+
+		data = (BYTE*)surf->fpVidMem;
+		b.handle    = handle;
+		b.stream    = i;
+		b.stride    = ctx->vstream[i].stride;
+		b.data_size = surf->lpGbl->dwLinearSize;
+		b.hash      = dp2trace_hash(data, b.data_size);
+
+		if(entry->trace.buf_handle[i] == handle && entry->trace.buf_hash[i] == b.hash)
+			continue;
+
+		entry->trace.buf_handle[i] = handle;
+		entry->trace.buf_hash[i] = b.hash;
+
+		MesaTraceRecord(ctx, DP2TRACE_BUFFER, sizeof(b) + b.data_size);
+		if(entry->trace.file)
+			MesaTraceWrite(entry, &b, sizeof(b));
+		if(entry->trace.file)
+			MesaTraceWrite(entry, data, b.data_size);
+		MesaTracePad(entry, sizeof(b) + b.data_size);
+	}
+}
+
+NUKED_LOCAL uint64_t MesaTraceDP2(mesa3d_ctx_t *ctx, LPBYTE cmd, DWORD cmd_size, LPBYTE vertices, DWORD fvf, DWORD vertex_count, DWORD flags)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	dp2trace_dp2_t d;
+
+	MesaTraceStreams(ctx);
+
+	d.fvf          = fvf;
+	d.flags        = flags;
+	d.cmd_size     = cmd_size;
+	d.vertex_count = vertex_count;
+	d.vertex_size  = (vertices != NULL) ? MesaFVFSize(fvf) * vertex_count : 0;
+	d.cpu_time     = entry->trace.last_cpu;
+	d.cmd_align    = ((DWORD)cmd) & 3;
+	d.reserved     = 0;
+
+	if(entry->trace.file)
+		MesaTraceRecord(ctx, DP2TRACE_DP2, sizeof(d) + cmd_size + d.vertex_size);
+	if(entry->trace.file)
+		MesaTraceWrite(entry, &d, sizeof(d));
+	if(entry->trace.file)
+		MesaTraceWrite(entry, cmd, cmd_size);
+	if(entry->trace.file && d.vertex_size)
+		MesaTraceWrite(entry, vertices, d.vertex_size);
+	MesaTracePad(entry, sizeof(d) + cmd_size + d.vertex_size);
+
+	return GetTimeTMS();
+}
+
+NUKED_LOCAL void MesaTraceDP2Done(mesa3d_ctx_t *ctx, uint64_t start)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+
+	entry->trace.last_cpu = (DWORD)(GetTimeTMS() - start);
+	entry->trace.frame_cpu += entry->trace.last_cpu;
+	entry->trace.frame_calls++;
+}
+
+NUKED_LOCAL void MesaTraceFrame(mesa3d_ctx_t *ctx, void *ptr)
+{
+	mesa3d_entry_t *entry = ctx->entry;
+	DDSURF *surf = SurfaceGetSURF(ctx->backbuffer);
+	dp2trace_frame_t f;
+
+	memset(&f, 0, sizeof(f));
+	f.frame     = entry->trace.frame++;
+	f.cpu_time  = entry->trace.frame_cpu;
+	f.dp2_calls = entry->trace.frame_calls;
+	/* counters are common for all processes, so they match only when
+	   traced application is the only one using D3D */
+	f.perf_commands = halPerf.dp2_commands - entry->trace.perf_commands;
+	f.perf_draws    = halPerf.draws - entry->trace.perf_draws;
+	entry->trace.perf_commands += f.perf_commands;
+	entry->trace.perf_draws    += f.perf_draws;
+	if(surf != NULL && surf->lpGbl != NULL && ptr != NULL)
+	{
+		f.width    = surf->width;
+		f.height   = surf->height;
+		f.bpp      = surf->bpp;
+		f.checksum = dp2trace_hash(ptr, surf->lpGbl->lPitch * surf->height);
+	}
+
+	MesaTraceRecord(ctx, DP2TRACE_FRAME, sizeof(f));
+	if(entry->trace.file)
+		MesaTraceWrite(entry, &f, sizeof(f));
+
+	entry->trace.frame_cpu = 0;
+	entry->trace.frame_calls = 0;
+}
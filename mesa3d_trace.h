@@ -0,0 +1,141 @@
+/******************************************************************************
+ * Copyright (c) 2025 Jaroslav Hensl                                          *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+ ******************************************************************************/
+#ifndef __MESA3D_TRACE_H__INCLUDED__
+#define __MESA3D_TRACE_H__INCLUDED__
+
+/*
+ * DP2 command stream trace (hal/dp2trace setting), file layout:
+ *
+ *   dp2trace_file_t
+ *   dp2trace_rec_t + payload (rec.size bytes)
+ *   dp2trace_rec_t + payload
+ *   ...
+ *
+ * All values are little endian, records are 4 bytes aligned. This header
+ * is shared with host tools, so it must not depend on windows headers.
+ */
+#define DP2TRACE_MAGIC   0x54325044UL /* "DP2T" */
+#define DP2TRACE_VERSION 2
+
+#define DP2TRACE_SURFACE 1 /* dp2trace_surface_t */
+#define DP2TRACE_TEXTURE 2 /* dp2trace_texture_t + pixels */
+#define DP2TRACE_BUFFER  3 /* dp2trace_buffer_t + data */
+#define DP2TRACE_DP2     4 /* dp2trace_dp2_t + commands + vertices */
+#define DP2TRACE_FRAME   5 /* dp2trace_frame_t */
+
+typedef struct dp2trace_file
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t pid;
+	uint32_t reserved;
+} dp2trace_file_t;
+
+typedef struct dp2trace_rec
+{
+	uint32_t type;
+	uint32_t size; /* payload size */
+	uint32_t ctx;  /* context handle */
+	uint32_t time; /* tenths of milliseconds from trace start */
+} dp2trace_rec_t;
+
+/* surface used as texture or render target */
+typedef struct dp2trace_surface
+{
+	uint32_t sid;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bpp;
+	uint32_t caps;
+	uint32_t flags;
+} dp2trace_surface_t;
+
+/* texture data at the moment of upload */
+typedef struct dp2trace_texture
+{
+	uint32_t sid;
+	uint32_t level;
+	uint32_t side;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bpp;
+	uint32_t data_size;
+	uint32_t hash;
+} dp2trace_texture_t;
+
+/* DX8 vertex/index buffer, written only when its content changes */
+typedef struct dp2trace_buffer
+{
+	uint32_t handle;
+	uint32_t stream;
+	uint32_t stride;
+	uint32_t data_size;
+	uint32_t hash;
+} dp2trace_buffer_t;
+
+/* one DrawPrimitives2 call */
+typedef struct dp2trace_dp2
+{
+	uint32_t fvf;
+	uint32_t flags;
+	uint32_t cmd_size;
+	uint32_t vertex_count;
+	uint32_t vertex_size;
+	uint32_t cpu_time; /* time spent in previous MesaDraw6 call (tenths of ms) */
+	uint32_t cmd_align; /* command buffer address & 3, IMM vertices are DWORD aligned */
+	uint32_t reserved;
+} dp2trace_dp2_t;
+
+/* end of scene, checksum of render target memory */
+typedef struct dp2trace_frame
+{
+	uint32_t frame;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bpp;
+	uint32_t cpu_time; /* sum of MesaDraw6 times in this frame */
+	uint32_t dp2_calls;
+	uint32_t checksum;
+	uint32_t perf_commands; /* perf_info_t.dp2_commands increment in this frame */
+	uint32_t perf_draws;    /* perf_info_t.draws increment in this frame */
+	uint32_t reserved;
+} dp2trace_frame_t;
+
+/* FNV-1a, same as for program cache */
+static inline uint32_t dp2trace_hash(const void *data, uint32_t size)
+{
+	const uint8_t *p = (const uint8_t*)data;
+	uint32_t h = 2166136261UL;
+	uint32_t i;
+	for(i = 0; i < size; i++)
+	{
+		h ^= p[i];
+		h *= 16777619UL;
+	}
+	return h;
+}
+
+#endif /* __MESA3D_TRACE_H__INCLUDED__ */
@@ -0,0 +1,98 @@
+/******************************************************************************
+ * Copyright (c) 2025 Jaroslav Hensl                                          *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+ ******************************************************************************/
+#ifndef __MESA3D_UNPROJECT_H__INCLUDED__
+#define __MESA3D_UNPROJECT_H__INCLUDED__
+
+#if defined(__GNUC__) && defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+/*
+ * Unproject range of pre-transformed (XYZRHW) positions to clip space,
+ * result is same as SV_UNPROJECT in mesa3d_draw.c:
+ *   w = 1/rhw
+ *   x = ((x - vpnorm[0])*vpnorm[2] - 1)*w
+ *   y = ((y - vpnorm[1])*vpnorm[3] - 1)*w
+ *   z = z*zscale*w
+ *
+ * src points to XYZRHW of first vertex, out is packed array of 4 floats
+ * per vertex. SSE version process 4 vertices per loop with reciprocal
+ * estimation refined by one Newton-Raphson step (~22 bits of precision).
+ */
+static void unproject_batch(float *out, const BYTE *src, DWORD stride, DWORD cnt, const float vpnorm[4], float zscale)
+{
+	DWORD i = 0;
+
+#if defined(__GNUC__) && defined(__SSE__)
+	const __m128 vx  = _mm_set1_ps(vpnorm[0]);
+	const __m128 vy  = _mm_set1_ps(vpnorm[1]);
+	const __m128 sx  = _mm_set1_ps(vpnorm[2]);
+	const __m128 sy  = _mm_set1_ps(vpnorm[3]);
+	const __m128 sz  = _mm_set1_ps(zscale);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+
+	for(; i + 4 <= cnt; i += 4)
+	{
+		__m128 x = _mm_loadu_ps((const float*)(src + stride*(i+0)));
+		__m128 y = _mm_loadu_ps((const float*)(src + stride*(i+1)));
+		__m128 z = _mm_loadu_ps((const float*)(src + stride*(i+2)));
+		__m128 w = _mm_loadu_ps((const float*)(src + stride*(i+3)));
+		__m128 r;
+
+		/* AoS -> SoA */
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+
+		r = _mm_rcp_ps(w);
+		r = _mm_mul_ps(r, _mm_sub_ps(two, _mm_mul_ps(w, r)));
+
+		x = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(x, vx), sx), one), r);
+		y = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(y, vy), sy), one), r);
+		z = _mm_mul_ps(_mm_mul_ps(z, sz), r);
+		w = r;
+
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+
+		_mm_storeu_ps(out + i*4 + 0,  x);
+		_mm_storeu_ps(out + i*4 + 4,  y);
+		_mm_storeu_ps(out + i*4 + 8,  z);
+		_mm_storeu_ps(out + i*4 + 12, w);
+	}
+#endif
+
+	for(; i < cnt; i++)
+	{
+		const float *v = (const float*)(src + stride*i);
+		float *o = out + i*4;
+
+		o[3] = 1.0f/v[3];
+		o[0] = (((v[0] - vpnorm[0]) * vpnorm[2]) - 1.0f)*o[3];
+		o[1] = (((v[1] - vpnorm[1]) * vpnorm[3]) - 1.0f)*o[3];
+		o[2] = (v[2]*zscale)*o[3];
+	}
+}
+
+#endif /* __MESA3D_UNPROJECT_H__INCLUDED__ */
@@ -0,0 +1,619 @@
+/******************************************************************************
+ * Copyright (c) 2025 Jaroslav Hensl                                          *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+ ******************************************************************************/
+#ifndef __MESA3D_VSARB_H__INCLUDED__
+#define __MESA3D_VSARB_H__INCLUDED__
+
+/*
+ * vs_1_0 and vs_1_1 bytecode to ARB_vertex_program translator
+ *
+ * v0-v15 -> vertex.attrib[n]
+ * r0-r11 -> TEMP rN
+ * c0-c95 -> program.env[n] (constants from DEF are in program.local[n])
+ * c[a0.x + n] -> cr[A0.x + n - base], DEF constants are program.local in cr[]
+ * a0.x   -> ADDRESS A0, loaded by ARL from value + 0.5 (D3D rounds, ARL floors)
+ * oPos   -> TEMP opos, Y is flipped same way as projection matrix at the end
+ * oD0/1  -> result.color.primary/secondary
+ * oTn    -> result.texcoord[n]
+ * oFog   -> result.fogcoord
+ * oPts   -> result.pointsize
+ *
+ */
+#define VSARB_MAX_TEMP   12
+#define VSARB_MAX_INPUT  16
+#define VSARB_MAX_CONST  96
+#define VSARB_MAX_TEXOUT 8
+
+/*
+ * ARB relative addressing offset is limited to -64..63 and Mesa allows
+ * only one relative addressed array, so the array for relative access
+ * starts at base = max(0, max_offset - 63)
+ */
+#define VSARB_REL_MAX    63
+
+#define VSARB_OUT_POS      0x01
+#define VSARB_OUT_DIFFUSE  0x02
+#define VSARB_OUT_SPECULAR 0x04
+#define VSARB_OUT_FOG      0x08
+#define VSARB_OUT_PSIZE    0x10
+
+typedef struct vsarb
+{
+	char *out;
+	DWORD len;
+	DWORD size;
+	BOOL emit;
+	BOOL error;
+	DWORD temps;
+	DWORD inputs;
+	DWORD outputs;
+	BOOL consts;
+	BOOL relative;
+	DWORD rel_max;
+	DWORD rel_base;
+	BOOL address;
+	DWORD def_cnt;
+	DWORD def_reg[VSARB_MAX_CONST];
+	float def_val[VSARB_MAX_CONST][4];
+} vsarb_t;
+
+static const char vsarb_comp[4] = {'x', 'y', 'z', 'w'};
+
+static void vsarb_puts(vsarb_t *st, const char *s)
+{
+	if(!st->emit)
+		return;
+
+	while(*s != '\0')
+	{
+		if(st->len+1 >= st->size)
+		{
+			st->error = TRUE;
+			return;
+		}
+		st->out[st->len++] = *s++;
+	}
+	st->out[st->len] = '\0';
+}
+
+static void vsarb_putu(vsarb_t *st, DWORD u)
+{
+	char buf[12];
+	int i = sizeof(buf)-1;
+
+	buf[i] = '\0';
+	do
+	{
+		buf[--i] = '0' + (u % 10);
+		u /= 10;
+	} while(u > 0);
+
+	vsarb_puts(st, buf+i);
+}
+
+static void vsarb_putc(vsarb_t *st, char c)
+{
+	char buf[2] = {c, '\0'};
+	vsarb_puts(st, buf);
+}
+
+static int vsarb_def_find(vsarb_t *st, DWORD reg)
+{
+	DWORD i;
+	for(i = 0; i < st->def_cnt; i++)
+	{
+		if(st->def_reg[i] == reg)
+			return i;
+	}
+	return -1;
+}
+
+/* items of relative array, DEF registers are replaced by program.local */
+static void vsarb_rel_items(vsarb_t *st)
+{
+	DWORD r = st->rel_base;
+	int def;
+
+	while(r < VSARB_MAX_CONST)
+	{
+		if(r > st->rel_base)
+			vsarb_puts(st, ", ");
+
+		if((def = vsarb_def_find(st, r)) >= 0)
+		{
+			vsarb_puts(st, "program.local[");
+			vsarb_putu(st, def);
+			vsarb_putc(st, ']');
+			r++;
+		}
+		else
+		{
+			DWORD from = r;
+			while(r + 1 < VSARB_MAX_CONST && vsarb_def_find(st, r + 1) < 0)
+				r++;
+
+			vsarb_puts(st, "program.env[");
+			vsarb_putu(st, from);
+			if(r > from)
+			{
+				vsarb_puts(st, "..");
+				vsarb_putu(st, r);
+			}
+			vsarb_putc(st, ']');
+			r++;
+		}
+	}
+}
+
+static void vsarb_mask(vsarb_t *st, DWORD mask)
+{
+	int i;
+	if(mask == 0xF)
+		return;
+
+	vsarb_putc(st, '.');
+	for(i = 0; i < 4; i++)
+	{
+		if(mask & (1 << i))
+			vsarb_putc(st, vsarb_comp[i]);
+	}
+}
+
+static DWORD vsarb_dst_mask(DWORD token)
+{
+	DWORD mask = (token & D3DSP_WRITEMASK_ALL) >> 16;
+	if(mask == 0)
+		mask = 0xF;
+
+	return mask;
+}
+
+static void vsarb_dst(vsarb_t *st, DWORD token, DWORD mask)
+{
+	DWORD type = (token & D3DSP_REGTYPE_MASK) >> D3DSP_REGTYPE_SHIFT;
+	DWORD num  = token & D3DSP_REGNUM_MASK;
+
+	if(token & D3DSP_DSTMOD_MASK)
+	{
+		/* no destination modifiers in vs_1_x */
+		st->error = TRUE;
+		return;
+	}
+
+	switch(type)
+	{
+		case D3DSPR_TEMP:
+			if(num >= VSARB_MAX_TEMP)
+			{
+				st->error = TRUE;
+				return;
+			}
+			st->temps |= 1 << num;
+			vsarb_putc(st, 'r');
+			vsarb_putu(st, num);
+			break;
+		case D3DSPR_RASTOUT:
+			switch(num)
+			{
+				case D3DSRO_POSITION:
+					st->outputs |= VSARB_OUT_POS;
+					vsarb_puts(st, "opos");
+					break;
+				case D3DSRO_FOG:
+					st->outputs |= VSARB_OUT_FOG;
+					vsarb_puts(st, "result.fogcoord");
+					break;
+				case D3DSRO_POINT_SIZE:
+					st->outputs |= VSARB_OUT_PSIZE;
+					vsarb_puts(st, "result.pointsize");
+					break;
+				default:
+					st->error = TRUE;
+					return;
+			}
+			break;
+		case D3DSPR_ATTROUT:
+			if(num == 0)
+			{
+				st->outputs |= VSARB_OUT_DIFFUSE;
+				vsarb_puts(st, "result.color.primary");
+			}
+			else if(num == 1)
+			{
+				st->outputs |= VSARB_OUT_SPECULAR;
+				vsarb_puts(st, "result.color.secondary");
+			}
+			else
+			{
+				st->error = TRUE;
+				return;
+			}
+			break;
+		case D3DSPR_TEXCRDOUT:
+			if(num >= VSARB_MAX_TEXOUT)
+			{
+				st->error = TRUE;
+				return;
+			}
+			vsarb_puts(st, "result.texcoord[");
+			vsarb_putu(st, num);
+			vsarb_putc(st, ']');
+			break;
+		default:
+			st->error = TRUE;
+			return;
+	}
+
+	vsarb_mask(st, mask);
+}
+
+/*
+ * slot >= 0 select one component from swizzle (for scalar instructions),
+ * slot < 0 means full swizzle
+ */
+static void vsarb_src(vsarb_t *st, DWORD token, int slot)
+{
+	DWORD type = (token & D3DSP_REGTYPE_MASK) >> D3DSP_REGTYPE_SHIFT;
+	DWORD num  = token & D3DSP_REGNUM_MASK;
+	DWORD swz  = (token & D3DSP_SWIZZLE_MASK) >> D3DSP_SWIZZLE_SHIFT;
+	DWORD mod  = (token & D3DSP_SRCMOD_MASK) >> D3DSP_SRCMOD_SHIFT;
+	int def;
+	int i;
+
+	if(mod == D3DSPSM_NEG)
+	{
+		vsarb_putc(st, '-');
+	}
+	else if(mod != D3DSPSM_NONE)
+	{
+		st->error = TRUE;
+		return;
+	}
+
+	switch(type)
+	{
+		case D3DSPR_TEMP:
+			if(num >= VSARB_MAX_TEMP)
+			{
+				st->error = TRUE;
+				return;
+			}
+			st->temps |= 1 << num;
+			vsarb_putc(st, 'r');
+			vsarb_putu(st, num);
+			break;
+		case D3DSPR_INPUT:
+			if(num >= VSARB_MAX_INPUT)
+			{
+				st->error = TRUE;
+				return;
+			}
+			st->inputs |= 1 << num;
+			vsarb_puts(st, "vertex.attrib[");
+			vsarb_putu(st, num);
+			vsarb_putc(st, ']');
+			break;
+		case D3DSPR_CONST:
+			if(num >= VSARB_MAX_CONST)
+			{
+				st->error = TRUE;
+				return;
+			}
+
+			if(token & D3DVS_ADDRESSMODE_MASK)
+			{
+				st->address = TRUE;
+				st->relative = TRUE;
+				if(num > st->rel_max)
+					st->rel_max = num;
+
+				vsarb_puts(st, "cr[A0.x");
+				if(num >= st->rel_base)
+				{
+					vsarb_putc(st, '+');
+					vsarb_putu(st, num - st->rel_base);
+				}
+				else
+				{
+					vsarb_putc(st, '-');
+					vsarb_putu(st, st->rel_base - num);
+				}
+				vsarb_putc(st, ']');
+			}
+			else if((def = vsarb_def_find(st, num)) >= 0)
+			{
+				vsarb_puts(st, "program.local[");
+				vsarb_putu(st, def);
+				vsarb_putc(st, ']');
+			}
+			else
+			{
+				st->consts = TRUE;
+				vsarb_puts(st, "c[");
+				vsarb_putu(st, num);
+				vsarb_putc(st, ']');
+			}
+			break;
+		default:
+			st->error = TRUE;
+			return;
+	}
+
+	if(slot >= 0)
+	{
+		vsarb_putc(st, '.');
+		vsarb_putc(st, vsarb_comp[(swz >> (slot*2)) & 3]);
+	}
+	else if(swz == 0x00 || swz == 0x55 || swz == 0xAA || swz == 0xFF)
+	{
+		/* replicate */
+		vsarb_putc(st, '.');
+		vsarb_putc(st, vsarb_comp[swz & 3]);
+	}
+	else if(swz != 0xE4)
+	{
+		vsarb_putc(st, '.');
+		for(i = 0; i < 4; i++)
+		{
+			vsarb_putc(st, vsarb_comp[(swz >> (i*2)) & 3]);
+		}
+	}
+}
+
+static void vsarb_op(vsarb_t *st, const char *name, const DWORD *p, DWORD pcnt, DWORD nsrc, BOOL scalar)
+{
+	DWORD i;
+
+	if(pcnt != nsrc+1)
+	{
+		st->error = TRUE;
+		return;
+	}
+
+	vsarb_puts(st, name);
+	vsarb_putc(st, ' ');
+	vsarb_dst(st, p[0], vsarb_dst_mask(p[0]));
+	for(i = 1; i <= nsrc; i++)
+	{
+		vsarb_puts(st, ", ");
+		vsarb_src(st, p[i], scalar ? 3 : -1);
+	}
+	vsarb_puts(st, ";\n");
+}
+
+/* m4x4, m4x3, m3x4, m3x3, m3x2 macros */
+static void vsarb_mtx(vsarb_t *st, const DWORD *p, DWORD pcnt, DWORD rows, const char *dp)
+{
+	DWORD mask;
+	DWORD k;
+
+	if(pcnt != 3)
+	{
+		st->error = TRUE;
+		return;
+	}
+
+	mask = vsarb_dst_mask(p[0]) & ((1 << rows) - 1);
+	for(k = 0; k < rows; k++)
+	{
+		if((mask & (1 << k)) == 0)
+			continue;
+
+		vsarb_puts(st, dp);
+		vsarb_puts(st, " mtx.");
+		vsarb_putc(st, vsarb_comp[k]);
+		vsarb_puts(st, ", ");
+		vsarb_src(st, p[1], -1);
+		vsarb_puts(st, ", ");
+		vsarb_src(st, (p[2] & ~D3DSP_REGNUM_MASK) | ((p[2] & D3DSP_REGNUM_MASK) + k), -1);
+		vsarb_puts(st, ";\n");
+	}
+
+	vsarb_puts(st, "MOV ");
+	vsarb_dst(st, p[0], mask);
+	vsarb_puts(st, ", mtx;\n");
+}
+
+static void vsarb_body(vsarb_t *st, const DWORD *code, DWORD cnt)
+{
+	DWORD i = 1; /* skip version */
+
+	while(i < cnt && !st->error)
+	{
+		DWORD ins = code[i];
+		DWORD op = ins & D3DSI_OPCODE_MASK;
+		const DWORD *p = &code[i+1];
+		DWORD pcnt = 0;
+
+		if(op == D3DSIO_END)
+			break;
+
+		if(op == D3DSIO_COMMENT)
+		{
+			i += 1 + ((ins & D3DSI_COMMENTSIZE_MASK) >> D3DSI_COMMENTSIZE_SHIFT);
+			continue;
+		}
+
+		if(op == D3DSIO_DEF)
+		{
+			/* values are floats, so parameter bit can't be used to count tokens */
+			if(i + 5 >= cnt)
+			{
+				st->error = TRUE;
+				break;
+			}
+
+			if(!st->emit)
+			{
+				DWORD reg = p[0] & D3DSP_REGNUM_MASK;
+				if(st->def_cnt >= VSARB_MAX_CONST || vsarb_def_find(st, reg) >= 0)
+				{
+					st->error = TRUE;
+					break;
+				}
+				st->def_reg[st->def_cnt] = reg;
+				memcpy(st->def_val[st->def_cnt], &p[1], sizeof(float)*4);
+				st->def_cnt++;
+			}
+			i += 6;
+			continue;
+		}
+
+		while(i + 1 + pcnt < cnt && (p[pcnt] & 0x80000000UL) != 0)
+		{
+			pcnt++;
+		}
+
+		switch(op)
+		{
+			case D3DSIO_NOP: break;
+			case D3DSIO_MOV:
+				if(pcnt == 2 && ((p[0] & D3DSP_REGTYPE_MASK) >> D3DSP_REGTYPE_SHIFT) == D3DSPR_ADDR)
+				{
+					/* ARL is floor, but mov to a0.x rounds to nearest */
+					st->address = TRUE;
+					vsarb_puts(st, "ADD a0r.x, ");
+					vsarb_src(st, p[1], 0);
+					vsarb_puts(st, ", 0.5;\n");
+					vsarb_puts(st, "ARL A0.x, a0r.x;\n");
+				}
+				else
+				{
+					vsarb_op(st, "MOV", p, pcnt, 1, FALSE);
+				}
+				break;
+			case D3DSIO_ADD: vsarb_op(st, "ADD", p, pcnt, 2, FALSE); break;
+			case D3DSIO_SUB: vsarb_op(st, "SUB", p, pcnt, 2, FALSE); break;
+			case D3DSIO_MAD: vsarb_op(st, "MAD", p, pcnt, 3, FALSE); break;
+			case D3DSIO_MUL: vsarb_op(st, "MUL", p, pcnt, 2, FALSE); break;
+			case D3DSIO_RCP: vsarb_op(st, "RCP", p, pcnt, 1, TRUE);  break;
+			case D3DSIO_RSQ: vsarb_op(st, "RSQ", p, pcnt, 1, TRUE);  break;
+			case D3DSIO_DP3: vsarb_op(st, "DP3", p, pcnt, 2, FALSE); break;
+			case D3DSIO_DP4: vsarb_op(st, "DP4", p, pcnt, 2, FALSE); break;
+			case D3DSIO_MIN: vsarb_op(st, "MIN", p, pcnt, 2, FALSE); break;
+			case D3DSIO_MAX: vsarb_op(st, "MAX", p, pcnt, 2, FALSE); break;
+			case D3DSIO_SLT: vsarb_op(st, "SLT", p, pcnt, 2, FALSE); break;
+			case D3DSIO_SGE: vsarb_op(st, "SGE", p, pcnt, 2, FALSE); break;
+			case D3DSIO_EXP: vsarb_op(st, "EX2", p, pcnt, 1, TRUE);  break;
+			case D3DSIO_LOG: vsarb_op(st, "LG2", p, pcnt, 1, TRUE);  break;
+			case D3DSIO_EXPP: vsarb_op(st, "EXP", p, pcnt, 1, TRUE); break;
+			case D3DSIO_LOGP: vsarb_op(st, "LOG", p, pcnt, 1, TRUE); break;
+			case D3DSIO_LIT: vsarb_op(st, "LIT", p, pcnt, 1, FALSE); break;
+			case D3DSIO_DST: vsarb_op(st, "DST", p, pcnt, 2, FALSE); break;
+			case D3DSIO_FRC: vsarb_op(st, "FRC", p, pcnt, 1, FALSE); break;
+			case D3DSIO_M4x4: vsarb_mtx(st, p, pcnt, 4, "DP4"); break;
+			case D3DSIO_M4x3: vsarb_mtx(st, p, pcnt, 3, "DP4"); break;
+			case D3DSIO_M3x4: vsarb_mtx(st, p, pcnt, 4, "DP3"); break;
+			case D3DSIO_M3x3: vsarb_mtx(st, p, pcnt, 3, "DP3"); break;
+			case D3DSIO_M3x2: vsarb_mtx(st, p, pcnt, 2, "DP3"); break;
+			default:
+				st->error = TRUE;
+				break;
+		}
+
+		i += 1 + pcnt;
+	}
+}
+
+/*
+ * Translate shader to ARB program text, return length of text in 'out'
+ * or 0 when shader cannot be translated. Constants defined by DEF have
+ * to be loaded to program local parameters from st->def_val.
+ */
+static DWORD vsarb_translate(vsarb_t *st, const DWORD *code, DWORD cnt, char *out, DWORD size)
+{
+	DWORD i;
+
+	memset(st, 0, sizeof(vsarb_t));
+	st->out = out;
+	st->size = size;
+
+	if(cnt < 2 || size == 0)
+		return 0;
+
+	if((code[0] & 0xFFFF0000UL) != 0xFFFE0000UL || D3DSHADER_VERSION_MAJOR(code[0]) != 1)
+		return 0;
+
+	/* 1st pass: resources usage and DEFs */
+	vsarb_body(st, code, cnt);
+	if(st->error)
+		return 0;
+
+	/* 2nd pass: code */
+	st->emit = TRUE;
+	vsarb_puts(st, "!!ARBvp1.0\n");
+	if(st->consts)
+		vsarb_puts(st, "PARAM c[96] = { program.env[0..95] };\n");
+
+	if(st->relative)
+	{
+		if(st->rel_max > VSARB_REL_MAX)
+			st->rel_base = st->rel_max - VSARB_REL_MAX;
+
+		vsarb_puts(st, "PARAM cr[");
+		vsarb_putu(st, VSARB_MAX_CONST - st->rel_base);
+		vsarb_puts(st, "] = { ");
+		vsarb_rel_items(st);
+		vsarb_puts(st, " };\n");
+	}
+
+	vsarb_puts(st, "PARAM yflip = {1.0, -1.0, 1.0, 1.0};\n");
+	vsarb_puts(st, "PARAM dxdef = {0.0, 0.0, 0.0, 1.0};\n");
+	vsarb_puts(st, "TEMP opos, mtx;\n");
+	for(i = 0; i < VSARB_MAX_TEMP; i++)
+	{
+		if(st->temps & (1 << i))
+		{
+			vsarb_puts(st, "TEMP r");
+			vsarb_putu(st, i);
+			vsarb_puts(st, ";\n");
+		}
+	}
+
+	if(st->address)
+	{
+		vsarb_puts(st, "ADDRESS A0;\n");
+		vsarb_puts(st, "TEMP a0r;\n");
+	}
+
+	vsarb_body(st, code, cnt);
+
+	/* D3D default colors when shader doesn't write them */
+	if((st->outputs & VSARB_OUT_DIFFUSE) == 0)
+		vsarb_puts(st, "MOV result.color.primary, dxdef;\n");
+
+	if((st->outputs & VSARB_OUT_SPECULAR) == 0)
+		vsarb_puts(st, "MOV result.color.secondary, dxdef.x;\n");
+
+	vsarb_puts(st, "MUL result.position, opos, yflip;\n");
+	vsarb_puts(st, "END\n");
+
+	if(st->error)
+		return 0;
+
+	return st->len;
+}
+
+#endif /* __MESA3D_VSARB_H__INCLUDED__ */
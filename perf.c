@@ -0,0 +1,141 @@
+/******************************************************************************
+ * Copyright (c) 2025 Jaroslav Hensl                                          *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+ ******************************************************************************/
+#include <windows.h>
+#include <ddraw.h>
+#include <ddrawi.h>
+#include <stdint.h>
+#include "ddrawi_ddk.h"
+
+#include "vmdahal32.h"
+#include "vmhal9x.h"
+
+#include "nocrt.h"
+
+/*
+ * Performance counters
+ *
+ * DLL memory is shared, so the counter block is common for all processes
+ * and can be read by the tray monitor through PerfInfo. Counters are only
+ * increased (by atomic add, no lock) and they wrap around, readers should
+ * compute differences between two snapshots.
+ */
+
+perf_info_t halPerf = {0};
+
+/*
+ * Time of last flip is per process (frame interval of one application),
+ * slot of process which didn't flip for longest time is reused.
+ */
+#define PERF_PROCS 8
+
+typedef struct perf_proc
+{
+	DWORD pid;
+	uint64_t last_frame;
+} perf_proc_t;
+
+static perf_proc_t perf_procs[PERF_PROCS] = {0};
+static LONG perf_lock = 0;
+
+static void PerfLock()
+{
+	while(InterlockedExchange(&perf_lock, 1) != 0)
+	{
+		Sleep(0);
+	}
+}
+
+static void PerfUnlock()
+{
+	InterlockedExchange(&perf_lock, 0);
+}
+
+/* return previous flip time of current process and set new one */
+static uint64_t PerfLastFrame(uint64_t now)
+{
+	DWORD pid = GetCurrentProcessId();
+	perf_proc_t *slot = &perf_procs[0];
+	uint64_t prev = 0;
+	int i;
+
+	PerfLock();
+	for(i = 0; i < PERF_PROCS; i++)
+	{
+		if(perf_procs[i].pid == pid)
+		{
+			slot = &perf_procs[i];
+			prev = slot->last_frame;
+			break;
+		}
+
+		if(perf_procs[i].last_frame < slot->last_frame)
+		{
+			slot = &perf_procs[i];
+		}
+	}
+	slot->pid = pid;
+	slot->last_frame = now;
+	PerfUnlock();
+
+	return prev;
+}
+
+void PerfFrame()
+{
+	uint64_t now = GetTimeTMS();
+	uint64_t prev = PerfLastFrame(now);
+	DWORD pos;
+
+	PERF_ADD(frames, 1);
+
+	if(prev == 0 || now < prev)
+	{
+		return;
+	}
+
+	/* pauses longer than ~5 days aren't interesting */
+	if(now - prev > 0xFFFFFFFFULL)
+	{
+		prev = now - 0xFFFFFFFFULL;
+	}
+
+	pos = (DWORD)InterlockedExchangeAdd((LONG*)&halPerf.frame_pos, 1);
+	halPerf.frame_time[pos % PERF_FRAMES] = (DWORD)(now - prev);
+}
+
+/* public */
+
+BOOL __stdcall PerfInfo(perf_info_t *info)
+{
+	if(info == NULL)
+	{
+		return FALSE;
+	}
+
+	memcpy(info, &halPerf, sizeof(perf_info_t));
+
+	return TRUE;
+}
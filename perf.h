@@ -0,0 +1,56 @@
+/******************************************************************************
+ * Copyright (c) 2025 Jaroslav Hensl                                          *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+ ******************************************************************************/
+#ifndef __PERF_H__INCLUDED__
+#define __PERF_H__INCLUDED__
+
+/*
+ * Performance counters block, read by tray monitor through PerfInfo
+ * export. All counters wrap around, compare two snapshots.
+ */
+#define PERF_FRAMES 64
+
+typedef struct perf_info
+{
+	DWORD frames;         /* flips */
+	DWORD dp2_commands;   /* DP2 commands parsed by MesaDraw6 */
+	DWORD draws;          /* DP2 draw commands, DRAWPRIMITIVE* counts every block */
+	DWORD upload_bytes;   /* color, depth and texture uploads to GL */
+	DWORD readback_bytes; /* color and depth downloads from GL */
+	DWORD blts;
+	DWORD blt_pixels;     /* destination area of blits */
+	DWORD lock_stalls;    /* locks which have to wait or were rejected as busy */
+	DWORD lock_time;      /* time spend waiting in locks, tenths of ms */
+	DWORD draws_merged;   /* draws appended to previous open GL primitive block */
+	DWORD light_calls;    /* glLight* calls */
+	DWORD frame_pos;      /* next write position in frame_time */
+	DWORD frame_time[PERF_FRAMES]; /* flip intervals, tenths of ms */
+} perf_info_t;
+
+typedef BOOL (__stdcall *PerfInfo_t)(perf_info_t *info);
+
+BOOL __stdcall PerfInfo(perf_info_t *info);
+
+#endif /* __PERF_H__INCLUDED__ */
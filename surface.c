@@ -66,6 +66,7 @@ void SurfaceCtxUnlock(){}
 #define SURF_TYPE_NONE 1
 #define SURF_TYPE_TEX  2
 //#define SURF_TYPE_CTX  3
+#define SURF_TYPE_VBO  4
 
 #define SURF_FLAG_EMPTY 1
 #define SURF_FLAG_COPY 2
@@ -81,6 +82,7 @@ typedef struct surface_attachment
 		int level;
 		int side;
 	} texture;
+	mesa_vbo_t *vbo;
 } surface_attachment_t;
 
 typedef struct context_attachment
@@ -250,6 +252,7 @@ static void SurfaceCopyLCL(LPDDRAWI_DDRAWSURFACE_LCL surf, DDSURF *dest, BOOL re
 	dest->attachments_cnt = 0;
 	dest->dwCaps          = surf->ddsCaps.dwCaps;
 	dest->dwCaps2         = 0;
+	dest->dwCaps3         = 0;
 	dest->dwSurfaceHandle = 0;
 	dest->dwColorKeyLow   = surf->ddckCKSrcBlt.dwColorSpaceLowValue;
 	dest->dwColorKeyHigh  = surf->ddckCKSrcBlt.dwColorSpaceHighValue;
@@ -257,6 +260,7 @@ static void SurfaceCopyLCL(LPDDRAWI_DDRAWSURFACE_LCL surf, DDSURF *dest, BOOL re
 	if(surf->lpSurfMore != NULL)
 	{
 		dest->dwCaps2 = surf->lpSurfMore->ddsCapsEx.dwCaps2;
+		dest->dwCaps3 = surf->lpSurfMore->ddsCapsEx.dwCaps3;
 		dest->dwSurfaceHandle = surf->lpSurfMore->dwSurfaceHandle;
 	}
 
@@ -405,6 +409,25 @@ NUKED_LOCAL void SurfaceAttachTexture(surface_id sid, void *mesa_tex, int level,
 	}
 }
 
+NUKED_LOCAL void SurfaceAttachVBO(surface_id sid, void *mesa_vbo)
+{
+	TRACE_ENTRY
+
+	surface_info_t *info = SurfaceGetInfo(sid);
+	if(info)
+	{
+		surface_attachment_t *item = hal_calloc(HEAP_NORMAL, sizeof(surface_attachment_t), 0);
+		if(item)
+		{
+			item->type = SURF_TYPE_VBO;
+			item->vbo = mesa_vbo;
+			item->pid = GetCurrentProcessId();
+			item->next = info->first;
+			info->first = item;
+		}
+	}
+}
+
 NUKED_LOCAL void SurfaceAttachCtx(void *mesa_ctx)
 {
 	TRACE_ENTRY
@@ -462,6 +485,7 @@ void SurfaceToMesaTex(surface_id sid)
 						item->texture.side < MESA3D_CUBE_SIDES)
 					{
 						item->texture.tex->data_dirty[item->texture.side][item->texture.level] = TRUE;
+						item->texture.tex->gpu_dirty[item->texture.side][item->texture.level] = FALSE;
 						item->texture.tex->dirty = TRUE;
 					}
 					break;
@@ -472,6 +496,54 @@ void SurfaceToMesaTex(surface_id sid)
 	}
 }
 
+/* render to texture: copy FBO directly to attached GL textures, surface memory
+   is downloaded on lock or blit in SurfaceFromMesa */
+NUKED_LOCAL BOOL SurfaceTexFromFBO(surface_id sid, void *mesa_ctx)
+{
+	surface_info_t *info = SurfaceGetInfo(sid);
+	surface_attachment_t *item;
+	int cnt = 0;
+
+	if(info == NULL)
+		return FALSE;
+
+	item = info->first;
+	while(item)
+	{
+		if(item->type == SURF_TYPE_TEX)
+		{
+			if(!MesaBufferCanCopyTexture(mesa_ctx, item->texture.tex, item->texture.level, item->texture.side))
+			{
+				return FALSE;
+			}
+			cnt++;
+		}
+		item = item->next;
+	}
+
+	/* texture not created yet, it'll be loaded from surface */
+	if(cnt == 0)
+		return FALSE;
+
+	if(info->flags & SURF_FLAG_EMPTY)
+	{
+		info->flags &= ~SURF_FLAG_EMPTY;
+		TOPIC("SURFACE", "Empty sid=%d => render target", sid);
+	}
+
+	item = info->first;
+	while(item)
+	{
+		if(item->type == SURF_TYPE_TEX)
+		{
+			MesaBufferCopyTexture(mesa_ctx, item->texture.tex, item->texture.level, item->texture.side);
+		}
+		item = item->next;
+	}
+
+	return TRUE;
+}
+
 void SurfaceToMesa(LPDDRAWI_DDRAWSURFACE_LCL surf, BOOL texonly)
 {
 	TRACE_ENTRY
@@ -566,20 +638,26 @@ void SurfaceFromMesa(LPDDRAWI_DDRAWSURFACE_LCL surf, BOOL texonly)
 {
 	TRACE_ENTRY
 
-#if 0
 	surface_info_t *info = SurfaceGetInfoFromLcl(surf);
 	if(info)
 	{
-		//if(info->lock)
-		//	return;
-
+		DWORD tex_pid = GetCurrentProcessId();
 		surface_attachment_t *item = info->first;
 		while(item)
 		{
 			switch(item->type)
 			{
 				case SURF_TYPE_TEX:
-					// don't downloading textures back to surfaces
+					/* texture was rendered on GPU only (SurfaceTexFromFBO) */
+					if(item->pid == tex_pid &&
+						item->texture.level <= item->texture.tex->mipmap_level &&
+						item->texture.side < MESA3D_CUBE_SIDES &&
+						item->texture.tex->gpu_dirty[item->texture.side][item->texture.level])
+					{
+						GL_BLOCK_BEGIN(item->texture.tex->ctx)
+							MesaBufferDownloadTexture(ctx, item->texture.tex, item->texture.level, item->texture.side);
+						GL_BLOCK_END
+					}
 					break;
 			}
 
@@ -587,8 +665,6 @@ void SurfaceFromMesa(LPDDRAWI_DDRAWSURFACE_LCL surf, BOOL texonly)
 		}
 	}
 
-#endif
-
 	if(texonly)
 		return;
 
@@ -679,6 +755,18 @@ BOOL SurfaceDelete(surface_id sid)
 					}
 #endif
 					break;
+				case SURF_TYPE_VBO:
+					if(item->pid == pid)
+					{
+						GL_BLOCK_BEGIN(item->vbo->ctx)
+							MesaVBODestroy(item->vbo, FALSE, sid);
+						GL_BLOCK_END
+					}
+					else if(ProcessExists(item->pid))
+					{
+						MesaVBODestroy(item->vbo, TRUE, sid);
+					}
+					break;
 			}
 			
 			item = item->next;
@@ -826,6 +914,55 @@ NUKED_LOCAL void SurfaceDeattachTexture(surface_id sid, void *mesa_tex, int leve
 	}
 }
 
+NUKED_LOCAL void SurfaceDeattachVBO(surface_id sid, void *mesa_vbo)
+{
+	TRACE_ENTRY
+
+	surface_info_t *info = SurfaceGetInfo(sid);
+	if(info)
+	{
+		surface_attachment_t *item = info->first;
+		surface_attachment_t *last = NULL;
+
+		while(item)
+		{
+			if(item->type == SURF_TYPE_VBO && item->vbo == mesa_vbo)
+			{
+				if(!last)
+				{
+					info->first = item->next;
+				}
+				else
+				{
+					last->next = item->next;
+				}
+
+				hal_free(HEAP_NORMAL, item);
+				break;
+			}
+
+			last = item;
+			item = item->next;
+		}
+	}
+}
+
+/* finish DP2 calls queued on worker threads (MesaDP2Sync) */
+void SurfaceCtxSync()
+{
+	context_attachment_t *citem = contexts.first;
+	DWORD pid = GetCurrentProcessId();
+
+	while(citem)
+	{
+		if(citem->pid == pid)
+		{
+			MesaDP2Sync(citem->ctx);
+		}
+		citem = citem->next;
+	}
+}
+
 void SurfaceDeattachCtx(void *mesa_ctx)
 {
 	TRACE_ENTRY
@@ -887,6 +1024,69 @@ NUKED_LOCAL mesa3d_texture_t *SurfaceGetTexture(surface_id sid, void *ctx, int l
 	return NULL;
 }
 
+NUKED_LOCAL mesa_vbo_t *SurfaceGetVBO(surface_id sid, void *ctx)
+{
+	surface_info_t *info = SurfaceGetInfo(sid);
+	if(info)
+	{
+		surface_attachment_t *item = info->first;
+		while(item)
+		{
+			if(item->type == SURF_TYPE_VBO && item->vbo->ctx == ctx)
+			{
+				return item->vbo;
+			}
+
+			item = item->next;
+		}
+	}
+
+	return NULL;
+}
+
+/* vertex buffer is locked, area is byte range (left - right) or NULL for whole buffer */
+void SurfaceVertexBufferLock(LPDDRAWI_DDRAWSURFACE_LCL surf, RECTL *area)
+{
+	surface_info_t *info = SurfaceGetInfoFromLcl(surf);
+	if(info)
+	{
+		DWORD size = surf->lpGbl->dwLinearSize;
+		DWORD start = 0;
+		DWORD end = size;
+
+		if(area != NULL && area->left >= 0 && area->left < area->right)
+		{
+			start = area->left;
+			end = area->right;
+			if(end > size)
+			{
+				end = size;
+			}
+		}
+
+		surface_attachment_t *item = info->first;
+		while(item)
+		{
+			if(item->type == SURF_TYPE_VBO && start < end)
+			{
+				mesa_vbo_t *vbo = item->vbo;
+				if(vbo->dirty_start >= vbo->dirty_end)
+				{
+					vbo->dirty_start = start;
+					vbo->dirty_end = end;
+				}
+				else
+				{
+					if(start < vbo->dirty_start) vbo->dirty_start = start;
+					if(end > vbo->dirty_end) vbo->dirty_end = end;
+				}
+			}
+
+			item = item->next;
+		}
+	}
+}
+
 static void SurfaceLoopDuplicate(LPDDRAWI_DDRAWSURFACE_LCL base, LPDDRAWI_DDRAWSURFACE_LCL target, surface_info_t *info)
 {
 	LPATTACHLIST item = target->lpAttachList;
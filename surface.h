@@ -53,6 +53,7 @@ typedef struct _DDSURF
 	DWORD dwFlags;
 	DWORD dwCaps;
 	DWORD dwCaps2;
+	DWORD dwCaps3;
 	DWORD dwSurfaceHandle;
 	DWORD dwColorKeyLow;
 	DWORD dwColorKeyHigh;
@@ -71,6 +72,8 @@ NUKED_LOCAL DDSURF *SurfaceGetSURF(surface_id sid);
 NUKED_LOCAL void *SurfaceGetVidMem(surface_id sid, BOOL ddi6);
 NUKED_LOCAL void SurfaceAttachTexture(surface_id sid, void *mesa_tex, int level, int side);
 NUKED_LOCAL void SurfaceDeattachTexture(surface_id sid, void *mesa_tex, int level, int side);
+NUKED_LOCAL void SurfaceAttachVBO(surface_id sid, void *mesa_vbo);
+NUKED_LOCAL void SurfaceDeattachVBO(surface_id sid, void *mesa_vbo);
 NUKED_LOCAL void SurfaceAttachCtx(void *mesa_ctx);
 NUKED_LOCAL void SurfaceDeattachCtx(void *mesa_ctx);
 NUKED_LOCAL LPDDRAWI_DDRAWSURFACE_LCL SurfaceGetLCL_DX7(surface_id sid);
@@ -0,0 +1,492 @@
+/******************************************************************************
+ * Copyright (c) 2025 Jaroslav Hensl                                          *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+ ******************************************************************************/
+/*
+ * DP2 trace reader, prints per frame statistics of trace captured with
+ * hal/dp2trace setting. Runs on host:
+ *
+ *   cc -O2 tests/dp2trace.c -o dp2trace
+ *   ./dp2trace game_1234.trc
+ *
+ * Command buffers are walked same way as MesaDraw6 does, so this also
+ * validates the command stream layout. Frame records carry increments of
+ * HAL performance counters (PerfInfo), these have to match commands and
+ * draws counted here, otherwise exit code is non zero.
+ *
+ * NOT IMPLEMENTED: replay of the trace through MesaDraw6 on headless
+ * OSMesa (per frame CPU time, GL call counts and render target checksums
+ * compared with the captured ones). MesaDraw6 reads textures, vertex
+ * buffers and render targets through the DDraw surface layer (surface.c,
+ * SurfaceGetSURF, DDRAWI_* structures), which needs Win32 and can't be
+ * built on host. Replay needs this layer behind a stub first. Until then
+ * CPU time and checksums in frame records come only from the capture.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../mesa3d_trace.h"
+
+/* opcodes from d3dhal_ddk.h */
+#define OP_POINTS                 1
+#define OP_INDEXEDLINELIST        2
+#define OP_INDEXEDTRIANGLELIST    3
+#define OP_RENDERSTATE            8
+#define OP_LINELIST              15
+#define OP_LINESTRIP             16
+#define OP_INDEXEDLINESTRIP      17
+#define OP_TRIANGLELIST          18
+#define OP_TRIANGLESTRIP         19
+#define OP_INDEXEDTRIANGLESTRIP  20
+#define OP_TRIANGLEFAN           21
+#define OP_INDEXEDTRIANGLEFAN    22
+#define OP_TRIANGLEFAN_IMM       23
+#define OP_LINELIST_IMM          24
+#define OP_TEXTURESTAGESTATE     25
+#define OP_INDEXEDTRIANGLELIST2  26
+#define OP_INDEXEDLINELIST2      27
+#define OP_UPDATEPALETTE         31
+#define OP_SETLIGHT              34
+#define OP_CLEAR                 42
+#define OP_CREATEVERTEXSHADER    45
+#define OP_SETVERTEXSHADERCONST  48
+#define OP_DRAWPRIMITIVE         52
+#define OP_DRAWINDEXEDPRIMITIVE  53
+#define OP_CREATEPIXELSHADER     54
+#define OP_SETPIXELSHADERCONST   57
+#define OP_CLIPPEDTRIANGLEFAN    58
+#define OP_DRAWPRIMITIVE2        59
+#define OP_DRAWINDEXEDPRIMITIVE2 60
+#define OP_MAX                  128
+
+#define SIZE_SPECIAL 0xFFFFFFFFUL
+
+/* size of one element, elements count is wStateCount/wPrimitiveCount,
+   0 = opcode unknown to this tool */
+static const uint32_t op_size[OP_MAX] = {
+	[1]  = 4,  /* POINTS */
+	[2]  = 4,  /* INDEXEDLINELIST */
+	[3]  = 8,  /* INDEXEDTRIANGLELIST */
+	[8]  = 8,  /* RENDERSTATE */
+	[15] = SIZE_SPECIAL, [16] = SIZE_SPECIAL, [17] = SIZE_SPECIAL,
+	[18] = SIZE_SPECIAL, [19] = SIZE_SPECIAL, [20] = SIZE_SPECIAL,
+	[21] = SIZE_SPECIAL, [22] = SIZE_SPECIAL, [23] = SIZE_SPECIAL,
+	[24] = SIZE_SPECIAL,
+	[25] = 8,  /* TEXTURESTAGESTATE */
+	[26] = SIZE_SPECIAL, [27] = SIZE_SPECIAL,
+	[28] = 16, /* VIEWPORTINFO */
+	[29] = 8,  /* WINFO */
+	[30] = 12, /* SETPALETTE */
+	[31] = SIZE_SPECIAL,
+	[32] = 8,  /* ZRANGE */
+	[33] = 68, /* SETMATERIAL */
+	[34] = SIZE_SPECIAL,
+	[35] = 4,  /* CREATELIGHT */
+	[36] = 68, /* SETTRANSFORM */
+	[38] = 36, /* TEXBLT */
+	[39] = 12, /* STATESET */
+	[40] = 8,  /* SETPRIORITY */
+	[41] = 8,  /* SETRENDERTARGET */
+	[42] = SIZE_SPECIAL,
+	[43] = 8,  /* SETTEXLOD */
+	[44] = 20, /* SETCLIPPLANE */
+	[45] = SIZE_SPECIAL,
+	[46] = 4,  /* DELETEVERTEXSHADER */
+	[47] = 4,  /* SETVERTEXSHADER */
+	[48] = SIZE_SPECIAL,
+	[49] = 12, /* SETSTREAMSOURCE */
+	[50] = 8,  /* SETSTREAMSOURCEUM */
+	[51] = 8,  /* SETINDICES */
+	[52] = 12, /* DRAWPRIMITIVE */
+	[53] = 24, /* DRAWINDEXEDPRIMITIVE */
+	[54] = SIZE_SPECIAL,
+	[55] = 4,  /* DELETEPIXELSHADER */
+	[56] = 4,  /* SETPIXELSHADER */
+	[57] = SIZE_SPECIAL,
+	[58] = 12, /* CLIPPEDTRIANGLEFAN */
+	[59] = 12, /* DRAWPRIMITIVE2 */
+	[60] = 24, /* DRAWINDEXEDPRIMITIVE2 */
+	[63] = 48, /* VOLUMEBLT */
+	[64] = 24, /* BUFFERBLT */
+	[65] = 68, /* MULTIPLYTRANSFORM */
+	[66] = 20, /* ADDDIRTYRECT */
+	[67] = 28, /* ADDDIRTYBOX */
+};
+
+typedef struct stats
+{
+	uint32_t dp2_calls;
+	uint32_t commands;
+	uint32_t states;
+	uint32_t draws;
+	uint32_t prims;
+	uint32_t unparsed;
+	uint32_t textures;
+	uint32_t buffers;
+	uint64_t upload_bytes;
+	uint32_t op_cnt[OP_MAX];
+} stats_t;
+
+static uint32_t fvf_size(uint32_t fvf)
+{
+	static const uint32_t tex_size[4] = {2*4, 3*4, 4*4, 1*4}; /* D3DFVF_TEXTUREFORMAT2, 3, 4, 1 */
+	static const uint32_t pos_size[8] = {0, 12, 16, 16, 20, 24, 28, 32};
+	uint32_t size = 0;
+	uint32_t i;
+
+	if(fvf & 0x001) size += 4;
+	size += pos_size[(fvf >> 1) & 7];
+	if(fvf & 0x010) size += 12;
+	if(fvf & 0x020) size += 4;
+	if(fvf & 0x040) size += 4;
+	if(fvf & 0x080) size += 4;
+	for(i = 0; i < ((fvf >> 8) & 0xF); i++)
+	{
+		size += tex_size[(fvf >> (16 + i*2)) & 3];
+	}
+
+	return size;
+}
+
+#define RD32(_p) ((uint32_t)(_p)[0] | ((uint32_t)(_p)[1] << 8) | ((uint32_t)(_p)[2] << 16) | ((uint32_t)(_p)[3] << 24))
+#define RD16(_p) ((uint32_t)(_p)[0] | ((uint32_t)(_p)[1] << 8))
+#define ALIGN4(_off, _base) _off = ((((_off) + (_base) + 3) & ~3UL) - (_base))
+
+/* walk one command buffer, returns FALSE on first command which cannot be parsed */
+static int walk_dp2(const dp2trace_dp2_t *d, const uint8_t *cmd, stats_t *st)
+{
+	uint32_t stride = fvf_size(d->fvf);
+	uint32_t off = 0;
+
+	while(off + 4 <= d->cmd_size)
+	{
+		uint32_t op    = cmd[off];
+		uint32_t cnt   = RD16(cmd + off + 2);
+		uint32_t i, esize;
+
+		off += 4;
+		st->commands++;
+
+		if(op >= OP_MAX || op_size[op] == 0)
+		{
+			st->unparsed++;
+			return 0;
+		}
+		st->op_cnt[op]++;
+
+		esize = op_size[op];
+		if(esize != SIZE_SPECIAL)
+		{
+			off += esize*cnt;
+			switch(op)
+			{
+				case OP_RENDERSTATE:
+				case OP_TEXTURESTAGESTATE:
+					st->states += cnt;
+					break;
+				case OP_POINTS:
+				case OP_INDEXEDLINELIST:
+				case OP_INDEXEDTRIANGLELIST:
+					st->draws++;
+					st->prims += cnt;
+					break;
+				case OP_DRAWPRIMITIVE:
+				case OP_DRAWINDEXEDPRIMITIVE:
+				case OP_CLIPPEDTRIANGLEFAN:
+				case OP_DRAWPRIMITIVE2:
+				case OP_DRAWINDEXEDPRIMITIVE2:
+					st->draws += cnt;
+					break;
+			}
+			continue;
+		}
+
+		switch(op)
+		{
+			case OP_LINELIST:
+			case OP_LINESTRIP:
+			case OP_TRIANGLELIST:
+			case OP_TRIANGLESTRIP:
+			case OP_TRIANGLEFAN:
+				off += 2;
+				st->draws++;
+				st->prims += cnt;
+				break;
+			case OP_INDEXEDLINESTRIP:
+				off += 2 + 2*(cnt + 1);
+				st->draws++;
+				st->prims += cnt;
+				break;
+			case OP_INDEXEDTRIANGLESTRIP:
+			case OP_INDEXEDTRIANGLEFAN:
+				off += 2 + 2*(cnt + 2);
+				st->draws++;
+				st->prims += cnt;
+				break;
+			case OP_INDEXEDTRIANGLELIST2:
+				off += 2 + 6*cnt;
+				st->draws++;
+				st->prims += cnt;
+				break;
+			case OP_INDEXEDLINELIST2:
+				off += 2 + 4*cnt;
+				st->draws++;
+				st->prims += cnt;
+				break;
+			case OP_TRIANGLEFAN_IMM:
+				off += 4;
+				ALIGN4(off, d->cmd_align);
+				off += stride*(cnt + 2);
+				st->draws++;
+				st->prims += cnt;
+				break;
+			case OP_LINELIST_IMM:
+				ALIGN4(off, d->cmd_align);
+				off += stride*cnt*2;
+				st->draws++;
+				st->prims += cnt;
+				break;
+			case OP_UPDATEPALETTE:
+				if(off + 8 > d->cmd_size) return 0;
+				off += 8 + 4*RD16(cmd + off + 6);
+				break;
+			case OP_CLEAR:
+				off += 16 + 16*cnt;
+				break;
+			case OP_SETLIGHT:
+				for(i = 0; i < cnt; i++)
+				{
+					if(off + 8 > d->cmd_size) return 0;
+					if(RD32(cmd + off + 4) == 2) /* D3DHAL_SETLIGHT_DATA + D3DLIGHT7 */
+						off += 104;
+					off += 8;
+				}
+				break;
+			case OP_CREATEVERTEXSHADER:
+				for(i = 0; i < cnt; i++)
+				{
+					if(off + 12 > d->cmd_size) return 0;
+					off += 12 + RD32(cmd + off + 4) + RD32(cmd + off + 8);
+				}
+				break;
+			case OP_CREATEPIXELSHADER:
+				for(i = 0; i < cnt; i++)
+				{
+					if(off + 8 > d->cmd_size) return 0;
+					off += 8 + RD32(cmd + off + 4);
+				}
+				break;
+			case OP_SETVERTEXSHADERCONST:
+			case OP_SETPIXELSHADERCONST:
+				for(i = 0; i < cnt; i++)
+				{
+					if(off + 8 > d->cmd_size) return 0;
+					off += 8 + 16*RD32(cmd + off + 4);
+				}
+				break;
+		}
+	}
+
+	return off == d->cmd_size;
+}
+
+static double clock_ms(void)
+{
+	return (double)clock() * 1000.0 / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *fr;
+	dp2trace_file_t head;
+	dp2trace_rec_t rec;
+	uint8_t *buf = NULL;
+	size_t buf_size = 0;
+	stats_t frame, total;
+	uint32_t frames = 0;
+	uint32_t perf_mismatch = 0;
+	int op;
+	double t0;
+
+	if(argc < 2)
+	{
+		printf("Usage: %s trace.trc\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	fr = fopen(argv[1], "rb");
+	if(fr == NULL)
+	{
+		printf("Cannot open %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	if(fread(&head, sizeof(head), 1, fr) != 1 || head.magic != DP2TRACE_MAGIC || head.version != DP2TRACE_VERSION)
+	{
+		printf("%s: not a DP2 trace (or unsupported version)\n", argv[1]);
+		fclose(fr);
+		return EXIT_FAILURE;
+	}
+
+	printf("pid: %u\n", head.pid);
+	/* no replay (see header), don't present captured values as measured here */
+	printf("hal_cpu and checksum are captured by the driver, trace is not replayed\n");
+	printf("frame  time[ms]  hal_cpu[ms]  parse[ms]  dp2  cmds  states  draws  prims  tex  vb  upload[kB]  checksum\n");
+
+	memset(&frame, 0, sizeof(frame));
+	memset(&total, 0, sizeof(total));
+	t0 = clock_ms();
+
+	while(fread(&rec, sizeof(rec), 1, fr) == 1)
+	{
+		if(rec.size > buf_size)
+		{
+			free(buf);
+			buf_size = rec.size;
+			buf = malloc(buf_size);
+			if(buf == NULL)
+			{
+				printf("Out of memory (record %u bytes)\n", rec.size);
+				return EXIT_FAILURE;
+			}
+		}
+
+		if(rec.size && fread(buf, rec.size, 1, fr) != 1)
+		{
+			printf("Truncated record (type %u)\n", rec.type);
+			break;
+		}
+
+		switch(rec.type)
+		{
+			case DP2TRACE_SURFACE:
+			{
+				const dp2trace_surface_t *s = (const dp2trace_surface_t*)buf;
+				printf("       surface %u: %ux%ux%u caps=0x%08X\n", s->sid, s->width, s->height, s->bpp, s->caps);
+				break;
+			}
+			case DP2TRACE_TEXTURE:
+			{
+				const dp2trace_texture_t *t = (const dp2trace_texture_t*)buf;
+				if(dp2trace_hash(buf + sizeof(*t), t->data_size) != t->hash)
+				{
+					printf("       texture %u: data hash mismatch\n", t->sid);
+				}
+				frame.textures++;
+				frame.upload_bytes += t->data_size;
+				break;
+			}
+			case DP2TRACE_BUFFER:
+			{
+				const dp2trace_buffer_t *b = (const dp2trace_buffer_t*)buf;
+				frame.buffers++;
+				frame.upload_bytes += b->data_size;
+				break;
+			}
+			case DP2TRACE_DP2:
+			{
+				const dp2trace_dp2_t *d = (const dp2trace_dp2_t*)buf;
+				frame.dp2_calls++;
+				frame.upload_bytes += d->vertex_size;
+				if(!walk_dp2(d, buf + sizeof(*d), &frame))
+				{
+					frame.unparsed++;
+				}
+				break;
+			}
+			case DP2TRACE_FRAME:
+			{
+				const dp2trace_frame_t *f = (const dp2trace_frame_t*)buf;
+				double t1 = clock_ms();
+				printf("%5u  %8.1f  %11.1f  %9.3f  %3u  %4u  %6u  %5u  %5u  %3u  %2u  %10.1f  %08X\n",
+					f->frame, rec.time/10.0, f->cpu_time/10.0, t1 - t0,
+					frame.dp2_calls, frame.commands, frame.states, frame.draws, frame.prims,
+					frame.textures, frame.buffers, frame.upload_bytes/1024.0, f->checksum);
+
+				/* HAL performance counters must count same commands as we do */
+				if(f->perf_commands != frame.commands || f->perf_draws != frame.draws)
+				{
+					printf("       perf counters mismatch: commands %u (expected %u), draws %u (expected %u)\n",
+						f->perf_commands, frame.commands, f->perf_draws, frame.draws);
+					perf_mismatch++;
+				}
+
+				total.dp2_calls    += frame.dp2_calls;
+				total.commands     += frame.commands;
+				total.states       += frame.states;
+				total.draws        += frame.draws;
+				total.prims        += frame.prims;
+				total.unparsed     += frame.unparsed;
+				total.textures     += frame.textures;
+				total.buffers      += frame.buffers;
+				total.upload_bytes += frame.upload_bytes;
+				for(op = 0; op < OP_MAX; op++)
+				{
+					total.op_cnt[op] += frame.op_cnt[op];
+				}
+
+				memset(&frame, 0, sizeof(frame));
+				frames++;
+				t0 = t1;
+				break;
+			}
+			default:
+				printf("Unknown record type %u\n", rec.type);
+				break;
+		}
+	}
+
+	fclose(fr);
+	free(buf);
+
+	printf("\nframes: %u, dp2 calls: %u, commands: %u, draws: %u, primitives: %u\n",
+		frames, total.dp2_calls, total.commands, total.draws, total.prims);
+	printf("uploads: %u textures, %u vertex buffers, %.1f kB\n", total.textures, total.buffers, total.upload_bytes/1024.0);
+	if(total.unparsed)
+	{
+		printf("WARNING: %u command buffers not fully parsed\n", total.unparsed);
+	}
+	if(perf_mismatch)
+	{
+		printf("WARNING: perf counters differ in %u frames (other D3D process running?)\n", perf_mismatch);
+	}
+	else
+	{
+		printf("perf counters: OK\n");
+	}
+
+	printf("commands by opcode:\n");
+	for(op = 0; op < OP_MAX; op++)
+	{
+		if(total.op_cnt[op])
+		{
+			printf("  %3d: %u\n", op, total.op_cnt[op]);
+		}
+	}
+
+	return perf_mismatch ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+/*
+ * Measure overhead of FBHDA_* wrappers from 3d_accel.c
+ *
+ * Needs vmdisp9x.dll (installed driver), build with mingw:
+ *   i686-w64-mingw32-gcc -O2 -I.. tests/fbhdabench.c -o fbhdabench.exe
+ */
+#include "../3d_accel.c"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LOOPS 1000000
+
+static double bench_time()
+{
+	static LARGE_INTEGER freq = {0};
+	LARGE_INTEGER stamp;
+
+	if(freq.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&freq);
+	}
+
+	QueryPerformanceCounter(&stamp);
+
+	return (double)stamp.QuadPart * 1000000.0 / (double)freq.QuadPart;
+}
+
+int main(int argc, char **argv)
+{
+	double t0, t1, t2, t3;
+	volatile FBHDA_t *fb = NULL;
+	volatile HMODULE mod = NULL;
+	DWORD i;
+
+	if(FBHDA_setup() == NULL)
+	{
+		printf("%s not available\n", VMDISP9X_LIB);
+		return EXIT_FAILURE;
+	}
+
+	/* library lookup done by wrapper on every call before caching */
+	t0 = bench_time();
+	for(i = 0; i < LOOPS; i++)
+	{
+		mod = GetModuleHandle(VMDISP9X_LIB);
+	}
+
+	/* wrapper (cached table) + call */
+	t1 = bench_time();
+	for(i = 0; i < LOOPS; i++)
+	{
+		fb = FBHDA_setup();
+	}
+
+	/* direct call without wrapper */
+	t2 = bench_time();
+	for(i = 0; i < LOOPS; i++)
+	{
+		fb = fbhda_lib.pFBHDA_setup();
+	}
+	t3 = bench_time();
+
+	printf("GetModuleHandle:       %8.4f us/call\n", (t1 - t0)/LOOPS);
+	printf("FBHDA_setup (wrapper): %8.4f us/call\n", (t2 - t1)/LOOPS);
+	printf("FBHDA_setup (direct):  %8.4f us/call\n", (t3 - t2)/LOOPS);
+	printf("wrapper overhead:      %8.4f us/call\n", ((t2 - t1) - (t3 - t2))/LOOPS);
+
+	(void)fb;
+	(void)mod;
+
+	return EXIT_SUCCESS;
+}
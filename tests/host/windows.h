@@ -0,0 +1,25 @@
+/*
+ * Minimal windows.h for native host build of tests which don't call
+ * Win32 API (shader translators), see "make tests".
+ */
+#ifndef __HOST_WINDOWS_H__INCLUDED__
+#define __HOST_WINDOWS_H__INCLUDED__
+
+#include <stdint.h>
+#include <string.h>
+
+typedef int BOOL;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#endif /* __HOST_WINDOWS_H__INCLUDED__ */
@@ -0,0 +1,304 @@
+/*
+ * ps_1_x to ARB_fragment_program translator test. Runs on host with stub
+ * windows.h from tests/host:
+ *
+ *   make tests
+ *
+ * or directly:
+ *
+ *   cc -Itests/host tests/psarb.c -o psarb
+ *   ./psarb
+ */
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../d3dshader_ddk.h"
+#include "../mesa3d_psarb.h"
+
+/*
+ * ps.1.1
+ * tex t0
+ * mad_x2 r0, t0_bx2, c1, v0
+ */
+static const DWORD ps_modulate[] = {
+	0xFFFF0101,
+	0x00000042, 0xB00F0000,
+	0x00000004, 0x810F0000, 0xB4E40000, 0xA0E40001, 0x90E40000,
+	0x0000FFFF
+};
+
+/*
+ * ps.1.1
+ * tex t0
+ * mul_sat r0.rgb, t0, v0
+ * +mov r0.a, r0
+ * mul r1.rgb, t0, c0
+ * +mov r1.a, 1-t0.a
+ * cnd r0, r0.a, t0, r1
+ */
+static const DWORD ps_coissue[] = {
+	0xFFFF0101,
+	0x00000042, 0xB00F0000,
+	0x00000005, 0x80170000, 0xB0E40000, 0x90E40000,
+	0x40000001, 0x80080000, 0x80E40000,
+	0x00000005, 0x80070001, 0xB0E40000, 0xA0E40000,
+	0x40000001, 0x80080001, 0xB6FF0000,
+	0x00000050, 0x800F0000, 0x80FF0000, 0xB0E40000, 0x80E40001,
+	0x0000FFFF
+};
+
+/*
+ * ps.1.1
+ * tex t0
+ * texm3x3pad t1, t0_bx2
+ * texm3x3pad t2, t0_bx2
+ * texm3x3spec t3, t0_bx2, c0
+ * mov r0, t3
+ */
+static const DWORD ps_spec[] = {
+	0xFFFF0101,
+	0x00000042, 0xB00F0000,
+	0x00000049, 0xB00F0001, 0xB4E40000,
+	0x00000049, 0xB00F0002, 0xB4E40000,
+	0x0000004C, 0xB00F0003, 0xB4E40000, 0xA0E40000,
+	0x00000001, 0x800F0000, 0xB0E40003,
+	0x0000FFFF
+};
+
+/*
+ * ps.1.3
+ * tex t0
+ * texbeml t1, t0
+ * mov r0, t1
+ */
+static const DWORD ps_bump[] = {
+	0xFFFF0103,
+	0x00000042, 0xB00F0000,
+	0x00000044, 0xB00F0001, 0xB0E40000,
+	0x00000001, 0x800F0000, 0xB0E40001,
+	0x0000FFFF
+};
+
+/*
+ * ps.1.4
+ * def c0, 0.0, 0.0, 0.0, 0.5
+ * texld r0, t0
+ * texcrd r1.rgb, t1
+ * texld r3, t3_dw
+ * cmp r0, r1, r0, c0
+ * phase
+ * texld r2, r0
+ * lrp_sat r0, c1, r2, r0
+ */
+static const DWORD ps_14[] = {
+	0xFFFF0104,
+	0x00000051, 0xA00F0000, 0x00000000, 0x00000000, 0x00000000, 0x3F000000,
+	0x00000042, 0x800F0000, 0xB0E40000,
+	0x00000040, 0x80070001, 0xB0E40001,
+	0x00000042, 0x800F0003, 0xBAE40003,
+	0x00000058, 0x800F0000, 0x80E40001, 0x80E40000, 0xA0E40000,
+	0x0000FFFD,
+	0x00000042, 0x800F0002, 0x80E40000,
+	0x00000012, 0x801F0000, 0xA0E40001, 0x80E40002, 0x80E40000,
+	0x0000FFFF
+};
+
+/* ps.2.0 (unsupported version) */
+static const DWORD ps_20[] = {
+	0xFFFF0200,
+	0x00000001, 0x800F0800, 0x90E40000,
+	0x0000FFFF
+};
+
+/* vs.1.1 (not pixel shader) */
+static const DWORD vs_simple[] = {
+	0xFFFE0101,
+	0x00000001, 0xC00F0000, 0x90E40000,
+	0x0000FFFF
+};
+
+/*
+ * ps.1.4
+ * texcrd r5.rgb, t0
+ * texdepth r5
+ * mov r0, c0
+ */
+static const DWORD ps_depth[] = {
+	0xFFFF0104,
+	0x00000040, 0x80070005, 0xB0E40000,
+	0x00000057, 0x800F0005,
+	0x00000001, 0x800F0000, 0xA0E40000,
+	0x0000FFFF
+};
+
+/*
+ * ps.1.3
+ * tex t0
+ * texm3x2pad t1, t0
+ * texm3x2depth t2, t0
+ * mov r0, t0
+ */
+static const DWORD ps_depth13[] = {
+	0xFFFF0103,
+	0x00000042, 0xB00F0000,
+	0x00000047, 0xB00F0001, 0xB0E40000,
+	0x00000054, 0xB00F0002, 0xB0E40000,
+	0x00000001, 0x800F0000, 0xB0E40000,
+	0x0000FFFF
+};
+
+/* ps.1.4 texdepth on other register than r5 */
+static const DWORD ps_depth_bad[] = {
+	0xFFFF0104,
+	0x00000057, 0x800F0004,
+	0x0000FFFF
+};
+
+static char text[8192];
+static psarb_t st;
+static int fails = 0;
+
+static void expect(const char *name, const char *line)
+{
+	if(strstr(text, line) == NULL)
+	{
+		printf("%s: missing \"%s\"\n", name, line);
+		fails++;
+	}
+}
+
+static DWORD translate(const char *name, const DWORD *code, DWORD size, DWORD variant)
+{
+	DWORD len = psarb_translate(&st, code, size/sizeof(DWORD), variant, text, sizeof(text));
+	printf("=== %s (%u) ===\n%s\n", name, (unsigned)len, len ? text : "");
+	return len;
+}
+
+int main(int argc, char **argv)
+{
+	if(translate("ps_modulate", ps_modulate, sizeof(ps_modulate), PSARB_VARIANT_FOG_LINEAR) == 0)
+	{
+		fails++;
+	}
+	else
+	{
+		expect("ps_modulate", "!!ARBfp1.0\nOPTION ARB_fog_linear;\n");
+		expect("ps_modulate", "PARAM c[8] = { program.env[0..7] };\n");
+		expect("ps_modulate", "TEMP t0;\n");
+		expect("ps_modulate", "TEX t0, fragment.texcoord[0], texture[0], 2D;\n");
+		expect("ps_modulate", "MAD s0, t0, psk.z, -psk.y;\n");
+		expect("ps_modulate", "MAD dm, s0, c[1], fragment.color.primary;\n");
+		expect("ps_modulate", "MUL r0, dm, psx.x;\n");
+		expect("ps_modulate", "MOV result.color, r0;\nEND\n");
+	}
+
+	if(translate("ps_coissue", ps_coissue, sizeof(ps_coissue), 0) == 0)
+	{
+		fails++;
+	}
+	else
+	{
+		expect("ps_coissue", "MUL_SAT co.xyz, t0, fragment.color.primary;\n");
+		expect("ps_coissue", "MOV r0.w, r0;\nMOV r0.xyz, co;\n");
+		expect("ps_coissue", "MUL r1.xyz, t0, c[0];\n");
+		expect("ps_coissue", "SUB s0, psk.y, t0.w;\nMOV r1.w, s0;\n");
+		expect("ps_coissue", "SUB tr, psk.x, r0.w;\n");
+		expect("ps_coissue", "CMP r0, tr, t0, r1;\n");
+	}
+
+	if(translate("ps_spec", ps_spec, sizeof(ps_spec), PSARB_VARIANT_CUBE(3)) == 0)
+	{
+		fails++;
+	}
+	else
+	{
+		expect("ps_spec", "DP3 tm.x, fragment.texcoord[1], s0;\n");
+		expect("ps_spec", "DP3 tm.y, fragment.texcoord[2], s0;\n");
+		expect("ps_spec", "DP3 tm.z, fragment.texcoord[3], s0;\n");
+		expect("ps_spec", "MOV te, c[0];\nDP3 tr.x, tm, te;\n");
+		expect("ps_spec", "MAD tr, tm, tr.x, -te;\nTEX t3, tr, texture[3], CUBE;\n");
+		expect("ps_spec", "MOV r0, t3;\n");
+	}
+
+	if(translate("ps_bump", ps_bump, sizeof(ps_bump), 0) == 0)
+	{
+		fails++;
+	}
+	else
+	{
+		expect("ps_bump", "MOV tr, t0;\n");
+		expect("ps_bump", "MAD tb.xy, program.env[9], tr.x, tb;\n");
+		expect("ps_bump", "MAD tb.xy, program.env[9].zwzw, tr.y, tb;\n");
+		expect("ps_bump", "TEX t1, tb, texture[1], 2D;\n");
+		expect("ps_bump", "MAD_SAT tr.w, tr.z, program.env[17].x, program.env[17].y;\n");
+		expect("ps_bump", "MUL t1.xyz, t1, tr.w;\n");
+	}
+
+	if(translate("ps_14", ps_14, sizeof(ps_14), 0) == 0)
+	{
+		fails++;
+	}
+	else
+	{
+		expect("ps_14", "TEMP r3;\n");
+		expect("ps_14", "MOV pj, fragment.texcoord[0];\nTEX r0, pj, texture[0], 2D;\n");
+		expect("ps_14", "MOV r1.xyz, pj;\n");
+		expect("ps_14", "RCP pj.w, pj.w;\n");
+		expect("ps_14", "CMP r0, r1, program.local[0], r0;\n");
+		expect("ps_14", "MOV pj, r0;\nTEX r2, pj, texture[2], 2D;\n");
+		expect("ps_14", "LRP_SAT r0, c[1], r2, r0;\n");
+		if(st.def_cnt != 1 || st.def_reg[0] != 0 || st.def_val[0][3] != 0.5f)
+		{
+			printf("ps_14: bad DEF\n");
+			fails++;
+		}
+	}
+
+	if(translate("ps_20", ps_20, sizeof(ps_20), 0) != 0)
+	{
+		fails++;
+	}
+
+	if(translate("vs_simple", vs_simple, sizeof(vs_simple), 0) != 0)
+	{
+		fails++;
+	}
+
+	if(translate("ps_depth", ps_depth, sizeof(ps_depth), 0) == 0)
+	{
+		fails++;
+	}
+	else
+	{
+		expect("ps_depth", "TEMP r5;\n");
+		expect("ps_depth", "RCP tr.y, r5.y;\nMUL tr.x, r5.x, tr.y;\nABS tr.y, r5.y;\n");
+		expect("ps_depth", "CMP tr.x, -tr.y, tr.x, psk.y;\nMOV_SAT result.depth.z, tr.x;\n");
+	}
+
+	if(translate("ps_depth13", ps_depth13, sizeof(ps_depth13), 0) == 0)
+	{
+		fails++;
+	}
+	else
+	{
+		expect("ps_depth13", "DP3 tm.y, fragment.texcoord[2], t0;\n");
+		expect("ps_depth13", "RCP tr.y, tm.y;\nMUL tr.x, tm.x, tr.y;\n");
+		expect("ps_depth13", "MOV_SAT result.depth.z, tr.x;\n");
+	}
+
+	if(translate("ps_depth_bad", ps_depth_bad, sizeof(ps_depth_bad), 0) != 0)
+	{
+		fails++;
+	}
+
+	if(psarb_translate(&st, ps_modulate, sizeof(ps_modulate)/sizeof(DWORD), 0, text, 64) != 0)
+	{
+		printf("overflow not detected\n");
+		fails++;
+	}
+
+	printf("%s (%d fails)\n", fails ? "FAIL" : "PASS", fails);
+
+	return fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
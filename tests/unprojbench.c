@@ -0,0 +1,102 @@
+/*
+ * Microbenchmark of XYZRHW unprojection, per vertex SV_UNPROJECT vs.
+ * batched unproject_batch from mesa3d_unproject.h. Runs on host:
+ *
+ *   cc -O2 -msse tests/unprojbench.c -o unprojbench
+ *   ./unprojbench
+ *
+ * Build without -msse (or on non x86) measures scalar fallback. Exit code
+ * is non zero when batch result differs from reference more than
+ * precision of reciprocal with one Newton-Raphson step.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+typedef uint8_t  BYTE;
+typedef uint32_t DWORD;
+
+#include "../mesa3d_unproject.h"
+
+#define VERTICES 4096
+#define STRIDE   32 /* D3DTLVERTEX */
+#define LOOPS    2000
+
+static double bench_time()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+/* same as SV_UNPROJECT */
+static void unproject_ref(float *out, const BYTE *src, DWORD stride, DWORD cnt, const float vpnorm[4], float zscale)
+{
+	DWORD i;
+	for(i = 0; i < cnt; i++)
+	{
+		const float *v = (const float*)(src + stride*i);
+		float *o = out + i*4;
+
+		o[3] = 1.0f/v[3];
+		o[0] = (((v[0] - vpnorm[0]) * vpnorm[2]) - 1.0f)*o[3];
+		o[1] = (((v[1] - vpnorm[1]) * vpnorm[3]) - 1.0f)*o[3];
+		o[2] = (v[2]*zscale)*o[3];
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static BYTE vertices[VERTICES*STRIDE];
+	static float ref[VERTICES*4];
+	static float out[VERTICES*4];
+	/* 640x480 viewport */
+	const float vpnorm[4] = {0.0f, 0.0f, 2.0f/640.0f, 2.0f/480.0f};
+	const float zscale = 1.0f;
+	double t, t_ref, t_batch, max_err = 0.0;
+	volatile float sink = 0.0f;
+	int i, l;
+
+	srand(1234);
+	for(i = 0; i < VERTICES; i++)
+	{
+		float *v = (float*)(vertices + i*STRIDE);
+		v[0] = (float)(rand() % 640);
+		v[1] = (float)(rand() % 480);
+		v[2] = (float)rand() / (float)RAND_MAX;
+		v[3] = 0.01f + (float)rand() / (float)RAND_MAX;
+	}
+
+	t = bench_time();
+	for(l = 0; l < LOOPS; l++)
+	{
+		unproject_ref(ref, vertices, STRIDE, VERTICES, vpnorm, zscale);
+		sink += ref[l % VERTICES];
+	}
+	t_ref = bench_time() - t;
+
+	t = bench_time();
+	for(l = 0; l < LOOPS; l++)
+	{
+		unproject_batch(out, vertices, STRIDE, VERTICES, vpnorm, zscale);
+		sink += out[l % VERTICES];
+	}
+	t_batch = bench_time() - t;
+
+	for(i = 0; i < VERTICES*4; i++)
+	{
+		double err = fabs((double)out[i] - (double)ref[i]) / (fabs((double)ref[i]) + 1e-6);
+		if(err > max_err)
+			max_err = err;
+	}
+
+	printf("reference: %.3f ns/vertex\n", t_ref * 1000.0 / ((double)VERTICES*LOOPS));
+	printf("batch:     %.3f ns/vertex (%.2fx)\n", t_batch * 1000.0 / ((double)VERTICES*LOOPS), t_ref / t_batch);
+	printf("max relative error: %g\n", max_err);
+
+	(void)sink;
+	return max_err > 1e-5 ? 1 : 0;
+}
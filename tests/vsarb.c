@@ -0,0 +1,191 @@
+/*
+ * vs_1_1 to ARB_vertex_program translator test. Runs on host with stub
+ * windows.h from tests/host:
+ *
+ *   make tests
+ *
+ * or directly:
+ *
+ *   cc -Itests/host tests/vsarb.c -o vsarb
+ *   ./vsarb
+ */
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../d3dshader_ddk.h"
+#include "../mesa3d_vsarb.h"
+
+/*
+ * vs.1.1
+ * m4x4 oPos, v0, c0
+ * mov oD0, v5
+ * mov oT0.xy, v7
+ */
+static const DWORD vs_transform[] = {
+	0xFFFE0101,
+	0x00000014, 0xC00F0000, 0x90E40000, 0xA0E40000,
+	0x00000001, 0xD00F0000, 0x90E40005,
+	0x00000001, 0xE0030000, 0x90E40007,
+	0x0000FFFF
+};
+
+/*
+ * vs.1.1
+ * ; comment
+ * def c90, 1.0, 0.5, 0.0, 2.0
+ * mov a0.x, v1.x
+ * m4x3 r0.xyz, v0, c[a0.x + 10]
+ * mov r1, c[a0.x + 70]
+ * lit r2, r1
+ * expp r3, r2.w
+ * logp r4.x, -r3.y
+ * rcp r5.x, c90.x
+ * mov oFog.x, r4.x
+ * mul oPos, r0, r5.x
+ */
+static const DWORD vs_full[] = {
+	0xFFFE0101,
+	0x0002FFFE, 0x4D4D4F43, 0x00544E45,
+	0x00000051, 0xA00F005A, 0x3F800000, 0x3F000000, 0x00000000, 0x40000000,
+	0x00000001, 0xB0010000, 0x90000001,
+	0x00000015, 0x80070000, 0x90E40000, 0xA0E4200A,
+	0x00000001, 0x800F0001, 0xA0E42046,
+	0x00000010, 0x800F0002, 0x80E40001,
+	0x0000004E, 0x800F0003, 0x80FF0002,
+	0x0000004F, 0x80010004, 0x81550003,
+	0x00000006, 0x80010005, 0xA000005A,
+	0x00000001, 0xC0010001, 0x80000004,
+	0x00000005, 0xC00F0000, 0x80E40000, 0x80000005,
+	0x0000FFFF
+};
+
+/*
+ * vs.1.1
+ * def c0, 1.0, 2.0, 3.0, 4.0
+ * def c95, 0.5, 0.5, 0.5, 0.5
+ * mov a0.x, v0.x
+ * mov oPos, c[a0.x + 0]
+ * mov oD0, c95
+ */
+static const DWORD vs_reldef[] = {
+	0xFFFE0101,
+	0x00000051, 0xA00F0000, 0x3F800000, 0x40000000, 0x40400000, 0x40800000,
+	0x00000051, 0xA00F005F, 0x3F000000, 0x3F000000, 0x3F000000, 0x3F000000,
+	0x00000001, 0xB0010000, 0x90000000,
+	0x00000001, 0xC00F0000, 0xA0E42000,
+	0x00000001, 0xD00F0000, 0xA0E4005F,
+	0x0000FFFF
+};
+
+/* ps.1.1 (not vertex shader) */
+static const DWORD ps_simple[] = {
+	0xFFFF0101,
+	0x00000001, 0x800F0000, 0x90E40000,
+	0x0000FFFF
+};
+
+/* vs.1.1 with unsupported source modifier (x2) */
+static const DWORD vs_badmod[] = {
+	0xFFFE0101,
+	0x00000001, 0xC00F0000, 0x97E40000,
+	0x0000FFFF
+};
+
+static char text[8192];
+static vsarb_t st;
+static int fails = 0;
+
+static void expect(const char *name, const char *line)
+{
+	if(strstr(text, line) == NULL)
+	{
+		printf("%s: missing \"%s\"\n", name, line);
+		fails++;
+	}
+}
+
+static DWORD translate(const char *name, const DWORD *code, DWORD size)
+{
+	DWORD len = vsarb_translate(&st, code, size/sizeof(DWORD), text, sizeof(text));
+	printf("=== %s (%u) ===\n%s\n", name, (unsigned)len, len ? text : "");
+	return len;
+}
+
+int main(int argc, char **argv)
+{
+	if(translate("vs_transform", vs_transform, sizeof(vs_transform)) == 0)
+	{
+		fails++;
+	}
+	else
+	{
+		expect("vs_transform", "!!ARBvp1.0\n");
+		expect("vs_transform", "PARAM c[96] = { program.env[0..95] };\n");
+		expect("vs_transform", "DP4 mtx.x, vertex.attrib[0], c[0];\n");
+		expect("vs_transform", "DP4 mtx.w, vertex.attrib[0], c[3];\n");
+		expect("vs_transform", "MOV opos, mtx;\n");
+		expect("vs_transform", "MOV result.color.primary, vertex.attrib[5];\n");
+		expect("vs_transform", "MOV result.texcoord[0].xy, vertex.attrib[7];\n");
+		expect("vs_transform", "MOV result.color.secondary, dxdef.x;\n");
+		expect("vs_transform", "MUL result.position, opos, yflip;\nEND\n");
+	}
+
+	if(translate("vs_full", vs_full, sizeof(vs_full)) == 0)
+	{
+		fails++;
+	}
+	else
+	{
+		expect("vs_full", "PARAM cr[89] = { program.env[7..89], program.local[0], program.env[91..95] };\n");
+		expect("vs_full", "TEMP r5;\n");
+		expect("vs_full", "ADDRESS A0;\n");
+		expect("vs_full", "ADD a0r.x, vertex.attrib[1].x, 0.5;\nARL A0.x, a0r.x;\n");
+		expect("vs_full", "DP4 mtx.z, vertex.attrib[0], cr[A0.x+5];\n");
+		expect("vs_full", "MOV r0.xyz, mtx;\n");
+		expect("vs_full", "MOV r1, cr[A0.x+63];\n");
+		expect("vs_full", "LIT r2, r1;\n");
+		expect("vs_full", "EXP r3, r2.w;\n");
+		expect("vs_full", "LOG r4.x, -r3.y;\n");
+		expect("vs_full", "RCP r5.x, program.local[0].x;\n");
+		expect("vs_full", "MOV result.fogcoord.x, r4.x;\n");
+		expect("vs_full", "MOV result.color.primary, dxdef;\n");
+		if(st.def_cnt != 1 || st.def_reg[0] != 90 || st.def_val[0][1] != 0.5f)
+		{
+			printf("vs_full: bad DEF\n");
+			fails++;
+		}
+	}
+
+	/* relative addressing has to see DEF constants */
+	if(translate("vs_reldef", vs_reldef, sizeof(vs_reldef)) == 0)
+	{
+		fails++;
+	}
+	else
+	{
+		expect("vs_reldef", "PARAM cr[96] = { program.local[0], program.env[1..94], program.local[1] };\n");
+		expect("vs_reldef", "MOV opos, cr[A0.x+0];\n");
+		expect("vs_reldef", "MOV result.color.primary, program.local[1];\n");
+	}
+
+	if(translate("ps_simple", ps_simple, sizeof(ps_simple)) != 0)
+	{
+		fails++;
+	}
+
+	if(translate("vs_badmod", vs_badmod, sizeof(vs_badmod)) != 0)
+	{
+		fails++;
+	}
+
+	if(vsarb_translate(&st, vs_transform, sizeof(vs_transform)/sizeof(DWORD), text, 64) != 0)
+	{
+		printf("overflow not detected\n");
+		fails++;
+	}
+
+	printf("%s (%d fails)\n", fails ? "FAIL" : "PASS", fails);
+
+	return fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
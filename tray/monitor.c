@@ -8,6 +8,7 @@
 #include "tray3d.h"
 
 #include "../3d_accel.h"
+#include "../perf.h"
 
 #include "nocrt.h"
 
@@ -28,7 +29,26 @@
 #define WVAL_VGPU_USED   21
 #define WVAL_VGPU_FREE   22
 
-#define WVAL_MAX 23
+#define WVAL_PERF_FPS      23
+#define WVAL_PERF_FTIME    24
+#define WVAL_PERF_CMDS     25
+#define WVAL_PERF_DRAWS    26
+#define WVAL_PERF_UPLOAD   27
+#define WVAL_PERF_READBACK 28
+#define WVAL_PERF_BLTS     29
+#define WVAL_PERF_BLTPX    30
+#define WVAL_PERF_STALLS   31
+#define WVAL_PERF_STALLT   32
+#define WVAL_PERF_MERGED   33
+#define WVAL_PERF_LIGHTS   34
+
+#define WVAL_MAX 35
+
+#define GRAPH_X 10
+#define GRAPH_H 80
+#define GRAPH_W 320
+/* graph top scale, tenths of ms (= 20 fps) */
+#define GRAPH_MIN_SCALE 500
 
 static HWND vals[WVAL_MAX] = {NULL};
 static BOOL close_win = FALSE;
@@ -36,6 +56,12 @@ static BOOL close_win = FALSE;
 static HMODULE vmdisp9x = NULL;
 static HMODULE vmhal9x = NULL;
 
+static perf_info_t perf_last;
+static DWORD perf_last_tick = 0;
+static RECT graph_rect = {0, 0, 0, 0};
+static DWORD graph[PERF_FRAMES];
+static DWORD graph_cnt = 0;
+
 static void draw(HWND win, HINSTANCE inst)
 {
 	int y = 10;
@@ -54,6 +80,25 @@ static void draw(HWND win, HINSTANCE inst)
 	CreateWindowA("STATIC", "vGPU, total: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
 	CreateWindowA("STATIC", "vGPU, used: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
 	CreateWindowA("STATIC", "vGPU, free: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
+	y += 20;
+	CreateWindowA("STATIC", "Flips per second: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
+	CreateWindowA("STATIC", "Frame time, avg/max: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
+	CreateWindowA("STATIC", "DP2 commands per second: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
+	CreateWindowA("STATIC", "Draw calls per second: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
+	CreateWindowA("STATIC", "Merged draws per second: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
+	CreateWindowA("STATIC", "Light calls per second: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
+	CreateWindowA("STATIC", "Upload to GL: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
+	CreateWindowA("STATIC", "Readback from GL: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
+	CreateWindowA("STATIC", "Blits per second: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
+	CreateWindowA("STATIC", "Blit area per second: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
+	CreateWindowA("STATIC", "Lock stalls per second: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
+	CreateWindowA("STATIC", "Lock waiting: ", WS_VISIBLE | WS_CHILD | SS_LEFT, x, y, 200, 20, win, 0, inst, NULL); y += 20;
+	y += 10;
+
+	graph_rect.left   = GRAPH_X;
+	graph_rect.top    = y;
+	graph_rect.right  = GRAPH_X + GRAPH_W;
+	graph_rect.bottom = y + GRAPH_H;
 
 	y = 10;
 	x += 200;
@@ -72,6 +117,19 @@ static void draw(HWND win, HINSTANCE inst)
 	vals[WVAL_VGPU_TOTAL] = CreateWindowA("STATIC", "- kB", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 100, 20, win, (HMENU)WVAL_VGPU_TOTAL, inst, NULL); y += 20;
 	vals[WVAL_VGPU_USED]  = CreateWindowA("STATIC", "- kB", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 100, 20, win, (HMENU)WVAL_VGPU_USED, inst, NULL);  y += 20;
 	vals[WVAL_VGPU_FREE]  = CreateWindowA("STATIC", "- kB", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 100, 20, win, (HMENU)WVAL_VGPU_FREE, inst, NULL);  y += 20;
+	y += 20;
+	vals[WVAL_PERF_FPS]      = CreateWindowA("STATIC", "-", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 120, 20, win, (HMENU)WVAL_PERF_FPS, inst, NULL);      y += 20;
+	vals[WVAL_PERF_FTIME]    = CreateWindowA("STATIC", "-", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 120, 20, win, (HMENU)WVAL_PERF_FTIME, inst, NULL);    y += 20;
+	vals[WVAL_PERF_CMDS]     = CreateWindowA("STATIC", "-", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 120, 20, win, (HMENU)WVAL_PERF_CMDS, inst, NULL);     y += 20;
+	vals[WVAL_PERF_DRAWS]    = CreateWindowA("STATIC", "-", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 120, 20, win, (HMENU)WVAL_PERF_DRAWS, inst, NULL);    y += 20;
+	vals[WVAL_PERF_MERGED]   = CreateWindowA("STATIC", "-", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 120, 20, win, (HMENU)WVAL_PERF_MERGED, inst, NULL);   y += 20;
+	vals[WVAL_PERF_LIGHTS]   = CreateWindowA("STATIC", "-", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 120, 20, win, (HMENU)WVAL_PERF_LIGHTS, inst, NULL);   y += 20;
+	vals[WVAL_PERF_UPLOAD]   = CreateWindowA("STATIC", "-", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 120, 20, win, (HMENU)WVAL_PERF_UPLOAD, inst, NULL);   y += 20;
+	vals[WVAL_PERF_READBACK] = CreateWindowA("STATIC", "-", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 120, 20, win, (HMENU)WVAL_PERF_READBACK, inst, NULL); y += 20;
+	vals[WVAL_PERF_BLTS]     = CreateWindowA("STATIC", "-", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 120, 20, win, (HMENU)WVAL_PERF_BLTS, inst, NULL);     y += 20;
+	vals[WVAL_PERF_BLTPX]    = CreateWindowA("STATIC", "-", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 120, 20, win, (HMENU)WVAL_PERF_BLTPX, inst, NULL);    y += 20;
+	vals[WVAL_PERF_STALLS]   = CreateWindowA("STATIC", "-", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 120, 20, win, (HMENU)WVAL_PERF_STALLS, inst, NULL);   y += 20;
+	vals[WVAL_PERF_STALLT]   = CreateWindowA("STATIC", "-", WS_VISIBLE | WS_CHILD | SS_RIGHT, x, y, 120, 20, win, (HMENU)WVAL_PERF_STALLT, inst, NULL);   y += 20;
 }
 
 static void setKB(int id, DWORD v)
@@ -86,6 +144,119 @@ static void setKB(int id, DWORD v)
 	}
 }
 
+static void setText(int id, const char *fmt, DWORD v1, DWORD v2)
+{
+	static char buf[64];
+	sprintf(buf, fmt, v1, v2);
+
+	HWND win = vals[id];
+	if(win)
+	{
+		SetWindowTextA(win, buf);
+	}
+}
+
+/* counter increment per second, counters wraps around */
+static DWORD perSec(DWORD cur, DWORD last, DWORD ms)
+{
+	return (DWORD)((double)(cur - last) * 1000.0 / ms);
+}
+
+static void updatePerf(HWND win, PerfInfo_t pPerfInfo)
+{
+	perf_info_t cur;
+	DWORD now = GetTickCount();
+	DWORD ms = now - perf_last_tick;
+	DWORD i, sum, max;
+
+	if(!pPerfInfo(&cur))
+	{
+		return;
+	}
+
+	if(perf_last_tick != 0 && ms > 0)
+	{
+		setText(WVAL_PERF_FPS,      "%lu", perSec(cur.frames, perf_last.frames, ms), 0);
+		setText(WVAL_PERF_CMDS,     "%lu", perSec(cur.dp2_commands, perf_last.dp2_commands, ms), 0);
+		setText(WVAL_PERF_DRAWS,    "%lu", perSec(cur.draws, perf_last.draws, ms), 0);
+		setText(WVAL_PERF_MERGED,   "%lu", perSec(cur.draws_merged, perf_last.draws_merged, ms), 0);
+		setText(WVAL_PERF_LIGHTS,   "%lu", perSec(cur.light_calls, perf_last.light_calls, ms), 0);
+		setText(WVAL_PERF_UPLOAD,   "%lu kB/s", perSec(cur.upload_bytes, perf_last.upload_bytes, ms)/1024, 0);
+		setText(WVAL_PERF_READBACK, "%lu kB/s", perSec(cur.readback_bytes, perf_last.readback_bytes, ms)/1024, 0);
+		setText(WVAL_PERF_BLTS,     "%lu", perSec(cur.blts, perf_last.blts, ms), 0);
+		setText(WVAL_PERF_BLTPX,    "%lu kpx", perSec(cur.blt_pixels, perf_last.blt_pixels, ms)/1000, 0);
+		setText(WVAL_PERF_STALLS,   "%lu", perSec(cur.lock_stalls, perf_last.lock_stalls, ms), 0);
+		/* tenths of ms per second = 1/10000 of time */
+		setText(WVAL_PERF_STALLT,   "%lu ms/s", perSec(cur.lock_time, perf_last.lock_time, ms)/10, 0);
+	}
+
+	/* oldest frame first */
+	graph_cnt = cur.frame_pos < PERF_FRAMES ? cur.frame_pos : PERF_FRAMES;
+	sum = 0;
+	max = 0;
+	for(i = 0; i < graph_cnt; i++)
+	{
+		graph[i] = cur.frame_time[(cur.frame_pos - graph_cnt + i) % PERF_FRAMES];
+		sum += graph[i];
+		if(graph[i] > max)
+			max = graph[i];
+	}
+
+	if(graph_cnt > 0 && cur.frames != perf_last.frames)
+	{
+		setText(WVAL_PERF_FTIME, "%lu / %lu ms", (sum/graph_cnt + 5)/10, (max + 5)/10);
+	}
+	else
+	{
+		setText(WVAL_PERF_FTIME, "-", 0, 0);
+	}
+
+	InvalidateRect(win, &graph_rect, TRUE);
+
+	perf_last = cur;
+	perf_last_tick = now;
+}
+
+/* rolling frame time graph, one bar per flip */
+static void paintGraph(HDC dc)
+{
+	DWORD i, scale = GRAPH_MIN_SCALE;
+	LONG w = graph_rect.right - graph_rect.left;
+	LONG h = graph_rect.bottom - graph_rect.top;
+	HPEN pen, old_pen;
+
+	if(h <= 0)
+		return;
+
+	FillRect(dc, &graph_rect, (HBRUSH)GetStockObject(BLACK_BRUSH));
+
+	for(i = 0; i < graph_cnt; i++)
+	{
+		if(graph[i] > scale)
+			scale = graph[i];
+	}
+
+	/* 60 fps line */
+	pen = CreatePen(PS_SOLID, 1, RGB(96, 96, 96));
+	old_pen = SelectObject(dc, pen);
+	MoveToEx(dc, graph_rect.left, graph_rect.bottom - (167 * h)/scale, NULL);
+	LineTo(dc, graph_rect.right, graph_rect.bottom - (167 * h)/scale);
+	SelectObject(dc, old_pen);
+	DeleteObject(pen);
+
+	pen = CreatePen(PS_SOLID, 1, RGB(0, 255, 0));
+	old_pen = SelectObject(dc, pen);
+	for(i = 0; i < graph_cnt; i++)
+	{
+		LONG x = graph_rect.left + (i * w)/PERF_FRAMES;
+		LONG bar = (graph[i] * h)/scale;
+		MoveToEx(dc, x, graph_rect.bottom - 1, NULL);
+		LineTo(dc, x, graph_rect.bottom - 1 - bar);
+	}
+	SelectObject(dc, old_pen);
+	DeleteObject(pen);
+}
+
 typedef BOOL (__stdcall *VidMemInfo_t)(DWORD *pused, DWORD *pfree);
 
 static void update(HWND win)
@@ -155,6 +326,12 @@ static void update(HWND win)
 				setKB(WVAL_VRAM_FREE, 0);
 			}
 		}
+
+		PerfInfo_t pPerfInfo = (PerfInfo_t)GetProcAddress(vmhal9x, "PerfInfo");
+		if(pPerfInfo)
+		{
+			updatePerf(win, pPerfInfo);
+		}
 	}
 }
 
@@ -169,6 +346,14 @@ static LRESULT CALLBACK monproc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPara
 			SetTimer(hwnd, IDT_TIMER1, 1000, (TIMERPROC) NULL);
 			break;
 		}
+		case WM_PAINT:
+		{
+			PAINTSTRUCT ps;
+			HDC dc = BeginPaint(hwnd, &ps);
+			paintGraph(dc);
+			EndPaint(hwnd, &ps);
+			return 0;
+		}
 		case WM_TIMER:
 		{ 
 			switch(wParam) 
@@ -210,7 +395,7 @@ void monitor()
 	moncs.hInstance     = hInst;
 	RegisterClass(&moncs);
 
-	win = CreateWindowA(WND_MON_CLASS_NAME, "vGPU monitor", WS_OVERLAPPED|WS_CAPTION|WS_THICKFRAME|WS_SYSMENU|WS_VISIBLE, CW_USEDEFAULT, CW_USEDEFAULT, 400, 400, 0, 0, hInst, 0);
+	win = CreateWindowA(WND_MON_CLASS_NAME, "vGPU monitor", WS_OVERLAPPED|WS_CAPTION|WS_THICKFRAME|WS_SYSMENU|WS_VISIBLE, CW_USEDEFAULT, CW_USEDEFAULT, 400, 720, 0, 0, hInst, 0);
 	
   while(GetMessage(&msg, NULL, 0, 0))
   {
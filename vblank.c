@@ -0,0 +1,342 @@
+/******************************************************************************
+ * Copyright (c) 2025 Jaroslav Hensl                                          *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+ ******************************************************************************/
+#include <windows.h>
+#include <ddraw.h>
+#include <ddrawi.h>
+#include <stdint.h>
+#include "ddrawi_ddk.h"
+
+#include "vmdahal32.h"
+#include "vmhal9x.h"
+
+#include "nocrt.h"
+
+/*
+ * Virtual vertical blank clock
+ *
+ * Frame N begins at time N/refresh and the last (525-480)/525 part of every
+ * frame is vertical blank (same proportion as VGA 640x480). The frame index is
+ * computed from the absolute time (not accumulated), so there is no drift.
+ *
+ * Blocking waits are done by waitable timer (Win98+), on Win95 Sleep is used.
+ * Timer handles are per process, DLL memory is shared, so the handles are
+ * stored with owner PID.
+ */
+
+#define TMS_PER_SEC 10000
+
+/* frame fraction (in 1/TMS_PER_SEC units) when vertical blank starts */
+#define VB_START ((TMS_PER_SEC*480)/525)
+
+/* polls closer than this (in frames) are counted as one busy loop */
+#define POLL_LOOP_FRAMES 2
+
+#define VB_TIMERS 8
+
+typedef HANDLE (WINAPI *CreateWaitableTimerA_h)(LPSECURITY_ATTRIBUTES lpTimerAttributes, BOOL bManualReset, LPCSTR lpTimerName);
+typedef BOOL (WINAPI *SetWaitableTimer_h)(HANDLE hTimer, const LARGE_INTEGER *lpDueTime, LONG lPeriod, PTIMERAPCROUTINE pfnCompletionRoutine, LPVOID lpArgToCompletionRoutine, BOOL fResume);
+
+typedef struct vblank_timer
+{
+	DWORD pid;
+	HANDLE timer;
+} vblank_timer_t;
+
+static struct
+{
+	BOOL timer_api_loaded;
+	CreateWaitableTimerA_h pCreateWaitableTimerA;
+	SetWaitableTimer_h pSetWaitableTimer;
+	vblank_timer_t timers[VB_TIMERS];
+	uint64_t flip_pending; /* time when last flip is on screen */
+	uint64_t last_flip;
+	uint64_t last_poll;
+	/* statistics */
+	DWORD flips;
+	DWORD flips_waited;
+	uint64_t jitter_sum;
+	DWORD jitter_cnt;
+	DWORD jitter_max;
+	uint64_t wait_time;
+	DWORD poll_calls;
+	uint64_t poll_time;
+} vblank = {FALSE};
+
+static DWORD VBlankRate()
+{
+	DWORD rate = GlobalVMHALenv()->refresh;
+
+	if(rate < VBLANK_MIN_RATE || rate > VBLANK_MAX_RATE)
+	{
+		rate = 60;
+	}
+
+	return rate;
+}
+
+/* number of frames started from time 0 */
+static uint64_t VBlankCounter(uint64_t t, DWORD rate)
+{
+	return (t * rate) / TMS_PER_SEC;
+}
+
+/* time when frame n starts (rounded up) */
+static uint64_t VBlankFrameTime(uint64_t n, DWORD rate)
+{
+	return (n * TMS_PER_SEC + rate - 1) / rate;
+}
+
+/* time when vertical blank starts in frame n */
+static uint64_t VBlankStartTime(uint64_t n, DWORD rate)
+{
+	return (n * TMS_PER_SEC + VB_START + rate - 1) / rate;
+}
+
+static HANDLE VBlankTimer()
+{
+	DWORD pid = GetCurrentProcessId();
+	int i;
+	int free_slot = -1;
+
+	if(!vblank.timer_api_loaded)
+	{
+		/* not in Windows 95 kernel */
+		HMODULE kernel = GetModuleHandleA("kernel32.dll");
+		if(kernel)
+		{
+			vblank.pCreateWaitableTimerA = (CreateWaitableTimerA_h)GetProcAddress(kernel, "CreateWaitableTimerA");
+			vblank.pSetWaitableTimer = (SetWaitableTimer_h)GetProcAddress(kernel, "SetWaitableTimer");
+		}
+		vblank.timer_api_loaded = TRUE;
+	}
+
+	if(vblank.pCreateWaitableTimerA == NULL || vblank.pSetWaitableTimer == NULL)
+	{
+		return NULL;
+	}
+
+	for(i = 0; i < VB_TIMERS; i++)
+	{
+		if(vblank.timers[i].pid == pid)
+		{
+			return vblank.timers[i].timer;
+		}
+
+		if(free_slot < 0)
+		{
+			if(vblank.timers[i].pid == 0 || !ProcessExists(vblank.timers[i].pid))
+			{
+				free_slot = i;
+			}
+		}
+	}
+
+	if(free_slot < 0)
+	{
+		WARN("No free vblank timer slot");
+		return NULL;
+	}
+
+	vblank.timers[free_slot].timer = vblank.pCreateWaitableTimerA(NULL, TRUE, NULL);
+	if(vblank.timers[free_slot].timer == NULL)
+	{
+		return NULL;
+	}
+	vblank.timers[free_slot].pid = pid;
+
+	TOPIC("VBLANK", "new timer for pid=%X, slot=%d", pid, free_slot);
+
+	return vblank.timers[free_slot].timer;
+}
+
+/* block until 'until' time (in tenths of ms) */
+static void VBlankSleep(uint64_t until)
+{
+	uint64_t now = GetTimeTMS();
+	HANDLE timer;
+
+	if(until <= now)
+	{
+		return;
+	}
+
+	timer = VBlankTimer();
+	if(timer != NULL)
+	{
+		LARGE_INTEGER due;
+		/* relative time in 100 ns units */
+		due.QuadPart = -(LONGLONG)((until - now) * 1000);
+		if(vblank.pSetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE))
+		{
+			WaitForSingleObject(timer, (DWORD)((until - now)/10) + 100);
+		}
+		else
+		{
+			Sleep((DWORD)((until - now + 9)/10));
+		}
+	}
+	else
+	{
+		Sleep((DWORD)((until - now + 9)/10));
+	}
+
+	vblank.wait_time += GetTimeTMS() - now;
+}
+
+static void VBlankPoll(uint64_t now)
+{
+	uint64_t loop_time = POLL_LOOP_FRAMES*TMS_PER_SEC/VBlankRate();
+
+	vblank.poll_calls++;
+	if(now >= vblank.last_poll && now - vblank.last_poll < loop_time)
+	{
+		vblank.poll_time += now - vblank.last_poll;
+	}
+	vblank.last_poll = now;
+}
+
+BOOL VBlankIsIn()
+{
+	DWORD rate = VBlankRate();
+	uint64_t now = GetTimeTMS();
+
+	VBlankPoll(now);
+
+	return ((now * rate) % TMS_PER_SEC) >= VB_START;
+}
+
+void VBlankWaitBegin()
+{
+	DWORD rate = VBlankRate();
+	uint64_t now = GetTimeTMS();
+	uint64_t n = VBlankCounter(now, rate);
+	uint64_t t = VBlankStartTime(n, rate);
+
+	if(t <= now)
+	{
+		/* already in blank, wait to next one */
+		t = VBlankStartTime(n+1, rate);
+	}
+
+	VBlankSleep(t);
+}
+
+void VBlankWaitEnd()
+{
+	DWORD rate = VBlankRate();
+	uint64_t now = GetTimeTMS();
+
+	VBlankSleep(VBlankFrameTime(VBlankCounter(now, rate)+1, rate));
+}
+
+BOOL VBlankFlipPending()
+{
+	uint64_t now = GetTimeTMS();
+
+	if(now < vblank.flip_pending)
+	{
+		VBlankPoll(now);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+BOOL VBlankFlipBegin(BOOL wait)
+{
+	uint64_t now = GetTimeTMS();
+
+	if(now < vblank.flip_pending)
+	{
+		if(!wait)
+		{
+			VBlankPoll(now);
+			return FALSE;
+		}
+
+		VBlankSleep(vblank.flip_pending);
+		vblank.flips_waited++;
+	}
+
+	return TRUE;
+}
+
+void VBlankFlipDone(BOOL vsync)
+{
+	DWORD rate = VBlankRate();
+	uint64_t now = GetTimeTMS();
+	uint64_t period = TMS_PER_SEC/rate;
+
+	if(vsync)
+	{
+		/* new surface is visible from next blank */
+		vblank.flip_pending = VBlankFrameTime(VBlankCounter(now, rate)+1, rate);
+	}
+	else
+	{
+		vblank.flip_pending = 0;
+	}
+
+	if(vblank.last_flip != 0 && now >= vblank.last_flip)
+	{
+		uint64_t interval = now - vblank.last_flip;
+		/* pauses between scenes aren't jitter */
+		if(interval < period*4)
+		{
+			DWORD jitter = (DWORD)(interval > period ? interval - period : period - interval);
+			vblank.jitter_sum += jitter;
+			vblank.jitter_cnt++;
+			if(jitter > vblank.jitter_max)
+			{
+				vblank.jitter_max = jitter;
+			}
+		}
+	}
+
+	vblank.last_flip = now;
+	vblank.flips++;
+}
+
+/* public */
+
+BOOL __stdcall VBlankInfo(vblank_info_t *info)
+{
+	if(info == NULL)
+	{
+		return FALSE;
+	}
+
+	info->refresh      = VBlankRate();
+	info->flips        = vblank.flips;
+	info->flips_waited = vblank.flips_waited;
+	info->jitter_avg   = vblank.jitter_cnt ? (DWORD)(vblank.jitter_sum / vblank.jitter_cnt) : 0;
+	info->jitter_max   = vblank.jitter_max;
+	info->wait_time    = (DWORD)(vblank.wait_time / 10);
+	info->poll_calls   = vblank.poll_calls;
+	info->poll_time    = (DWORD)(vblank.poll_time / 10);
+
+	return TRUE;
+}
@@ -90,6 +90,15 @@ static VMHAL_enviroment_t VMHALenv = {
 	FALSE, // s3tc bug
 	TRUE,  // textures in sysmem
 	0,     // low detail
+	TRUE,  // vertex shader (need GL_ARB_vertex_program)
+	60,    // virtual refresh rate
+	TRUE,  // copy flipped surface to screen in background thread
+	TRUE,  // mirror vertex buffers to GL buffer objects
+	16384, // converted textures cache (kB)
+	TRUE,  // pack cold items in converted textures cache
+	FALSE, // translate DP2 on worker thread
+	4,     // DP2 worker queue depth
+	TRUE,  // pixel shader (need GL_ARB_fragment_program)
 };
 
 static DWORD CalcPitch(DWORD w, DWORD bpp)
@@ -311,6 +320,11 @@ static void ReadEnv(VMHAL_enviroment_t *dst)
 		dst->vertexblend = vmhal_setup_dw("hal", "vertexblend") ? TRUE : FALSE;
 	}
 
+	if(vmhal_setup_str("hal", "vertexshader", FALSE) != NULL)
+	{
+		dst->vertexshader = vmhal_setup_dw("hal", "vertexshader") ? TRUE : FALSE;
+	}
+
 	if(vmhal_setup_str("hal", "palette", FALSE) != NULL)
 	{
 		dst->allow_palette = vmhal_setup_dw("hal", "palette") ? TRUE : FALSE;
@@ -331,6 +345,50 @@ static void ReadEnv(VMHAL_enviroment_t *dst)
 		dst->sysmem = vmhal_setup_dw("hal", "sysmem") ? TRUE : FALSE;
 	}
 	
+	if(vmhal_setup_str("hal", "refresh", FALSE) != NULL)
+	{
+		DWORD rate = vmhal_setup_dw("hal", "refresh");
+		if(rate >= VBLANK_MIN_RATE && rate <= VBLANK_MAX_RATE)
+		{
+			dst->refresh = rate;
+		}
+	}
+
+	if(vmhal_setup_str("hal", "asyncflip", FALSE) != NULL)
+	{
+		dst->async_flip = vmhal_setup_dw("hal", "asyncflip") ? TRUE : FALSE;
+	}
+
+	if(vmhal_setup_str("hal", "vbo", FALSE) != NULL)
+	{
+		dst->vbo = vmhal_setup_dw("hal", "vbo") ? TRUE : FALSE;
+	}
+
+	if(vmhal_setup_str("hal", "texcache", FALSE) != NULL)
+	{
+		dst->texcache = vmhal_setup_dw("hal", "texcache");
+	}
+
+	if(vmhal_setup_str("hal", "texcache_pack", FALSE) != NULL)
+	{
+		dst->texcache_pack = vmhal_setup_dw("hal", "texcache_pack") ? TRUE : FALSE;
+	}
+
+	if(vmhal_setup_str("hal", "dp2thread", FALSE) != NULL)
+	{
+		dst->dp2thread = vmhal_setup_dw("hal", "dp2thread") ? TRUE : FALSE;
+	}
+
+	if(vmhal_setup_str("hal", "dp2queue", FALSE) != NULL)
+	{
+		dst->dp2queue = vmhal_setup_dw("hal", "dp2queue");
+	}
+
+	if(vmhal_setup_str("hal", "pixelshader", FALSE) != NULL)
+	{
+		dst->pixelshader = vmhal_setup_dw("hal", "pixelshader") ? TRUE : FALSE;
+	}
+
 	if(vmhal_setup_str("hal", "reduce_tex_units", FALSE) != NULL)
 	{
 		DWORD t = vmhal_setup_dw("hal", "reduce_tex_units");
@@ -531,6 +589,7 @@ BOOL WINAPI DllMain(HINSTANCE hModule, DWORD dwReason, LPVOID lpvReserved)
 			InterlockedExchange(&lProcessCount, tmp);
 			
 			dllHinst = hModule;
+			FBHDA_lib_notify(dwReason);
 #ifdef D3DHAL
 			Mesa3DCleanProc();
 #endif
@@ -547,7 +606,9 @@ BOOL WINAPI DllMain(HINSTANCE hModule, DWORD dwReason, LPVOID lpvReserved)
 			Mesa3DCleanProc();
 			hal_dump_allocs();
 #endif
+			FlipQueueDestroy();
 			FBHDA_free();
+			FBHDA_lib_notify(dwReason);
 			do
 			{
 				tmp = InterlockedExchange(&lProcessCount, -1);
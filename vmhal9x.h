@@ -128,6 +128,9 @@ BOOL ProcessExists(DWORD pid);
 BOOL IsInFront(VMDAHAL_t *ddhal, void *ptr);
 DWORD GetOffset(VMDAHAL_t *ddhal, void *ptr);
 BOOL FlipPrimary(VMDAHAL_t *ddhal, void *to);
+BOOL FlipIsPending(void *ptr);
+void FlipWaitSurface(void *ptr);
+void FlipQueueDestroy();
 
 /* modes */
 void UpdateCustomMode(VMDAHAL_t *hal);
@@ -135,8 +138,6 @@ void UpdateCustomMode(VMDAHAL_t *hal);
 /* globals */
 extern VMDAHAL_t *globalHal;
 extern BOOL halVSync;
-extern uint64_t last_flip_time;
-#define SCREEN_TIME ((uint64_t)(10000/60))
 
 /* debug */
 void SetExceptionHandler();
@@ -144,12 +145,46 @@ void SetExceptionHandler();
 /* timing */
 uint64_t GetTimeTMS();
 
+/* virtual vertical blank */
+#define VBLANK_MIN_RATE 24
+#define VBLANK_MAX_RATE 500
+
+typedef struct vblank_info
+{
+	DWORD refresh;      /* Hz */
+	DWORD flips;
+	DWORD flips_waited; /* flips blocked until previous one reach the screen */
+	DWORD jitter_avg;   /* average |flip interval - frame period|, tenths of ms */
+	DWORD jitter_max;   /* tenths of ms */
+	DWORD wait_time;    /* time spend in blocking waits, ms */
+	DWORD poll_calls;   /* DDWAITVB_I_TESTVB, GetFlipStatus and rejected flips */
+	DWORD poll_time;    /* time burned by application in polling loops, ms */
+} vblank_info_t;
+
+BOOL VBlankIsIn();
+void VBlankWaitBegin();
+void VBlankWaitEnd();
+BOOL VBlankFlipPending();
+BOOL VBlankFlipBegin(BOOL wait);
+void VBlankFlipDone(BOOL vsync);
+BOOL __stdcall VBlankInfo(vblank_info_t *info);
+
+/* performance counters (common for all processes) */
+#include "perf.h"
+
+extern perf_info_t halPerf;
+
+#define PERF_ADD(_field, _v) InterlockedExchangeAdd((LONG*)&halPerf._field, (LONG)(_v))
+
+void PerfFrame();
+
 /* mesa */
 void Mesa3DCleanProc();
 void Mesa3DCalibrate(BOOL loadonly);
 
 void SurfaceCtxLock();
 void SurfaceCtxUnlock();
+void SurfaceCtxSync();
 
 typedef DWORD surface_id;
 
@@ -171,6 +206,7 @@ void SurfaceApplyColorKey(surface_id sid, DWORD low, DWORD hi, DWORD low_pal, DW
 DWORD SurfaceDataSize(LPDDRAWI_DDRAWSURFACE_GBL gbl, DWORD *outPitch);
 
 void SurfaceLock(LPDDRAWI_DDRAWSURFACE_LCL surf);
+void SurfaceVertexBufferLock(LPDDRAWI_DDRAWSURFACE_LCL surf, RECTL *area);
 void SurfaceUnlock(LPDDRAWI_DDRAWSURFACE_LCL surf);
 
 inline static DWORD SurfacePitch(DWORD width, DWORD bpp)
@@ -209,6 +245,15 @@ typedef struct _VMHAL_enviroment
 	BOOL s3tc_bug;
 	BOOL sysmem;
 	DWORD lowdetail;
+	BOOL vertexshader;
+	DWORD refresh;
+	BOOL async_flip;
+	BOOL vbo;
+	DWORD texcache; // kB
+	BOOL texcache_pack;
+	BOOL dp2thread;
+	DWORD dp2queue;
+	BOOL pixelshader;
 } VMHAL_enviroment_t;
 
 #define DX7_SURFACE_NEST_TYPES (DDSCAPS_TEXTURE | DDSCAPS_3DDEVICE | DDSCAPS_ZBUFFER)
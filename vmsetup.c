@@ -76,6 +76,9 @@
 
 #define REG_DATA_MAX 254
 
+/* power of 2 */
+#define SETUP_HASH_SIZE 64
+
 typedef struct _settings_block_t
 {
 	char *name;
@@ -85,6 +88,8 @@ typedef struct _settings_block_t
 	struct _settings_block_t *next;
 	char *next_data;
 	DWORD data_left;
+	DWORD hash;
+	struct _settings_block_t *hash_next;
 } settings_block_t;
 
 static char setup[SETUP_MAXSIZE];
@@ -96,11 +101,63 @@ static settings_block_t first_block = {
 	DATA_NULL,
 	NULL,
 	setup,
-	SETUP_MAXSIZE
+	SETUP_MAXSIZE,
+	0,
+	NULL
 };
 
 static settings_block_t *last_block = &first_block;
 
+static settings_block_t *setup_hash[SETUP_HASH_SIZE] = {NULL};
+
+/* case insensitive FNV-1a of "category/name" */
+static DWORD setup_hash_key(const char *category, const char *name)
+{
+	DWORD h = 2166136261UL;
+	const char *s;
+
+	if(category != NULL)
+	{
+		for(s = category; *s != '\0'; s++)
+		{
+			h = (h ^ (BYTE)tolower(*s)) * 16777619UL;
+		}
+	}
+
+	h = (h ^ '/') * 16777619UL;
+
+	for(s = name; *s != '\0'; s++)
+	{
+		h = (h ^ (BYTE)tolower(*s)) * 16777619UL;
+	}
+
+	return h;
+}
+
+static settings_block_t *setup_hash_find(DWORD hash, const char *category, const char *name)
+{
+	settings_block_t *block = setup_hash[hash & (SETUP_HASH_SIZE-1)];
+
+	while(block != NULL)
+	{
+		if(block->hash == hash && stricmp(block->name, name) == 0)
+		{
+			if(category == NULL)
+			{
+				if(block->category == NULL)
+					return block;
+			}
+			else if(block->category != NULL && stricmp(block->category, category) == 0)
+			{
+				return block;
+			}
+		}
+		block = block->hash_next;
+	}
+
+	return NULL;
+}
+
 static BOOL alloc_block(const char *name,	const char *category,	void *data,	DWORD data_type)
 {
 	size_t size_name = 0; 
@@ -110,8 +167,18 @@ static BOOL alloc_block(const char *name,	const char *category,	void *data,	DWOR
 	char *data_str = NULL;
 	DWORD data_dw;
 	char strbuf[16];
+	DWORD hash;
+
+	if(name == NULL) return FALSE;
 
-	if(name != NULL) size_name = strlen(name)+1;
+	/* first loaded value wins (profile > exe > global), so don't store shadowed ones */
+	hash = setup_hash_key(category, name);
+	if(setup_hash_find(hash, category, name) != NULL)
+	{
+		return TRUE;
+	}
+
+	size_name = strlen(name)+1;
 
 	if(category != NULL) size_category = strlen(category)+1;
 
@@ -152,17 +219,9 @@ static BOOL alloc_block(const char *name,	const char *category,	void *data,	DWOR
 		settings_block_t *block = (settings_block_t*)ptr;
 		ptr += sizeof(settings_block_t);
 
-		if(name != NULL)
-		{
-			block->name = ptr;
-			memcpy(block->name, name, size_name);
-
-			ptr += size_name;
-		}
-		else
-		{
-			block->name = NULL;
-		}
+		block->name = ptr;
+		memcpy(block->name, name, size_name);
+		ptr += size_name;
 
 		if(category != NULL)
 		{
@@ -195,6 +254,10 @@ static BOOL alloc_block(const char *name,	const char *category,	void *data,	DWOR
 		last_block->next = block;
 		last_block = block;
 
+		block->hash = hash;
+		block->hash_next = setup_hash[hash & (SETUP_HASH_SIZE-1)];
+		setup_hash[hash & (SETUP_HASH_SIZE-1)] = block;
+
 		return TRUE;
 	}
 	return FALSE;	
@@ -202,35 +265,10 @@ static BOOL alloc_block(const char *name,	const char *category,	void *data,	DWOR
 
 static settings_block_t *vmhal_settings_block(const char *category, const char *name)
 {
-	settings_block_t *block = &first_block;
-	
-	while(block != NULL)
-	{
-		if(category == NULL)
-		{
-			if(block->category == NULL)
-			{
-				if(block->name != NULL && stricmp(block->name, name) == 0)
-				{
-					return block;
-				}
-			}
-		}
-		else
-		{
-			if(block->category != NULL && stricmp(block->category, category) == 0)
-			{
-				if(block->name != NULL && stricmp(block->name, name) == 0)
-				{
-					return block;
-				}
-			}
-		}
-		
-		block = block->next;
-	}
-	
-	return NULL;
+	if(name == NULL)
+		return NULL;
+
+	return setup_hash_find(setup_hash_key(category, name), category, name);
 }
 
 const char *vmhal_setup_str(const char *category, const char *name, BOOL empty_str)